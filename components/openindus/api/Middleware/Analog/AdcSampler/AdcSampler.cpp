@@ -0,0 +1,353 @@
+/**
+ * @file AdcSampler.cpp
+ * @brief Background sampling of the ESP32 ADC channels
+ * @author Kévin Lefeuvre (kevin.lefeuvre@openindus.com)
+ * @copyright (c) [2025] OpenIndus, Inc. All rights reserved.
+ * @see https://openindus.com
+ */
+
+#include "AdcSampler.h"
+
+static const char TAG[] = "AdcSampler";
+
+#define ADC_SAMPLER_RAW_MAX         ((1 << SOC_ADC_DIGI_MAX_BITWIDTH) - 1)
+#define ADC_SAMPLER_READ_TIMEOUT_MS 20
+
+adc_continuous_handle_t AdcSampler::_handle = NULL;
+AdcSampler::Channel_t AdcSampler::_channels[ADC_SAMPLER_MAX_CHANNELS];
+uint8_t AdcSampler::_nbChannels = 0;
+int8_t AdcSampler::_index[SOC_ADC_PERIPH_NUM][SOC_ADC_MAX_CHANNEL_NUM];
+uint16_t* AdcSampler::_lut[SOC_ADC_PERIPH_NUM] = {NULL};
+SemaphoreHandle_t AdcSampler::_mutex = NULL;
+portMUX_TYPE AdcSampler::_lock = portMUX_INITIALIZER_UNLOCKED;
+TaskHandle_t AdcSampler::_taskHandle = NULL;
+bool AdcSampler::_running = false;
+
+int AdcSampler::init(void)
+{
+    int err = 0;
+
+    if (_handle != NULL) {
+        return 0;
+    }
+
+    ESP_LOGI(TAG, "Init ADC continuous sampling");
+
+    memset(_index, -1, sizeof(_index));
+    _mutex = xSemaphoreCreateMutex();
+
+    adc_continuous_handle_cfg_t handleConfig = {
+        .max_store_buf_size = ADC_SAMPLER_FRAME_SIZE * 4,
+        .conv_frame_size = ADC_SAMPLER_FRAME_SIZE,
+        .flags = {.flush_pool = 1},
+    };
+    err |= adc_continuous_new_handle(&handleConfig, &_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create ADC continuous handle");
+        _handle = NULL;
+        return -1;
+    }
+
+    /* High priority: the threshold callbacks protect the outputs */
+    xTaskCreate(_task, "ADC sampler task", 4096, NULL, 15, &_taskHandle);
+
+    adc_continuous_evt_cbs_t cbs = {
+        .on_conv_done = _convDoneIsr,
+        .on_pool_ovf = NULL,
+    };
+    err |= adc_continuous_register_event_callbacks(_handle, &cbs, NULL);
+
+    return err;
+}
+
+int AdcSampler::addChannel(adc_unit_t unit, adc_channel_t channel, uint8_t averaging)
+{
+    int index = -1;
+
+    if ((_handle == NULL) || (unit >= SOC_ADC_PERIPH_NUM) || (channel >= SOC_ADC_MAX_CHANNEL_NUM)) {
+        ESP_LOGE(TAG, "Invalid ADC%d channel %d", unit + 1, channel);
+        return -1;
+    }
+    if ((averaging == 0) || (averaging > ADC_SAMPLER_BUFFER_SIZE)) {
+        ESP_LOGE(TAG, "Invalid averaging: %d", averaging);
+        return -1;
+    }
+
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    if (_index[unit][channel] >= 0) {
+        index = _index[unit][channel];
+    } else if (_nbChannels >= ADC_SAMPLER_MAX_CHANNELS) {
+        ESP_LOGE(TAG, "Too many ADC channels");
+    } else if ((_lut[unit] == NULL) && (_buildLut(unit) < 0)) {
+        ESP_LOGE(TAG, "Failed to build calibration table of ADC%d", unit + 1);
+    } else {
+        index = _nbChannels;
+        Channel_t* ch = &_channels[index];
+        ch->unit = unit;
+        ch->channel = channel;
+        ch->head = 0;
+        ch->count = 0;
+        ch->averaging = averaging;
+        ch->sum = 0;
+        ch->value.store(-1);
+        ch->threshold = -1;
+        ch->above = 0;
+        ch->thresholdCallback = NULL;
+        ch->thresholdArg = NULL;
+        ch->override.store(-1);
+        _nbChannels++;
+        _index[unit][channel] = index;
+        if (_configure() < 0) {
+            ESP_LOGE(TAG, "Failed to configure ADC%d channel %d", unit + 1, channel);
+        }
+    }
+    xSemaphoreGive(_mutex);
+
+    return index;
+}
+
+int AdcSampler::setAveraging(int index, uint8_t averaging)
+{
+    if ((index < 0) || (index >= _nbChannels) || (averaging == 0) || (averaging > ADC_SAMPLER_BUFFER_SIZE)) {
+        ESP_LOGE(TAG, "Invalid averaging: %d", averaging);
+        return -1;
+    }
+
+    /* Compute the sum of the last samples again */
+    Channel_t* ch = &_channels[index];
+    portENTER_CRITICAL(&_lock);
+    ch->averaging = averaging;
+    if (ch->count > averaging) {
+        ch->count = averaging;
+    }
+    ch->sum = 0;
+    for (int i = 1; i <= ch->count; i++) {
+        ch->sum += ch->samples[(ch->head + ADC_SAMPLER_BUFFER_SIZE - i) % ADC_SAMPLER_BUFFER_SIZE];
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    return 0;
+}
+
+int AdcSampler::readRaw(int index)
+{
+    if ((index < 0) || (index >= _nbChannels)) {
+        ESP_LOGE(TAG, "Invalid ADC channel index: %d", index);
+        return -1;
+    }
+
+    int value = _channels[index].value.load();
+    for (int i = 0; (value < 0) && (i < ADC_SAMPLER_READ_TIMEOUT_MS); i++) {
+        vTaskDelay(pdMS_TO_TICKS(1));
+        value = _channels[index].value.load();
+    }
+    if (value < 0) {
+        ESP_LOGE(TAG, "No sample on ADC%d channel %d", _channels[index].unit + 1, _channels[index].channel);
+    }
+    return value;
+}
+
+int AdcSampler::readMilliVolt(int index)
+{
+    int raw = readRaw(index);
+    if (raw < 0) {
+        return -1;
+    }
+    return rawToMilliVolt(_channels[index].unit, raw);
+}
+
+int AdcSampler::rawToMilliVolt(adc_unit_t unit, int raw)
+{
+    if (raw < 0) {
+        raw = 0;
+    } else if (raw > ADC_SAMPLER_RAW_MAX) {
+        raw = ADC_SAMPLER_RAW_MAX;
+    }
+    if ((unit < SOC_ADC_PERIPH_NUM) && (_lut[unit] != NULL)) {
+        return _lut[unit][raw];
+    }
+    return -1;
+}
+
+int AdcSampler::milliVoltToRaw(adc_unit_t unit, int milliVolt)
+{
+    if ((unit >= SOC_ADC_PERIPH_NUM) || (_lut[unit] == NULL)) {
+        return -1;
+    }
+
+    /* The table is monotonic */
+    int low = 0;
+    int high = ADC_SAMPLER_RAW_MAX;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (_lut[unit][mid] < milliVolt) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+int AdcSampler::setThreshold(int index, int raw, AdcThresholdCallback_t callback, void* arg)
+{
+    if ((index < 0) || (index >= _nbChannels)) {
+        ESP_LOGE(TAG, "Invalid ADC channel index: %d", index);
+        return -1;
+    }
+
+    Channel_t* ch = &_channels[index];
+    portENTER_CRITICAL(&_lock);
+    ch->threshold = (callback != NULL) ? raw : -1;
+    ch->above = 0;
+    ch->thresholdCallback = callback;
+    ch->thresholdArg = arg;
+    portEXIT_CRITICAL(&_lock);
+
+    return 0;
+}
+
+int AdcSampler::setOverride(int index, int raw)
+{
+    if ((index < 0) || (index >= _nbChannels) || (raw > ADC_SAMPLER_RAW_MAX)) {
+        ESP_LOGE(TAG, "Invalid override on ADC channel index: %d", index);
+        return -1;
+    }
+    _channels[index].override.store(raw);
+    return 0;
+}
+
+/* The calibration curve only depends on the unit and the attenuation,
+it is computed once for every raw value */
+int AdcSampler::_buildLut(adc_unit_t unit)
+{
+    adc_cali_handle_t caliHandle = NULL;
+    adc_cali_curve_fitting_config_t caliConfig = {
+        .unit_id = unit,
+        .chan = ADC_CHANNEL_0,
+        .atten = ADC_ATTEN_DB_12,
+        .bitwidth = ADC_BITWIDTH_12,
+    };
+    if (adc_cali_create_scheme_curve_fitting(&caliConfig, &caliHandle) != ESP_OK) {
+        return -1;
+    }
+
+    _lut[unit] = (uint16_t*)malloc((ADC_SAMPLER_RAW_MAX + 1) * sizeof(uint16_t));
+    if (_lut[unit] == NULL) {
+        adc_cali_delete_scheme_curve_fitting(caliHandle);
+        return -1;
+    }
+
+    int voltage = 0;
+    for (int raw = 0; raw <= ADC_SAMPLER_RAW_MAX; raw++) {
+        adc_cali_raw_to_voltage(caliHandle, raw, &voltage);
+        _lut[unit][raw] = (uint16_t)voltage;
+    }
+    adc_cali_delete_scheme_curve_fitting(caliHandle);
+
+    return 0;
+}
+
+/* Must be called with _mutex taken */
+int AdcSampler::_configure(void)
+{
+    int err = 0;
+    adc_digi_pattern_config_t pattern[ADC_SAMPLER_MAX_CHANNELS];
+    bool units[SOC_ADC_PERIPH_NUM] = {false};
+
+    if (_running) {
+        adc_continuous_stop(_handle);
+        _running = false;
+    }
+
+    for (int i = 0; i < _nbChannels; i++) {
+        pattern[i].atten = ADC_ATTEN_DB_12;
+        pattern[i].channel = _channels[i].channel;
+        pattern[i].unit = _channels[i].unit;
+        pattern[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+        units[_channels[i].unit] = true;
+    }
+
+    adc_continuous_config_t config = {
+        .pattern_num = _nbChannels,
+        .adc_pattern = pattern,
+        .sample_freq_hz = ADC_SAMPLER_FREQUENCY_HZ,
+        .conv_mode = (units[ADC_UNIT_1] && units[ADC_UNIT_2]) ? ADC_CONV_ALTER_UNIT :
+                     (units[ADC_UNIT_2] ? ADC_CONV_SINGLE_UNIT_2 : ADC_CONV_SINGLE_UNIT_1),
+        .format = ADC_DIGI_OUTPUT_FORMAT_TYPE2,
+    };
+    err |= adc_continuous_config(_handle, &config);
+    err |= adc_continuous_start(_handle);
+    _running = (err == ESP_OK);
+
+    return (err == ESP_OK) ? 0 : -1;
+}
+
+void AdcSampler::_pushSample(Channel_t* ch, uint16_t raw)
+{
+    AdcThresholdCallback_t callback = NULL;
+    void* arg = NULL;
+
+    int override = ch->override.load();
+    if (override >= 0) {
+        raw = (uint16_t)override;
+    }
+
+    portENTER_CRITICAL(&_lock);
+    if (ch->count >= ch->averaging) {
+        ch->sum -= ch->samples[(ch->head + ADC_SAMPLER_BUFFER_SIZE - ch->averaging) % ADC_SAMPLER_BUFFER_SIZE];
+    } else {
+        ch->count++;
+    }
+    ch->samples[ch->head] = raw;
+    ch->head = (ch->head + 1) % ADC_SAMPLER_BUFFER_SIZE;
+    ch->sum += raw;
+    ch->value.store((int)(ch->sum / ch->count));
+
+    /* Comparator on the raw samples, not on the average, to react within a few samples */
+    if ((ch->threshold >= 0) && (raw > ch->threshold)) {
+        if (ch->above < ADC_SAMPLER_THRESHOLD_SAMPLES) {
+            ch->above++;
+            if (ch->above == ADC_SAMPLER_THRESHOLD_SAMPLES) {
+                callback = ch->thresholdCallback;
+                arg = ch->thresholdArg;
+            }
+        }
+    } else {
+        ch->above = 0;
+    }
+    portEXIT_CRITICAL(&_lock);
+
+    if (callback != NULL) {
+        callback((int)(ch - _channels), raw, arg);
+    }
+}
+
+bool IRAM_ATTR AdcSampler::_convDoneIsr(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void *userData)
+{
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(_taskHandle, &higherPriorityTaskWoken);
+    return (higherPriorityTaskWoken == pdTRUE);
+}
+
+void AdcSampler::_task(void *pvParameters)
+{
+    static uint8_t buffer[ADC_SAMPLER_FRAME_SIZE];
+    uint32_t length = 0;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        xSemaphoreTake(_mutex, portMAX_DELAY);
+        while (_running && (adc_continuous_read(_handle, buffer, sizeof(buffer), &length, 0) == ESP_OK)) {
+            for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= length; i += SOC_ADC_DIGI_RESULT_BYTES) {
+                adc_digi_output_data_t *data = (adc_digi_output_data_t*)&buffer[i];
+                uint32_t unit = data->type2.unit;
+                uint32_t channel = data->type2.channel;
+                if ((unit < SOC_ADC_PERIPH_NUM) && (channel < SOC_ADC_MAX_CHANNEL_NUM) && (_index[unit][channel] >= 0)) {
+                    _pushSample(&_channels[_index[unit][channel]], data->type2.data);
+                }
+            }
+        }
+        xSemaphoreGive(_mutex);
+    }
+}
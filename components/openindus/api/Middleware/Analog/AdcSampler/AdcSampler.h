@@ -0,0 +1,157 @@
+/**
+ * @file AdcSampler.h
+ * @brief Background sampling of the ESP32 ADC channels
+ * @author Kévin Lefeuvre (kevin.lefeuvre@openindus.com)
+ * @copyright (c) [2025] OpenIndus, Inc. All rights reserved.
+ * @see https://openindus.com
+ */
+
+#pragma once
+
+#include "Common.h"
+#include "esp_adc/adc_continuous.h"
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
+#include <atomic>
+
+#define ADC_SAMPLER_MAX_CHANNELS        16
+#define ADC_SAMPLER_BUFFER_SIZE         64      // Maximum averaging
+#define ADC_SAMPLER_FREQUENCY_HZ        20000   // Shared by all the channels
+#define ADC_SAMPLER_FRAME_SIZE          128     // 32 conversions, 1.6ms at 20kHz
+#define ADC_SAMPLER_DEFAULT_AVERAGING   16
+#define ADC_SAMPLER_THRESHOLD_SAMPLES   4       // Consecutive samples above a threshold to trigger it
+
+/**
+ * @brief Function prototype for threshold callbacks, called from the sampling task
+ *
+ */
+typedef void (*AdcThresholdCallback_t)(int index, int raw, void* arg);
+
+/**
+ * @brief The ADC units are sampled continuously by DMA, each channel keeps the last samples
+ * in a ring buffer and a moving average, so that a read returns the latest value immediately.
+ *
+ */
+class AdcSampler
+{
+public:
+
+    /**
+     * @brief Create the continuous ADC driver and the sampling task.
+     * Sampling starts when the first channel is added.
+     *
+     * @return 0 if success, -1 if error
+     */
+    static int init(void);
+
+    /**
+     * @brief Add a channel to the conversion pattern.
+     * Adding a channel that is already sampled returns its index.
+     *
+     * @param unit ADC unit
+     * @param channel ADC channel
+     * @param averaging Number of samples of the moving average (1 to ADC_SAMPLER_BUFFER_SIZE)
+     * @return Index of the channel, -1 if error
+     */
+    static int addChannel(adc_unit_t unit, adc_channel_t channel, uint8_t averaging = ADC_SAMPLER_DEFAULT_AVERAGING);
+
+    /**
+     * @brief Set the number of samples of the moving average.
+     *
+     * @param index Index returned by addChannel
+     * @param averaging Number of samples (1 to ADC_SAMPLER_BUFFER_SIZE)
+     * @return 0 if success, -1 if error
+     */
+    static int setAveraging(int index, uint8_t averaging);
+
+    /**
+     * @brief Read the averaged raw value of a channel.
+     * Wait for the first samples if the channel was just added.
+     *
+     * @param index Index returned by addChannel
+     * @return Raw value, -1 if error
+     */
+    static int readRaw(int index);
+
+    /**
+     * @brief Read the averaged calibrated voltage of a channel.
+     *
+     * @param index Index returned by addChannel
+     * @return Voltage in mV, -1 if error
+     */
+    static int readMilliVolt(int index);
+
+    /**
+     * @brief Convert a raw value to a calibrated voltage.
+     *
+     * @param unit ADC unit
+     * @param raw Raw value
+     * @return Voltage in mV
+     */
+    static int rawToMilliVolt(adc_unit_t unit, int raw);
+
+    /**
+     * @brief Convert a calibrated voltage to the lowest raw value reaching it.
+     *
+     * @param unit ADC unit
+     * @param milliVolt Voltage in mV
+     * @return Raw value, -1 if error
+     */
+    static int milliVoltToRaw(adc_unit_t unit, int milliVolt);
+
+    /**
+     * @brief Compare every sample of a channel with a threshold.
+     * The callback is called once when ADC_SAMPLER_THRESHOLD_SAMPLES consecutive samples
+     * are above the threshold, and again after the channel went below it.
+     *
+     * @param index Index returned by addChannel
+     * @param raw Raw threshold, -1 to disable
+     * @param callback Function called from the sampling task
+     * @param arg Argument of the callback
+     * @return 0 if success, -1 if error
+     */
+    static int setThreshold(int index, int raw, AdcThresholdCallback_t callback, void* arg = NULL);
+
+    /**
+     * @brief Replace the samples of a channel by a simulated value, to test the threshold path.
+     *
+     * @param index Index returned by addChannel
+     * @param raw Simulated raw value, -1 to use the ADC samples again
+     * @return 0 if success, -1 if error
+     */
+    static int setOverride(int index, int raw);
+
+private:
+
+    typedef struct {
+        adc_unit_t unit;
+        adc_channel_t channel;
+        uint16_t samples[ADC_SAMPLER_BUFFER_SIZE];
+        uint8_t head;
+        uint8_t count;
+        uint8_t averaging;
+        uint32_t sum;
+        std::atomic<int> value; // Averaged raw value, -1 until the first sample
+        int threshold;          // Raw threshold, -1 if disabled
+        uint8_t above;          // Consecutive samples above the threshold
+        AdcThresholdCallback_t thresholdCallback;
+        void* thresholdArg;
+        std::atomic<int> override; // Simulated raw value, -1 if disabled
+    } Channel_t;
+
+    static adc_continuous_handle_t _handle;
+    static Channel_t _channels[ADC_SAMPLER_MAX_CHANNELS];
+    static uint8_t _nbChannels;
+    static int8_t _index[SOC_ADC_PERIPH_NUM][SOC_ADC_MAX_CHANNEL_NUM]; // Index of each unit/channel, -1 if not sampled
+    static uint16_t *_lut[SOC_ADC_PERIPH_NUM]; // Raw to mV calibration table of each unit
+    static SemaphoreHandle_t _mutex;
+    static portMUX_TYPE _lock;
+    static TaskHandle_t _taskHandle;
+    static bool _running;
+
+    static int _buildLut(adc_unit_t unit);
+    static int _configure(void);
+    static void _pushSample(Channel_t *channel, uint16_t raw);
+    static bool IRAM_ATTR _convDoneIsr(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void *userData);
+    static void _task(void *pvParameters);
+};
@@ -0,0 +1,288 @@
+/**
+ * @file AnalogCapture.cpp
+ * @brief Buffered waveform capture of the ADS866x channels
+ * @author Kévin Lefeuvre (kevin.lefeuvre@openindus.com)
+ * @copyright (c) [2025] OpenIndus, Inc. All rights reserved.
+ * @see https://openindus.com
+ */
+
+#include "AnalogCapture.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+static const char TAG[] = "AnalogCapture";
+
+AnalogCapture_Config_t AnalogCapture::_config;
+uint16_t *AnalogCapture::_buffer = NULL;
+uint32_t AnalogCapture::_bufferSweeps = 0;
+uint8_t AnalogCapture::_nbChannels = 0;
+uint32_t AnalogCapture::_head = 0;
+uint32_t AnalogCapture::_stored = 0;
+volatile AnalogCapture_State_t AnalogCapture::_state = CAPTURE_STATE_IDLE;
+volatile bool AnalogCapture::_running = false;
+volatile bool AnalogCapture::_stopRequest = false;
+uint32_t AnalogCapture::_sampleRate = 0;
+uint32_t AnalogCapture::_overruns = 0;
+uint16_t AnalogCapture::_latest[ADS866X_MAX_CHANNELS_NB];
+TaskHandle_t AnalogCapture::_taskHandle = NULL;
+SemaphoreHandle_t AnalogCapture::_done = NULL;
+
+int AnalogCapture::start(const AnalogCapture_Config_t &config)
+{
+    uint8_t nbChannels = __builtin_popcount(config.channels);
+
+    if (nbChannels == 0) {
+        ESP_LOGE(TAG, "No channel to capture");
+        return -1;
+    }
+    if (config.postSamples == 0) {
+        ESP_LOGE(TAG, "Post-trigger window must be at least 1 sample");
+        return -1;
+    }
+    if (config.trigger >= CAPTURE_TRIGGER_MAX) {
+        ESP_LOGE(TAG, "Invalid trigger: %u", config.trigger);
+        return -1;
+    }
+    if ((config.trigger != CAPTURE_TRIGGER_NONE) &&
+        ((config.triggerChannel >= ADS866X_MAX_CHANNELS_NB) || !(config.channels & (1 << config.triggerChannel)))) {
+        ESP_LOGE(TAG, "Trigger channel %u is not captured", config.triggerChannel);
+        return -1;
+    }
+
+    stop();
+
+    if (_done == NULL) {
+        _done = xSemaphoreCreateBinary();
+    }
+    xSemaphoreTake(_done, 0); // Given by a capture that ended by itself
+
+    /* Release the previous data */
+    if (_buffer != NULL) {
+        heap_caps_free(_buffer);
+        _buffer = NULL;
+    }
+
+    size_t size = ((size_t)config.preSamples + config.postSamples) * nbChannels * sizeof(uint16_t);
+    _buffer = (uint16_t *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (_buffer == NULL) {
+        ESP_LOGW(TAG, "No PSRAM available, using internal memory");
+        _buffer = (uint16_t *)heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    }
+    if (_buffer == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes", size);
+        _state = CAPTURE_STATE_IDLE;
+        return -1;
+    }
+
+    _config = config;
+    _nbChannels = nbChannels;
+    _bufferSweeps = config.preSamples + config.postSamples;
+    _head = 0;
+    _stored = 0;
+    _sampleRate = 0;
+    _overruns = 0;
+    _stopRequest = false;
+    _state = CAPTURE_STATE_ARMED;
+    _running = true;
+
+    if (xTaskCreate(_task, "Analog capture task", 4096, NULL, ANALOG_CAPTURE_TASK_PRIORITY, &_taskHandle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the capture task");
+        _running = false;
+        _state = CAPTURE_STATE_ERROR;
+        return -1;
+    }
+
+    return 0;
+}
+
+void AnalogCapture::stop(void)
+{
+    if (_running) {
+        _stopRequest = true;
+        xSemaphoreTake(_done, portMAX_DELAY);
+    }
+}
+
+AnalogCapture_Status_t AnalogCapture::getStatus(void)
+{
+    AnalogCapture_Status_t status;
+    status.state = _state;
+    status.channels = _config.channels;
+    status.sampleRate = _sampleRate;
+    status.samples = (_state == CAPTURE_STATE_DONE) ? _bufferSweeps : 0;
+    status.triggerIndex = (_state == CAPTURE_STATE_DONE) ? _config.preSamples : 0;
+    status.overruns = _overruns;
+    return status;
+}
+
+int AnalogCapture::read(uint32_t offset, uint16_t *buffer, uint32_t count)
+{
+    if ((_state != CAPTURE_STATE_DONE) || (_buffer == NULL) || (buffer == NULL)) {
+        return -1;
+    }
+
+    uint32_t total = _bufferSweeps * _nbChannels;
+    if (offset >= total) {
+        return 0;
+    }
+    if (count > total - offset) {
+        count = total - offset;
+    }
+
+    /* The ring is full when the capture is done, the oldest sweep is at the head */
+    uint32_t start = (_head * _nbChannels + offset) % total;
+    uint32_t first = (count < total - start) ? count : total - start;
+    memcpy(buffer, &_buffer[start], first * sizeof(uint16_t));
+    memcpy(&buffer[first], _buffer, (count - first) * sizeof(uint16_t));
+
+    return count;
+}
+
+int AnalogCapture::getLatest(uint8_t channel, uint16_t *raw)
+{
+    if (!_running || (channel >= ADS866X_MAX_CHANNELS_NB) || !(_config.channels & (1 << channel))) {
+        return -1;
+    }
+    *raw = _latest[channel];
+    return 0;
+}
+
+bool AnalogCapture::_isTriggered(uint16_t value, int32_t previous)
+{
+    switch (_config.trigger) {
+    case CAPTURE_TRIGGER_NONE:
+        return true;
+    case CAPTURE_TRIGGER_RISING:
+        return (previous >= 0) && (previous < _config.triggerLevel) && (value >= _config.triggerLevel);
+    case CAPTURE_TRIGGER_FALLING:
+        return (previous >= 0) && (previous >= _config.triggerLevel) && (value < _config.triggerLevel);
+    case CAPTURE_TRIGGER_ABOVE:
+        return value >= _config.triggerLevel;
+    case CAPTURE_TRIGGER_BELOW:
+        return value < _config.triggerLevel;
+    default:
+        return false;
+    }
+}
+
+void AnalogCapture::_task(void *pvParameters)
+{
+    uint8_t channels[ADS866X_MAX_CHANNELS_NB];
+    uint8_t triggerPos = 0;
+    uint16_t block[ANALOG_CAPTURE_BLOCK_SIZE];
+    uint32_t sums[ADS866X_MAX_CHANNELS_NB] = {};
+    uint32_t blockValues = (ANALOG_CAPTURE_BLOCK_SIZE / _nbChannels) * _nbChannels;
+    uint32_t decimation = 1;
+    uint32_t accumulated = 0;
+    uint32_t written = 0;
+    uint32_t remaining = 0;
+    uint64_t rawSweeps = 0;
+    int32_t previous = -1;
+
+    /* Position of each value inside a sweep */
+    for (int channel = 0, i = 0; channel < ADS866X_MAX_CHANNELS_NB; channel++) {
+        if (_config.channels & (1 << channel)) {
+            if (channel == _config.triggerChannel) {
+                triggerPos = i;
+            }
+            channels[i++] = channel;
+        }
+    }
+
+    if (ads866x_stream_start(_config.channels) != 0) {
+        _state = CAPTURE_STATE_ERROR;
+    } else {
+        /* Time the stream to get the maximum rate, then average down to the requested one */
+        uint32_t frames = 0;
+        int64_t start = esp_timer_get_time();
+        while (frames < ANALOG_CAPTURE_CALIBRATION * _nbChannels) {
+            ads866x_stream_read(block, blockValues);
+            frames += blockValues;
+        }
+        int64_t elapsed = esp_timer_get_time() - start;
+        float framePeriod = (float)elapsed / frames;
+        float maxRate = 1000000.0f / (framePeriod * _nbChannels);
+        int64_t overrunTime = (int64_t)((blockValues + ADS866X_SCAN_QUEUE_SIZE) * framePeriod);
+
+        if ((_config.sampleRate > 0) && (_config.sampleRate < maxRate)) {
+            decimation = (uint32_t)(maxRate / _config.sampleRate + 0.5f);
+        }
+        _sampleRate = (uint32_t)(maxRate / decimation);
+        ESP_LOGI(TAG, "Capture of channels 0x%02x at %lu Hz (max %.0f Hz)", _config.channels, _sampleRate, maxRate);
+
+        start = esp_timer_get_time();
+        int64_t last = start;
+
+        while (!_stopRequest && (_state != CAPTURE_STATE_DONE)) {
+            if (ads866x_stream_read(block, blockValues) != 0) {
+                _state = CAPTURE_STATE_ERROR;
+                break;
+            }
+
+            /* The SPI queue runs dry if the task was late by more than the queued frames */
+            int64_t now = esp_timer_get_time();
+            if (now - last > overrunTime) {
+                _overruns++;
+            }
+            last = now;
+
+            for (uint32_t i = 0; i < blockValues; i += _nbChannels) {
+                for (int c = 0; c < _nbChannels; c++) {
+                    _latest[channels[c]] = block[i + c];
+                    sums[c] += block[i + c];
+                }
+                rawSweeps++;
+
+                if (++accumulated < decimation) {
+                    continue;
+                }
+
+                uint16_t *sweep = &_buffer[_head * _nbChannels];
+                for (int c = 0; c < _nbChannels; c++) {
+                    sweep[c] = (uint16_t)((sums[c] + decimation / 2) / decimation);
+                    sums[c] = 0;
+                }
+                accumulated = 0;
+                _head = (_head + 1) % _bufferSweeps;
+                if (_stored < _bufferSweeps) {
+                    _stored++;
+                }
+                written++;
+
+                if (_state == CAPTURE_STATE_ARMED) {
+                    /* The trigger sweep needs the full pre-trigger window before it */
+                    if ((written > _config.preSamples) && _isTriggered(sweep[triggerPos], previous)) {
+                        _state = CAPTURE_STATE_TRIGGERED;
+                        remaining = _config.postSamples - 1;
+                    }
+                } else {
+                    remaining--;
+                }
+                previous = sweep[triggerPos];
+
+                if ((_state == CAPTURE_STATE_TRIGGERED) && (remaining == 0)) {
+                    _state = CAPTURE_STATE_DONE;
+                    break;
+                }
+            }
+        }
+
+        elapsed = esp_timer_get_time() - start;
+        if (elapsed > 0) {
+            _sampleRate = (uint32_t)(rawSweeps * 1000000 / elapsed / decimation);
+        }
+
+        ads866x_stream_stop();
+
+        if (_state == CAPTURE_STATE_DONE) {
+            ESP_LOGI(TAG, "Capture done, %lu samples at %lu Hz, %lu overruns", _bufferSweeps, _sampleRate, _overruns);
+        } else if (_state != CAPTURE_STATE_ERROR) {
+            _state = CAPTURE_STATE_IDLE;
+        }
+    }
+
+    _running = false;
+    _taskHandle = NULL;
+    xSemaphoreGive(_done);
+    vTaskDelete(NULL);
+}
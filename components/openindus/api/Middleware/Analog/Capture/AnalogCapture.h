@@ -0,0 +1,136 @@
+/**
+ * @file AnalogCapture.h
+ * @brief Buffered waveform capture of the ADS866x channels
+ * @author Kévin Lefeuvre (kevin.lefeuvre@openindus.com)
+ * @copyright (c) [2025] OpenIndus, Inc. All rights reserved.
+ * @see https://openindus.com
+ */
+
+#pragma once
+
+#include "Common.h"
+#include "ads866x.h"
+
+#define ANALOG_CAPTURE_BLOCK_SIZE       64      // Values read from the ADC stream at once
+#define ANALOG_CAPTURE_CALIBRATION      256     // Sweeps timed to measure the maximum rate
+#define ANALOG_CAPTURE_TASK_PRIORITY    10
+
+/**
+ * @brief Capture triggers, compared with the raw value of the trigger channel
+ *
+ */
+typedef enum {
+    CAPTURE_TRIGGER_NONE    = 0,    // Trigger as soon as the pre-trigger window is full
+    CAPTURE_TRIGGER_RISING  = 1,    // Value crosses the level upward
+    CAPTURE_TRIGGER_FALLING = 2,    // Value crosses the level downward
+    CAPTURE_TRIGGER_ABOVE   = 3,    // Value is above or equal to the level
+    CAPTURE_TRIGGER_BELOW   = 4,    // Value is below the level
+    CAPTURE_TRIGGER_MAX
+} AnalogCapture_Trigger_t;
+
+typedef enum {
+    CAPTURE_STATE_IDLE      = 0,
+    CAPTURE_STATE_ARMED     = 1,    // Filling the pre-trigger window or waiting for the trigger
+    CAPTURE_STATE_TRIGGERED = 2,    // Acquiring the post-trigger window
+    CAPTURE_STATE_DONE      = 3,    // Data can be read
+    CAPTURE_STATE_ERROR     = 4
+} AnalogCapture_State_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t channels;           // Bit n to capture ADC channel n
+    uint32_t sampleRate;        // Sweeps per second, 0 for the maximum rate
+    uint32_t preSamples;        // Sweeps kept before the trigger
+    uint32_t postSamples;       // Sweeps acquired from the trigger, at least 1
+    uint8_t trigger;            // AnalogCapture_Trigger_t
+    uint8_t triggerChannel;     // ADC channel compared with the level, must be captured
+    uint16_t triggerLevel;      // Raw level
+} AnalogCapture_Config_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t state;              // AnalogCapture_State_t
+    uint8_t channels;           // Captured ADC channels
+    uint32_t sampleRate;        // Measured sweeps per second
+    uint32_t samples;           // Sweeps available for reading
+    uint32_t triggerIndex;      // Index of the trigger sweep in the data
+    uint32_t overruns;          // Blocks for which the SPI queue may have run dry
+} AnalogCapture_Status_t;
+
+/**
+ * @brief The ADS866x runs continuously in auto-sequence mode, the sweeps are averaged down to
+ * the requested rate and stored in a ring buffer (in PSRAM when available) until the trigger
+ * and the post-trigger window. The device is reserved while a capture is armed.
+ *
+ */
+class AnalogCapture
+{
+public:
+
+    /**
+     * @brief Allocate the buffer and start the acquisition task.
+     * A previous capture is stopped and its data released.
+     *
+     * @param config Capture configuration
+     * @return 0 if success, -1 if error
+     */
+    static int start(const AnalogCapture_Config_t &config);
+
+    /**
+     * @brief Stop the acquisition. The data stays readable if the capture was done.
+     *
+     */
+    static void stop(void);
+
+    /**
+     * @brief Get the state of the capture
+     *
+     * @return Status
+     */
+    static AnalogCapture_Status_t getStatus(void);
+
+    /**
+     * @brief Read the captured values, sweep after sweep from the oldest one, channels in
+     * ascending order inside a sweep.
+     *
+     * @param offset Index of the first value
+     * @param buffer Raw values
+     * @param count Maximum number of values to read
+     * @return Number of values read, -1 if no data
+     */
+    static int read(uint32_t offset, uint16_t *buffer, uint32_t count);
+
+    /**
+     * @brief Get the last value acquired on a channel, to serve single reads while the device is reserved.
+     *
+     * @param channel ADC channel
+     * @param raw Raw value
+     * @return 0 if success, -1 if no capture is running on this channel
+     */
+    static int getLatest(uint8_t channel, uint16_t *raw);
+
+    /**
+     * @brief Check if a capture is using the device
+     *
+     * @return true if armed or triggered
+     */
+    static inline bool isRunning(void) { return _running; }
+
+private:
+
+    static AnalogCapture_Config_t _config;
+    static uint16_t *_buffer;
+    static uint32_t _bufferSweeps;  // pre + post sweeps
+    static uint8_t _nbChannels;
+    static uint32_t _head;          // Next sweep written in the ring
+    static uint32_t _stored;        // Sweeps written since the start, saturated to the ring size
+    static volatile AnalogCapture_State_t _state;
+    static volatile bool _running;
+    static volatile bool _stopRequest;
+    static uint32_t _sampleRate;
+    static uint32_t _overruns;
+    static uint16_t _latest[ADS866X_MAX_CHANNELS_NB];
+    static TaskHandle_t _taskHandle;
+    static SemaphoreHandle_t _done;
+
+    static bool _isTriggered(uint16_t value, int32_t previous);
+    static void _task(void *pvParameters);
+};
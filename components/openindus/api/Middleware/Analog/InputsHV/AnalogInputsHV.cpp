@@ -13,52 +13,32 @@ static const char TAG[] = "AnalogInputsHV";
 adc_unit_t AnalogInputsHV::_adc_unit;
 adc_channel_t* AnalogInputsHV::_adc_channels;
 uint8_t AnalogInputsHV::_nb_channels;
-adc_oneshot_unit_handle_t* AnalogInputsHV::_adc_handles;
-adc_cali_handle_t* AnalogInputsHV::_adc_cali_handles;
+int* AnalogInputsHV::_adc_indexes;
 float* AnalogInputsHV::_coeff_a;
 float* AnalogInputsHV::_coeff_b;
 
 int AnalogInputsHV::init(const adc_unit_t adc_unit,
     const adc_channel_t* adc_channels,
-    uint8_t nb_channels,
-    adc_oneshot_unit_handle_t adc_handle) 
+    uint8_t nb_channels) 
 {
     esp_err_t ret = ESP_OK;
     ESP_LOGI(TAG, "Initialize Analog Inputs");
 
+    _adc_unit = adc_unit;
     _nb_channels = nb_channels;
     _adc_channels = (adc_channel_t*)calloc(_nb_channels, sizeof(adc_channel_t));
-    _adc_handles = (adc_oneshot_unit_handle_t*)calloc(_nb_channels, sizeof(adc_oneshot_unit_handle_t));
-    _adc_cali_handles = (adc_cali_handle_t*)calloc(_nb_channels, sizeof(adc_cali_handle_t));
+    _adc_indexes = (int*)calloc(_nb_channels, sizeof(int));
     _coeff_a = (float*)calloc(_nb_channels, sizeof(float));
     _coeff_b = (float*)calloc(_nb_channels, sizeof(float));
 
     for (size_t i = 0; i < nb_channels; i++) {
         _adc_channels[i] = adc_channels[i];
-        _adc_handles[i] = adc_handle;
-        _adc_cali_handles[i] = NULL;
-        
-        // Configure ADC channel
-        adc_oneshot_chan_cfg_t config = {
-            .atten = ADC_ATTEN_DB_12,
-            .bitwidth = ADC_BITWIDTH_12,
-        };
-        ret = adc_oneshot_config_channel(_adc_handles[i], adc_channels[i], &config);
-        if (ret != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to configure ADC channel for input %d", i);
-            continue;
-        }
 
-        // Initialize ADC calibration
-        adc_cali_curve_fitting_config_t cali_config = {
-            .unit_id = adc_unit,
-            .chan = adc_channels[i],
-            .atten = ADC_ATTEN_DB_12,
-            .bitwidth = ADC_BITWIDTH_12,
-        };
-        ret = adc_cali_create_scheme_curve_fitting(&cali_config, &_adc_cali_handles[i]);
-        if (ret != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to create ADC calibration scheme for input %d", i);
+        // Add ADC channel to the background sampling
+        _adc_indexes[i] = AdcSampler::addChannel(adc_unit, adc_channels[i], ESP_ADC_NO_OF_SAMPLES);
+        if (_adc_indexes[i] < 0) {
+            ESP_LOGE(TAG, "Failed to configure ADC channel for input %d", i);
+            ret = ESP_FAIL;
         }
 
         // Get eFuse coefficients
@@ -98,26 +78,13 @@ float AnalogInputsHV::read(AnalogInput_Num_t num, AnalogInput_Unit_t unit)
         return -1;
     }
 
-    // Read raw ADC values with averaging
-    int voltage_sum = 0;
-    int adc_raw = 0;
-    int voltage = 0;
-    
-    // Making the mean with voltage and not adc_reading to be more precise
-    for (int i = 0; i < ESP_ADC_NO_OF_SAMPLES; i++)
-    {
-        esp_err_t ret = adc_oneshot_read(_adc_handles[num], _adc_channels[num], &adc_raw);
-        if (ret == ESP_OK) {
-            if (_adc_cali_handles[num] != NULL) {
-                ret = adc_cali_raw_to_voltage(_adc_cali_handles[num], adc_raw, &voltage);
-                if (ret == ESP_OK) {
-                    voltage_sum += voltage;
-                }
-            }
-        }
+    // Latest average of the last ESP_ADC_NO_OF_SAMPLES samples
+    int voltage = AdcSampler::readMilliVolt(_adc_indexes[num]);
+    if (voltage < 0) {
+        voltage = 0;
     }
     
-    float avg_voltage = (float) voltage_sum / (float) ESP_ADC_NO_OF_SAMPLES;
+    float avg_voltage = (float) voltage;
     
     // Apply unit conversion
     float value = 0.0f;
@@ -9,11 +9,9 @@
 #pragma once
 
 #include <string.h>
-#include "esp_adc/adc_oneshot.h"
-#include "esp_adc/adc_cali.h"
-#include "esp_adc/adc_cali_scheme.h"
 #include "esp_efuse.h"
 #include "AnalogInputs.h"
+#include "AdcSampler.h"
 
 #define ESP_ADC_NO_OF_SAMPLES 10U
 #define ESP_ADC_DEFAULT_COEFF_A 11.6965f
@@ -24,8 +22,7 @@ class AnalogInputsHV
 public:
     static int init(const adc_unit_t adc_unit,
         const adc_channel_t* adc_channels,
-        uint8_t nb_channels,
-        adc_oneshot_unit_handle_t adc_handle);
+        uint8_t nb_channels);
 
     /**
      * @brief Read the value of AIN.
@@ -80,8 +77,7 @@ private:
     static adc_unit_t _adc_unit;
     static adc_channel_t *_adc_channels;
     static uint8_t _nb_channels;
-    static adc_oneshot_unit_handle_t *_adc_handles;
-    static adc_cali_handle_t *_adc_cali_handles;
+    static int *_adc_indexes; // Index of each channel in AdcSampler
     static float *_coeff_a;
     static float *_coeff_b;
 
@@ -21,6 +21,8 @@ static const char TAG[] = "AnalogInputsLV";
 uint8_t AnalogInputsLV::_nb;
 AnalogInputAds866x** AnalogInputsLV::_ains;
 uint8_t* AnalogInputsLV::_current_sat;
+uint8_t AnalogInputsLV::_scanMask = 0;
+uint8_t AnalogInputsLV::_captureInputs = 0;
 
 int AnalogInputsLV::init(ads866x_config_t *ads866xConfig, const ain_num_t* num, const gpio_num_t* cmdGpio, uint8_t nb) 
 {
@@ -44,6 +46,7 @@ int AnalogInputsLV::init(ads866x_config_t *ads866xConfig, const ain_num_t* num,
         _ains[i] = new AnalogInputAds866x(num[i], cmdGpio[i]);
         err |= _ains[i]->init(AIN_DEFAULT_RANGE, AIN_DEFAULT_MODE);
         _current_sat[i] = 0;
+        _scanMask |= (1 << _ains[i]->getNum());
     }
 
     /* Create control task for overcurrent */
@@ -76,6 +79,122 @@ int AnalogInputsLV::analogRead(AnalogInput_Num_t num)
     return -1;
 }
 
+int AnalogInputsLV::analogReadAll(float *values, AnalogInput_Unit_t unit)
+{
+    uint16_t raws[ADS866X_MAX_CHANNELS_NB];
+
+    /* The device is reserved by the capture, use its last samples */
+    if (AnalogCapture::isRunning()) {
+        int err = 0;
+        for (size_t i = 0; i < _nb; i++) {
+            uint16_t raw;
+            if (AnalogCapture::getLatest(_ains[i]->getNum(), &raw) == 0) {
+                values[i] = _ains[i]->convert(raw, unit);
+            } else {
+                err = -1;
+            }
+        }
+        return err;
+    }
+
+    if (ads866x_scan(_scanMask, 1, raws) != 0) {
+        return -1;
+    }
+
+    /* The scan returns the channels in ascending order */
+    int index = 0;
+    for (int channel = 0; channel < ADS866X_MAX_CHANNELS_NB; channel++) {
+        if (_scanMask & (1 << channel)) {
+            for (size_t i = 0; i < _nb; i++) {
+                if (_ains[i]->getNum() == channel) {
+                    values[i] = _ains[i]->convert(raws[index], unit);
+                }
+            }
+            index++;
+        }
+    }
+    return 0;
+}
+
+int AnalogInputsLV::analogCaptureStart(uint8_t inputs, uint32_t sampleRate, uint32_t preSamples, uint32_t postSamples,
+                                       AnalogCapture_Trigger_t trigger, AnalogInput_Num_t triggerInput, float triggerLevel)
+{
+    AnalogCapture_Config_t config = {};
+
+    if ((inputs == 0) || (inputs >> _nb) != 0) {
+        ESP_LOGE(TAG, "Invalid inputs to capture: 0x%02x", inputs);
+        return -1;
+    }
+    if ((trigger != CAPTURE_TRIGGER_NONE) && ((triggerInput >= _nb) || !(inputs & (1 << triggerInput)))) {
+        ESP_LOGE(TAG, "Trigger input AIN_%i is not captured", triggerInput+1);
+        return -1;
+    }
+
+    for (size_t i = 0; i < _nb; i++) {
+        if (inputs & (1 << i)) {
+            config.channels |= (1 << _ains[i]->getNum());
+        }
+    }
+    config.sampleRate = sampleRate;
+    config.preSamples = preSamples;
+    config.postSamples = postSamples;
+    config.trigger = trigger;
+    if (trigger != CAPTURE_TRIGGER_NONE) {
+        float level = ads866x_convert_volt_2_raw(triggerLevel, _ains[triggerInput]->getVoltageRange());
+        config.triggerChannel = _ains[triggerInput]->getNum();
+        config.triggerLevel = (level < 0) ? 0 : (level > 0xFFF) ? 0xFFF : (uint16_t)level;
+    }
+
+    _captureInputs = inputs;
+    return AnalogCapture::start(config);
+}
+
+void AnalogInputsLV::analogCaptureStop(void)
+{
+    AnalogCapture::stop();
+}
+
+AnalogCapture_Status_t AnalogInputsLV::analogCaptureStatus(void)
+{
+    AnalogCapture_Status_t status = AnalogCapture::getStatus();
+    status.channels = _captureInputs;
+    return status;
+}
+
+int AnalogInputsLV::analogCaptureRead(uint32_t offset, uint16_t *buffer, uint32_t count)
+{
+    uint8_t channels = AnalogCapture::getStatus().channels;
+    uint8_t n = __builtin_popcount(channels);
+    uint8_t pos[ADS866X_MAX_CHANNELS_NB];
+    uint16_t sweep[ADS866X_MAX_CHANNELS_NB];
+
+    if ((n == 0) || (buffer == NULL)) {
+        return -1;
+    }
+
+    /* The capture stores the channels in ascending order, which is not the order of the inputs */
+    for (size_t i = 0, q = 0; i < _nb; i++) {
+        if (_captureInputs & (1 << i)) {
+            uint8_t channel = _ains[i]->getNum();
+            pos[q++] = __builtin_popcount(channels & ((1 << channel) - 1));
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t index = offset + i;
+        if ((i == 0) || (index % n == 0)) {
+            int ret = AnalogCapture::read(index - index % n, sweep, n);
+            if (ret < 0) {
+                return -1;
+            } else if (ret < n) {
+                return i;
+            }
+        }
+        buffer[i] = sweep[pos[index % n]];
+    }
+    return count;
+}
+
 float AnalogInputsLV::analogReadVolt(AnalogInput_Num_t num)
 {
     return read(num, AIN_UNIT_VOLT);
@@ -138,10 +257,16 @@ uint8_t AnalogInputsLV::analogInputGetVoltageRange(AnalogInput_Num_t num)
  * and switch to voltage mode if it lasts more than 30s */
 void AnalogInputsLV::_controlTask(void *pvParameters)
 {
+    float *currents = (float *)calloc(_nb, sizeof(float));
+
     while (1) {
+        if (analogReadAll(currents, AIN_UNIT_MILLIAMP) != 0) {
+            vTaskDelay(pdMS_TO_TICKS(500));
+            continue;
+        }
         for (size_t i = 0; i < _nb; i++) {
             if (_ains[i]->getMode() == AIN_MODE_CURRENT) {
-                if (_ains[i]->read(AIN_UNIT_MILLIAMP) > AIN_SAT_CURRENT_AMP) {
+                if (currents[i] > AIN_SAT_CURRENT_AMP) {
                     _current_sat[i] += 1;
                     if (_current_sat[i] >= 60) {
                         _ains[i]->setMode(AIN_MODE_VOLTAGE);
@@ -156,6 +281,7 @@ void AnalogInputsLV::_controlTask(void *pvParameters)
         }
         vTaskDelay(pdMS_TO_TICKS(500));
     }
+    free(currents);
 }
 
 /******************* Analog Input Ads866x **********************/
@@ -195,6 +321,14 @@ int AnalogInputAds866x::init(AnalogInput_VoltageRange_t range, AnalogInput_Mode_
 
 int AnalogInputAds866x::read(void)
 {
+    if (AnalogCapture::isRunning()) {
+        uint16_t raw;
+        if (AnalogCapture::getLatest(_num, &raw) != 0) {
+            ESP_LOGE(TAG, "ADC channel %i is not captured, it can't be read during a capture", _num);
+            return -1;
+        }
+        return raw;
+    }
     return ads866x_analog_read(_num);
 }
 
@@ -205,8 +339,21 @@ float AnalogInputAds866x::read(AnalogInput_Unit_t unit)
         return -1;
     }
 
-    float value = ads866x_analog_read(_num);
-    float voltage = ads866x_convert_raw_2_volt(value, _voltage_range);
+    int raw = read();
+    if (raw < 0) {
+        return -1;
+    }
+    return convert(raw, unit);
+}
+
+float AnalogInputAds866x::convert(uint16_t raw, AnalogInput_Unit_t unit)
+{
+    if ((unit == AIN_UNIT_MILLIAMP || unit == AIN_UNIT_AMP) && _mode != AIN_MODE_CURRENT) {
+        return -1;
+    }
+
+    float value = raw;
+    float voltage = ads866x_convert_raw_2_volt(raw, _voltage_range);
 
     switch (unit) {
         case AIN_UNIT_RAW:
@@ -235,7 +382,9 @@ float AnalogInputAds866x::read(AnalogInput_Unit_t unit)
 
 void AnalogInputAds866x::setMode(AnalogInput_Mode_t mode)
 {
-    if (mode != AIN_MODE_VOLTAGE && mode != AIN_MODE_CURRENT) {
+    if (AnalogCapture::isRunning()) {
+        ESP_LOGE(TAG, "The mode of ADC channel %i can't be changed during a capture", _num);
+    } else if (mode != AIN_MODE_VOLTAGE && mode != AIN_MODE_CURRENT) {
             ESP_LOGE(TAG, "Invalid mode");
     } else {
         _mode = mode;
@@ -256,7 +405,9 @@ uint8_t AnalogInputAds866x::getMode(void)
 
 void AnalogInputAds866x::setVoltageRange(AnalogInput_VoltageRange_t range)
 {
-    if (_mode == AIN_MODE_CURRENT) {
+    if (AnalogCapture::isRunning()) {
+        ESP_LOGE(TAG, "The range of ADC channel %i can't be changed during a capture", _num);
+    } else if (_mode == AIN_MODE_CURRENT) {
         if (range != AIN_VOLTAGE_RANGE_0_2V56) {
             ESP_LOGE(TAG,"Range in current mode should be 0-2V56 !");
         } else {
@@ -275,6 +426,9 @@ void AnalogInputAds866x::setVoltageRange(AnalogInput_VoltageRange_t range)
 
 uint8_t AnalogInputAds866x::getVoltageRange(void)
 {
+    if (AnalogCapture::isRunning()) {
+        return (uint8_t)_voltage_range; // The device is kept by the capture
+    }
     return ads866x_get_channel_voltage_range(_num);
 }
 
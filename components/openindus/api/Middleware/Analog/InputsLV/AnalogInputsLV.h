@@ -10,6 +10,7 @@
 
 #include "AnalogInputs.h"
 #include "ads866x.h"
+#include "AnalogCapture.h"
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_timer.h"
@@ -38,11 +39,13 @@ public:
     int init(AnalogInput_VoltageRange_t range, AnalogInput_Mode_t mode);
     int read(void);
     float read(AnalogInput_Unit_t unit);
+    float convert(uint16_t raw, AnalogInput_Unit_t unit);
     void setMode(AnalogInput_Mode_t mode);
     uint8_t getMode(void);
     void setVoltageRange(AnalogInput_VoltageRange_t range);
     uint8_t getVoltageRange(void);
     gpio_num_t getModePin();
+    inline uint8_t getNum(void) { return _num; }
 
 private:
     int _num;
@@ -137,8 +140,65 @@ public:
      **/
     static uint8_t analogInputGetVoltageRange(AnalogInput_Num_t num);
 
+    /**
+     * @brief Get the number of analog inputs
+     *
+     * @return Number of analog inputs
+     **/
+    static inline uint8_t getInputNumber(void) { return _nb; }
+
+    /**
+     * @brief Read all the analog inputs with a single scan of the ADC
+     *
+     * @param values Array of getInputNumber() values, -1 for a current unit on an input in voltage mode
+     * @param unit Unit of the values
+     * @return 0 if success, -1 otherwise
+     **/
+    static int analogReadAll(float *values, AnalogInput_Unit_t unit);
+
+    /**
+     * @brief Start a waveform capture of several inputs. The ADC runs continuously and its samples
+     * are averaged down to the sample rate. While the capture is armed, the captured inputs return
+     * their last sample and the other inputs can't be read.
+     * @param inputs Bit n to capture AIN_n+1
+     * @param sampleRate Samples per second on each input, 0 for the maximum rate
+     * @param preSamples Samples kept before the trigger
+     * @param postSamples Samples acquired from the trigger, at least 1
+     * @param trigger Trigger type
+     * @param triggerInput Input compared with the level, must be captured
+     * @param triggerLevel Level in V at the ADC input (current x 100 Ohm in current mode)
+     * @return 0 if success, -1 otherwise
+     **/
+    static int analogCaptureStart(uint8_t inputs, uint32_t sampleRate, uint32_t preSamples, uint32_t postSamples,
+                                  AnalogCapture_Trigger_t trigger = CAPTURE_TRIGGER_NONE,
+                                  AnalogInput_Num_t triggerInput = AIN_1, float triggerLevel = 0.0f);
+
+    /**
+     * @brief Stop the capture, the data stays readable if it was done
+     **/
+    static void analogCaptureStop(void);
+
+    /**
+     * @brief Get the state of the capture
+     * @return Status, channels holds the captured inputs
+     **/
+    static AnalogCapture_Status_t analogCaptureStatus(void);
+
+    /**
+     * @brief Read the raw values of a capture that is done: sample after sample from the oldest
+     * one, inputs in ascending order inside a sample.
+     * Convert them with the voltage range of each input.
+     * @param offset Index of the first value
+     * @param buffer Raw values
+     * @param count Maximum number of values
+     * @return Number of values read, -1 if no data
+     **/
+    static int analogCaptureRead(uint32_t offset, uint16_t *buffer, uint32_t count);
+
 private:
     static uint8_t _nb;
+    static uint8_t _scanMask; // ADC channels of the inputs
+    static uint8_t _captureInputs; // Inputs of the last capture
     static AnalogInputAds866x **_ains;
     static uint8_t *_current_sat;
 
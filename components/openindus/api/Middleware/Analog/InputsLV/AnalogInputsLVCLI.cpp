@@ -10,6 +10,9 @@
 #include "esp_log.h"
 #include "esp_console.h"
 #include "argtable3/argtable3.h"
+#include "mbedtls/base64.h"
+
+#define CAPTURE_CLI_READ_CHUNK 240 // Values per output line
 
 static struct {
     struct arg_int *ain;
@@ -173,11 +176,177 @@ static int _registerAnalogRead()
     return esp_console_cmd_register(&read_cmd);
 }
 
+static struct {
+    struct arg_int *inputs;
+    struct arg_int *rate;
+    struct arg_int *pre;
+    struct arg_int *post;
+    struct arg_int *trigger;
+    struct arg_int *ain;
+    struct arg_dbl *level;
+    struct arg_end *end;
+} _analogCaptureStartArgs;
+
+static int _analogCaptureStart(int argc, char **argv)
+{
+    int err = arg_parse(argc, argv, (void **) &_analogCaptureStartArgs);
+    if (err != 0) {
+        arg_print_errors(stderr, _analogCaptureStartArgs.end, argv[0]);
+        return -1;
+    }
+
+    uint8_t inputs = (uint8_t)_analogCaptureStartArgs.inputs->ival[0];
+    uint32_t rate = (_analogCaptureStartArgs.rate->count == 1) ? _analogCaptureStartArgs.rate->ival[0] : 0;
+    uint32_t pre = (_analogCaptureStartArgs.pre->count == 1) ? _analogCaptureStartArgs.pre->ival[0] : 0;
+    uint32_t post = (_analogCaptureStartArgs.post->count == 1) ? _analogCaptureStartArgs.post->ival[0] : 1000;
+    AnalogCapture_Trigger_t trigger = CAPTURE_TRIGGER_NONE;
+    if (_analogCaptureStartArgs.trigger->count == 1) {
+        trigger = (AnalogCapture_Trigger_t)_analogCaptureStartArgs.trigger->ival[0];
+    }
+    AnalogInput_Num_t ain = AIN_1;
+    if (_analogCaptureStartArgs.ain->count == 1) {
+        ain = (AnalogInput_Num_t)(_analogCaptureStartArgs.ain->ival[0] - 1);
+    }
+    float level = (_analogCaptureStartArgs.level->count == 1) ? _analogCaptureStartArgs.level->dval[0] : 0.0f;
+
+    return AnalogInputsLV::analogCaptureStart(inputs, rate, pre, post, trigger, ain, level);
+}
+
+static int _registerAnalogCaptureStart()
+{
+    _analogCaptureStartArgs.inputs = arg_int1(NULL, NULL, "<INPUTS>", "Bit n to capture AIN n+1 (15 for all)");
+    _analogCaptureStartArgs.rate = arg_int0("r", "rate", "<HZ>", "Samples per second, default to the maximum rate");
+    _analogCaptureStartArgs.pre = arg_int0("p", "pre", "<SAMPLES>", "Samples before the trigger (default 0)");
+    _analogCaptureStartArgs.post = arg_int0("n", "post", "<SAMPLES>", "Samples from the trigger (default 1000)");
+    _analogCaptureStartArgs.trigger = arg_int0("t", "trigger", "<TRIGGER>", "0 = None, 1 = Rising, 2 = Falling, 3 = Above, 4 = Below");
+    _analogCaptureStartArgs.ain = arg_int0("a", "ain", "<AIN>", "Trigger input [1-4]");
+    _analogCaptureStartArgs.level = arg_dbl0("l", "level", "<V>", "Trigger level in V");
+    _analogCaptureStartArgs.end = arg_end(7);
+
+    const esp_console_cmd_t cmd = {
+        .command = "analog-capture-start",
+        .help = "Start a waveform capture of the AIN",
+        .hint = NULL,
+        .func = &_analogCaptureStart,
+        .argtable = &_analogCaptureStartArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    return esp_console_cmd_register(&cmd);
+}
+
+static int _analogCaptureStop(int argc, char **argv)
+{
+    AnalogInputsLV::analogCaptureStop();
+    return 0;
+}
+
+static int _registerAnalogCaptureStop()
+{
+    const esp_console_cmd_t cmd = {
+        .command = "analog-capture-stop",
+        .help = "Stop the waveform capture",
+        .hint = NULL,
+        .func = &_analogCaptureStop,
+        .argtable = NULL,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    return esp_console_cmd_register(&cmd);
+}
+
+static int _analogCaptureStatus(int argc, char **argv)
+{
+    AnalogCapture_Status_t status = AnalogInputsLV::analogCaptureStatus();
+    printf("{\"state\":%u,\"inputs\":%u,\"rate\":%lu,\"samples\":%lu,\"trigger_index\":%lu,\"overruns\":%lu}\n",
+        status.state, status.channels, status.sampleRate, status.samples, status.triggerIndex, status.overruns);
+    return 0;
+}
+
+static int _registerAnalogCaptureStatus()
+{
+    const esp_console_cmd_t cmd = {
+        .command = "analog-capture-status",
+        .help = "Print the state of the waveform capture (0 = Idle, 1 = Armed, 2 = Triggered, 3 = Done, 4 = Error)",
+        .hint = NULL,
+        .func = &_analogCaptureStatus,
+        .argtable = NULL,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    return esp_console_cmd_register(&cmd);
+}
+
+static struct {
+    struct arg_int *offset;
+    struct arg_int *count;
+    struct arg_end *end;
+} _analogCaptureReadArgs;
+
+static int _analogCaptureRead(int argc, char **argv)
+{
+    int err = arg_parse(argc, argv, (void **) &_analogCaptureReadArgs);
+    if (err != 0) {
+        arg_print_errors(stderr, _analogCaptureReadArgs.end, argv[0]);
+        return -1;
+    }
+
+    AnalogCapture_Status_t status = AnalogInputsLV::analogCaptureStatus();
+    uint32_t total = status.samples * __builtin_popcount(status.channels);
+    uint32_t offset = (_analogCaptureReadArgs.offset->count == 1) ? _analogCaptureReadArgs.offset->ival[0] : 0;
+    uint32_t count = (_analogCaptureReadArgs.count->count == 1) ? _analogCaptureReadArgs.count->ival[0] : total;
+
+    if (status.state != CAPTURE_STATE_DONE) {
+        ESP_LOGE(__func__, "No capture done");
+        return -1;
+    }
+
+    /* Raw binary would be altered by the console line endings: print base64 lines of little-endian values */
+    uint16_t values[CAPTURE_CLI_READ_CHUNK];
+    unsigned char line[((CAPTURE_CLI_READ_CHUNK * sizeof(uint16_t) + 2) / 3) * 4 + 1];
+    while (count > 0) {
+        int ret = AnalogInputsLV::analogCaptureRead(offset, values, (count > CAPTURE_CLI_READ_CHUNK) ? CAPTURE_CLI_READ_CHUNK : count);
+        if (ret <= 0) {
+            break;
+        }
+        size_t len = 0;
+        mbedtls_base64_encode(line, sizeof(line), &len, (const unsigned char *)values, ret * sizeof(uint16_t));
+        printf("%.*s\n", (int)len, line);
+        offset += ret;
+        count -= ret;
+    }
+    printf("END\n");
+
+    return 0;
+}
+
+static int _registerAnalogCaptureRead()
+{
+    _analogCaptureReadArgs.offset = arg_int0("o", "offset", "<INDEX>", "First value (default 0)");
+    _analogCaptureReadArgs.count = arg_int0("c", "count", "<VALUES>", "Number of values (default all)");
+    _analogCaptureReadArgs.end = arg_end(2);
+
+    const esp_console_cmd_t cmd = {
+        .command = "analog-capture-read",
+        .help = "Print the raw values of the capture in base64 (uint16 little-endian, inputs in ascending order)",
+        .hint = NULL,
+        .func = &_analogCaptureRead,
+        .argtable = &_analogCaptureReadArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    return esp_console_cmd_register(&cmd);
+}
+
 int AnalogInputsLV::_registerCLI(void) 
 {
     int err = 0;
     err |= _registerAnalogInputMode();
     err |= _registerAnalogInputVoltageRange();
     err |= _registerAnalogRead();
+    err |= _registerAnalogCaptureStart();
+    err |= _registerAnalogCaptureStop();
+    err |= _registerAnalogCaptureStatus();
+    err |= _registerAnalogCaptureRead();
     return err;
 }
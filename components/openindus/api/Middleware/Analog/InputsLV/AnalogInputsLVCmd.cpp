@@ -60,6 +60,11 @@ float AnalogInputsLVCmd::analogReadVolt(AnalogInput_Num_t num)
 
 float AnalogInputsLVCmd::analogReadMilliVolt(AnalogInput_Num_t num)
 {
+    float value;
+    if (_module->readInputImage(IMAGE_ANALOG_INPUTS_MILLIVOLT, &value, sizeof(float), num * sizeof(float)) == 0) {
+        return value;
+    }
+
     std::vector<uint8_t> msgBytes = {CALLBACK_ANALOG_READ_MILLIVOLT, (uint8_t)num};
     _module->runCallback(msgBytes);
     float* ret = reinterpret_cast<float*>(&msgBytes[2]);
@@ -82,4 +87,72 @@ float AnalogInputsLVCmd::analogReadMilliAmp(AnalogInput_Num_t num)
     return *ret;
 }
 
+int AnalogInputsLVCmd::analogCaptureStart(uint8_t inputs, uint32_t sampleRate, uint32_t preSamples, uint32_t postSamples,
+                                          AnalogCapture_Trigger_t trigger, AnalogInput_Num_t triggerInput, float triggerLevel)
+{
+    std::vector<uint8_t> msgBytes = {CALLBACK_ANALOG_CAPTURE_START, inputs};
+    uint8_t* ptr = reinterpret_cast<uint8_t*>(&sampleRate);
+    msgBytes.insert(msgBytes.end(), ptr, ptr + sizeof(uint32_t));
+    ptr = reinterpret_cast<uint8_t*>(&preSamples);
+    msgBytes.insert(msgBytes.end(), ptr, ptr + sizeof(uint32_t));
+    ptr = reinterpret_cast<uint8_t*>(&postSamples);
+    msgBytes.insert(msgBytes.end(), ptr, ptr + sizeof(uint32_t));
+    msgBytes.push_back((uint8_t)trigger);
+    msgBytes.push_back((uint8_t)triggerInput);
+    ptr = reinterpret_cast<uint8_t*>(&triggerLevel);
+    msgBytes.insert(msgBytes.end(), ptr, ptr + sizeof(float));
+    if (_module->runCallback(msgBytes) != 0) {
+        return -1;
+    }
+    int* ret = reinterpret_cast<int*>(&msgBytes[2]);
+    return *ret;
+}
+
+void AnalogInputsLVCmd::analogCaptureStop(void)
+{
+    std::vector<uint8_t> msgBytes = {CALLBACK_ANALOG_CAPTURE_STOP};
+    _module->runCallback(msgBytes);
+}
+
+AnalogCapture_Status_t AnalogInputsLVCmd::analogCaptureStatus(void)
+{
+    AnalogCapture_Status_t status = {};
+    status.state = CAPTURE_STATE_ERROR;
+    std::vector<uint8_t> msgBytes = {CALLBACK_ANALOG_CAPTURE_STATUS, 0};
+    if ((_module->runCallback(msgBytes) == 0) && (msgBytes.size() >= 2 + sizeof(AnalogCapture_Status_t))) {
+        memcpy(&status, &msgBytes[2], sizeof(AnalogCapture_Status_t));
+    }
+    return status;
+}
+
+int AnalogInputsLVCmd::analogCaptureRead(uint32_t offset, uint16_t *buffer, uint32_t count)
+{
+    uint32_t done = 0;
+
+    while (done < count) {
+        uint32_t index = offset + done;
+        uint16_t size = (count - done > ANALOG_CAPTURE_READ_CHUNK) ? ANALOG_CAPTURE_READ_CHUNK : (count - done);
+        std::vector<uint8_t> msgBytes = {CALLBACK_ANALOG_CAPTURE_READ};
+        uint8_t* ptr = reinterpret_cast<uint8_t*>(&index);
+        msgBytes.insert(msgBytes.end(), ptr, ptr + sizeof(uint32_t));
+        ptr = reinterpret_cast<uint8_t*>(&size);
+        msgBytes.insert(msgBytes.end(), ptr, ptr + sizeof(uint16_t));
+        if (_module->runCallback(msgBytes) != 0) {
+            return -1;
+        }
+
+        /* Answer: [callback, status, values...], status is 0 if data is available */
+        if ((msgBytes.size() < 2) || (msgBytes[1] != 0)) {
+            return (done > 0) ? done : -1;
+        }
+        uint32_t received = (msgBytes.size() - 2) / sizeof(uint16_t);
+        memcpy(&buffer[done], &msgBytes[2], received * sizeof(uint16_t));
+        done += received;
+        if (received < size) {
+            break; // End of the data
+        }
+    }
+    return done;
+}
+
 #endif
\ No newline at end of file
@@ -14,6 +14,8 @@
 
 #if defined(CONFIG_MODULE_MASTER)
 
+#define ANALOG_CAPTURE_READ_CHUNK   500 // Values per bus frame
+
 class AnalogInputsLVCmd
 {
 public:
@@ -98,6 +100,44 @@ public:
      **/
     uint8_t analogInputGetVoltageRange(AnalogInput_Num_t num);
 
+    /**
+     * @brief Start a waveform capture of several inputs
+     *
+     * @param inputs Bit n to capture AIN_n+1
+     * @param sampleRate Samples per second on each input, 0 for the maximum rate
+     * @param preSamples Samples kept before the trigger
+     * @param postSamples Samples acquired from the trigger, at least 1
+     * @param trigger Trigger type
+     * @param triggerInput Input compared with the level, must be captured
+     * @param triggerLevel Level in V at the ADC input
+     * @return 0 if success, -1 otherwise
+     */
+    int analogCaptureStart(uint8_t inputs, uint32_t sampleRate, uint32_t preSamples, uint32_t postSamples,
+                           AnalogCapture_Trigger_t trigger = CAPTURE_TRIGGER_NONE,
+                           AnalogInput_Num_t triggerInput = AIN_1, float triggerLevel = 0.0f);
+
+    /**
+     * @brief Stop the capture, the data stays readable if it was done
+     */
+    void analogCaptureStop(void);
+
+    /**
+     * @brief Get the state of the capture
+     *
+     * @return Status, channels holds the captured inputs
+     */
+    AnalogCapture_Status_t analogCaptureStatus(void);
+
+    /**
+     * @brief Read the raw values of a capture that is done, in chunks of ANALOG_CAPTURE_READ_CHUNK values
+     *
+     * @param offset Index of the first value
+     * @param buffer Raw values
+     * @param count Maximum number of values
+     * @return Number of values read, -1 if error
+     */
+    int analogCaptureRead(uint32_t offset, uint16_t *buffer, uint32_t count);
+
 private:
     ModuleControl* _module;
 };
@@ -68,6 +68,49 @@ int AnalogInputsLVCmdHandler::init() {
         data.insert(data.end(), ptr, ptr + sizeof(float));
     });
 
+    Slave::addCallback(CALLBACK_ANALOG_CAPTURE_START, [](std::vector<uint8_t>& data) {
+        uint32_t* sampleRate = reinterpret_cast<uint32_t*>(&data[2]);
+        uint32_t* preSamples = reinterpret_cast<uint32_t*>(&data[6]);
+        uint32_t* postSamples = reinterpret_cast<uint32_t*>(&data[10]);
+        float* triggerLevel = reinterpret_cast<float*>(&data[16]);
+        int ret = AnalogInputsLV::analogCaptureStart(data[1], *sampleRate, *preSamples, *postSamples,
+            (AnalogCapture_Trigger_t)data[14], (AnalogInput_Num_t)data[15], *triggerLevel);
+        data.resize(2);
+        uint8_t* ptr = reinterpret_cast<uint8_t*>(&ret);
+        data.insert(data.end(), ptr, ptr + sizeof(int));
+    });
+
+    Slave::addCallback(CALLBACK_ANALOG_CAPTURE_STOP, [](std::vector<uint8_t>& data) {
+        AnalogInputsLV::analogCaptureStop();
+        data.clear();
+    });
+
+    Slave::addCallback(CALLBACK_ANALOG_CAPTURE_STATUS, [](std::vector<uint8_t>& data) {
+        AnalogCapture_Status_t status = AnalogInputsLV::analogCaptureStatus();
+        uint8_t* ptr = reinterpret_cast<uint8_t*>(&status);
+        data.resize(2);
+        data.insert(data.end(), ptr, ptr + sizeof(AnalogCapture_Status_t));
+    });
+
+    Slave::addCallback(CALLBACK_ANALOG_CAPTURE_READ, [](std::vector<uint8_t>& data) {
+        uint32_t* offset = reinterpret_cast<uint32_t*>(&data[1]);
+        uint16_t* size = reinterpret_cast<uint16_t*>(&data[5]);
+        uint16_t count = (*size < (BUS_RS_DATA_LENGTH_MAX - 2) / sizeof(uint16_t)) ? *size : (BUS_RS_DATA_LENGTH_MAX - 2) / sizeof(uint16_t);
+        uint32_t index = *offset;
+        /* Answer: [callback, status, values...] */
+        data.resize(2 + count * sizeof(uint16_t));
+        int ret = AnalogInputsLV::analogCaptureRead(index, reinterpret_cast<uint16_t*>(&data[2]), count);
+        data[1] = (ret < 0) ? 1 : 0;
+        data.resize(2 + ((ret < 0) ? 0 : ret) * sizeof(uint16_t));
+    });
+
+    Slave::addProcessImage(IMAGE_ANALOG_INPUTS_MILLIVOLT, [](std::vector<uint8_t>& data) {
+        float values[ADS866X_MAX_CHANNELS_NB] = {};
+        AnalogInputsLV::analogReadAll(values, AIN_UNIT_MILLIVOLT);
+        uint8_t* ptr = reinterpret_cast<uint8_t*>(values);
+        data.insert(data.end(), ptr, ptr + AnalogInputsLV::getInputNumber() * sizeof(float));
+    });
+
     return 0;
 }
 
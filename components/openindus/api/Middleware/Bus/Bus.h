@@ -12,6 +12,8 @@
 #include "BusCAN.h"
 #include "BusRS.h"
 
+#define BUS_STATS_VERSION 1 // Layout of Bus::BusStats_t sent with CMD_GET_BUS_STATS
+
 class Bus : 
     public BusRS,
     public BusCAN,
@@ -23,8 +25,31 @@ private:
 
 public:
 
+    /* Statistics of both buses, also sent to the master with CMD_GET_BUS_STATS */
+    typedef struct {
+        BusRS::Stats_t rs;
+        BusCAN::Stats_t can;
+    } BusStats_t;
+
     static inline int init(void) {
         return _registerCLI();
     }
 
+    static inline void getBusStats(BusStats_t* stats) {
+        BusRS::getStats(&stats->rs);
+        BusCAN::getStats(&stats->can);
+    }
+
+    static inline void resetBusStats(void) {
+        BusRS::resetStats();
+        BusCAN::resetStats();
+    }
+
+    /**
+     * @brief Print the statistics as a JSON object
+     * 
+     * @param stats 
+     */
+    static void printBusStats(const BusStats_t* stats);
+
 };
\ No newline at end of file
@@ -15,12 +15,57 @@
 
 #include "BusCAN.h"
 #include <string.h>
+#include <stdlib.h>
+#include <algorithm>
 #include "esp_log.h"
 #include "driver/twai.h"
 
 static const char TAG[] = "BusCAN";
 
+/* Dual filter mode, standard frames: the first filter also covers the first data byte, the RTR bit is ignored */
+#define FILTER_DUAL_DONT_CARE ((1 << 20) | 0x000F0000 | 0x0000000F | (1 << 4))
+#define FILTER_STD_SHIFT_1 21
+#define FILTER_STD_SHIFT_2 5
+/* Dual filter mode, extended frames: the second filter compares ID[28:13], the priority class is ignored.
+   The first filter is kept for the standard frames of the master (identifier 0, any data), its bits 
+   [3:0] belong to the first data byte, so the lowest bit of the source is not compared. */
+#define FILTER_DUAL_EXT_DONT_CARE (0x001F000F | 0x0000C007)
+#define FILTER_EXT_SHIFT_2 (BUS_CAN_SOURCE_SHIFT - 13)
+#define FILTER_ID_MASK 0x7FF
+
 SemaphoreHandle_t BusCAN::_mutex;
+bool BusCAN::_priorityIds = false;
+twai_general_config_t BusCAN::_generalConfig;
+twai_timing_config_t BusCAN::_timingConfig;
+twai_filter_config_t BusCAN::_filterConfig;
+twai_filter_config_t BusCAN::_filterInstalled;
+uint8_t BusCAN::_accepted[BUS_CAN_ID_MAX / 8];
+bool BusCAN::_acceptAll = true;
+bool BusCAN::_filterPending = false;
+TickType_t BusCAN::_filterTick = 0;
+int BusCAN::_readers = 0;
+BusCAN::FilterStats_t BusCAN::_filterStats;
+std::vector<uint16_t> BusCAN::_filterIds;
+BusCAN::TxRing_t BusCAN::_txRings[BUS_CAN_PRIORITY_NB];
+TaskHandle_t BusCAN::_txTaskHandle = NULL;
+SemaphoreHandle_t BusCAN::_txMutex;
+std::atomic<uint32_t> BusCAN::_txSent(0);
+std::atomic<uint32_t> BusCAN::_txDropped(0);
+std::atomic<uint32_t> BusCAN::_txOverwritten(0);
+std::atomic<uint32_t> BusCAN::_txFailed(0);
+BusCANSegment BusCAN::_segment;
+BusCAN::MessageCallback_t BusCAN::_messageCallback = NULL;
+int BusCAN::_flowControlId = -1;
+SemaphoreHandle_t BusCAN::_segmentMutex = NULL;
+QueueHandle_t BusCAN::_flowQueue;
+std::atomic<int32_t> BusCAN::_segmentSource(-1);
+std::atomic<uint32_t> BusCAN::_segmentsSent(0);
+std::atomic<uint32_t> BusCAN::_segmentErrors(0);
+BusCAN::Stats_t BusCAN::_stats;
+twai_status_info_t BusCAN::_status;
+
+/* Telemetry is only useful when recent: a newer frame replaces the oldest one */
+static const bool _txOverwrite[BUS_CAN_PRIORITY_NB] = {false, false, false, true};
 
 /**
  * @brief initialization of CAN communication
@@ -36,6 +81,16 @@ int BusCAN::begin(gpio_num_t txNum, gpio_num_t rxNum)
 
     _mutex = xSemaphoreCreateMutex();
     xSemaphoreGive(_mutex);
+    _txMutex = xSemaphoreCreateMutex();
+    _segmentMutex = xSemaphoreCreateMutex();
+    _flowQueue = xQueueCreate(2, BUS_CAN_SEGMENT_FLOW_LENGTH);
+    for (int i = 0; i < BUS_CAN_PRIORITY_NB; i++) {
+        for (uint32_t j = 0; j < BUS_CAN_TX_RING_SIZE; j++) {
+            _txRings[i].slots[j].sequence.store(j, std::memory_order_relaxed);
+        }
+        _txRings[i].head.store(0, std::memory_order_relaxed);
+        _txRings[i].tail.store(0, std::memory_order_relaxed);
+    }
 
     twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(
         txNum, 
@@ -44,10 +99,19 @@ int BusCAN::begin(gpio_num_t txNum, gpio_num_t rxNum)
     );
     g_config.intr_flags = 0;
     g_config.rx_queue_len = 255;
+    g_config.tx_queue_len = 1; // Frames wait in the rings, ordered by priority
+    g_config.alerts_enabled = TWAI_ALERT_ERR_PASS | TWAI_ALERT_BUS_OFF | TWAI_ALERT_BUS_RECOVERED;
         
     twai_timing_config_t t_config = TWAI_TIMING_CONFIG_1MBITS();
     twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
 
+    /* Kept to install the driver again when the acceptance filter changes */
+    _generalConfig = g_config;
+    _timingConfig = t_config;
+    _filterConfig = f_config;
+    _filterInstalled = f_config;
+    _acceptAll = true;
+
     /* install TWAI driver */
     ESP_LOGI(TAG, "install twai driver");
     err |= twai_driver_install(&g_config, &t_config, &f_config);
@@ -59,6 +123,10 @@ int BusCAN::begin(gpio_num_t txNum, gpio_num_t rxNum)
     err |= twai_clear_receive_queue();
     err |= twai_clear_transmit_queue();
 
+    if (_txTaskHandle == NULL) {
+        xTaskCreate(_txTask, "BusCAN TX task", 3072, NULL, 6, &_txTaskHandle);
+    }
+
     return err;
 }
 
@@ -84,34 +152,63 @@ void BusCAN::end(void)
  * @param frame 
  * @param id identifier
  * @param size frame size 
+ * @param priority arbitration priority, used with the priority identifiers
  * @return error: -1, succeed: 0
  */
-int BusCAN::write(Frame_t* frame, uint16_t id, uint8_t size)
+int BusCAN::write(Frame_t* frame, uint16_t id, uint8_t size, Priority_e priority)
 {
-    esp_err_t err;
+    return _write(frame, id, size, priority, 0);
+}
+
+/* With a wait time, the frame waits for room in its ring instead of replacing the oldest one */
+int BusCAN::_write(Frame_t* frame, uint16_t id, uint8_t size, Priority_e priority, TickType_t wait)
+{
+    TickType_t start = xTaskGetTickCount();
     twai_message_t msg = {
         .flags = 0,
         .identifier = id,
         .data_length_code = size,
         .data = {}
     };
-    memcpy(msg.data, frame, size);
-    xSemaphoreTake(_mutex, portMAX_DELAY);
-    err = twai_transmit(&msg, pdMS_TO_TICKS(100)); 
-    if (err != ESP_OK) {
-        goto error;
-    } else {
-        goto success;
+    if (_priorityIds) {
+        msg.extd = 1;
+        msg.identifier = ((uint32_t)priority << BUS_CAN_PRIORITY_SHIFT) | ((uint32_t)(id & FILTER_ID_MASK) << BUS_CAN_SOURCE_SHIFT);
     }
+    memcpy(msg.data, frame, size);
 
-error:
-    xSemaphoreGive(_mutex);
-    ESP_LOGE(TAG, "Error in twai_transmit: %s", esp_err_to_name(err));
-    return -1;
-success:
-    xSemaphoreGive(_mutex);
+    /* The frames of a segmented message are never replaced, a missing one would drop the whole message: 
+       they wait in the first ring which does not overwrite, their identifier keeps the priority class */
+    int index = priority % BUS_CAN_PRIORITY_NB;
+    if (frame->cmd == BUS_CAN_SEGMENT_CMD) {
+        while ((index > 0) && _txOverwrite[index]) {
+            index--;
+        }
+    }
+    TxRing_t* ring = &_txRings[index];
+    while (!_txPush(ring, &msg)) {
+        twai_message_t oldest;
+        if (wait > 0) {
+            if ((xTaskGetTickCount() - start) >= wait) {
+                _txDropped++;
+                return -1;
+            }
+            vTaskDelay(1);
+            continue;
+        }
+        if (!_txOverwrite[index]) {
+            _txDropped++;
+            ESP_LOGD(TAG, "TX ring %d full, frame dropped", index);
+            return -1;
+        }
+        if (_txPop(ring, &oldest)) {
+            _txOverwritten++;
+        }
+    }
+    if (_txTaskHandle != NULL) {
+        xTaskNotifyGive(_txTaskHandle);
+    }
 #if defined(DEBUG_BUS)    
-    ESP_LOGI(TAG, "WRITE - ID: %u | DATA:", msg.identifier);
+    ESP_LOGI(TAG, "WRITE - ID: %lu | DATA:", msg.identifier);
     ESP_LOG_BUFFER_HEX_LEVEL(TAG, msg.data, msg.data_length_code, ESP_LOG_INFO);
 #endif
     return 0;
@@ -130,21 +227,82 @@ int BusCAN::read(Frame_t* frame, uint16_t* id, uint8_t* size, TickType_t timeout
 {
     esp_err_t err;
     twai_message_t msg;
-    // xSemaphoreTake(_mutex, portMAX_DELAY);
-    err = twai_receive(&msg, timeout);
-    xSemaphoreTake(_mutex, portMAX_DELAY);
-    if (err != ESP_OK) {
+    TickType_t start = xTaskGetTickCount();
+
+    /* Wait in slices, so that a new acceptance filter can be applied while no task is in twai_receive */
+    while (1) {
+        TickType_t slice = pdMS_TO_TICKS(BUS_CAN_FILTER_LATENCY);
+        if (timeout != portMAX_DELAY) {
+            TickType_t elapsed = xTaskGetTickCount() - start;
+            slice = (elapsed < timeout) ? std::min(slice, timeout - elapsed) : 0;
+        }
+
+        xSemaphoreTake(_mutex, portMAX_DELAY);
+        _readers++;
+        xSemaphoreGive(_mutex);
+
+        err = twai_receive(&msg, slice);
+
+        xSemaphoreTake(_mutex, portMAX_DELAY);
+        _readers--;
+        _applyPendingFilter();
+        if (_segment.streams() > 0) {
+            _segment.purge(pdTICKS_TO_MS(xTaskGetTickCount()));
+        }
+        if (err == ESP_OK) {
+            twai_status_info_t status;
+            if (((_filterStats.received % BUS_CAN_RX_SAMPLE) == 0) && (twai_get_status_info(&status) == ESP_OK)) {
+                _stats.rxHighWater = std::max(_stats.rxHighWater, status.msgs_to_rx + 1); // This frame included
+            }
+            uint16_t source = msg.extd ? ((msg.identifier >> BUS_CAN_SOURCE_SHIFT) & FILTER_ID_MASK) : 
+                (msg.identifier & FILTER_ID_MASK);
+            _filterStats.received++;
+            if (!_acceptAll && !(_accepted[source / 8] & (1 << (source % 8)))) {
+                _filterStats.rejected++; // Matched by the hardware masks only
+                xSemaphoreGive(_mutex);
+                continue;
+            }
+            if ((msg.data[0] == BUS_CAN_SEGMENT_CMD) && (msg.data_length_code >= 2)) {
+                BusCANSegment::Result_e result = BusCANSegment::SEGMENT_NONE;
+                uint8_t* message = NULL;
+                uint16_t messageSize = 0;
+                if ((msg.data[1] & 0xF0) == BUS_CAN_SEGMENT_FLOW) {
+                    int32_t target = msg.data[4] | (msg.data[5] << 8);
+                    if ((msg.data_length_code >= 1 + BUS_CAN_SEGMENT_FLOW_LENGTH) && (target == _segmentSource.load())) {
+                        xQueueSend(_flowQueue, &msg.data[1], 0);
+                    }
+                } else if (_messageCallback) {
+                    result = _segment.push(source, &msg.data[1], msg.data_length_code - 1, 
+                        pdTICKS_TO_MS(xTaskGetTickCount()), &message, &messageSize);
+                }
+                xSemaphoreGive(_mutex);
+                if (result == BusCANSegment::SEGMENT_FLOW) {
+                    _sendFlow(BusCANSegment::FLOW_CONTINUE, source);
+                } else if (result == BusCANSegment::SEGMENT_OVERFLOW) {
+                    _sendFlow(BusCANSegment::FLOW_OVERFLOW, source);
+                } else if (result == BusCANSegment::SEGMENT_COMPLETE) {
+                    _messageCallback(source, message, messageSize);
+                    free(message);
+                }
+                continue;
+            }
+            memcpy(frame, msg.data, sizeof(Frame_t));
+            *id = source;
+            *size = msg.data_length_code;
+            goto success;
+        }
+        if ((err == ESP_ERR_TIMEOUT) && (slice > 0)) {
+            xSemaphoreGive(_mutex);
+            continue;
+        }
         goto error;
-    } else {
-        memcpy(frame, msg.data, sizeof(Frame_t));
-        *id = msg.identifier;
-        *size = msg.data_length_code;
-        goto success;
-    }    
+    }
 
 error:
     xSemaphoreGive(_mutex);    
-    ESP_LOGE(TAG, "Error in twai_receive: %s", esp_err_to_name(err));
+    if (err != ESP_ERR_TIMEOUT) {
+        ESP_LOGE(TAG, "Error in twai_receive: %s", esp_err_to_name(err));
+    }
     return -1;
 success:
     xSemaphoreGive(_mutex);
@@ -153,4 +311,440 @@ success:
     ESP_LOG_BUFFER_HEX_LEVEL(TAG, msg.data, msg.data_length_code, ESP_LOG_INFO);
 #endif
     return 0;
-}
\ No newline at end of file
+}
+
+void BusCAN::setFilter(std::vector<uint16_t> ids)
+{
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    memset(_accepted, 0, sizeof(_accepted));
+    for (auto id : ids) {
+        _accepted[(id & FILTER_ID_MASK) / 8] |= (1 << (id % 8));
+    }
+    _acceptAll = ids.empty();
+    _filterIds = ids;
+    xSemaphoreGive(_mutex);
+    _updateFilter();
+}
+
+void BusCAN::setPriorityIds(bool enable)
+{
+    if (enable != _priorityIds) {
+        ESP_LOGI(TAG, "Priority identifiers %s", enable ? "enabled" : "disabled");
+        xSemaphoreTake(_mutex, portMAX_DELAY);
+        _priorityIds = enable;
+        xSemaphoreGive(_mutex);
+        _updateFilter(); // The filter compares other bits of the extended identifiers
+    }
+}
+
+/* The software filter applies at once, the hardware filter once the changes are over */
+void BusCAN::_updateFilter(void)
+{
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    _computeFilter(_filterIds, &_filterConfig);
+    _filterPending = (_filterConfig.acceptance_code != _filterInstalled.acceptance_code) || 
+        (_filterConfig.acceptance_mask != _filterInstalled.acceptance_mask) || 
+        (_filterConfig.single_filter != _filterInstalled.single_filter);
+    _filterTick = xTaskGetTickCount();
+    if (_filterPending) {
+        ESP_LOGI(TAG, "Acceptance filter: code 0x%08lx, mask 0x%08lx", _filterConfig.acceptance_code, _filterConfig.acceptance_mask);
+    }
+    xSemaphoreGive(_mutex);
+}
+
+bool BusCAN::getFilter(uint32_t* code, uint32_t* mask)
+{
+    *code = _filterConfig.acceptance_code;
+    *mask = _filterConfig.acceptance_mask;
+    return _acceptAll;
+}
+
+int BusCAN::writeMessage(const uint8_t* data, uint16_t size, uint16_t id, Priority_e priority)
+{
+    Frame_t frame;
+    if (size <= sizeof(Frame_t)) {
+        memcpy(&frame, data, size);
+        return write(&frame, id, size, priority);
+    }
+    if ((size > BUS_CAN_SEGMENT_MESSAGE_MAX) || (_segmentMutex == NULL)) {
+        return -1;
+    }
+
+    TickType_t timeout = pdMS_TO_TICKS(BUS_CAN_SEGMENT_TIMEOUT);
+    uint8_t flow[BUS_CAN_SEGMENT_FLOW_LENGTH];
+    uint8_t sequence = 1;
+    uint16_t offset;
+    int err = -1;
+
+    xSemaphoreTake(_segmentMutex, portMAX_DELAY);
+    xQueueReset(_flowQueue);
+    _segmentSource = id;
+    frame.cmd = BUS_CAN_SEGMENT_CMD;
+    offset = BusCANSegment::encodeFirst(frame.args, data, size);
+    if (_write(&frame, id, sizeof(Frame_t), priority, timeout) < 0) {
+        goto end;
+    }
+    while (offset < size) {
+        if (xQueueReceive(_flowQueue, flow, timeout) != pdTRUE) {
+            ESP_LOGW(TAG, "No flow control, message of %u bytes not sent", size);
+            goto end;
+        }
+        if ((flow[0] & 0x0F) == BusCANSegment::FLOW_WAIT) {
+            continue;
+        } else if ((flow[0] & 0x0F) != BusCANSegment::FLOW_CONTINUE) {
+            ESP_LOGW(TAG, "Message of %u bytes refused", size);
+            goto end;
+        }
+        /* Block size 0: no other flow control until the end of the message */
+        for (int i = 0; ((flow[1] == 0) || (i < flow[1])) && (offset < size); i++) {
+            uint8_t count = std::min(size - offset, BUS_CAN_SEGMENT_CONSECUTIVE_DATA);
+            BusCANSegment::encodeConsecutive(frame.args, sequence++, &data[offset], count);
+            if (_write(&frame, id, 1 + 1 + count, priority, timeout) < 0) {
+                goto end;
+            }
+            offset += count;
+            if (flow[2] > 0) {
+                vTaskDelay(pdMS_TO_TICKS(flow[2]));
+            }
+        }
+    }
+    err = 0;
+
+end:
+    _segmentSource = -1;
+    xSemaphoreGive(_segmentMutex);
+    if (err == 0) {
+        _segmentsSent++;
+    } else {
+        _segmentErrors++;
+    }
+    return err;
+}
+
+void BusCAN::setMessageCallback(MessageCallback_t callback, int flowControlId)
+{
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    _messageCallback = callback;
+    _flowControlId = flowControlId;
+    if (!callback) {
+        _segment.reset();
+    }
+    xSemaphoreGive(_mutex);
+}
+
+void BusCAN::getSegmentStats(SegmentStats_t* stats)
+{
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    const BusCANSegment::Counters_t& counters = _segment.getCounters();
+    stats->received = counters.messages;
+    stats->lost = counters.lost;
+    stats->timeouts = counters.timeouts;
+    stats->overflows = counters.overflows;
+    xSemaphoreGive(_mutex);
+    stats->sent = _segmentsSent.load();
+    stats->sendErrors = _segmentErrors.load();
+}
+
+void BusCAN::resetSegmentStats(void)
+{
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    _segment.resetCounters();
+    xSemaphoreGive(_mutex);
+    _segmentsSent = 0;
+    _segmentErrors = 0;
+}
+
+/* Answer a sender, only by the module which controls the flow (the master) */
+void BusCAN::_sendFlow(BusCANSegment::Flow_e status, uint16_t target)
+{
+    if (_flowControlId >= 0) {
+        Frame_t frame;
+        frame.cmd = BUS_CAN_SEGMENT_CMD;
+        BusCANSegment::encodeFlow(frame.args, status, target);
+        write(&frame, (uint16_t)_flowControlId, 1 + BUS_CAN_SEGMENT_FLOW_LENGTH);
+    }
+}
+
+void BusCAN::getStats(Stats_t* stats)
+{
+    memcpy(stats, &_stats, sizeof(Stats_t));
+    stats->txFrames = _txSent.load();
+    stats->rxFrames = _filterStats.received;
+}
+
+void BusCAN::resetStats(void)
+{
+    uint8_t state = _stats.state;
+    uint8_t txErrorCounter = _stats.txErrorCounter;
+    uint8_t rxErrorCounter = _stats.rxErrorCounter;
+    memset(&_stats, 0, sizeof(Stats_t));
+    _stats.state = state;
+    _stats.txErrorCounter = txErrorCounter;
+    _stats.rxErrorCounter = rxErrorCounter;
+    _txSent = 0;
+    _filterStats.received = 0;
+}
+
+void BusCAN::getTxStats(TxStats_t* stats)
+{
+    stats->sent = _txSent.load();
+    stats->dropped = _txDropped.load();
+    stats->overwritten = _txOverwritten.load();
+    stats->failed = _txFailed.load();
+}
+
+void BusCAN::resetTxStats(void)
+{
+    _txSent = 0;
+    _txDropped = 0;
+    _txOverwritten = 0;
+    _txFailed = 0;
+}
+
+bool BusCAN::flush(TickType_t timeout)
+{
+    TickType_t start = xTaskGetTickCount();
+    while (1) {
+        bool empty = true;
+        for (int i = 0; i < BUS_CAN_PRIORITY_NB; i++) {
+            empty &= (_txRings[i].head.load() == _txRings[i].tail.load());
+        }
+        twai_status_info_t status;
+        if (empty && (twai_get_status_info(&status) == ESP_OK) && (status.msgs_to_tx == 0)) {
+            return true;
+        }
+        if ((xTaskGetTickCount() - start) >= timeout) {
+            return false;
+        }
+        vTaskDelay(1);
+    }
+}
+
+void BusCAN::getFilterStats(FilterStats_t* stats)
+{
+    memcpy(stats, &_filterStats, sizeof(FilterStats_t));
+}
+
+void BusCAN::resetFilterStats(void)
+{
+    memset(&_filterStats, 0, sizeof(FilterStats_t));
+}
+
+/**
+ * @brief Split the sorted identifiers in two groups, one per filter, so that the masks 
+ * let through as few other identifiers as possible
+ */
+void BusCAN::_computeFilter(std::vector<uint16_t> &ids, twai_filter_config_t* config)
+{
+    if (ids.empty()) {
+        twai_filter_config_t all = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+        *config = all;
+        return;
+    }
+
+    /* Don't care bits of each group: the bits which differ from its first identifier */
+    auto groupMask = [&ids](size_t first, size_t last) {
+        uint32_t mask = 0;
+        for (size_t i = first; i < last; i++) {
+            mask |= (ids[i] ^ ids[first]);
+        }
+        return mask & FILTER_ID_MASK;
+    };
+
+    config->single_filter = false;
+
+    /* Priority identifiers: the master keeps sending standard frames, which the hardware compares 
+       with the same bits, so the first filter only lets them through and the second one takes all 
+       the extended identifiers */
+    if (_priorityIds) {
+        size_t first = (ids.size() > 1) && (ids[0] == 0) ? 1 : 0; // Sorted, the master comes first
+        uint32_t mask = groupMask(first, ids.size());
+        config->acceptance_code = (uint32_t)(ids[first] & ~mask & FILTER_ID_MASK) << FILTER_EXT_SHIFT_2;
+        config->acceptance_mask = (mask << FILTER_EXT_SHIFT_2) | FILTER_DUAL_EXT_DONT_CARE;
+        return;
+    }
+
+    size_t split = ids.size(); // Second group is empty: both filters are the same
+    uint32_t best = UINT32_MAX;
+    for (size_t i = 1; i <= ids.size(); i++) {
+        uint32_t maskA = groupMask(0, i);
+        uint32_t maskB = (i < ids.size()) ? groupMask(i, ids.size()) : maskA;
+        uint32_t accepted = (1 << __builtin_popcount(maskA)) + ((i < ids.size()) ? (1 << __builtin_popcount(maskB)) : 0);
+        if (accepted < best) {
+            best = accepted;
+            split = i;
+        }
+    }
+
+    uint16_t idA = ids[0];
+    uint16_t idB = (split < ids.size()) ? ids[split] : ids[0];
+    uint32_t maskA = groupMask(0, split);
+    uint32_t maskB = (split < ids.size()) ? groupMask(split, ids.size()) : maskA;
+    config->acceptance_code = ((uint32_t)(idA & ~maskA & FILTER_ID_MASK) << FILTER_STD_SHIFT_1) | 
+        ((uint32_t)(idB & ~maskB & FILTER_ID_MASK) << FILTER_STD_SHIFT_2);
+    config->acceptance_mask = (maskA << FILTER_STD_SHIFT_1) | (maskB << FILTER_STD_SHIFT_2) | FILTER_DUAL_DONT_CARE;
+}
+
+/* Called with the mutex taken, by the reading tasks and by the transmit task when no task reads */
+void BusCAN::_applyPendingFilter(void)
+{
+    if (_filterPending && (_readers == 0) && 
+        ((xTaskGetTickCount() - _filterTick) >= pdMS_TO_TICKS(BUS_CAN_FILTER_DEBOUNCE))) {
+        _applyFilter();
+    }
+}
+
+/* Install the driver again with the new filter, called with the mutex taken and no task in twai_receive */
+void BusCAN::_applyFilter(void)
+{
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(_txMutex, portMAX_DELAY);
+    err |= twai_stop();
+    err |= twai_driver_uninstall();
+    err |= twai_driver_install(&_generalConfig, &_timingConfig, &_filterConfig);
+    err |= twai_start();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot apply the acceptance filter");
+    }
+    xSemaphoreGive(_txMutex);
+    _filterInstalled = _filterConfig;
+    _filterPending = false;
+}
+
+/**
+ * @brief Reserve the head slot with a compare and swap, fill it, then publish it through its sequence
+ * 
+ * @return false if the ring is full
+ */
+bool BusCAN::_txPush(TxRing_t* ring, const twai_message_t* msg)
+{
+    uint32_t pos = ring->head.load(std::memory_order_relaxed);
+    while (1) {
+        auto slot = &ring->slots[pos % BUS_CAN_TX_RING_SIZE];
+        int32_t diff = (int32_t)(slot->sequence.load(std::memory_order_acquire) - pos);
+        if (diff == 0) {
+            if (ring->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                slot->msg = *msg;
+                slot->sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // Not yet sent since the previous turn
+        } else {
+            pos = ring->head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * @brief Take the tail slot, called by the transmit task and by the producers which overwrite
+ * 
+ * @return false if the ring is empty
+ */
+bool BusCAN::_txPop(TxRing_t* ring, twai_message_t* msg)
+{
+    uint32_t pos = ring->tail.load(std::memory_order_relaxed);
+    while (1) {
+        auto slot = &ring->slots[pos % BUS_CAN_TX_RING_SIZE];
+        int32_t diff = (int32_t)(slot->sequence.load(std::memory_order_acquire) - (pos + 1));
+        if (diff == 0) {
+            if (ring->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                *msg = slot->msg;
+                slot->sequence.store(pos + BUS_CAN_TX_RING_SIZE, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // Not filled yet
+        } else {
+            pos = ring->tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * @brief Give the frames to the driver, highest priority class first. The driver queue holds a 
+ * single frame, so a stalled transmission only blocks this task: the producers keep queueing 
+ * and the reading tasks keep receiving.
+ */
+void BusCAN::_txTask(void *pvParameters)
+{
+    twai_message_t msg;
+    TickType_t monitorTick = xTaskGetTickCount();
+
+    while (1) {
+        if ((xTaskGetTickCount() - monitorTick) >= pdMS_TO_TICKS(BUS_CAN_MONITOR_PERIOD)) {
+            _monitor();
+            xSemaphoreTake(_mutex, portMAX_DELAY);
+            _applyPendingFilter();
+            xSemaphoreGive(_mutex);
+            monitorTick = xTaskGetTickCount();
+        }
+
+        int i = 0;
+        while ((i < BUS_CAN_PRIORITY_NB) && !_txPop(&_txRings[i], &msg)) {
+            i++;
+        }
+        if (i == BUS_CAN_PRIORITY_NB) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(BUS_CAN_MONITOR_PERIOD));
+            continue;
+        }
+
+        /* Waits for the driver to take the frame, the slot is freed when the previous frame is sent */
+        xSemaphoreTake(_txMutex, portMAX_DELAY);
+        esp_err_t err = twai_transmit(&msg, pdMS_TO_TICKS(BUS_CAN_TX_TIMEOUT));
+        xSemaphoreGive(_txMutex);
+        if (err == ESP_OK) {
+            _txSent++;
+        } else {
+            _txFailed++;
+            ESP_LOGE(TAG, "Error in twai_transmit: %s", esp_err_to_name(err));
+        }
+    }
+}
+
+/**
+ * @brief Count the error state transitions and collect the counters of the driver.
+ * A module which went bus off recovers and starts again.
+ */
+void BusCAN::_monitor(void)
+{
+    uint32_t alerts = 0;
+    twai_status_info_t status;
+
+    auto delta = [](uint32_t current, uint32_t &previous) {
+        uint32_t count = (current >= previous) ? (current - previous) : current;
+        previous = current;
+        return count;
+    };
+
+    xSemaphoreTake(_txMutex, portMAX_DELAY);
+    if (twai_read_alerts(&alerts, 0) == ESP_OK) {
+        if (alerts & TWAI_ALERT_ERR_PASS) {
+            _stats.errorPassive++;
+        }
+        if (alerts & TWAI_ALERT_BUS_OFF) {
+            _stats.busOff++;
+            ESP_LOGW(TAG, "Bus off, recovering");
+            twai_initiate_recovery();
+        }
+        if (alerts & TWAI_ALERT_BUS_RECOVERED) {
+            ESP_LOGI(TAG, "Bus recovered");
+            twai_start();
+        }
+    }
+    if (twai_get_status_info(&status) == ESP_OK) {
+        _stats.txFailed += delta(status.tx_failed_count, _status.tx_failed_count);
+        _stats.rxMissed += delta(status.rx_missed_count, _status.rx_missed_count);
+        _stats.rxOverrun += delta(status.rx_overrun_count, _status.rx_overrun_count);
+        _stats.arbLost += delta(status.arb_lost_count, _status.arb_lost_count);
+        _stats.busErrors += delta(status.bus_error_count, _status.bus_error_count);
+        _stats.rxHighWater = std::max(_stats.rxHighWater, status.msgs_to_rx);
+        _stats.state = (uint8_t)status.state;
+        _stats.txErrorCounter = (uint8_t)std::min(status.tx_error_counter, (uint32_t)UINT8_MAX);
+        _stats.rxErrorCounter = (uint8_t)std::min(status.rx_error_counter, (uint32_t)UINT8_MAX);
+    }
+    xSemaphoreGive(_txMutex);
+}
@@ -18,6 +18,29 @@
 #include "driver/gpio.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
+#include "driver/twai.h"
+#include <vector>
+#include <atomic>
+#include <functional>
+#include "BusCANSegment.h"
+
+#define BUS_CAN_HEARTBEAT_PERIOD 1000 // ms, CMD_HEARTBEAT sent by each slave: [state, uptime (ms, 4 bytes)]
+
+#define BUS_CAN_ID_MAX 2048 // Standard identifiers
+#define BUS_CAN_FILTER_LATENCY 50 // ms, a reading task applies a new acceptance filter within this time
+#define BUS_CAN_FILTER_DEBOUNCE 20 // ms, without another change before the driver is installed again
+
+#define BUS_CAN_PRIORITY_NB 4
+#define BUS_CAN_TX_RING_SIZE 16 // Frames waiting per priority class, power of 2
+#define BUS_CAN_TX_TIMEOUT 100 // ms, a frame which cannot be sent within this time is dropped
+
+#define BUS_CAN_MONITOR_PERIOD 10 // ms, driver alerts and counters collected by the transmit task
+#define BUS_CAN_RX_SAMPLE 8 // The depth of the receive queue is sampled every n frames
+
+/* Priority identifiers (extended frames): the priority class decides the arbitration, then the source.
+   The source sits where the dual acceptance filter compares extended identifiers (ID[28:13]). */
+#define BUS_CAN_PRIORITY_SHIFT 27
+#define BUS_CAN_SOURCE_SHIFT 16
 
 class BusCAN
 {
@@ -34,13 +57,207 @@ public:
 
     } Frame_t;
 
+    /* Arbitration priority of a frame, from the highest */
+    typedef enum {
+        PRIORITY_EMERGENCY = 0, // Errors, overcurrents, motor alarms
+        PRIORITY_MOTION,        // Digital interrupts, used for limit switches and motor stops
+        PRIORITY_IO,            // Commands and other events
+        PRIORITY_TELEMETRY,     // Sensor values, heartbeats
+    } Priority_e;
+
+    typedef struct {
+        uint32_t received;  // Frames which passed the hardware filter
+        uint32_t rejected;  // Dropped by the software filter
+    } FilterStats_t;
+
+    typedef struct {
+        uint32_t sent;          // Frames given to the driver
+        uint32_t dropped;       // Lost because their ring was full
+        uint32_t overwritten;   // Telemetry replaced by a newer frame
+        uint32_t failed;        // Not sent within BUS_CAN_TX_TIMEOUT
+    } TxStats_t;
+
+    typedef struct {
+        uint32_t txFrames;
+        uint32_t rxFrames;
+        uint32_t txFailed;      // Single shot or aborted transmissions
+        uint32_t rxMissed;      // Receive queue full
+        uint32_t rxOverrun;     // Hardware FIFO overrun
+        uint32_t arbLost;       // Arbitration losses
+        uint32_t busErrors;     // Error frames
+        uint32_t errorPassive;  // Transitions to error passive
+        uint32_t busOff;        // Transitions to bus off, followed by a recovery
+        uint32_t rxHighWater;   // Frames waiting in the receive queue
+        uint8_t state;          // twai_state_t
+        uint8_t txErrorCounter;
+        uint8_t rxErrorCounter;
+    } Stats_t;
+
+    typedef struct {
+        uint32_t sent;          // Segmented messages sent
+        uint32_t sendErrors;    // Refused, or without flow control
+        uint32_t received;      // Segmented messages reassembled
+        uint32_t lost;
+        uint32_t timeouts;
+        uint32_t overflows;
+    } SegmentStats_t;
+
+    /* Source module, message (command byte first) and size */
+    typedef std::function<void(uint16_t, uint8_t*, uint16_t)> MessageCallback_t;
+
     static int begin(gpio_num_t txNum, gpio_num_t rxNum);
     static void end(void);
-    static int write(Frame_t* frame, uint16_t id, uint8_t size = 8);
+    /**
+     * @brief Queue a frame in the ring of its priority class, without waiting. The transmit task 
+     * sends the highest class first. When the ring is full, a telemetry frame replaces the oldest 
+     * one, a frame of another class is dropped. The segments of a message are never replaced.
+     * 
+     * @return error: -1, succeed: 0
+     */
+    static int write(Frame_t* frame, uint16_t id, uint8_t size = 8, Priority_e priority = PRIORITY_IO);
     static int read(Frame_t* frame, uint16_t* id, uint8_t* size, TickType_t timeout = portMAX_DELAY);
 
+    /**
+     * @brief Send a message of any size up to BUS_CAN_SEGMENT_MESSAGE_MAX, command byte first.
+     * A message longer than a frame is split in segments: a first frame, then blocks of consecutive 
+     * frames, each block waiting for a flow control of the receiver. Blocks the calling task until 
+     * the last frame is queued, it must not be the task which reads the bus.
+     * 
+     * @param data 
+     * @param size 
+     * @param id identifier of the sender
+     * @param priority 
+     * @return error: -1, succeed: 0
+     */
+    static int writeMessage(const uint8_t* data, uint16_t size, uint16_t id, Priority_e priority = PRIORITY_IO);
+
+    /**
+     * @brief Reassemble the segmented messages, the callback is run by the reading task.
+     * Without a callback, the segments are dropped.
+     * 
+     * @param callback 
+     * @param flowControlId identifier used to answer the senders, -1 to only listen
+     */
+    static void setMessageCallback(MessageCallback_t callback, int flowControlId = -1);
+
+    static void getSegmentStats(SegmentStats_t* stats);
+    static void resetSegmentStats(void);
+
+    /**
+     * @brief Send the frames with priority identifiers, only when all the modules of the rail can 
+     * receive them. The frames of both layouts are decoded by read(), the acceptance filter
+     * follows the layout in use.
+     * 
+     * @param enable 
+     */
+    static void setPriorityIds(bool enable);
+
+    static inline bool getPriorityIds(void) {
+        return _priorityIds;
+    }
+
+    /**
+     * @brief Only receive the frames of the given identifiers.
+     * The TWAI acceptance filter is set in dual filter mode, each filter covering a group of 
+     * identifiers. The frames of other identifiers matched by the masks are dropped in software.
+     * Installing a new filter restarts the driver: the changes made within BUS_CAN_FILTER_DEBOUNCE 
+     * are applied together, and only if the filter differs from the installed one.
+     * 
+     * @param ids Identifiers, all the frames are received if empty
+     */
+    static void setFilter(std::vector<uint16_t> ids);
+
+    /**
+     * @brief Get the hardware acceptance filter
+     * 
+     * @param code 
+     * @param mask 
+     * @return true if all the frames are accepted
+     */
+    static bool getFilter(uint32_t* code, uint32_t* mask);
+
+    static void getFilterStats(FilterStats_t* stats);
+    static void resetFilterStats(void);
+
+    static void getTxStats(TxStats_t* stats);
+    static void resetTxStats(void);
+
+    /**
+     * @brief Health of the bus: frame counts, error states and driver counters.
+     * Always on, the driver counters are collected every BUS_CAN_MONITOR_PERIOD.
+     * 
+     * @param stats 
+     */
+    static void getStats(Stats_t* stats);
+    static void resetStats(void);
+
+    /**
+     * @brief Wait for the transmit rings to be empty
+     * 
+     * @return true if all the frames left the rings
+     */
+    static bool flush(TickType_t timeout);
+
 private:
 
     static SemaphoreHandle_t _mutex;
+    static bool _priorityIds;
+
+    static twai_general_config_t _generalConfig;
+    static twai_timing_config_t _timingConfig;
+    static twai_filter_config_t _filterConfig;
+    static twai_filter_config_t _filterInstalled;
+    static uint8_t _accepted[BUS_CAN_ID_MAX / 8]; // Software filter
+    static bool _acceptAll;
+    static bool _filterPending; // Waits for the debounce time and for the reading tasks to leave twai_receive
+    static TickType_t _filterTick; // Last change
+    static int _readers;
+    static FilterStats_t _filterStats;
+    static std::vector<uint16_t> _filterIds;
+
+    static void _updateFilter(void);
+    static void _computeFilter(std::vector<uint16_t> &ids, twai_filter_config_t* config);
+    static void _applyFilter(void);
+    static void _applyPendingFilter(void);
+
+    /* Transmit rings, one per priority class: several producers, read by the transmit task.
+       Each slot carries a sequence number telling whether it is free or filled for this turn. */
+    typedef struct {
+        struct {
+            std::atomic<uint32_t> sequence;
+            twai_message_t msg;
+        } slots[BUS_CAN_TX_RING_SIZE];
+        std::atomic<uint32_t> head; // Next slot to fill
+        std::atomic<uint32_t> tail; // Next slot to send
+    } TxRing_t;
+
+    static TxRing_t _txRings[BUS_CAN_PRIORITY_NB];
+    static TaskHandle_t _txTaskHandle;
+    static SemaphoreHandle_t _txMutex; // Keeps the driver installed during a transmission
+    static std::atomic<uint32_t> _txSent;
+    static std::atomic<uint32_t> _txDropped;
+    static std::atomic<uint32_t> _txOverwritten;
+    static std::atomic<uint32_t> _txFailed;
+
+    static int _write(Frame_t* frame, uint16_t id, uint8_t size, Priority_e priority, TickType_t wait);
+    static bool _txPush(TxRing_t* ring, const twai_message_t* msg);
+    static bool _txPop(TxRing_t* ring, twai_message_t* msg);
+    static void _txTask(void *pvParameters);
+
+    static BusCANSegment _segment; // Reassembly, protected by the mutex
+    static MessageCallback_t _messageCallback;
+    static int _flowControlId;
+    static SemaphoreHandle_t _segmentMutex; // One segmented message sent at a time
+    static QueueHandle_t _flowQueue; // Flow controls for the message being sent
+    static std::atomic<int32_t> _segmentSource; // Sender of this message, -1 if none
+    static std::atomic<uint32_t> _segmentsSent;
+    static std::atomic<uint32_t> _segmentErrors;
+
+    static void _sendFlow(BusCANSegment::Flow_e status, uint16_t target);
+
+    static Stats_t _stats; // Driver counters, updated by the transmit task
+    static twai_status_info_t _status; // Last driver counters, they restart when the driver is installed again
+
+    static void _monitor(void);
 
 };
@@ -0,0 +1,143 @@
+/**
+ * @file BusCANSegment.cpp
+ * @brief Segmentation and reassembly of the CAN bus messages longer than one frame
+ * @author Kévin Lefeuvre (kevin.lefeuvre@openindus.com)
+ * @copyright (c) [2025] OpenIndus, Inc. All rights reserved.
+ * @see https://openindus.com
+ */
+
+#include "BusCANSegment.h"
+#include <stdlib.h>
+#include <algorithm>
+
+#define SEGMENT_PCI(args)       ((args)[0] & 0xF0)
+#define SEGMENT_LOW(args)       ((args)[0] & 0x0F)
+
+BusCANSegment::BusCANSegment(void)
+{
+    resetCounters();
+}
+
+BusCANSegment::~BusCANSegment(void)
+{
+    reset();
+}
+
+BusCANSegment::Result_e BusCANSegment::push(uint16_t source, const uint8_t* args, uint8_t length, uint32_t now, 
+    uint8_t** message, uint16_t* size)
+{
+    if (length == 0) {
+        _counters.lost++;
+        return SEGMENT_NONE;
+    }
+
+    auto it = _streams.find(source);
+    switch (SEGMENT_PCI(args))
+    {
+        case BUS_CAN_SEGMENT_FIRST:
+        {
+            if (it != _streams.end()) { // The end of the previous message is missing
+                _drop(it);
+                _counters.lost++;
+            }
+            uint16_t messageSize = (uint16_t)((SEGMENT_LOW(args) << 8) | args[1]);
+            if ((length < 2 + BUS_CAN_SEGMENT_FIRST_DATA) || (messageSize <= BUS_CAN_SEGMENT_FIRST_DATA)) {
+                _counters.lost++;
+                return SEGMENT_NONE;
+            }
+            if ((messageSize > BUS_CAN_SEGMENT_MESSAGE_MAX) || (_streams.size() >= BUS_CAN_SEGMENT_SOURCES_MAX)) {
+                _counters.overflows++;
+                return SEGMENT_OVERFLOW;
+            }
+            uint8_t* data = (uint8_t*)malloc(messageSize);
+            if (data == NULL) {
+                _counters.overflows++;
+                return SEGMENT_OVERFLOW;
+            }
+            memcpy(data, &args[2], BUS_CAN_SEGMENT_FIRST_DATA);
+            _streams[source] = {data, messageSize, BUS_CAN_SEGMENT_FIRST_DATA, 1, BUS_CAN_SEGMENT_BLOCK, now};
+            return SEGMENT_FLOW;
+        }
+        case BUS_CAN_SEGMENT_CONSECUTIVE:
+        {
+            if (it == _streams.end()) {
+                _counters.lost++;
+                return SEGMENT_NONE;
+            }
+            Stream_t &stream = it->second;
+            uint16_t count = std::min((uint16_t)BUS_CAN_SEGMENT_CONSECUTIVE_DATA, (uint16_t)(stream.size - stream.received));
+            if ((SEGMENT_LOW(args) != stream.sequence) || (length < 1 + count)) {
+                _drop(it);
+                _counters.lost++;
+                return SEGMENT_LOST;
+            }
+            memcpy(&stream.data[stream.received], &args[1], count);
+            stream.received += count;
+            stream.sequence = (stream.sequence + 1) & 0x0F;
+            stream.lastTime = now;
+            if (stream.received == stream.size) {
+                *message = stream.data;
+                *size = stream.size;
+                _streams.erase(it);
+                _counters.messages++;
+                return SEGMENT_COMPLETE;
+            }
+            if (--stream.block == 0) {
+                stream.block = BUS_CAN_SEGMENT_BLOCK;
+                return SEGMENT_FLOW;
+            }
+            return SEGMENT_NONE;
+        }
+        default: // Flow controls are handled by the sender
+            return SEGMENT_NONE;
+    }
+}
+
+void BusCANSegment::purge(uint32_t now)
+{
+    for (auto it = _streams.begin(); it != _streams.end();) {
+        auto next = std::next(it);
+        if ((now - it->second.lastTime) > BUS_CAN_SEGMENT_TIMEOUT) {
+            _drop(it);
+            _counters.timeouts++;
+        }
+        it = next;
+    }
+}
+
+void BusCANSegment::reset(void)
+{
+    for (auto &stream : _streams) {
+        free(stream.second.data);
+    }
+    _streams.clear();
+}
+
+uint8_t BusCANSegment::encodeFirst(uint8_t* args, const uint8_t* message, uint16_t size)
+{
+    args[0] = BUS_CAN_SEGMENT_FIRST | ((size >> 8) & 0x0F);
+    args[1] = size & 0xFF;
+    memcpy(&args[2], message, BUS_CAN_SEGMENT_FIRST_DATA);
+    return BUS_CAN_SEGMENT_FIRST_DATA;
+}
+
+void BusCANSegment::encodeConsecutive(uint8_t* args, uint8_t sequence, const uint8_t* data, uint8_t length)
+{
+    args[0] = BUS_CAN_SEGMENT_CONSECUTIVE | (sequence & 0x0F);
+    memcpy(&args[1], data, length);
+}
+
+void BusCANSegment::encodeFlow(uint8_t* args, Flow_e status, uint16_t target)
+{
+    args[0] = BUS_CAN_SEGMENT_FLOW | (status & 0x0F);
+    args[1] = BUS_CAN_SEGMENT_BLOCK;
+    args[2] = 0; // No separation time, the frames are queued by the transmit task
+    args[3] = target & 0xFF;
+    args[4] = (target >> 8) & 0xFF;
+}
+
+void BusCANSegment::_drop(std::map<uint16_t, Stream_t>::iterator it)
+{
+    free(it->second.data);
+    _streams.erase(it);
+}
@@ -0,0 +1,140 @@
+/**
+ * @file BusCANSegment.h
+ * @brief Segmentation and reassembly of the CAN bus messages longer than one frame
+ * @author Kévin Lefeuvre (kevin.lefeuvre@openindus.com)
+ * @copyright (c) [2025] OpenIndus, Inc. All rights reserved.
+ * @see https://openindus.com
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <map>
+
+#define BUS_CAN_SEGMENT_CMD 0x20 // CMD_CAN_SEGMENT: [PCI, ...]
+
+/* Protocol control information, high nibble of the first argument (ISO 15765-2 layout) */
+#define BUS_CAN_SEGMENT_FIRST 0x10          // [0x1 | size[11:8], size[7:0], 5 bytes]
+#define BUS_CAN_SEGMENT_CONSECUTIVE 0x20    // [0x2 | sequence, 6 bytes]
+#define BUS_CAN_SEGMENT_FLOW 0x30           // [0x3 | status, block size, separation (ms), target (2 bytes)]
+#define BUS_CAN_SEGMENT_FIRST_DATA 5
+#define BUS_CAN_SEGMENT_CONSECUTIVE_DATA 6
+#define BUS_CAN_SEGMENT_FLOW_LENGTH 5
+
+#define BUS_CAN_SEGMENT_MESSAGE_MAX 512 // bytes, command included
+#define BUS_CAN_SEGMENT_BLOCK 8 // Consecutive frames between two flow controls
+#define BUS_CAN_SEGMENT_TIMEOUT 100 // ms, without the next frame of a message or its flow control
+#define BUS_CAN_SEGMENT_SOURCES_MAX 8 // Messages reassembled at the same time
+
+/**
+ * @brief Reassembly of segmented messages, one stream per source module.
+ * The frames of several sources can be interleaved. A stream is dropped when a frame is missing
+ * or when its next frame does not come within BUS_CAN_SEGMENT_TIMEOUT.
+ * It does not depend on the TWAI driver and can be fed with recorded traffic on the host.
+ */
+class BusCANSegment
+{
+public:
+
+    typedef enum {
+        SEGMENT_NONE = 0,   // Frame consumed
+        SEGMENT_FLOW,       // The sender waits for a flow control
+        SEGMENT_OVERFLOW,   // Message refused, the sender must be told
+        SEGMENT_COMPLETE,   // Message reassembled
+        SEGMENT_LOST,       // Stream dropped
+    } Result_e;
+
+    typedef enum {
+        FLOW_CONTINUE = 0,
+        FLOW_WAIT,
+        FLOW_OVERFLOW,
+    } Flow_e;
+
+    typedef struct {
+        uint32_t messages;
+        uint32_t lost;      // Missing or unexpected frames
+        uint32_t timeouts;
+        uint32_t overflows; // Too large or too many streams
+    } Counters_t;
+
+    BusCANSegment(void);
+    ~BusCANSegment(void);
+
+    /**
+     * @brief Add a frame of a segmented message
+     *
+     * @param source Module identifier
+     * @param args Arguments of the frame, after the command byte
+     * @param length Number of arguments
+     * @param now Time in ms
+     * @param message Reassembled message when complete, to be freed by the caller
+     * @param size Size of the message
+     * @return Result_e
+     */
+    Result_e push(uint16_t source, const uint8_t* args, uint8_t length, uint32_t now, uint8_t** message, uint16_t* size);
+
+    /**
+     * @brief Drop the streams without a frame for BUS_CAN_SEGMENT_TIMEOUT
+     *
+     * @param now Time in ms
+     */
+    void purge(uint32_t now);
+
+    /**
+     * @brief Drop all the streams
+     *
+     */
+    void reset(void);
+
+    inline size_t streams(void) {
+        return _streams.size();
+    }
+
+    inline const Counters_t& getCounters(void) {
+        return _counters;
+    }
+
+    inline void resetCounters(void) {
+        memset(&_counters, 0, sizeof(Counters_t));
+    }
+
+    /**
+     * @brief Fill the arguments of the first frame
+     *
+     * @return uint8_t Number of bytes of the message copied
+     */
+    static uint8_t encodeFirst(uint8_t* args, const uint8_t* message, uint16_t size);
+
+    /**
+     * @brief Fill the arguments of a consecutive frame
+     *
+     * @param sequence Index of the frame, from 1
+     * @param length Number of bytes, at most BUS_CAN_SEGMENT_CONSECUTIVE_DATA
+     */
+    static void encodeConsecutive(uint8_t* args, uint8_t sequence, const uint8_t* data, uint8_t length);
+
+    /**
+     * @brief Fill the arguments of a flow control frame
+     *
+     * @param target Sender of the message
+     */
+    static void encodeFlow(uint8_t* args, Flow_e status, uint16_t target);
+
+private:
+
+    typedef struct {
+        uint8_t* data;
+        uint16_t size;
+        uint16_t received;
+        uint8_t sequence;   // Expected in the next frame
+        uint8_t block;      // Frames left in the block
+        uint32_t lastTime;
+    } Stream_t;
+
+    std::map<uint16_t, Stream_t> _streams;
+    Counters_t _counters;
+
+    void _drop(std::map<uint16_t, Stream_t>::iterator it);
+};
@@ -10,6 +10,7 @@
 #include "esp_log.h"
 #include "esp_console.h"
 #include "argtable3/argtable3.h"
+#include "esp_timer.h"
 
 static const char TAG[] = "BusCLI";
 
@@ -235,6 +236,603 @@ static int _registerCANReadCmd(void)
     }
 }
 
+/* --- bus-can-filter --- */
+
+static struct {
+    struct arg_lit *reset;
+    struct arg_end *end;
+} CANFilterArgs;
+
+static int CANFilterCmd(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &CANFilterArgs);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, CANFilterArgs.end, argv[0]);
+        return 1;
+    }
+
+    if (CANFilterArgs.reset->count > 0) {
+        BusCAN::resetFilterStats();
+        return 0;
+    }
+
+    uint32_t code, mask;
+    bool acceptAll = BusCAN::getFilter(&code, &mask);
+    BusCAN::FilterStats_t stats;
+    BusCAN::getFilterStats(&stats);
+    printf("{\"accept_all\":%s,\"priority_ids\":%s,\"code\":%lu,\"mask\":%lu,\"received\":%lu,\"rejected\":%lu}\n",
+        acceptAll ? "true" : "false", BusCAN::getPriorityIds() ? "true" : "false", code, mask, stats.received, stats.rejected);
+    return 0;
+}
+
+static int _registerCANFilterCmd(void)
+{
+    CANFilterArgs.reset = arg_lit0("r", "reset", "reset the counters");
+    CANFilterArgs.end = arg_end(1);
+
+    const esp_console_cmd_t cmd = {
+        .command = "bus-can-filter",
+        .help = "Print the CAN acceptance filter and the counts of received and rejected frames",
+        .hint = NULL,
+        .func = &CANFilterCmd,
+        .argtable = &CANFilterArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    
+    if (esp_console_cmd_register(&cmd) == ESP_OK) {
+        return 0;
+    } else {
+        return -1;
+    }
+}
+
+/* --- bus-can-bench --- */
+
+#define CAN_BENCH_CMD 0xFF // Not a command, ignored by the modules
+
+static struct {
+    struct arg_int *producers;
+    struct arg_int *events;
+    struct arg_end *end;
+} CANBenchArgs;
+
+typedef struct {
+    int events;
+    uint16_t id;
+    SemaphoreHandle_t done;
+} CANBenchProducer_t;
+
+static void CANBenchTask(void *pvParameters)
+{
+    CANBenchProducer_t* producer = (CANBenchProducer_t*)pvParameters;
+    BusCAN::Frame_t frame;
+    frame.cmd = CAN_BENCH_CMD;
+    for (int i = 0; i < producer->events; i++) {
+        memcpy(frame.args, &i, sizeof(int));
+        BusCAN::write(&frame, producer->id, 1 + sizeof(int), BusCAN::PRIORITY_TELEMETRY);
+    }
+    xSemaphoreGive(producer->done);
+    vTaskDelete(NULL);
+}
+
+static int CANBenchCmd(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &CANBenchArgs);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, CANBenchArgs.end, argv[0]);
+        return 1;
+    }
+
+    int producers = (CANBenchArgs.producers->count > 0) ? CANBenchArgs.producers->ival[0] : 4;
+    int events = (CANBenchArgs.events->count > 0) ? CANBenchArgs.events->ival[0] : 250;
+    if ((producers < 1) || (producers > 8) || (events < 1)) {
+        fprintf(stderr, "Invalid arguments\n");
+        return 1;
+    }
+
+    CANBenchProducer_t producer = {events, (uint16_t)BusIO::readId(), xSemaphoreCreateCounting(producers, 0)};
+    BusCAN::TxStats_t before, after;
+    BusCAN::getTxStats(&before);
+
+    /* Producers run at the priority of the event tasks of the modules */
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < producers; i++) {
+        xTaskCreate(CANBenchTask, "CAN bench task", 2048, &producer, 1, NULL);
+    }
+    for (int i = 0; i < producers; i++) {
+        xSemaphoreTake(producer.done, portMAX_DELAY);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    BusCAN::flush(pdMS_TO_TICKS(1000));
+    BusCAN::getTxStats(&after);
+    vSemaphoreDelete(producer.done);
+
+    printf("{\"producers\":%d,\"events\":%d,\"events_per_s\":%.0f,\"sent\":%lu,\"dropped\":%lu,\"overwritten\":%lu,\"failed\":%lu}\n",
+        producers, producers * events, (float)producers * events * 1000000 / (elapsed > 0 ? elapsed : 1),
+        after.sent - before.sent, after.dropped - before.dropped, 
+        after.overwritten - before.overwritten, after.failed - before.failed);
+    return 0;
+}
+
+static int _registerCANBenchCmd(void)
+{
+    CANBenchArgs.producers = arg_int0("p", "producers", "<N>", "producer tasks (default 4)");
+    CANBenchArgs.events = arg_int0("n", "events", "<N>", "events per producer (default 250)");
+    CANBenchArgs.end = arg_end(2);
+
+    const esp_console_cmd_t cmd = {
+        .command = "bus-can-bench",
+        .help = "Measure the events per second queued on the CAN bus by concurrent producer tasks",
+        .hint = NULL,
+        .func = &CANBenchCmd,
+        .argtable = &CANBenchArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    
+    if (esp_console_cmd_register(&cmd) == ESP_OK) {
+        return 0;
+    } else {
+        return -1;
+    }
+}
+
+/* --- bus-can-segments --- */
+
+static struct {
+    struct arg_lit *reset;
+    struct arg_end *end;
+} CANSegmentsArgs;
+
+static int CANSegmentsCmd(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &CANSegmentsArgs);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, CANSegmentsArgs.end, argv[0]);
+        return 1;
+    }
+
+    if (CANSegmentsArgs.reset->count > 0) {
+        BusCAN::resetSegmentStats();
+        return 0;
+    }
+
+    BusCAN::SegmentStats_t stats;
+    BusCAN::getSegmentStats(&stats);
+    printf("{\"sent\":%lu,\"send_errors\":%lu,\"received\":%lu,\"lost\":%lu,\"timeouts\":%lu,\"overflows\":%lu}\n",
+        stats.sent, stats.sendErrors, stats.received, stats.lost, stats.timeouts, stats.overflows);
+    return 0;
+}
+
+static int _registerCANSegmentsCmd(void)
+{
+    CANSegmentsArgs.reset = arg_lit0("r", "reset", "reset the counters");
+    CANSegmentsArgs.end = arg_end(1);
+
+    const esp_console_cmd_t cmd = {
+        .command = "bus-can-segments",
+        .help = "Print the counters of the segmented CAN messages",
+        .hint = NULL,
+        .func = &CANSegmentsCmd,
+        .argtable = &CANSegmentsArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    
+    if (esp_console_cmd_register(&cmd) == ESP_OK) {
+        return 0;
+    } else {
+        return -1;
+    }
+}
+
+/* --- bus-can-segment-test --- */
+
+/* Split a message in the arguments of its frames, as sent by BusCAN::writeMessage */
+static int CANSegmentSplit(const uint8_t* message, uint16_t size, uint8_t frames[][7], uint8_t* lengths)
+{
+    int count = 0;
+    uint16_t offset = BusCANSegment::encodeFirst(frames[count], message, size);
+    lengths[count++] = 7;
+    for (uint8_t sequence = 1; offset < size; sequence++) {
+        uint8_t length = (size - offset < BUS_CAN_SEGMENT_CONSECUTIVE_DATA) ? (size - offset) : BUS_CAN_SEGMENT_CONSECUTIVE_DATA;
+        BusCANSegment::encodeConsecutive(frames[count], sequence, &message[offset], length);
+        lengths[count++] = 1 + length;
+        offset += length;
+    }
+    return count;
+}
+
+/* Reassembly of interleaved streams, of a stream with a missing frame and of an interrupted stream */
+static int CANSegmentTestCmd(int argc, char **argv)
+{
+    const uint16_t sources[] = {3, 17, 250};
+    const uint16_t sizes[] = {40, 200, BUS_CAN_SEGMENT_MESSAGE_MAX};
+    const int nb = sizeof(sources) / sizeof(sources[0]);
+    const int framesMax = 2 + BUS_CAN_SEGMENT_MESSAGE_MAX / BUS_CAN_SEGMENT_CONSECUTIVE_DATA;
+    BusCANSegment segment;
+    uint8_t (*frames)[framesMax][7] = (uint8_t (*)[framesMax][7])malloc(nb * sizeof(*frames));
+    uint8_t (*lengths)[framesMax] = (uint8_t (*)[framesMax])malloc(nb * sizeof(*lengths));
+    uint8_t* messages = (uint8_t*)malloc(nb * BUS_CAN_SEGMENT_MESSAGE_MAX);
+    if ((frames == NULL) || (lengths == NULL) || (messages == NULL)) {
+        free(frames);
+        free(lengths);
+        free(messages);
+        return 1;
+    }
+
+    int counts[nb];
+    for (int i = 0; i < nb; i++) {
+        for (int j = 0; j < sizes[i]; j++) {
+            messages[i * BUS_CAN_SEGMENT_MESSAGE_MAX + j] = (uint8_t)(j * (i + 1) + sources[i]);
+        }
+        counts[i] = CANSegmentSplit(&messages[i * BUS_CAN_SEGMENT_MESSAGE_MAX], sizes[i], frames[i], lengths[i]);
+    }
+
+    /* Interleaved: one frame of each source in turn, flow controls when the blocks end */
+    bool interleaved = true;
+    int completed = 0;
+    int flows = 0;
+    for (int k = 0; k < framesMax; k++) {
+        for (int i = 0; i < nb; i++) {
+            if (k >= counts[i]) {
+                continue;
+            }
+            uint8_t* message = NULL;
+            uint16_t size = 0;
+            BusCANSegment::Result_e result = segment.push(sources[i], frames[i][k], lengths[i][k], k, &message, &size);
+            if (result == BusCANSegment::SEGMENT_FLOW) {
+                flows++;
+            } else if (result == BusCANSegment::SEGMENT_COMPLETE) {
+                interleaved &= (k == counts[i] - 1) && (size == sizes[i]) && 
+                    (memcmp(message, &messages[i * BUS_CAN_SEGMENT_MESSAGE_MAX], size) == 0);
+                completed++;
+                free(message);
+            } else if (result != BusCANSegment::SEGMENT_NONE) {
+                interleaved = false;
+            }
+        }
+    }
+    int expectedFlows = 0;
+    for (int i = 0; i < nb; i++) {
+        expectedFlows += 1 + (counts[i] - 2) / BUS_CAN_SEGMENT_BLOCK; // After the first frame, then after each full block
+    }
+    interleaved &= (completed == nb) && (flows == expectedFlows) && (segment.streams() == 0);
+
+    /* Missing frame: the stream is dropped at the next frame, the following ones are ignored */
+    uint8_t* message = NULL;
+    uint16_t size = 0;
+    segment.resetCounters();
+    bool lost = true;
+    for (int k = 0; k < counts[1]; k++) {
+        if (k == 5) {
+            continue;
+        }
+        BusCANSegment::Result_e result = segment.push(sources[1], frames[1][k], lengths[1][k], k, &message, &size);
+        lost &= (result != BusCANSegment::SEGMENT_COMPLETE);
+        lost &= (k != 6) || (result == BusCANSegment::SEGMENT_LOST);
+    }
+    lost &= (segment.streams() == 0) && (segment.getCounters().messages == 0);
+
+    /* Timeout: a stream without its next frame is dropped, the others are kept */
+    segment.resetCounters();
+    segment.push(sources[0], frames[0][0], lengths[0][0], 1000, &message, &size);
+    segment.push(sources[2], frames[2][0], lengths[2][0], 1000 + BUS_CAN_SEGMENT_TIMEOUT, &message, &size);
+    segment.purge(1000 + BUS_CAN_SEGMENT_TIMEOUT + 1);
+    bool timeout = (segment.getCounters().timeouts == 1) && (segment.streams() == 1);
+    segment.reset();
+
+    /* Too large */
+    uint8_t first[7] = {BUS_CAN_SEGMENT_FIRST | 0x0F, 0xFF};
+    bool overflow = (segment.push(sources[0], first, sizeof(first), 0, &message, &size) == BusCANSegment::SEGMENT_OVERFLOW);
+
+    printf("{\"interleaved\":%s,\"lost\":%s,\"timeout\":%s,\"overflow\":%s}\n", 
+        interleaved ? "true" : "false", lost ? "true" : "false", timeout ? "true" : "false", overflow ? "true" : "false");
+
+    free(frames);
+    free(lengths);
+    free(messages);
+    return (interleaved && lost && timeout && overflow) ? 0 : 1;
+}
+
+static int _registerCANSegmentTestCmd(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "bus-can-segment-test",
+        .help = "Check the reassembly of segmented CAN messages with recorded frames",
+        .hint = NULL,
+        .func = &CANSegmentTestCmd,
+        .argtable = NULL,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    
+    if (esp_console_cmd_register(&cmd) == ESP_OK) {
+        return 0;
+    } else {
+        return -1;
+    }
+}
+
+/* --- bus-can-arbitration-sim --- */
+
+#define CAN_SIM_MODULES_MAX 16
+#define CAN_SIM_BITS_STANDARD 135 // 8 bytes frame with the worst case bit stuffing, 1 bit = 1 us at 1 Mbit/s
+#define CAN_SIM_BITS_EXTENDED 160
+
+/* Frames queued by each module per 1000 frame times, by class: the telemetry saturates the bus */
+static const int CANSimLoad[BUS_CAN_PRIORITY_NB] = {5, 20, 50, 1000};
+
+static struct {
+    struct arg_int *modules;
+    struct arg_int *frames;
+    struct arg_int *seed;
+    struct arg_end *end;
+} CANArbitrationArgs;
+
+typedef struct {
+    uint32_t arrivals[BUS_CAN_PRIORITY_NB][BUS_CAN_TX_RING_SIZE]; // Time each queued frame arrived (us)
+    uint8_t first[BUS_CAN_PRIORITY_NB];
+    uint8_t count[BUS_CAN_PRIORITY_NB];
+} CANSimModule_t;
+
+static uint32_t CANSimRandom(uint32_t* state)
+{
+    *state = *state * 1664525 + 1013904223;
+    return *state >> 8;
+}
+
+/**
+ * @brief Simulate the arbitration of the frames queued by the modules, each one sending its 
+ * highest class first like the transmit task. With the priority identifiers the class decides 
+ * the arbitration, with the standard identifiers the lowest module id does.
+ * 
+ * @param worst Worst latency of each class (us), from the queueing to the end of the frame
+ */
+static void CANSimRun(CANSimModule_t* modules, int nb, int frames, uint32_t seed, bool priorityIds, uint32_t worst[BUS_CAN_PRIORITY_NB])
+{
+    uint32_t bits = priorityIds ? CAN_SIM_BITS_EXTENDED : CAN_SIM_BITS_STANDARD;
+    uint32_t now = 0;
+    memset(modules, 0, nb * sizeof(CANSimModule_t));
+    memset(worst, 0, BUS_CAN_PRIORITY_NB * sizeof(uint32_t));
+
+    for (int f = 0; f < frames; f++) {
+        /* Frames queued during the previous frame */
+        for (int m = 0; m < nb; m++) {
+            for (int c = 0; c < BUS_CAN_PRIORITY_NB; c++) {
+                if ((int)(CANSimRandom(&seed) % 1000) >= CANSimLoad[c]) {
+                    continue;
+                }
+                CANSimModule_t* module = &modules[m];
+                if (module->count[c] == BUS_CAN_TX_RING_SIZE) {
+                    if (c != BusCAN::PRIORITY_TELEMETRY) {
+                        continue; // Dropped
+                    }
+                    module->first[c] = (module->first[c] + 1) % BUS_CAN_TX_RING_SIZE; // Replaces the oldest one
+                    module->count[c]--;
+                }
+                uint32_t arrival = (now >= bits) ? (now - CANSimRandom(&seed) % bits) : now;
+                module->arrivals[c][(module->first[c] + module->count[c]) % BUS_CAN_TX_RING_SIZE] = arrival;
+                module->count[c]++;
+            }
+        }
+
+        /* The lowest identifier wins */
+        int winner = -1;
+        int winnerClass = 0;
+        uint32_t winnerId = UINT32_MAX;
+        for (int m = 0; m < nb; m++) {
+            int c = 0;
+            while ((c < BUS_CAN_PRIORITY_NB) && (modules[m].count[c] == 0)) {
+                c++;
+            }
+            if (c == BUS_CAN_PRIORITY_NB) {
+                continue;
+            }
+            uint16_t id = m + 1;
+            uint32_t identifier = priorityIds ? 
+                (((uint32_t)c << BUS_CAN_PRIORITY_SHIFT) | ((uint32_t)id << BUS_CAN_SOURCE_SHIFT)) : id;
+            if (identifier < winnerId) {
+                winnerId = identifier;
+                winner = m;
+                winnerClass = c;
+            }
+        }
+        now += bits;
+        if (winner < 0) {
+            continue;
+        }
+        CANSimModule_t* module = &modules[winner];
+        uint32_t latency = now - module->arrivals[winnerClass][module->first[winnerClass]];
+        worst[winnerClass] = std::max(worst[winnerClass], latency);
+        module->first[winnerClass] = (module->first[winnerClass] + 1) % BUS_CAN_TX_RING_SIZE;
+        module->count[winnerClass]--;
+    }
+
+    /* The frames still queued have waited at least until now */
+    for (int m = 0; m < nb; m++) {
+        for (int c = 0; c < BUS_CAN_PRIORITY_NB; c++) {
+            if (modules[m].count[c] > 0) {
+                worst[c] = std::max(worst[c], now - modules[m].arrivals[c][modules[m].first[c]]);
+            }
+        }
+    }
+}
+
+static int CANArbitrationCmd(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &CANArbitrationArgs);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, CANArbitrationArgs.end, argv[0]);
+        return 1;
+    }
+
+    int nb = (CANArbitrationArgs.modules->count > 0) ? CANArbitrationArgs.modules->ival[0] : 8;
+    int frames = (CANArbitrationArgs.frames->count > 0) ? CANArbitrationArgs.frames->ival[0] : 10000;
+    uint32_t seed = (CANArbitrationArgs.seed->count > 0) ? CANArbitrationArgs.seed->ival[0] : 1;
+    if ((nb < 1) || (nb > CAN_SIM_MODULES_MAX) || (frames < 1)) {
+        fprintf(stderr, "Invalid arguments\n");
+        return 1;
+    }
+
+    CANSimModule_t* modules = (CANSimModule_t*)malloc(nb * sizeof(CANSimModule_t));
+    if (modules == NULL) {
+        return 1;
+    }
+    uint32_t priority[BUS_CAN_PRIORITY_NB];
+    uint32_t standard[BUS_CAN_PRIORITY_NB];
+    CANSimRun(modules, nb, frames, seed, true, priority);
+    CANSimRun(modules, nb, frames, seed, false, standard);
+    free(modules);
+
+    printf("{\"modules\":%d,\"frames\":%d,\"emergency_us\":%lu,\"motion_us\":%lu,\"io_us\":%lu,\"telemetry_us\":%lu,"
+        "\"standard_emergency_us\":%lu,\"standard_motion_us\":%lu,\"standard_io_us\":%lu,\"standard_telemetry_us\":%lu}\n",
+        nb, frames, priority[0], priority[1], priority[2], priority[3], standard[0], standard[1], standard[2], standard[3]);
+    return 0;
+}
+
+static int _registerCANArbitrationCmd(void)
+{
+    CANArbitrationArgs.modules = arg_int0("m", "modules", "<N>", "modules on the bus (default 8)");
+    CANArbitrationArgs.frames = arg_int0("n", "frames", "<N>", "frames sent (default 10000)");
+    CANArbitrationArgs.seed = arg_int0("s", "seed", "<N>", "seed of the arrivals (default 1)");
+    CANArbitrationArgs.end = arg_end(3);
+
+    const esp_console_cmd_t cmd = {
+        .command = "bus-can-arbitration-sim",
+        .help = "Simulate the worst latency of each priority class on a saturated CAN bus, with the priority and the standard identifiers",
+        .hint = NULL,
+        .func = &CANArbitrationCmd,
+        .argtable = &CANArbitrationArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    
+    if (esp_console_cmd_register(&cmd) == ESP_OK) {
+        return 0;
+    } else {
+        return -1;
+    }
+}
+
+/* --- bus-stats --- */
+
+void Bus::printBusStats(const BusStats_t* stats)
+{
+    printf("{\"rs\":{\"tx_frames\":%lu,\"rx_frames\":%lu,\"framing_errors\":%lu,\"checksum_errors\":%lu,\"timeout_errors\":%lu},",
+        stats->rs.txFrames, stats->rs.rxFrames, stats->rs.framingErrors, stats->rs.checksumErrors, stats->rs.timeoutErrors);
+    printf("\"can\":{\"tx_frames\":%lu,\"rx_frames\":%lu,\"tx_failed\":%lu,\"rx_missed\":%lu,\"rx_overrun\":%lu,"
+        "\"arb_lost\":%lu,\"bus_errors\":%lu,\"error_passive\":%lu,\"bus_off\":%lu,\"rx_high_water\":%lu,"
+        "\"state\":%u,\"tx_error_counter\":%u,\"rx_error_counter\":%u}}\n",
+        stats->can.txFrames, stats->can.rxFrames, stats->can.txFailed, stats->can.rxMissed, stats->can.rxOverrun,
+        stats->can.arbLost, stats->can.busErrors, stats->can.errorPassive, stats->can.busOff, stats->can.rxHighWater,
+        stats->can.state, stats->can.txErrorCounter, stats->can.rxErrorCounter);
+}
+
+static struct {
+    struct arg_lit *reset;
+    struct arg_end *end;
+} busStatsArgs;
+
+static int busStatsCmd(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &busStatsArgs);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, busStatsArgs.end, argv[0]);
+        return 1;
+    }
+
+    if (busStatsArgs.reset->count > 0) {
+        Bus::resetBusStats();
+        return 0;
+    }
+
+    Bus::BusStats_t stats;
+    Bus::getBusStats(&stats);
+    Bus::printBusStats(&stats);
+    return 0;
+}
+
+static int _registerBusStatsCmd(void)
+{
+    busStatsArgs.reset = arg_lit0("r", "reset", "reset the counters");
+    busStatsArgs.end = arg_end(1);
+
+    const esp_console_cmd_t cmd = {
+        .command = "bus-stats",
+        .help = "Print the health counters of the RS and CAN buses",
+        .hint = NULL,
+        .func = &busStatsCmd,
+        .argtable = &busStatsArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    
+    if (esp_console_cmd_register(&cmd) == ESP_OK) {
+        return 0;
+    } else {
+        return -1;
+    }
+}
+
+/* --- bus-rs-slaves --- */
+
+static struct {
+    struct arg_lit *reset;
+    struct arg_end *end;
+} RSSlavesArgs;
+
+static int RSSlavesCmd(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &RSSlavesArgs);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, RSSlavesArgs.end, argv[0]);
+        return 1;
+    }
+
+    if (RSSlavesArgs.reset->count > 0) {
+        BusRS::resetSlaveStats();
+        return 0;
+    }
+
+    uint16_t ids[BUS_RS_SLAVE_STATS_NB];
+    int nb = BusRS::getSlaveStatsIds(ids, BUS_RS_SLAVE_STATS_NB);
+    BusRS::SlaveStats_t stats;
+    printf("[");
+    for (int i = 0; i < nb; i++) {
+        if (BusRS::getSlaveStats(ids[i], &stats) == 0) {
+            printf("%s{\"id\":%u,\"transactions\":%lu,\"timeouts\":%lu,\"errors\":%lu,\"corrupted\":%lu,"
+                "\"p50_us\":%lu,\"p99_us\":%lu,\"max_us\":%lu}", (i > 0) ? "," : "", stats.id, stats.transactions, 
+                stats.timeouts, stats.errors, stats.corrupted, stats.p50, stats.p99, stats.max);
+        }
+    }
+    printf("]\n");
+    return 0;
+}
+
+static int _registerRSSlavesCmd(void)
+{
+    RSSlavesArgs.reset = arg_lit0("r", "reset", "reset the counters");
+    RSSlavesArgs.end = arg_end(1);
+
+    const esp_console_cmd_t cmd = {
+        .command = "bus-rs-slaves",
+        .help = "Print the transaction counts and latencies of each slave",
+        .hint = NULL,
+        .func = &RSSlavesCmd,
+        .argtable = &RSSlavesArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    
+    if (esp_console_cmd_register(&cmd) == ESP_OK) {
+        return 0;
+    } else {
+        return -1;
+    }
+}
+
 /* --- bus-rs-write --- */
 
 static struct {
@@ -254,23 +852,26 @@ static int RSWriteCmd(int argc, char **argv)
         return 1;
     }
 
-    BusRS::Frame_t frame;
+    BusRS::Frame_t frame = {};
 
     frame.cmd = RSWriteArgs.cmd->ival[0];
     frame.id = RSWriteArgs.id->ival[0];
     frame.dir = RSWriteArgs.dir->ival[0];
     frame.ack = RSWriteArgs.ack->ival[0];
 
-    int size = argc - 5;
+    int size = RSWriteArgs.data->count;
     frame.length = size;
-    frame.data = (uint8_t*) malloc(size * sizeof(uint8_t));
+    frame.data = BusRS::allocBuffer();
+    if (frame.data == NULL) {
+        return 1;
+    }
     for (int i = 0; i < size; i++) {
         frame.data[i] = RSWriteArgs.data->ival[i];
     }
 
     BusRS::write(&frame);
 
-    free(frame.data);
+    BusRS::freeBuffer(frame.data);
     return 0;
 }
 
@@ -304,7 +905,11 @@ static int _registerRSWriteCmd(void)
 
 static int RSReadCmd(int argc, char **argv)
 {
-    BusRS::Frame_t frame;
+    BusRS::Frame_t frame = {};
+    frame.data = BusRS::allocBuffer();
+    if (frame.data == NULL) {
+        return 1;
+    }
 
     if (BusRS::read(&frame) == ESP_OK) {
         printf("Sync: %02X\n", frame.sync);
@@ -322,9 +927,11 @@ static int RSReadCmd(int argc, char **argv)
         printf("\n");
     } else {
         fprintf(stderr, "Failed to read from RS bus\n");
+        BusRS::freeBuffer(frame.data);
         return 1;
     }
 
+    BusRS::freeBuffer(frame.data);
     return 0;
 }
 
@@ -347,6 +954,187 @@ static int _registerRSReadCmd(void)
     }
 }
 
+/* --- bus-rs-stats --- */
+
+static struct {
+    struct arg_lit *reset;
+    struct arg_end *end;
+} RSStatsArgs;
+
+static int RSStatsCmd(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &RSStatsArgs);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, RSStatsArgs.end, argv[0]);
+        return 1;
+    }
+
+    if (RSStatsArgs.reset->count > 0) {
+        BusRS::resetStats();
+        return 0;
+    }
+
+    BusRS::Stats_t stats;
+    BusRS::getStats(&stats);
+    printf("{\"tx_frames\":%lu,\"rx_frames\":%lu,\"framing_errors\":%lu,\"checksum_errors\":%lu,\"timeout_errors\":%lu}\n",
+        stats.txFrames, stats.rxFrames, stats.framingErrors, stats.checksumErrors, stats.timeoutErrors);
+    return 0;
+}
+
+static int _registerRSStatsCmd(void)
+{
+    RSStatsArgs.reset = arg_lit0("r", "reset", "reset the counters");
+    RSStatsArgs.end = arg_end(1);
+
+    const esp_console_cmd_t cmd = {
+        .command = "bus-rs-stats",
+        .help = "Print the RS bus frame counters",
+        .hint = NULL,
+        .func = &RSStatsCmd,
+        .argtable = &RSStatsArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    
+    if (esp_console_cmd_register(&cmd) == ESP_OK) {
+        return 0;
+    } else {
+        return -1;
+    }
+}
+
+/* --- bus-rs-rates --- */
+
+static int RSRatesCmd(int argc, char **argv)
+{
+    printf("{\"baud_rate\":%lu,\"rates\":[", BusRS::getBaudRate(BusRS::getBaudRateIndex()));
+    for (int i = 0; i < BUS_RS_BAUD_RATES_NB; i++) {
+        BusRS::RateStats_t stats;
+        BusRS::getRateStats(i, &stats);
+        printf("%s{\"baud_rate\":%lu,\"rx_frames\":%lu,\"framing_errors\":%lu,\"checksum_errors\":%lu,\"timeout_errors\":%lu}",
+            (i > 0) ? "," : "", stats.baudRate, stats.rxFrames, stats.framingErrors, stats.checksumErrors, stats.timeoutErrors);
+    }
+    printf("]}\n");
+    return 0;
+}
+
+static int _registerRSRatesCmd(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "bus-rs-rates",
+        .help = "Print the RS bus baud rate and the frame counters of each rate",
+        .hint = NULL,
+        .func = &RSRatesCmd,
+        .argtable = NULL,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    
+    if (esp_console_cmd_register(&cmd) == ESP_OK) {
+        return 0;
+    } else {
+        return -1;
+    }
+}
+
+/* --- bus-rs-fault --- */
+
+static struct {
+    struct arg_int *id;
+    struct arg_int *bits;
+    struct arg_end *end;
+} RSFaultArgs;
+
+static int RSFaultCmd(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &RSFaultArgs);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, RSFaultArgs.end, argv[0]);
+        return 1;
+    }
+
+    uint16_t id = (RSFaultArgs.id->count > 0) ? RSFaultArgs.id->ival[0] : 0;
+    uint32_t bits[BUS_RS_FAULT_BITS_MAX];
+    int count = RSFaultArgs.bits->count;
+    for (int i = 0; i < count; i++) {
+        bits[i] = RSFaultArgs.bits->ival[i];
+    }
+
+    BusRS::injectFault(id, bits, count);
+    return 0;
+}
+
+static int _registerRSFaultCmd(void)
+{
+    RSFaultArgs.id = arg_int0("i", "id", "ID", "only corrupt the next frame received with this identifier");
+    RSFaultArgs.bits = arg_intn(NULL, NULL, "<BITS>", 1, BUS_RS_FAULT_BITS_MAX, "bit positions to flip, from the sync byte");
+    RSFaultArgs.end = arg_end(1);
+
+    const esp_console_cmd_t cmd = {
+        .command = "bus-rs-fault",
+        .help = "Flip bits in the next frame received from the RS bus",
+        .hint = NULL,
+        .func = &RSFaultCmd,
+        .argtable = &RSFaultArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    
+    if (esp_console_cmd_register(&cmd) == ESP_OK) {
+        return 0;
+    } else {
+        return -1;
+    }
+}
+
+/* --- bus-rs-crc-bench --- */
+
+static int RSCrcBenchCmd(int argc, char **argv)
+{
+    const int loops = 100;
+    size_t size = BUS_RS_DATA_LENGTH_MAX + 9; // Largest frame with extended header
+    uint8_t* buffer = BusRS::allocBuffer();
+    if (buffer == NULL) {
+        return 1;
+    }
+    for (size_t i = 0; i < BUS_RS_DATA_LENGTH_MAX; i++) {
+        buffer[i] = (uint8_t)i;
+    }
+
+    volatile uint16_t crc = 0;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < loops; i++) {
+        crc = BusRSParser::crc16(0xFFFF, buffer, BUS_RS_DATA_LENGTH_MAX);
+        crc = BusRSParser::crc16(crc, buffer, size - BUS_RS_DATA_LENGTH_MAX);
+    }
+    float crcTime = (float)(esp_timer_get_time() - start) / loops;
+    float wireTime = (float)size * 10 * 1000000 / BusRS::getBaudRate(BusRS::getBaudRateIndex()); // 8N1
+
+    printf("{\"bytes\":%u,\"crc_us\":%.2f,\"wire_us\":%.2f}\n", size, crcTime, wireTime);
+
+    BusRS::freeBuffer(buffer);
+    return 0;
+}
+
+static int _registerRSCrcBenchCmd(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "bus-rs-crc-bench",
+        .help = "Time the CRC of the largest RS bus frame against its transmission time",
+        .hint = NULL,
+        .func = &RSCrcBenchCmd,
+        .argtable = NULL,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    
+    if (esp_console_cmd_register(&cmd) == ESP_OK) {
+        return 0;
+    } else {
+        return -1;
+    }
+}
+
 int Bus::_registerCLI(void)
 {
     int err = 0;
@@ -356,7 +1144,18 @@ int Bus::_registerCLI(void)
     err |= _registerBusPowerCmd();
     err |= _registerCANWriteCmd();
     err |= _registerCANReadCmd();
+    err |= _registerCANFilterCmd();
+    err |= _registerCANBenchCmd();
+    err |= _registerCANSegmentsCmd();
+    err |= _registerCANSegmentTestCmd();
+    err |= _registerCANArbitrationCmd();
+    err |= _registerBusStatsCmd();
+    err |= _registerRSSlavesCmd();
     err |= _registerRSWriteCmd();
     err |= _registerRSReadCmd();
+    err |= _registerRSStatsCmd();
+    err |= _registerRSRatesCmd();
+    err |= _registerRSFaultCmd();
+    err |= _registerRSCrcBenchCmd();
     return err;
 }
\ No newline at end of file
@@ -11,6 +11,7 @@
 static const char BUS_IO_TAG[] = "BusIO";
 
 BusIO::Config_s* BusIO::_config;
+int BusIO::_adcIndex = -1;
 
 int BusIO::init(Config_s* config)
 {
@@ -21,21 +22,10 @@ int BusIO::init(Config_s* config)
 
     /* OI-ID */
     ESP_LOGI(BUS_IO_TAG, "Init ADC channel for OI-ID");
-    // Configure ADC channel
-    adc_oneshot_chan_cfg_t adcConfig = {
-        .atten = ADC_ATTEN_DB_12,
-        .bitwidth = ADC_BITWIDTH_12,
-    };
-    err |= adc_oneshot_config_channel(_config->adcHandle, _config->adcChannelId, &adcConfig);
-    
-    // Initialize ADC calibration
-    adc_cali_curve_fitting_config_t adcCaliConfig = {
-        .unit_id = ADC_UNIT_1,
-        .chan = _config->adcChannelId,
-        .atten = ADC_ATTEN_DB_12,
-        .bitwidth = ADC_BITWIDTH_12,
-    };
-    err |= adc_cali_create_scheme_curve_fitting(&adcCaliConfig, &_config->adcCaliHandle);
+    _adcIndex = AdcSampler::addChannel(ADC_UNIT_1, _config->adcChannelId, 64);
+    if (_adcIndex < 0) {
+        err |= -1;
+    }
 
     /* OI-GPIO */
     ESP_LOGI(BUS_IO_TAG, "Init GPIO for OI-SYNC");
@@ -65,20 +55,9 @@ int BusIO::init(Config_s* config)
 
 uint32_t BusIO::readId(void)
 {
-    int adc_reading = 0;
-    int raw_value = 0;
-    int voltage = 0;
-    
-    // Take multiple readings for averaging
-    for (int i = 0; i < 64; i++) {
-        adc_oneshot_read(_config->adcHandle, _config->adcChannelId, &raw_value);
-        adc_reading += raw_value;
-    }
-    adc_reading /= 64;
-    
-    // Convert raw value to voltage
-    adc_cali_raw_to_voltage(_config->adcCaliHandle, adc_reading, &voltage);
-    return voltage;
+    // Average of the last 64 samples
+    int voltage = AdcSampler::readMilliVolt(_adcIndex);
+    return (voltage < 0) ? 0 : voltage;
 }
 
 void BusIO::powerOn(void)
@@ -13,9 +13,7 @@
 #include "esp_err.h"
 #include "esp_log.h"
 #include "driver/gpio.h"
-#include "esp_adc/adc_oneshot.h"
-#include "esp_adc/adc_cali.h"
-#include "esp_adc/adc_cali_scheme.h"
+#include "AdcSampler.h"
 
 class BusIO
 {
@@ -25,8 +23,6 @@ public:
         gpio_num_t gpioNumSync;
         gpio_mode_t gpioModeSync;
         gpio_num_t gpioNumPower;
-        adc_oneshot_unit_handle_t adcHandle;
-        adc_cali_handle_t adcCaliHandle;
     };
 
     static int init(Config_s* config);
@@ -39,5 +35,6 @@ public:
 
 private:
     static Config_s* _config;
+    static int _adcIndex;
 
 };
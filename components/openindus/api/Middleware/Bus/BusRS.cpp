@@ -14,11 +14,8 @@
  */
 
 #include "BusRS.h"
-
-#define BUS_RS_SYNC_BYTE 0xAA
-#define BUS_RS_HEADER_LENGTH 7
-#define BUS_RS_DATA_LENGTH_MAX 1024
-#define BUS_RS_FRAME_LENGTH_MAX (BUS_RS_HEADER_LENGTH + BUS_RS_DATA_LENGTH_MAX)
+#include "esp_timer.h"
+#include <algorithm>
 
 static const char TAG[] = "BusRS";
 
@@ -26,6 +23,30 @@ uart_port_t BusRS::_port;
 QueueHandle_t BusRS::_eventQueue;
 SemaphoreHandle_t BusRS::_writeMutex;
 SemaphoreHandle_t BusRS::_writeReadMutex;
+uint8_t BusRS::_pool[BUS_RS_POOL_SIZE][BUS_RS_DATA_LENGTH_MAX];
+QueueHandle_t BusRS::_poolQueue = NULL;
+BusRS::Transaction_t BusRS::_window[BUS_RS_WINDOW_SIZE + 1];
+SemaphoreHandle_t BusRS::_windowMutex;
+SemaphoreHandle_t BusRS::_windowFreed = NULL;
+int BusRS::_windowWaiting = 0;
+int BusRS::_windowActive = 0;
+volatile TaskHandle_t BusRS::_pausedBy = NULL;
+int BusRS::_pauseDepth = 0;
+SemaphoreHandle_t BusRS::_readMutex;
+uint8_t BusRS::_nextTag = 0;
+BusRS::Frame_t BusRS::_rxFrame;
+uint8_t BusRS::_rxBuffer[BUS_RS_DATA_LENGTH_MAX];
+uint8_t BusRS::_crcEnabled[BUS_RS_ID_MAX / 8];
+BusRS::Stats_t BusRS::_stats;
+BusRSParser BusRS::_parser;
+const uint32_t BusRS::_baudRates[BUS_RS_BAUD_RATES_NB] = BUS_RS_BAUD_RATES;
+uint8_t BusRS::_baudRateIndex = 0;
+BusRS::RateStats_t BusRS::_rateStats[BUS_RS_BAUD_RATES_NB];
+BusRS::Stats_t BusRS::_rateSnapshot;
+size_t BusRS::_rxPending = 0;
+BusRS::SlaveCounters_t BusRS::_slaveStats[BUS_RS_SLAVE_STATS_NB];
+int BusRS::_slaveStatsNb = 0;
+portMUX_TYPE BusRS::_slaveStatsLock = portMUX_INITIALIZER_UNLOCKED;
 
 /**
  * @brief initialization of RS communication
@@ -44,10 +65,31 @@ int BusRS::begin(uart_port_t port, gpio_num_t tx_num, gpio_num_t rx_num)
     xSemaphoreGive(_writeMutex);
     _writeReadMutex = xSemaphoreCreateMutex();
     xSemaphoreGive(_writeReadMutex);
+    _windowMutex = xSemaphoreCreateMutex();
+    xSemaphoreGive(_windowMutex);
+    if (_windowFreed == NULL) {
+        _windowFreed = xSemaphoreCreateCounting(BUS_RS_WINDOW_WAITERS, 0);
+    }
+    _windowWaiting = 0;
+    _windowActive = 0;
+    _pausedBy = NULL;
+    _pauseDepth = 0;
+    _readMutex = xSemaphoreCreateMutex();
+    xSemaphoreGive(_readMutex);
+    memset(_window, 0, sizeof(_window));
+
+    /* Buffer pool */
+    if (_poolQueue == NULL) {
+        _poolQueue = xQueueCreate(BUS_RS_POOL_SIZE, sizeof(uint8_t*));
+        for (int i = 0; i < BUS_RS_POOL_SIZE; i++) {
+            uint8_t* buffer = _pool[i];
+            xQueueSend(_poolQueue, &buffer, 0);
+        }
+    }
 
     ESP_LOGI(TAG, "Configure uart parameters");
     uart_config_t uart_config = {
-        .baud_rate = 921600UL,
+        .baud_rate = BUS_RS_BAUD_RATE,
         .data_bits = UART_DATA_8_BITS,
         .parity = UART_PARITY_DISABLE,
         .stop_bits = UART_STOP_BITS_1,
@@ -73,6 +115,10 @@ int BusRS::begin(uart_port_t port, gpio_num_t tx_num, gpio_num_t rx_num)
     /* Important: trigger an interrupt as soon as one byte time of empty uart rx happened */
     err |= uart_set_rx_timeout(_port, 1);
 
+    _parser.reset();
+    _rxPending = 0;
+    _baudRateIndex = 0;
+
     return err;
 }
 
@@ -85,30 +131,71 @@ void BusRS::end(void)
     uart_driver_delete(_port);
 }
 
+/**
+ * @brief Get a payload buffer of BUS_RS_DATA_LENGTH_MAX bytes from the bus pool
+ * 
+ * @param timeout Maximum time to wait for a free buffer (ms)
+ * @return uint8_t* buffer, NULL if no buffer is available
+ */
+uint8_t* BusRS::allocBuffer(uint32_t timeout)
+{
+    uint8_t* buffer = NULL;
+    if (xQueueReceive(_poolQueue, &buffer, pdMS_TO_TICKS(timeout)) != pdTRUE) {
+        ESP_LOGE(TAG, "No buffer available");
+        return NULL;
+    }
+    return buffer;
+}
+
+/**
+ * @brief Give back a buffer obtained with allocBuffer
+ * 
+ * @param buffer 
+ */
+void BusRS::freeBuffer(uint8_t* buffer)
+{
+    if (buffer != NULL) {
+        xQueueSend(_poolQueue, &buffer, 0);
+    }
+}
+
 /**
  * @brief Send RS frame
+ * Header and payload are written one after the other in the uart tx buffer,
+ * there is no intermediate copy of the frame.
+ * Use transfer() when an answer is expected.
  * 
  * @param frame 
  */
 void BusRS::write(Frame_t* frame, uint32_t timeout)
 {
-    uint8_t* buffer = (uint8_t*)malloc(BUS_RS_FRAME_LENGTH_MAX);
-    size_t length;
+    /* The requests waiting for an answer are held when their transaction is opened */
+    if (!frame->ack && (_pausedBy != NULL) && (_pausedBy != xTaskGetCurrentTaskHandle())) {
+        _waitResume(xTaskGetTickCount(), portMAX_DELAY);
+    }
+
     frame->sync = BUS_RS_SYNC_BYTE;
+    /* A request takes the CRC flag negotiated for the slave id,
+       an answer (dir == 0) keeps the flag it was given from the request */
+    if (frame->dir == 1) {
+        frame->crc = getCrc(frame->id);
+    }
     if (frame->length <= BUS_RS_DATA_LENGTH_MAX) {
         frame->checksum = _calculateChecksum(frame);
-        memcpy(buffer, frame, BUS_RS_HEADER_LENGTH);
-        memcpy(&buffer[BUS_RS_HEADER_LENGTH], frame->data, frame->length);
-        length = frame->length + BUS_RS_HEADER_LENGTH;
-        if(frame->ack)
-            xSemaphoreTake(_writeReadMutex, portMAX_DELAY);
         xSemaphoreTake(_writeMutex, portMAX_DELAY);
-        uart_write_bytes(_port, (const char*) buffer, length);
+        uart_write_bytes(_port, (const char*) frame, BUS_RS_HEADER_LENGTH + frame->ext);
+        if (frame->length > 0) {
+            uart_write_bytes(_port, (const char*) frame->data, frame->length);
+        }
+        if (frame->crc) {
+            uint16_t crc = _calculateCrc(frame);
+            uint8_t trailer[BUS_RS_CRC_LENGTH] = {(uint8_t)(crc >> 8), (uint8_t)(crc & 0xFF)};
+            uart_write_bytes(_port, (const char*) trailer, BUS_RS_CRC_LENGTH);
+        }
         uart_wait_tx_done(_port, pdMS_TO_TICKS(timeout));
+        _stats.txFrames++;
         xSemaphoreGive(_writeMutex);
     }
-    free(buffer);
-    buffer = NULL;
 #if defined(DEBUG_BUS)
     ESP_LOGI(TAG, "WRITE - ID: %u | CMD: 0x%02X | LENGTH: 0x%02X | CHCK: 0x%02X | DATA:", \
             frame->id, frame->cmd, frame->length, frame->checksum);
@@ -118,63 +205,84 @@ void BusRS::write(Frame_t* frame, uint32_t timeout)
 
 /**
  * @brief Receive RS frame
+ * The received bytes are given to the parser, which drops garbage and corrupted
+ * frames and resynchronizes on the next valid header.
  * 
  * @param frame 
+ * @param timeout 
+ * @param size Size of the buffer pointed by frame->data
  */
-int BusRS::read(Frame_t* frame, uint32_t timeout)
+int BusRS::read(Frame_t* frame, uint32_t timeout, size_t size)
 {
     uart_event_t event;
-    uint8_t* buffer = (uint8_t*)malloc(BUS_RS_FRAME_LENGTH_MAX);
-    int index = 0;
-    while (1) {
-        if (xQueueReceive(_eventQueue, (void*)&event, pdMS_TO_TICKS(timeout)) == pdTRUE) {
+    uint8_t chunk[128];
+    TickType_t start = xTaskGetTickCount();
+    TickType_t ticks = pdMS_TO_TICKS(timeout);
+    TickType_t elapsed;
+    TickType_t wait;
+
+    while (!_parser.next()) {
+        if (_rxPending > 0) { // Get the bytes announced by the last event
+            size_t n = (_rxPending > sizeof(chunk)) ? sizeof(chunk) : _rxPending;
+            if (n > _parser.space()) {
+                n = _parser.space();
+            }
+            int length = uart_read_bytes(_port, chunk, n, 0);
+            if (length <= 0) {
+                _rxPending = 0;
+            } else {
+                _parser.push(chunk, length);
+                _rxPending -= length;
+            }
+            continue;
+        }
+
+        elapsed = xTaskGetTickCount() - start;
+        if (timeout == portMAX_DELAY) {
+            wait = portMAX_DELAY;
+        } else if (elapsed < ticks) {
+            wait = ticks - elapsed;
+        } else {
+            ESP_LOGE(TAG, "Timeout error");
+            return -1;
+        }
+        if (_parser.busy() && (wait > pdMS_TO_TICKS(BUS_RS_GAP_TIMEOUT))) {
+            wait = pdMS_TO_TICKS(BUS_RS_GAP_TIMEOUT);
+        }
+
+        if (xQueueReceive(_eventQueue, (void*)&event, wait) == pdTRUE) {
             if (event.type == UART_DATA) {
-                uart_read_bytes(_port, buffer, event.size, pdMS_TO_TICKS(timeout));
-                if (index == 0) { // Start frame
-                    if (event.size >= BUS_RS_HEADER_LENGTH) { // Get header frame
-                        memcpy(frame, buffer, BUS_RS_HEADER_LENGTH);
-                        memcpy(frame->data, &buffer[BUS_RS_HEADER_LENGTH], event.size - BUS_RS_HEADER_LENGTH);
-                        index += (event.size - BUS_RS_HEADER_LENGTH);
-                        if ((frame->sync != BUS_RS_SYNC_BYTE) || (frame->length > BUS_RS_DATA_LENGTH_MAX)) { // Check header frame
-                            ESP_LOGE(TAG, "Invalid header frame");
-                            goto error;
-                        }
-                    } else {
-                        // Ignore data
-                    }
-                } else {
-                    memcpy(&frame->data[index], buffer, event.size);
-                    index += event.size;
-                }
-                if (index >= frame->length || index > BUS_RS_FRAME_LENGTH_MAX) {
-                    xSemaphoreGive(_writeReadMutex);
-                    if (_verifyChecksum(frame)) {
-                        goto success;
-                    } else {
-                        ESP_LOGE(TAG, "Invalid checksum: %02X, expected: %02X", frame->checksum, _calculateChecksum(frame));
-                        goto error;
-                    }
-                }
+                _rxPending += event.size;
             } else {
                 uart_flush_input(_port);
                 xQueueReset(_eventQueue);
+                _parser.reset();
+                _rxPending = 0;
                 ESP_LOGE(TAG, "Event type error: %d", event.type);
-                goto error;
+                return -1;
             }
-        } else {
-            ESP_LOGE(TAG, "Timeout error");
-            goto error;
+        } else if (_parser.busy()) {
+            _stats.timeoutErrors++;
+            _parser.abort();
+            ESP_LOGE(TAG, "Incomplete frame dropped");
         }
     }
-error:
-    free(buffer);
-    buffer = NULL;
-    xSemaphoreGive(_writeReadMutex);
-    return -1;
-success:
-    free(buffer);
-    buffer = NULL;
-    xSemaphoreGive(_writeReadMutex);
+
+    const uint8_t* header;
+    const uint8_t* data;
+    size_t headerLength;
+    size_t length;
+    _parser.getFrame(&header, &headerLength, &data, &length);
+    if (length > size) {
+        ESP_LOGE(TAG, "Frame too long: %u, buffer size: %u", length, size);
+        return -1;
+    }
+    memcpy(frame, header, headerLength);
+    if (!frame->ext) {
+        frame->tag = 0;
+    }
+    memcpy(frame->data, data, length);
+
 #if defined(DEBUG_BUS)
     ESP_LOGI(TAG, "READ - ID: %u | CMD: 0x%02X | LENGTH: 0x%02X | CHCK: 0x%02X | DATA:", \
             frame->id, frame->cmd, frame->length, frame->checksum);
@@ -183,6 +291,252 @@ success:
     return 0;
 }
 
+/**
+ * @brief Send a frame and wait for its answer
+ * Untagged transactions are serialized. Tagged transactions (frame->ext set) to
+ * different slaves can be in flight at the same time, answers are matched
+ * to their request with the tag. The answer is decoded in frame.
+ * 
+ * @param frame 
+ * @param timeout (ms)
+ * @param size Size of the buffer pointed by frame->data
+ * @return error: -1, succeed: 0
+ */
+int BusRS::transfer(Frame_t* frame, uint32_t timeout, size_t size)
+{
+    TickType_t start = xTaskGetTickCount();
+    TickType_t ticks = pdMS_TO_TICKS(timeout);
+    Transaction_t* transaction = NULL;
+    bool tagged = frame->ext;
+    int err = -1;
+
+    if (!tagged) {
+        if (xSemaphoreTake(_writeReadMutex, ticks) != pdTRUE) {
+            ESP_LOGE(TAG, "Bus busy");
+            return -1;
+        }
+    }
+    transaction = _sendTransaction(frame, size, timeout, start, ticks);
+    if (transaction != NULL) {
+        err = _endTransaction(transaction, start, ticks);
+    }
+    if (!tagged) {
+        xSemaphoreGive(_writeReadMutex);
+    }
+    return err;
+}
+
+int BusRS::transferStart(Frame_t* frame, uint32_t timeout, size_t size)
+{
+    if (!frame->ext) {
+        ESP_LOGE(TAG, "Only tagged requests can be started");
+        return -1;
+    }
+    Transaction_t* transaction = _sendTransaction(frame, size, timeout, xTaskGetTickCount(), pdMS_TO_TICKS(timeout));
+    return (transaction != NULL) ? (int)(transaction - _window) : -1;
+}
+
+int BusRS::transferWait(int transaction, uint32_t timeout)
+{
+    if ((transaction < 0) || (transaction >= BUS_RS_WINDOW_SIZE) || !_window[transaction].busy || 
+        (_window[transaction].task != xTaskGetCurrentTaskHandle())) {
+        ESP_LOGE(TAG, "Invalid transaction: %d", transaction);
+        return -1;
+    }
+    return _endTransaction(&_window[transaction], xTaskGetTickCount(), pdMS_TO_TICKS(timeout));
+}
+
+/**
+ * @brief Reserve a transaction slot and send the request
+ * 
+ * @return Transaction_t* NULL if no slot is available in time
+ */
+BusRS::Transaction_t* BusRS::_sendTransaction(Frame_t* frame, size_t size, uint32_t timeout, TickType_t start, TickType_t ticks)
+{
+    frame->ack = true;
+    Transaction_t* transaction = _openTransaction(frame, size, start, ticks);
+    if (transaction == NULL) {
+        ESP_LOGE(TAG, "No transaction available");
+        return NULL;
+    }
+    transaction->checksumErrors = _parser.getCounters().checksumErrors;
+    write(frame, timeout);
+    transaction->sent = esp_timer_get_time();
+    return transaction;
+}
+
+/**
+ * @brief Wait for the answer, record the transaction and release its slot
+ */
+int BusRS::_endTransaction(Transaction_t* transaction, TickType_t start, TickType_t ticks)
+{
+    int err = _waitTransaction(transaction, start, ticks);
+    _recordTransaction(transaction->id, transaction->done, (err != 0) || transaction->frame->error, 
+        _parser.getCounters().checksumErrors != transaction->checksumErrors, 
+        (uint32_t)(esp_timer_get_time() - transaction->sent));
+    _closeTransaction(transaction);
+    return err;
+}
+
+/**
+ * @brief Reserve a transaction slot for the frame
+ * A tagged frame gets a free slot of the window as soon as no other request
+ * to the same slave is pending, an untagged frame uses the dedicated slot.
+ * Until then, or while another task paused the bus, the task sleeps and is woken each time 
+ * a slot is freed.
+ * 
+ * @return Transaction_t* NULL on timeout
+ */
+BusRS::Transaction_t* BusRS::_openTransaction(Frame_t* frame, size_t size, TickType_t start, TickType_t ticks)
+{
+    Transaction_t* transaction = NULL;
+
+    while (transaction == NULL) {
+        xSemaphoreTake(_windowMutex, portMAX_DELAY);
+        if ((_pausedBy != NULL) && (_pausedBy != xTaskGetCurrentTaskHandle())) {
+            // Held until resume()
+        } else if (frame->ext) {
+            bool pending = false;
+            for (int i = 0; i < BUS_RS_WINDOW_SIZE; i++) {
+                if (_window[i].busy && (_window[i].id == frame->id)) {
+                    pending = true;
+                } else if (!_window[i].busy && (transaction == NULL)) {
+                    transaction = &_window[i];
+                }
+            }
+            if (pending) {
+                transaction = NULL;
+            } else if (transaction != NULL) {
+                frame->tag = _nextTag++;
+                transaction->tag = frame->tag;
+            }
+        } else {
+            transaction = &_window[BUS_RS_WINDOW_SIZE];
+        }
+        if (transaction != NULL) {
+            transaction->busy = true;
+            transaction->done = false;
+            transaction->status = -1;
+            transaction->id = frame->id;
+            transaction->task = xTaskGetCurrentTaskHandle();
+            transaction->frame = frame;
+            transaction->size = size;
+            _windowActive++;
+        } else {
+            _windowWaiting++;
+        }
+        xSemaphoreGive(_windowMutex);
+
+        if (transaction == NULL) {
+            TickType_t elapsed = xTaskGetTickCount() - start;
+            if ((elapsed >= ticks) || (xSemaphoreTake(_windowFreed, ticks - elapsed) != pdTRUE)) {
+                break;
+            }
+        }
+    }
+    return transaction;
+}
+
+void BusRS::_closeTransaction(Transaction_t* transaction)
+{
+    xSemaphoreTake(_windowMutex, portMAX_DELAY);
+    transaction->busy = false;
+    transaction->task = NULL;
+    transaction->frame = NULL;
+    _windowActive--;
+    for (; _windowWaiting > 0; _windowWaiting--) { // Each waiting task checks the window again
+        xSemaphoreGive(_windowFreed);
+    }
+    if ((_pausedBy != NULL) && (_pausedBy != xTaskGetCurrentTaskHandle()) && (_windowActive == 0)) {
+        xTaskNotifyGive(_pausedBy); // The bus is quiet
+    }
+    xSemaphoreGive(_windowMutex);
+}
+
+/**
+ * @brief Wait for the answer of a transaction
+ * The first waiting task takes the lead and reads the bus for everyone,
+ * the other ones sleep until their answer has been dispatched or the lead is released.
+ */
+int BusRS::_waitTransaction(Transaction_t* transaction, TickType_t start, TickType_t ticks)
+{
+    TickType_t elapsed;
+
+    while (!transaction->done) {
+        elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= ticks) {
+            break;
+        }
+        if (xSemaphoreTake(_readMutex, 0) == pdTRUE) {
+            while (!transaction->done) {
+                elapsed = xTaskGetTickCount() - start;
+                if (elapsed >= ticks) {
+                    break;
+                }
+                _rxFrame.data = _rxBuffer;
+                if (read(&_rxFrame, pdTICKS_TO_MS(ticks - elapsed)) == 0) {
+                    _dispatch(&_rxFrame);
+                }
+            }
+            xSemaphoreGive(_readMutex);
+
+            /* Wake up pending transactions so that one of them takes the lead */
+            xSemaphoreTake(_windowMutex, portMAX_DELAY);
+            for (int i = 0; i < BUS_RS_WINDOW_SIZE + 1; i++) {
+                if (_window[i].busy && !_window[i].done && (&_window[i] != transaction)) {
+                    xTaskNotifyGive(_window[i].task);
+                }
+            }
+            xSemaphoreGive(_windowMutex);
+        } else {
+            ulTaskNotifyTake(pdTRUE, ticks - elapsed);
+        }
+    }
+
+    if (!transaction->done) {
+        ESP_LOGE(TAG, "Transaction timeout, id: %u", transaction->id);
+    }
+    return transaction->done ? transaction->status : -1;
+}
+
+/**
+ * @brief Give a received frame to the transaction waiting for it
+ */
+void BusRS::_dispatch(Frame_t* frame)
+{
+    Transaction_t* transaction = NULL;
+
+    xSemaphoreTake(_windowMutex, portMAX_DELAY);
+    if (frame->ext) {
+        for (int i = 0; i < BUS_RS_WINDOW_SIZE; i++) {
+            if (_window[i].busy && !_window[i].done && (_window[i].tag == frame->tag)) {
+                transaction = &_window[i];
+                break;
+            }
+        }
+    } else if (_window[BUS_RS_WINDOW_SIZE].busy && !_window[BUS_RS_WINDOW_SIZE].done) {
+        transaction = &_window[BUS_RS_WINDOW_SIZE];
+    }
+
+    if (transaction != NULL) {
+        if (frame->length <= transaction->size) {
+            memcpy(transaction->frame, frame, BUS_RS_HEADER_LENGTH + 1); // Header and tag
+            memcpy(transaction->frame->data, frame->data, frame->length);
+            transaction->status = 0;
+        } else {
+            ESP_LOGE(TAG, "Frame too long: %u, buffer size: %u", frame->length, transaction->size);
+            transaction->status = -1;
+        }
+        transaction->done = true;
+        if (transaction->task != xTaskGetCurrentTaskHandle()) {
+            xTaskNotifyGive(transaction->task);
+        }
+    } else {
+        ESP_LOGW(TAG, "Unexpected frame, id: %u, cmd: 0x%02X, tag: %u", frame->id, frame->cmd, frame->tag);
+    }
+    xSemaphoreGive(_windowMutex);
+}
+
 /**
  * @brief Calculates the checksum of a RS frame
  * 
@@ -197,21 +551,327 @@ uint8_t BusRS::_calculateChecksum(Frame_t *frame)
     checksum ^= (frame->flags & 0xFF);
     checksum ^= (frame->length >> 8);
     checksum ^= (frame->length & 0xFF);
-    for (int i=0; i<frame->length; i++) {
-        checksum ^= frame->data[i];
+    if (frame->ext) {
+        checksum ^= frame->tag;
+    }
+    /* With a CRC, the checksum only protects the header */
+    if (!frame->crc) {
+        for (int i=0; i<frame->length; i++) {
+            checksum ^= frame->data[i];
+        }
     }
     return checksum;
 }
 
 /**
- * @brief Verifies the checksum of an RS frame
+ * @brief Calculates the CRC-16 of a RS frame, over the header as sent (tag included) and the payload
  * 
  * @param frame 
- * @return true 
- * @return false 
+ * @return uint16_t crc
+ */
+uint16_t BusRS::_calculateCrc(Frame_t *frame)
+{
+    uint16_t crc = BusRSParser::crc16(0xFFFF, (const uint8_t*) frame, BUS_RS_HEADER_LENGTH + frame->ext);
+    return BusRSParser::crc16(crc, frame->data, frame->length);
+}
+
+/**
+ * @brief Protect the frames sent to a slave with a CRC-16.
+ * Only enable it for slaves which announced BUS_RS_CAPABILITY_CRC.
+ * 
+ * @param id Slave id
+ * @param enable 
+ */
+void BusRS::setCrc(uint16_t id, bool enable)
+{
+    if (id < BUS_RS_ID_MAX) {
+        if (enable) {
+            _crcEnabled[id / 8] |= (1 << (id % 8));
+        } else {
+            _crcEnabled[id / 8] &= ~(1 << (id % 8));
+        }
+    }
+}
+
+bool BusRS::getCrc(uint16_t id)
+{
+    return (id < BUS_RS_ID_MAX) && (_crcEnabled[id / 8] & (1 << (id % 8)));
+}
+
+void BusRS::getStats(Stats_t* stats)
+{
+    const BusRSParser::Counters_t& counters = _parser.getCounters();
+    memcpy(stats, &_stats, sizeof(Stats_t));
+    stats->rxFrames = counters.frames;
+    stats->framingErrors = counters.framingErrors;
+    stats->checksumErrors = counters.checksumErrors;
+}
+
+void BusRS::resetStats(void)
+{
+    memset(&_stats, 0, sizeof(Stats_t));
+    _parser.resetCounters();
+    memset(&_rateSnapshot, 0, sizeof(Stats_t));
+    memset(_rateStats, 0, sizeof(_rateStats));
+}
+
+/**
+ * @brief Change the baud rate of the uart, once the pending frame has been sent.
+ * The modules of the rail must be switched together, see Master::negotiateBaudRate,
+ * and the bus paused so that no frame crosses the switch.
+ * 
+ * @param index Index in BUS_RS_BAUD_RATES
+ * @return error: -1, succeed: 0
+ */
+int BusRS::setBaudRate(uint8_t index)
+{
+    if (index >= BUS_RS_BAUD_RATES_NB) {
+        return -1;
+    }
+    _updateRateStats();
+    xSemaphoreTake(_writeMutex, portMAX_DELAY);
+    uart_wait_tx_done(_port, pdMS_TO_TICKS(10));
+    esp_err_t err = uart_set_baudrate(_port, _baudRates[index]);
+    if (err == ESP_OK) {
+        _baudRateIndex = index;
+    }
+    xSemaphoreGive(_writeMutex);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set the baud rate to %lu", _baudRates[index]);
+        return -1;
+    }
+    ESP_LOGI(TAG, "Baud rate: %lu", _baudRates[index]);
+    return 0;
+}
+
+/**
+ * @brief Hold the transfers and the writes of the other tasks, then wait for the transactions
+ * in flight to end. The calling task keeps using the bus until resume().
+ * Pauses of the same task nest.
+ * 
+ * @param timeout (ms)
+ * @return 0 when the bus is quiet, -1 on timeout. Call resume() in both cases.
+ */
+int BusRS::pause(uint32_t timeout)
+{
+    TickType_t start = xTaskGetTickCount();
+    TickType_t ticks = pdMS_TO_TICKS(timeout);
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+
+    /* Another task may hold the bus */
+    if (!_waitResume(start, ticks)) {
+        ESP_LOGE(TAG, "Bus paused by another task");
+        return -1;
+    }
+    xSemaphoreTake(_windowMutex, portMAX_DELAY);
+    _pausedBy = self;
+    _pauseDepth++;
+    ulTaskNotifyTake(pdTRUE, 0);
+    int active = _windowActive;
+    xSemaphoreGive(_windowMutex);
+
+    /* The transactions in flight end with their answer or their timeout */
+    while (active > 0) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= ticks) {
+            ESP_LOGW(TAG, "%d transactions still in flight", active);
+            return -1;
+        }
+        ulTaskNotifyTake(pdTRUE, ticks - elapsed);
+        xSemaphoreTake(_windowMutex, portMAX_DELAY);
+        active = _windowActive;
+        xSemaphoreGive(_windowMutex);
+    }
+
+    /* And the frame being written */
+    xSemaphoreTake(_writeMutex, portMAX_DELAY);
+    xSemaphoreGive(_writeMutex);
+    return 0;
+}
+
+/**
+ * @brief Release the bus held by pause()
+ */
+void BusRS::resume(void)
+{
+    xSemaphoreTake(_windowMutex, portMAX_DELAY);
+    if ((_pausedBy == xTaskGetCurrentTaskHandle()) && (--_pauseDepth == 0)) {
+        _pausedBy = NULL;
+        for (; _windowWaiting > 0; _windowWaiting--) {
+            xSemaphoreGive(_windowFreed);
+        }
+    }
+    xSemaphoreGive(_windowMutex);
+}
+
+/**
+ * @brief Wait until the bus is not paused by another task
+ * 
+ * @return false on timeout
+ */
+bool BusRS::_waitResume(TickType_t start, TickType_t ticks)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    while (1) {
+        xSemaphoreTake(_windowMutex, portMAX_DELAY);
+        if ((_pausedBy == NULL) || (_pausedBy == self)) {
+            xSemaphoreGive(_windowMutex);
+            return true;
+        }
+        _windowWaiting++;
+        xSemaphoreGive(_windowMutex);
+
+        if (ticks == portMAX_DELAY) {
+            xSemaphoreTake(_windowFreed, portMAX_DELAY);
+            continue;
+        }
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if ((elapsed >= ticks) || (xSemaphoreTake(_windowFreed, ticks - elapsed) != pdTRUE)) {
+            return false;
+        }
+    }
+}
+
+/**
+ * @brief Get the counters of the frames received at a baud rate
+ * 
+ * @param index Index in BUS_RS_BAUD_RATES
+ * @param stats 
+ */
+void BusRS::getRateStats(uint8_t index, RateStats_t* stats)
+{
+    _updateRateStats();
+    if (index < BUS_RS_BAUD_RATES_NB) {
+        memcpy(stats, &_rateStats[index], sizeof(RateStats_t));
+        stats->baudRate = _baudRates[index];
+    } else {
+        memset(stats, 0, sizeof(RateStats_t));
+    }
+}
+
+int BusRS::getSlaveStats(uint16_t id, SlaveStats_t* stats)
+{
+    int index = -1;
+    portENTER_CRITICAL(&_slaveStatsLock);
+    for (int i = 0; i < _slaveStatsNb; i++) {
+        if (_slaveStats[i].id == id) {
+            index = i;
+            stats->id = id;
+            stats->transactions = _slaveStats[i].transactions;
+            stats->timeouts = _slaveStats[i].timeouts;
+            stats->errors = _slaveStats[i].errors;
+            stats->corrupted = _slaveStats[i].corrupted;
+            stats->max = _slaveStats[i].max;
+            memcpy(stats->histogram, _slaveStats[i].histogram, sizeof(stats->histogram));
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&_slaveStatsLock);
+    if (index < 0) {
+        return -1;
+    }
+
+    /* Percentiles of the answered transactions, bounded by the longest one */
+    uint32_t total = 0;
+    for (int i = 0; i < BUS_RS_LATENCY_BINS; i++) {
+        total += stats->histogram[i];
+    }
+    uint32_t p50 = (total + 1) / 2;
+    uint32_t p99 = total - total / 100;
+    uint32_t count = 0;
+    stats->p50 = 0;
+    stats->p99 = 0;
+    for (int i = 0; i < BUS_RS_LATENCY_BINS; i++) {
+        count += stats->histogram[i];
+        uint32_t bound = std::min((uint32_t)((1ULL << i) - 1), stats->max);
+        if ((stats->p50 == 0) && (count >= p50) && (count > 0)) {
+            stats->p50 = bound;
+        }
+        if ((stats->p99 == 0) && (count >= p99) && (count > 0)) {
+            stats->p99 = bound;
+        }
+    }
+    return 0;
+}
+
+int BusRS::getSlaveStatsIds(uint16_t* ids, int max)
+{
+    int nb = 0;
+    portENTER_CRITICAL(&_slaveStatsLock);
+    for (int i = 0; (i < _slaveStatsNb) && (nb < max); i++) {
+        ids[nb++] = _slaveStats[i].id;
+    }
+    portEXIT_CRITICAL(&_slaveStatsLock);
+    return nb;
+}
+
+void BusRS::resetSlaveStats(void)
+{
+    portENTER_CRITICAL(&_slaveStatsLock);
+    _slaveStatsNb = 0;
+    memset(_slaveStats, 0, sizeof(_slaveStats));
+    portEXIT_CRITICAL(&_slaveStatsLock);
+}
+
+/**
+ * @brief Count a transaction, its latency goes to the bin of its highest bit
+ */
+void BusRS::_recordTransaction(uint16_t id, bool answered, bool error, bool corrupted, uint32_t latency)
+{
+    int bin = (latency == 0) ? 0 : (32 - __builtin_clz(latency));
+    if (bin >= BUS_RS_LATENCY_BINS) {
+        bin = BUS_RS_LATENCY_BINS - 1;
+    }
+
+    portENTER_CRITICAL(&_slaveStatsLock);
+    SlaveCounters_t* counters = NULL;
+    for (int i = 0; i < _slaveStatsNb; i++) {
+        if (_slaveStats[i].id == id) {
+            counters = &_slaveStats[i];
+            break;
+        }
+    }
+    if ((counters == NULL) && (_slaveStatsNb < BUS_RS_SLAVE_STATS_NB)) {
+        counters = &_slaveStats[_slaveStatsNb++];
+        counters->id = id;
+    }
+    if (counters != NULL) {
+        counters->transactions++;
+        if (!answered) {
+            counters->timeouts += corrupted ? 0 : 1;
+            counters->corrupted += corrupted ? 1 : 0;
+        } else {
+            counters->errors += error ? 1 : 0;
+            counters->histogram[bin]++;
+            if (latency > counters->max) {
+                counters->max = latency;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&_slaveStatsLock);
+}
+
+void BusRS::_updateRateStats(void)
+{
+    Stats_t stats;
+    getStats(&stats);
+    RateStats_t* rate = &_rateStats[_baudRateIndex];
+    rate->rxFrames += stats.rxFrames - _rateSnapshot.rxFrames;
+    rate->framingErrors += stats.framingErrors - _rateSnapshot.framingErrors;
+    rate->checksumErrors += stats.checksumErrors - _rateSnapshot.checksumErrors;
+    rate->timeoutErrors += stats.timeoutErrors - _rateSnapshot.timeoutErrors;
+    _rateSnapshot = stats;
+}
+
+/**
+ * @brief Flip bits of the next received frame before it is verified, to check that it is dropped.
+ * Bits are numbered from the first header byte, through the payload and the CRC.
+ * 
+ * @param id Only corrupt a frame of this slave, 0 for any frame
+ * @param bits Bit indexes
+ * @param count Number of bits, up to BUS_RS_FAULT_BITS_MAX
  */
-bool BusRS::_verifyChecksum(Frame_t *frame)
+void BusRS::injectFault(uint16_t id, const uint32_t* bits, size_t count)
 {
-    uint8_t checksum = _calculateChecksum(frame);
-    return (frame->checksum == checksum);
+    _parser.injectFault(id, bits, count);
 }
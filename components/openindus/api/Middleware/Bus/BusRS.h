@@ -23,6 +23,40 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "BusRSParser.h"
+
+#define BUS_RS_POOL_SIZE 4
+#define BUS_RS_ID_MAX 2048 // 11 bits identifiers
+#define BUS_RS_GAP_TIMEOUT 10 // ms, an incomplete frame is dropped when the line stays idle
+
+/* Baud rates of the rail, the first one is used until the master negotiates a faster one */
+#define BUS_RS_BAUD_RATE 921600
+#define BUS_RS_BAUD_RATES {BUS_RS_BAUD_RATE, 2000000, 3000000, 4000000, 5000000}
+#define BUS_RS_BAUD_RATES_NB 5
+#define BUS_RS_BAUD_PROBATION 500 // ms, a new baud rate is reverted unless the master confirms it
+
+/* Protocol negotiation (CMD_GET_CAPABILITIES) */
+#define BUS_RS_PROTOCOL_VERSION 1
+#define BUS_RS_CAPABILITY_TAG (1 << 0) // Frames can carry a sequence tag
+#define BUS_RS_CAPABILITY_BATCH (1 << 1) // Several callbacks can be run with CMD_RUN_CALLBACK_BATCH
+#define BUS_RS_CAPABILITY_CRC (1 << 2) // Frames can be protected by a CRC-16
+#define BUS_RS_CAPABILITY_BAUD (1 << 3) // The baud rate can be switched (CMD_GET_BAUD_RATES, CMD_SET_BAUD_RATE)
+#define BUS_RS_CAPABILITY_WINDOW (1 << 4) // Firmware can be received in a sliding window (CMD_FLASH_LOADER_CHUNK)
+#define BUS_RS_CAPABILITY_DEFLATE (1 << 5) // Compressed firmware can be received (CMD_FLASH_LOADER_DEFL_BEGIN)
+#define BUS_RS_CAPABILITY_CAN_PRIORITY (1 << 6) // CAN frames can carry priority identifiers (CMD_SET_CAN_PRIORITY)
+#define BUS_RS_CAPABILITY_CAN_SEGMENT (1 << 7) // CAN messages can be segmented (CMD_CAN_SEGMENT)
+#define BUS_RS_CAPABILITIES (BUS_RS_CAPABILITY_TAG | BUS_RS_CAPABILITY_BATCH | BUS_RS_CAPABILITY_CRC | \
+    BUS_RS_CAPABILITY_BAUD | BUS_RS_CAPABILITY_WINDOW | BUS_RS_CAPABILITY_DEFLATE | BUS_RS_CAPABILITY_CAN_PRIORITY | \
+    BUS_RS_CAPABILITY_CAN_SEGMENT)
+
+/* Maximum number of tagged transactions in flight */
+#define BUS_RS_WINDOW_SIZE 4
+#define BUS_RS_WINDOW_WAITERS 16 // Tasks waiting for a slot of the window, woken when one is freed
+
+/* Transaction statistics of the slaves (master side) */
+#define BUS_RS_SLAVE_STATS_NB 32 // Slaves followed, the next ones are not counted
+#define BUS_RS_LATENCY_BINS 24 // Bin n: latency below 2^n us, the last one holds the longer ones
 
 class BusRS
 {
@@ -37,19 +71,128 @@ public:
                 uint16_t dir        : 1;    // 1 --> Master to Slave | 0 --> Slave to Master
                 uint16_t ack        : 1;    // ack needed
                 uint16_t error      : 1;    // Error
-                uint16_t reserved   : 2;
+                uint16_t ext        : 1;    // 1 --> Header is followed by the tag byte
+                uint16_t crc        : 1;    // 1 --> Payload is followed by a CRC-16/CCITT of the frame
             };
             uint16_t flags;
         };
         uint16_t length; // data length
         uint8_t checksum;
+        uint8_t tag; // Sequence tag, only sent if ext is set
         uint8_t* data;
     } Frame_t;
 
+    typedef struct {
+        uint32_t txFrames;
+        uint32_t rxFrames;
+        uint32_t framingErrors;     // Garbage between frames and rejected headers
+        uint32_t checksumErrors;    // Corrupted frames, dropped
+        uint32_t timeoutErrors;     // Incomplete frames, dropped
+    } Stats_t;
+
+    typedef struct {
+        uint32_t baudRate;
+        uint32_t rxFrames;
+        uint32_t framingErrors;
+        uint32_t checksumErrors;
+        uint32_t timeoutErrors;
+    } RateStats_t;
+
+    typedef struct {
+        uint16_t id;
+        uint32_t transactions;
+        uint32_t timeouts;
+        uint32_t errors;        // Error flag set in the answer
+        uint32_t corrupted;     // Timeouts while a corrupted frame was dropped
+        uint32_t p50;           // us, upper bound of the latency bin
+        uint32_t p99;           // us
+        uint32_t max;           // us
+        uint32_t histogram[BUS_RS_LATENCY_BINS];
+    } SlaveStats_t;
+
     static int begin(uart_port_t port, gpio_num_t tx_num, gpio_num_t rx_num);
     static void end(void);
     static void write(Frame_t* frame, uint32_t timeout=0);
-    static int read(Frame_t* frame, uint32_t timeout=portMAX_DELAY);
+    static int read(Frame_t* frame, uint32_t timeout=portMAX_DELAY, size_t size=BUS_RS_DATA_LENGTH_MAX);
+    static int transfer(Frame_t* frame, uint32_t timeout, size_t size=BUS_RS_DATA_LENGTH_MAX);
+
+    /**
+     * @brief Send a tagged request (frame->ext set) without waiting for its answer.
+     * A task can start requests to several slaves, then collect their answers with transferWait().
+     * 
+     * @param frame Request, the answer is decoded in it: it must stay valid until transferWait()
+     * @param timeout (ms) Maximum time to wait for a free slot of the window
+     * @param size Size of the buffer pointed by frame->data
+     * @return int Transaction handle, -1 on error
+     */
+    static int transferStart(Frame_t* frame, uint32_t timeout, size_t size=BUS_RS_DATA_LENGTH_MAX);
+
+    /**
+     * @brief Wait for the answer of a request sent by transferStart(), the transaction is released
+     * 
+     * @param transaction Handle returned by transferStart()
+     * @param timeout (ms)
+     * @return error: -1, succeed: 0
+     */
+    static int transferWait(int transaction, uint32_t timeout);
+
+    static inline uint8_t getCapabilities(void) {
+        return BUS_RS_CAPABILITIES;
+    }
+
+    static uint8_t* allocBuffer(uint32_t timeout=portMAX_DELAY);
+    static void freeBuffer(uint8_t* buffer);
+
+    static void setCrc(uint16_t id, bool enable);
+    static bool getCrc(uint16_t id);
+
+    static void getStats(Stats_t* stats);
+    static void resetStats(void);
+
+    static void injectFault(uint16_t id, const uint32_t* bits, size_t count);
+
+    static int setBaudRate(uint8_t index);
+    static int pause(uint32_t timeout);
+    static void resume(void);
+
+    static inline uint8_t getBaudRateIndex(void) {
+        return _baudRateIndex;
+    }
+
+    static inline uint32_t getBaudRate(uint8_t index) {
+        return (index < BUS_RS_BAUD_RATES_NB) ? _baudRates[index] : 0;
+    }
+
+    /**
+     * @brief Baud rates supported by this module
+     * 
+     * @return uint8_t Bit n set if BUS_RS_BAUD_RATES[n] is supported
+     */
+    static inline uint8_t getBaudRates(void) {
+        return (1 << BUS_RS_BAUD_RATES_NB) - 1;
+    }
+
+    static void getRateStats(uint8_t index, RateStats_t* stats);
+
+    /**
+     * @brief Transactions of a slave: counts and latency, from the request to the answer
+     * 
+     * @param id Slave id
+     * @param stats 
+     * @return error: -1 if no transaction has been recorded, succeed: 0
+     */
+    static int getSlaveStats(uint16_t id, SlaveStats_t* stats);
+
+    /**
+     * @brief Slaves with recorded transactions
+     * 
+     * @param ids 
+     * @param max Size of ids
+     * @return int Number of slaves
+     */
+    static int getSlaveStatsIds(uint16_t* ids, int max);
+
+    static void resetSlaveStats(void);
 
 private:
 
@@ -58,7 +201,79 @@ private:
     static SemaphoreHandle_t _writeMutex;
     static SemaphoreHandle_t _writeReadMutex;
 
+    /* Payload buffers owned by the bus, lent to callers to avoid heap allocations */
+    static uint8_t _pool[BUS_RS_POOL_SIZE][BUS_RS_DATA_LENGTH_MAX];
+    static QueueHandle_t _poolQueue;
+
+    /* Pending transactions, the last slot is reserved for the untagged one */
+    typedef struct {
+        bool busy;
+        bool done;
+        int status;
+        uint8_t tag;
+        uint16_t id;
+        TaskHandle_t task;
+        Frame_t* frame;
+        size_t size;
+        int64_t sent;               // us
+        uint32_t checksumErrors;    // When the request was sent
+    } Transaction_t;
+
+    static Transaction_t _window[BUS_RS_WINDOW_SIZE + 1];
+    static SemaphoreHandle_t _windowMutex;
+    static SemaphoreHandle_t _windowFreed; // Given by _closeTransaction and resume, once per waiting task
+    static int _windowWaiting;
+    static int _windowActive; // Open transactions
+    static volatile TaskHandle_t _pausedBy; // The other tasks wait until resume()
+    static int _pauseDepth;
+    static SemaphoreHandle_t _readMutex;
+    static uint8_t _nextTag;
+    static Frame_t _rxFrame;
+    static uint8_t _rxBuffer[BUS_RS_DATA_LENGTH_MAX];
+
+    static bool _waitResume(TickType_t start, TickType_t ticks);
+    static Transaction_t* _openTransaction(Frame_t* frame, size_t size, TickType_t start, TickType_t ticks);
+    static void _closeTransaction(Transaction_t* transaction);
+    static int _waitTransaction(Transaction_t* transaction, TickType_t start, TickType_t ticks);
+    static Transaction_t* _sendTransaction(Frame_t* frame, size_t size, uint32_t timeout, TickType_t start, TickType_t ticks);
+    static int _endTransaction(Transaction_t* transaction, TickType_t start, TickType_t ticks);
+    static void _dispatch(Frame_t* frame);
+
+    /* Received bytes are framed by the parser, an event can announce more bytes than it has room for */
+    static BusRSParser _parser;
+    static size_t _rxPending;
+
+    /* Frames sent to these slaves are protected by a CRC (master side) */
+    static uint8_t _crcEnabled[BUS_RS_ID_MAX / 8];
+
+    static Stats_t _stats;
+
+    /* Counters are attributed to the baud rate in use when they are collected */
+    static const uint32_t _baudRates[BUS_RS_BAUD_RATES_NB];
+    static uint8_t _baudRateIndex;
+    static RateStats_t _rateStats[BUS_RS_BAUD_RATES_NB];
+    static Stats_t _rateSnapshot;
+
+    static void _updateRateStats(void);
+
+    /* Always on: one short critical section per transaction */
+    typedef struct {
+        uint16_t id;
+        uint32_t transactions;
+        uint32_t timeouts;
+        uint32_t errors;
+        uint32_t corrupted;
+        uint32_t max;
+        uint32_t histogram[BUS_RS_LATENCY_BINS];
+    } SlaveCounters_t;
+
+    static SlaveCounters_t _slaveStats[BUS_RS_SLAVE_STATS_NB];
+    static int _slaveStatsNb;
+    static portMUX_TYPE _slaveStatsLock;
+
+    static void _recordTransaction(uint16_t id, bool answered, bool error, bool corrupted, uint32_t latency);
+
     static uint8_t _calculateChecksum(Frame_t *frame);
-    static bool _verifyChecksum(Frame_t *frame);
+    static uint16_t _calculateCrc(Frame_t *frame);
 
 };
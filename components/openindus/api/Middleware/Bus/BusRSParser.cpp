@@ -0,0 +1,221 @@
+/**
+ * @file BusRSParser.cpp
+ * @brief Resynchronizing parser of the RS bus byte stream
+ * @author Kévin Lefeuvre (kevin.lefeuvre@openindus.com)
+ * @copyright (c) [2025] OpenIndus, Inc. All rights reserved.
+ * @see https://openindus.com
+ */
+
+#include "BusRSParser.h"
+
+/* Header layout: sync, cmd, flags (2 bytes), length (2 bytes), checksum, [tag] */
+#define PARSER_FLAGS(b)     ((uint16_t)((b)[2] | ((b)[3] << 8)))
+#define PARSER_LENGTH(b)    ((size_t)((b)[4] | ((b)[5] << 8)))
+#define PARSER_ID(b)        (PARSER_FLAGS(b) & 0x07FF)
+#define PARSER_EXT(b)       ((PARSER_FLAGS(b) >> 14) & 1)
+#define PARSER_CRC(b)       ((PARSER_FLAGS(b) >> 15) & 1)
+
+BusRSParser::BusRSParser(void)
+{
+    reset();
+    resetCounters();
+    _fault.count = 0;
+}
+
+void BusRSParser::reset(void)
+{
+    _state = PARSER_STATE_SYNC;
+    _length = 0;
+    _pending = 0;
+    _headerLength = BUS_RS_HEADER_LENGTH;
+    _frameLength = 0;
+    _lost = false;
+    _ready = false;
+}
+
+void BusRSParser::abort(void)
+{
+    if (busy()) {
+        _resync();
+    }
+}
+
+size_t BusRSParser::push(const uint8_t* data, size_t length)
+{
+    if (length > space()) {
+        length = space();
+    }
+    memcpy(&_buffer[_length + _pending], data, length);
+    _pending += length;
+    return length;
+}
+
+bool BusRSParser::next(void)
+{
+    /* Drop the frame given by the previous call, the bytes received after it are kept */
+    if (_ready) {
+        memmove(_buffer, &_buffer[_length], _pending);
+        _length = 0;
+        _ready = false;
+        _state = PARSER_STATE_SYNC;
+    }
+
+    while (1) {
+        if (_state == PARSER_STATE_SYNC) {
+            const uint8_t* sync = (const uint8_t*) memchr(_buffer, BUS_RS_SYNC_BYTE, _pending);
+            size_t skipped = (sync != NULL) ? (size_t)(sync - _buffer) : _pending;
+            if (skipped > 0) {
+                if (!_lost) {
+                    _lost = true;
+                    _counters.framingErrors++;
+                }
+                _pending -= skipped;
+                memmove(_buffer, &_buffer[skipped], _pending);
+            }
+            if (_pending == 0) {
+                return false;
+            }
+            _length = 1;
+            _pending--;
+            _headerLength = BUS_RS_HEADER_LENGTH;
+            _state = PARSER_STATE_HEADER;
+            continue;
+        }
+
+        size_t target = (_state == PARSER_STATE_HEADER) ? _headerLength : _frameLength;
+        size_t n = target - _length;
+        if (n > _pending) {
+            n = _pending;
+        }
+        _length += n;
+        _pending -= n;
+        if (_length < target) {
+            return false;
+        }
+
+        if (_state == PARSER_STATE_HEADER) {
+            if ((_headerLength == BUS_RS_HEADER_LENGTH) && PARSER_EXT(_buffer)) {
+                _headerLength++; // Tag byte
+                continue;
+            }
+            if (!_checkHeader()) {
+                if (!_lost) {
+                    _counters.framingErrors++;
+                }
+                _resync();
+                continue;
+            }
+            _frameLength = _headerLength + PARSER_LENGTH(_buffer) + (PARSER_CRC(_buffer) ? BUS_RS_CRC_LENGTH : 0);
+            _state = PARSER_STATE_PAYLOAD;
+        } else {
+            _applyFault();
+            if (_checkFrame()) {
+                _counters.frames++;
+                _lost = false;
+                _ready = true;
+                return true;
+            }
+            if (!_lost) {
+                _counters.checksumErrors++;
+            }
+            _resync();
+        }
+    }
+}
+
+void BusRSParser::getFrame(const uint8_t** header, size_t* headerLength, const uint8_t** data, size_t* length)
+{
+    *header = _buffer;
+    *headerLength = _headerLength;
+    *data = &_buffer[_headerLength];
+    *length = PARSER_LENGTH(_buffer);
+}
+
+void BusRSParser::injectFault(uint16_t id, const uint32_t* bits, size_t count)
+{
+    if (count > BUS_RS_FAULT_BITS_MAX) {
+        count = BUS_RS_FAULT_BITS_MAX;
+    }
+    _fault.count = 0;
+    _fault.id = id;
+    memcpy(_fault.bits, bits, count * sizeof(uint32_t));
+    _fault.count = count;
+}
+
+/**
+ * @brief Check the header before waiting for the payload.
+ * The checksum only covers the header of the frames protected by a CRC.
+ */
+bool BusRSParser::_checkHeader(void)
+{
+    if (PARSER_LENGTH(_buffer) > BUS_RS_DATA_LENGTH_MAX) {
+        return false;
+    }
+    if (PARSER_CRC(_buffer) && (_buffer[6] != _checksum())) {
+        return false;
+    }
+    return true;
+}
+
+bool BusRSParser::_checkFrame(void)
+{
+    if (_buffer[6] != _checksum()) {
+        return false;
+    }
+    if (PARSER_CRC(_buffer)) {
+        size_t length = _frameLength - BUS_RS_CRC_LENGTH;
+        uint16_t crc = (_buffer[length] << 8) | _buffer[length + 1];
+        return (crc == crc16(0xFFFF, _buffer, length));
+    }
+    return true;
+}
+
+/**
+ * @brief XOR checksum of the frame, the payload is left out when the frame has a CRC
+ */
+uint8_t BusRSParser::_checksum(void)
+{
+    uint8_t checksum = 0xFE;
+    for (int i = 1; i < 6; i++) { // cmd, flags and length
+        checksum ^= _buffer[i];
+    }
+    if (PARSER_EXT(_buffer)) {
+        checksum ^= _buffer[7];
+    }
+    if (!PARSER_CRC(_buffer)) {
+        size_t length = PARSER_LENGTH(_buffer);
+        for (size_t i = 0; i < length; i++) {
+            checksum ^= _buffer[_headerLength + i];
+        }
+    }
+    return checksum;
+}
+
+void BusRSParser::_applyFault(void)
+{
+    if ((_fault.count == 0) || ((_fault.id != 0) && (_fault.id != PARSER_ID(_buffer)))) {
+        return;
+    }
+    for (int i = 0; i < _fault.count; i++) {
+        size_t byte = _fault.bits[i] / 8;
+        if ((byte < _frameLength) && (byte != 4) && (byte != 5)) {
+            _buffer[byte] ^= (1 << (_fault.bits[i] % 8));
+        }
+    }
+    _fault.count = 0;
+}
+
+/**
+ * @brief Drop the sync byte of the rejected frame and scan the following bytes again
+ */
+void BusRSParser::_resync(void)
+{
+    size_t total = _length + _pending;
+    const uint8_t* sync = (const uint8_t*) memchr(&_buffer[1], BUS_RS_SYNC_BYTE, total - 1);
+    size_t skipped = (sync != NULL) ? (size_t)(sync - _buffer) : total;
+    _pending = total - skipped;
+    memmove(_buffer, &_buffer[skipped], _pending);
+    _length = 0;
+    _lost = true;
+    _state = PARSER_STATE_SYNC;
+}
@@ -0,0 +1,166 @@
+/**
+ * @file BusRSParser.h
+ * @brief Resynchronizing parser of the RS bus byte stream
+ * @author Kévin Lefeuvre (kevin.lefeuvre@openindus.com)
+ * @copyright (c) [2025] OpenIndus, Inc. All rights reserved.
+ * @see https://openindus.com
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "esp_rom_crc.h"
+
+#define BUS_RS_SYNC_BYTE 0xAA
+#define BUS_RS_HEADER_LENGTH 7
+#define BUS_RS_DATA_LENGTH_MAX 1024
+#define BUS_RS_FRAME_LENGTH_MAX (BUS_RS_HEADER_LENGTH + BUS_RS_DATA_LENGTH_MAX)
+#define BUS_RS_CRC_LENGTH 2
+#define BUS_RS_FAULT_BITS_MAX 8
+
+/* Largest frame (tag and CRC included) plus one chunk of received bytes */
+#define BUS_RS_PARSER_BUFFER_SIZE (BUS_RS_FRAME_LENGTH_MAX + 1 + BUS_RS_CRC_LENGTH + 128)
+
+/**
+ * @brief Incremental parser of the RS bus frames.
+ * Bytes are pushed as they arrive, in chunks of any size. The parser scans for the sync byte,
+ * checks the header before it waits for the payload and verifies the checksum or the CRC.
+ * When a candidate frame is rejected, the bytes after its sync byte are scanned again, so that
+ * a frame hidden by garbage or by a truncated frame is still found. Each loss of synchronization
+ * counts as one error, whatever the number of false candidates rejected before the next frame.
+ * It does not depend on the uart driver and can be fed with recorded traffic on the host.
+ */
+class BusRSParser
+{
+public:
+
+    typedef struct {
+        uint32_t frames;
+        uint32_t framingErrors;     // Garbage between frames and rejected headers
+        uint32_t checksumErrors;    // Corrupted frames
+    } Counters_t;
+
+    BusRSParser(void);
+
+    /**
+     * @brief Drop the buffered bytes
+     *
+     */
+    void reset(void);
+
+    /**
+     * @brief Reject the incomplete frame, when the line went idle before its end.
+     * The bytes received after its sync byte are scanned again by the next call to next().
+     *
+     */
+    void abort(void);
+
+    /**
+     * @brief Number of bytes that can be pushed
+     *
+     * @return size_t
+     */
+    inline size_t space(void) {
+        return BUS_RS_PARSER_BUFFER_SIZE - _length - _pending;
+    }
+
+    /**
+     * @brief Add received bytes to the parser
+     *
+     * @param data
+     * @param length Number of bytes, at most space()
+     * @return size_t Number of bytes added
+     */
+    size_t push(const uint8_t* data, size_t length);
+
+    /**
+     * @brief Parse the buffered bytes until a frame is complete.
+     * The frame stays available until the next call.
+     *
+     * @return true if a frame is available
+     */
+    bool next(void);
+
+    /**
+     * @brief Check if the start of a frame has been received
+     *
+     * @return true if a frame is incomplete
+     */
+    inline bool busy(void) {
+        return (_length > 0) && !_ready;
+    }
+
+    /**
+     * @brief Get the frame found by next()
+     *
+     * @param header Header bytes (BUS_RS_HEADER_LENGTH bytes followed by the tag if the ext flag is set)
+     * @param headerLength
+     * @param data Payload
+     * @param length Payload length
+     */
+    void getFrame(const uint8_t** header, size_t* headerLength, const uint8_t** data, size_t* length);
+
+    inline const Counters_t& getCounters(void) {
+        return _counters;
+    }
+
+    inline void resetCounters(void) {
+        memset(&_counters, 0, sizeof(Counters_t));
+    }
+
+    /**
+     * @brief Flip bits of the next complete frame before it is verified, to check that it is dropped.
+     * Bits are numbered from the sync byte, through the payload and the CRC. The length bytes are
+     * never flipped, so that the size of the frame is kept.
+     *
+     * @param id Only corrupt a frame with this identifier, 0 for any frame
+     * @param bits Bit indexes
+     * @param count Number of bits, up to BUS_RS_FAULT_BITS_MAX
+     */
+    void injectFault(uint16_t id, const uint32_t* bits, size_t count);
+
+    /**
+     * @brief CRC-16/CCITT (poly 0x1021, init 0xFFFF), computed by the ROM table-driven routine
+     *
+     * @param crc Initial value or CRC of the previous bytes
+     * @param data
+     * @param length
+     * @return uint16_t CRC
+     */
+    static inline uint16_t crc16(uint16_t crc, const uint8_t* data, size_t length) {
+        /* The ROM routine complements the CRC on input and output */
+        return ~esp_rom_crc16_be(~crc, data, length);
+    }
+
+private:
+
+    typedef enum {
+        PARSER_STATE_SYNC = 0,
+        PARSER_STATE_HEADER,
+        PARSER_STATE_PAYLOAD,
+    } State_t;
+
+    State_t _state;
+    uint8_t _buffer[BUS_RS_PARSER_BUFFER_SIZE];
+    size_t _length;         // Bytes of the candidate frame, from the sync byte
+    size_t _pending;        // Bytes received after the candidate frame, not parsed yet
+    size_t _headerLength;
+    size_t _frameLength;    // Header, payload and CRC
+    bool _lost;             // Errors are counted once until the next valid frame
+    bool _ready;
+    Counters_t _counters;
+
+    struct {
+        uint16_t id;
+        uint8_t count;
+        uint32_t bits[BUS_RS_FAULT_BITS_MAX];
+    } _fault;
+
+    bool _checkHeader(void);
+    bool _checkFrame(void);
+    uint8_t _checksum(void);
+    void _applyFault(void);
+    void _resync(void);
+};
@@ -7,18 +7,28 @@
  */
 
 #include "DigitalInputs.h"
+#include "esp_timer.h"
 
 static const char TAG[] = "DigitalInputs";
 
+#define DIN_COUNTER_LIMIT           32767   // PCNT high limit in frequency mode
+#define DIN_COUNTER_TASK_PERIOD_MS  10      // Gate time resolution
+
 uint8_t DigitalInputs::_nb = DIN_MAX;
 IsrCallback_t* DigitalInputs::_callbacks;
 void** DigitalInputs::_args;
-QueueHandle_t DigitalInputs::_event;
+TaskHandle_t DigitalInputs::_taskHandle = NULL;
+DigitalInputs::EventBuffer_t* DigitalInputs::_eventBuffers;
+SemaphoreHandle_t DigitalInputs::_eventMutex;
 #if defined(CONFIG_OI_CORE)
 ioex_device_t** DigitalInputs::_device;
 ioex_num_t* DigitalInputs::_ioex_nums;
 #else
 gpio_num_t* DigitalInputs::_gpios;
+DigitalInputs::Counter_t* DigitalInputs::_counters;
+SemaphoreHandle_t DigitalInputs::_counterMutex;
+portMUX_TYPE DigitalInputs::_counterLock = portMUX_INITIALIZER_UNLOCKED;
+TaskHandle_t DigitalInputs::_counterTaskHandle = NULL;
 #endif
 
 #if defined(CONFIG_OI_CORE)
@@ -40,6 +50,12 @@ int DigitalInputs::init(const gpio_num_t *gpio, int nb)
 
     _callbacks = (IsrCallback_t*) calloc(nb, sizeof(IsrCallback_t));
     _args = (void**) calloc(nb, sizeof(void*));
+    _eventBuffers = (EventBuffer_t*) calloc(nb, sizeof(EventBuffer_t));
+    _eventMutex = xSemaphoreCreateMutex();
+#if !defined(CONFIG_OI_CORE)
+    _counters = (Counter_t*) calloc(nb, sizeof(Counter_t));
+    _counterMutex = xSemaphoreCreateMutex();
+#endif
 
     ESP_LOGI(TAG, "Init Digital Inputs");
     
@@ -70,9 +86,8 @@ int DigitalInputs::init(const gpio_num_t *gpio, int nb)
     err |= gpio_config(&dinConf);
 #endif
 
-    _event = xQueueCreate(1, sizeof(uint32_t));
     ESP_LOGI(TAG, "Create interrupt task");
-    xTaskCreate(_task, "DIN intr task", 4096, NULL, 10, NULL);
+    xTaskCreate(_task, "DIN intr task", 4096, NULL, 10, &_taskHandle);
 
     return err;
 }
@@ -100,18 +115,13 @@ void DigitalInputs::attachInterrupt(DIn_Num_t num, IsrCallback_t callback, Inter
             detachInterrupt(num); // Detach previous interrupt
         }
 
-        _callbacks[num] = callback;
+        xSemaphoreTake(_eventMutex, portMAX_DELAY);
         _args[num] = arg;
-
-#if defined(CONFIG_OI_CORE)
-        ioex_isr_handler_add(*_device, _ioex_nums[num], (ioex_isr_t)callback, (void *)num, 1);
-        ioex_set_interrupt_type(*_device, _ioex_nums[num], (ioex_interrupt_type_t)(mode));
-        ioex_interrupt_enable(*_device, _ioex_nums[num]);
-#else
-        gpio_isr_handler_add(_gpios[num], _isr, (void *)num);
-        gpio_set_intr_type(_gpios[num], (gpio_int_type_t)mode);
-        gpio_intr_enable(_gpios[num]);
-#endif
+        _eventBuffers[num].pending.store(0);
+        _eventBuffers[num].callbackMode = (uint8_t)mode;
+        _callbacks[num] = callback;
+        _updateInterrupt(num);
+        xSemaphoreGive(_eventMutex);
     } else {
         ESP_LOGE(TAG, "Invalid DIN_%d", num+1);
     }
@@ -120,47 +130,453 @@ void DigitalInputs::attachInterrupt(DIn_Num_t num, IsrCallback_t callback, Inter
 void DigitalInputs::detachInterrupt(DIn_Num_t num)
 {
     if (num < _nb) {
+        xSemaphoreTake(_eventMutex, portMAX_DELAY);
         _callbacks[num] = NULL;
         _args[num] = NULL;
+        _eventBuffers[num].callbackMode = NONE_MODE;
+        _updateInterrupt(num);
+        xSemaphoreGive(_eventMutex);
+    } else {
+        ESP_LOGE(TAG, "Invalid DIN_%d", num+1);
+    }
+}
+
+void DigitalInputs::captureEvents(DIn_Num_t num, InterruptMode_t mode)
+{
+    if (num < _nb) {
+        EventBuffer_t* buffer = &_eventBuffers[num];
+        xSemaphoreTake(_eventMutex, portMAX_DELAY);
+        buffer->captureMode = NONE_MODE;
+        buffer->tail.store(buffer->head.load());
+        buffer->overflows.store(0);
+        buffer->captureMode = (uint8_t)mode;
+        _updateInterrupt(num); // Back to the edges of the callback when the capture stops
+        xSemaphoreGive(_eventMutex);
+    } else {
+        ESP_LOGE(TAG, "Invalid DIN_%d", num+1);
+    }
+}
+
+int DigitalInputs::readEvents(DIn_Num_t num, DigitalInputEvent_t* events, int max)
+{
+    int count = 0;
+    if (num < _nb) {
+        EventBuffer_t* buffer = &_eventBuffers[num];
+        xSemaphoreTake(_eventMutex, portMAX_DELAY);
+        uint32_t tail = buffer->tail.load(std::memory_order_relaxed);
+        uint32_t head = buffer->head.load(std::memory_order_acquire);
+        while ((tail != head) && (count < max)) {
+            events[count++] = buffer->events[tail % DIN_EVENT_BUFFER_SIZE];
+            tail++;
+        }
+        buffer->tail.store(tail, std::memory_order_release);
+        xSemaphoreGive(_eventMutex);
+    } else {
+        ESP_LOGE(TAG, "Invalid DIN_%d", num+1);
+        count = -1;
+    }
+    return count;
+}
+
+uint32_t DigitalInputs::getEventOverflows(DIn_Num_t num)
+{
+    if (num < _nb) {
+        return _eventBuffers[num].overflows.load();
+    } else {
+        ESP_LOGE(TAG, "Invalid DIN_%d", num+1);
+    }
+    return 0;
+}
+
+int DigitalInputs::attachCounter(DIn_Num_t num, InterruptMode_t edge, CounterMode_t mode, uint32_t gateTime)
+{
 #if defined(CONFIG_OI_CORE)
-        ioex_interrupt_disable(*_device, _ioex_nums[num]);
-        ioex_isr_handler_remove(*_device, _ioex_nums[num]);
+    ESP_LOGE(TAG, "Counter is not available on DIN_%d (IO expander input)", num+1);
+    return -1;
 #else
-        gpio_intr_disable(_gpios[num]);
-        gpio_isr_handler_remove(_gpios[num]);
+    int err = 0;
+
+    if (num >= _nb) {
+        ESP_LOGE(TAG, "Invalid DIN_%d", num+1);
+        return -1;
+    }
+    if ((edge != RISING_MODE) && (edge != FALLING_MODE) && (edge != CHANGE_MODE)) {
+        ESP_LOGE(TAG, "Invalid counter edge");
+        return -1;
+    }
+    if ((mode == COUNTER_MODE_FREQUENCY) && (gateTime < DIN_COUNTER_TASK_PERIOD_MS)) {
+        ESP_LOGE(TAG, "Gate time must be at least %dms", DIN_COUNTER_TASK_PERIOD_MS);
+        return -1;
+    }
+
+    if (_counters[num].unit != NULL) {
+        detachCounter(num); // Detach previous counter
+    }
+
+    xSemaphoreTake(_counterMutex, portMAX_DELAY);
+    Counter_t* counter = &_counters[num];
+
+    /* In period mode, the watch point is reached on every pulse */
+    pcnt_unit_config_t unitConfig = {
+        .low_limit = -1,
+        .high_limit = (mode == COUNTER_MODE_PERIOD) ? 1 : DIN_COUNTER_LIMIT,
+        .intr_priority = 0,
+        .flags = {.accum_count = 0},
+    };
+    if (pcnt_new_unit(&unitConfig, &counter->unit) != ESP_OK) {
+        ESP_LOGE(TAG, "No pulse counter unit available for DIN_%d", num+1);
+        counter->unit = NULL;
+        xSemaphoreGive(_counterMutex);
+        return -1;
+    }
+
+    pcnt_glitch_filter_config_t filterConfig = {
+        .max_glitch_ns = 1000,
+    };
+    err |= pcnt_unit_set_glitch_filter(counter->unit, &filterConfig);
+
+    pcnt_chan_config_t chanConfig = {
+        .edge_gpio_num = _gpios[num],
+        .level_gpio_num = -1,
+        .flags = {},
+    };
+    err |= pcnt_new_channel(counter->unit, &chanConfig, &counter->channel);
+    err |= pcnt_channel_set_edge_action(counter->channel,
+        (edge != FALLING_MODE) ? PCNT_CHANNEL_EDGE_ACTION_INCREASE : PCNT_CHANNEL_EDGE_ACTION_HOLD,
+        (edge != RISING_MODE) ? PCNT_CHANNEL_EDGE_ACTION_INCREASE : PCNT_CHANNEL_EDGE_ACTION_HOLD);
+    err |= pcnt_channel_set_level_action(counter->channel, 
+        PCNT_CHANNEL_LEVEL_ACTION_KEEP, PCNT_CHANNEL_LEVEL_ACTION_KEEP);
+
+    err |= pcnt_unit_add_watch_point(counter->unit, unitConfig.high_limit);
+    pcnt_event_callbacks_t cbs = {
+        .on_reach = _counterIsr,
+    };
+    err |= pcnt_unit_register_event_callbacks(counter->unit, &cbs, (void *)num);
+
+    portENTER_CRITICAL(&_counterLock);
+    counter->mode = mode;
+    counter->overflow = 0;
+    counter->lastPulse = 0;
+    counter->period = 0;
+    counter->gateTime = gateTime;
+    counter->gateStart = esp_timer_get_time();
+    counter->gateCount = 0;
+    counter->frequency = 0;
+    portEXIT_CRITICAL(&_counterLock);
+
+    err |= pcnt_unit_enable(counter->unit);
+    err |= pcnt_unit_clear_count(counter->unit);
+    err |= pcnt_unit_start(counter->unit);
+    xSemaphoreGive(_counterMutex);
+
+    if (err != 0) {
+        ESP_LOGE(TAG, "Failed to attach counter to DIN_%d", num+1);
+        detachCounter(num);
+        return -1;
+    }
+
+    if (_counterTaskHandle == NULL) {
+        ESP_LOGI(TAG, "Create counter task");
+        xTaskCreate(_counterTask, "DIN counter task", 2048, NULL, 5, &_counterTaskHandle);
+    }
+
+    return 0;
 #endif
+}
+
+void DigitalInputs::detachCounter(DIn_Num_t num)
+{
+#if !defined(CONFIG_OI_CORE)
+    if (num < _nb) {
+        xSemaphoreTake(_counterMutex, portMAX_DELAY);
+        Counter_t* counter = &_counters[num];
+        if (counter->unit != NULL) {
+            pcnt_unit_stop(counter->unit);
+            pcnt_unit_disable(counter->unit);
+            if (counter->channel != NULL) {
+                pcnt_del_channel(counter->channel);
+                counter->channel = NULL;
+            }
+            pcnt_del_unit(counter->unit);
+            counter->unit = NULL;
+        }
+        xSemaphoreGive(_counterMutex);
     } else {
         ESP_LOGE(TAG, "Invalid DIN_%d", num+1);
     }
+#endif
 }
 
-void IRAM_ATTR DigitalInputs::_isr(void* pvParameters)
+int64_t DigitalInputs::getCount(DIn_Num_t num)
 {
-    uint32_t din = (uint32_t)pvParameters;
-    xQueueSendFromISR(_event, &din, NULL);
+    int64_t count = 0;
+#if !defined(CONFIG_OI_CORE)
+    if (num < _nb) {
+        xSemaphoreTake(_counterMutex, portMAX_DELAY);
+        if (_counters[num].unit != NULL) {
+            count = _readCount(&_counters[num]);
+        }
+        xSemaphoreGive(_counterMutex);
+    } else {
+        ESP_LOGE(TAG, "Invalid DIN_%d", num+1);
+    }
+#endif
+    return count;
 }
 
-void DigitalInputs::_task(void* pvParameters)
+void DigitalInputs::resetCount(DIn_Num_t num)
+{
+#if !defined(CONFIG_OI_CORE)
+    if (num < _nb) {
+        xSemaphoreTake(_counterMutex, portMAX_DELAY);
+        Counter_t* counter = &_counters[num];
+        if (counter->unit != NULL) {
+            pcnt_unit_clear_count(counter->unit);
+            portENTER_CRITICAL(&_counterLock);
+            counter->overflow = 0;
+            counter->lastPulse = 0;
+            counter->period = 0;
+            counter->gateStart = esp_timer_get_time();
+            counter->gateCount = 0;
+            counter->frequency = 0;
+            portEXIT_CRITICAL(&_counterLock);
+        }
+        xSemaphoreGive(_counterMutex);
+    } else {
+        ESP_LOGE(TAG, "Invalid DIN_%d", num+1);
+    }
+#endif
+}
+
+float DigitalInputs::getFrequency(DIn_Num_t num)
 {
-    DIn_Num_t din;
+    float frequency = 0;
+#if !defined(CONFIG_OI_CORE)
+    if (num < _nb) {
+        if (_counters[num].mode == COUNTER_MODE_PERIOD) {
+            float period = getPeriod(num);
+            frequency = (period > 0) ? (1000000.0f / period) : 0;
+        } else {
+            portENTER_CRITICAL(&_counterLock);
+            frequency = _counters[num].frequency;
+            portEXIT_CRITICAL(&_counterLock);
+        }
+    } else {
+        ESP_LOGE(TAG, "Invalid DIN_%d", num+1);
+    }
+#endif
+    return frequency;
+}
 
-    while(1) {
-        if(xQueueReceive(_event, &din, portMAX_DELAY)) {
-            // Disable interrupt
+float DigitalInputs::getPeriod(DIn_Num_t num)
+{
+    float period = 0;
+#if !defined(CONFIG_OI_CORE)
+    if (num < _nb) {
+        Counter_t* counter = &_counters[num];
+        if (counter->mode == COUNTER_MODE_PERIOD) {
+            int64_t now = esp_timer_get_time();
+            portENTER_CRITICAL(&_counterLock);
+            /* If the input stops, the period grows with the time elapsed since the last pulse */
+            if (counter->period > 0) {
+                period = (float)std::max(counter->period, now - counter->lastPulse);
+            }
+            portEXIT_CRITICAL(&_counterLock);
+        } else {
+            float frequency = getFrequency(num);
+            period = (frequency > 0) ? (1000000.0f / frequency) : 0;
+        }
+    } else {
+        ESP_LOGE(TAG, "Invalid DIN_%d", num+1);
+    }
+#endif
+    return period;
+}
+
+/**
+ * @brief Program the edges wanted by the capture and by the user callback, must be called 
+ * with _eventMutex taken. The modes are bit masks: RISING_MODE | FALLING_MODE is CHANGE_MODE.
+ */
+void DigitalInputs::_updateInterrupt(DIn_Num_t num)
+{
+    EventBuffer_t* buffer = &_eventBuffers[num];
+    uint8_t mode = buffer->captureMode | buffer->callbackMode;
+    if (mode == buffer->intrMode) {
+        return;
+    }
+    if (mode == NONE_MODE) {
+        _disableInterrupt(num);
+    } else {
+        _enableInterrupt(num, (InterruptMode_t)mode);
+    }
+    buffer->intrMode = mode;
+}
+
+/* Whether an edge interests a consumer, the level after the edge tells its direction */
+static inline bool IRAM_ATTR _edgeWanted(uint8_t mode, uint8_t intrMode, int level)
+{
+    if (mode == intrMode) {
+        return true; // Programmed for this consumer only, a short pulse may be read back at its other level
+    }
+    return (mode & (level ? RISING_MODE : FALLING_MODE)) != 0;
+}
+
+void DigitalInputs::_enableInterrupt(DIn_Num_t num, InterruptMode_t mode)
+{
 #if defined(CONFIG_OI_CORE)
-            ioex_interrupt_disable(*_device, _ioex_nums[din]);
+    if (!_eventBuffers[num].isrAdded) {
+        ioex_isr_handler_add(*_device, _ioex_nums[num], _ioexIsr, (void *)num, 1);
+    }
+    ioex_set_interrupt_type(*_device, _ioex_nums[num], (ioex_interrupt_type_t)(mode));
+    ioex_interrupt_enable(*_device, _ioex_nums[num]);
 #else
-            gpio_intr_disable(_gpios[din]);
+    if (!_eventBuffers[num].isrAdded) {
+        gpio_isr_handler_add(_gpios[num], _isr, (void *)num);
+    }
+    gpio_set_intr_type(_gpios[num], (gpio_int_type_t)mode);
+    gpio_intr_enable(_gpios[num]);
 #endif
-            _callbacks[din](_args[din]); // Call user function
+    _eventBuffers[num].isrAdded = true;
+}
 
-            // Re-enable interrupt
+void DigitalInputs::_disableInterrupt(DIn_Num_t num)
+{
 #if defined(CONFIG_OI_CORE)
-            ioex_interrupt_enable(*_device,_ioex_nums[din]);
+    ioex_interrupt_disable(*_device, _ioex_nums[num]);
+    ioex_isr_handler_remove(*_device, _ioex_nums[num]);
 #else
-            gpio_intr_enable(_gpios[din]);
+    gpio_intr_disable(_gpios[num]);
+    gpio_isr_handler_remove(_gpios[num]);
 #endif
-            xQueueReset(_event); // Empty queue to avoid overflow
+    _eventBuffers[num].isrAdded = false;
+}
+
+void IRAM_ATTR DigitalInputs::_recordEvent(uint32_t din, int level)
+{
+    EventBuffer_t* buffer = &_eventBuffers[din];
+    if ((buffer->captureMode != NONE_MODE) && _edgeWanted(buffer->captureMode, buffer->intrMode, level)) {
+        uint32_t head = buffer->head.load(std::memory_order_relaxed);
+        if (head - buffer->tail.load(std::memory_order_acquire) >= DIN_EVENT_BUFFER_SIZE) {
+            buffer->overflows.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            buffer->events[head % DIN_EVENT_BUFFER_SIZE].timestamp = esp_timer_get_time();
+            buffer->events[head % DIN_EVENT_BUFFER_SIZE].level = (uint8_t)level;
+            buffer->head.store(head + 1, std::memory_order_release);
         }
     }
-}
\ No newline at end of file
+}
+
+#if defined(CONFIG_OI_CORE)
+/* Called from the IO expander task */
+void DigitalInputs::_ioexIsr(void* pvParameters)
+{
+    uint32_t din = (uint32_t)pvParameters;
+    int level = ioex_get_level(*_device, _ioex_nums[din]);
+    _recordEvent(din, level);
+    if ((_callbacks[din] != NULL) && _edgeWanted(_eventBuffers[din].callbackMode, _eventBuffers[din].intrMode, level)) {
+        _eventBuffers[din].pending.fetch_add(1);
+        xTaskNotifyGive(_taskHandle);
+    }
+}
+#endif
+
+void IRAM_ATTR DigitalInputs::_isr(void* pvParameters)
+{
+#if !defined(CONFIG_OI_CORE)
+    uint32_t din = (uint32_t)pvParameters;
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    int level = gpio_get_level(_gpios[din]);
+    _recordEvent(din, level);
+    if ((_callbacks[din] != NULL) && _edgeWanted(_eventBuffers[din].callbackMode, _eventBuffers[din].intrMode, level)) {
+        _eventBuffers[din].pending.fetch_add(1);
+        vTaskNotifyGiveFromISR(_taskHandle, &higherPriorityTaskWoken);
+    }
+    portYIELD_FROM_ISR(higherPriorityTaskWoken);
+#endif
+}
+
+void DigitalInputs::_task(void* pvParameters)
+{
+    uint32_t pending;
+
+    while(1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        /* Call the user function once per edge, edges which occur meanwhile are counted */
+        for (uint8_t din = 0; din < _nb; din++) {
+            pending = _eventBuffers[din].pending.exchange(0);
+            while ((pending > 0) && (_callbacks[din] != NULL)) {
+                _callbacks[din](_args[din]);
+                pending--;
+            }
+        }
+    }
+}
+
+#if !defined(CONFIG_OI_CORE)
+/* Must be called with _counterMutex taken */
+int64_t DigitalInputs::_readCount(Counter_t* counter)
+{
+    int value;
+    int64_t overflow, check;
+
+    /* Read again if the watch point was reached meanwhile */
+    do {
+        portENTER_CRITICAL(&_counterLock);
+        overflow = counter->overflow;
+        portEXIT_CRITICAL(&_counterLock);
+        value = 0;
+        pcnt_unit_get_count(counter->unit, &value);
+        portENTER_CRITICAL(&_counterLock);
+        check = counter->overflow;
+        portEXIT_CRITICAL(&_counterLock);
+    } while (overflow != check);
+
+    return overflow + value;
+}
+
+bool IRAM_ATTR DigitalInputs::_counterIsr(pcnt_unit_handle_t unit, const pcnt_watch_event_data_t *edata, void *userCtx)
+{
+    Counter_t* counter = &_counters[(uint32_t)userCtx];
+    int64_t now = esp_timer_get_time();
+
+    /* The unit is cleared when reaching the high limit */
+    portENTER_CRITICAL_ISR(&_counterLock);
+    counter->overflow += edata->watch_point_value;
+    if (counter->mode == COUNTER_MODE_PERIOD) {
+        if (counter->lastPulse != 0) {
+            counter->period = now - counter->lastPulse;
+        }
+        counter->lastPulse = now;
+    }
+    portEXIT_CRITICAL_ISR(&_counterLock);
+
+    return false;
+}
+
+void DigitalInputs::_counterTask(void* pvParameters)
+{
+    int64_t now, count;
+
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(DIN_COUNTER_TASK_PERIOD_MS));
+        xSemaphoreTake(_counterMutex, portMAX_DELAY);
+        now = esp_timer_get_time();
+        for (uint8_t din = 0; din < _nb; din++) {
+            Counter_t* counter = &_counters[din];
+            if ((counter->unit == NULL) || (counter->mode != COUNTER_MODE_FREQUENCY)) {
+                continue;
+            }
+            /* Frequency measured over the gate time */
+            if ((now - counter->gateStart) >= ((int64_t)counter->gateTime * 1000)) {
+                count = _readCount(counter);
+                portENTER_CRITICAL(&_counterLock);
+                counter->frequency = (float)(count - counter->gateCount) * 1000000.0f / (float)(now - counter->gateStart);
+                counter->gateCount = count;
+                counter->gateStart = now;
+                portEXIT_CRITICAL(&_counterLock);
+            }
+        }
+        xSemaphoreGive(_counterMutex);
+    }
+}
+#endif
@@ -10,11 +10,13 @@
 
 #include "Common.h"
 #include "DigitalInputsInterface.h"
+#include <atomic>
 
 #if defined(CONFIG_OI_CORE)
 #include "pcal6524.h"
 #else
 #include "driver/gpio.h"
+#include "driver/pulse_cnt.h"
 #endif
 
 class DigitalInputs : public DigitalInputsInterface
@@ -26,6 +28,16 @@ public:
     int digitalRead(DIn_Num_t num) override;
     void attachInterrupt(DIn_Num_t num, IsrCallback_t callback, InterruptMode_t mode, void *arg = NULL) override;
     void detachInterrupt(DIn_Num_t num) override;
+    void captureEvents(DIn_Num_t num, InterruptMode_t mode) override;
+    int readEvents(DIn_Num_t num, DigitalInputEvent_t* events, int max) override;
+    uint32_t getEventOverflows(DIn_Num_t num) override;
+    int attachCounter(DIn_Num_t num, InterruptMode_t edge = RISING_MODE, 
+        CounterMode_t mode = COUNTER_MODE_FREQUENCY, uint32_t gateTime = 1000) override;
+    void detachCounter(DIn_Num_t num) override;
+    int64_t getCount(DIn_Num_t num) override;
+    void resetCount(DIn_Num_t num) override;
+    float getFrequency(DIn_Num_t num) override;
+    float getPeriod(DIn_Num_t num) override;
 
 protected:
 #if defined(CONFIG_OI_CORE)
@@ -38,10 +50,55 @@ private:
     static uint8_t _nb; // Number of digital inputs
     static IsrCallback_t *_callbacks;
     static void **_args;
-    static QueueHandle_t _event;
+    static TaskHandle_t _taskHandle;
     static void IRAM_ATTR _isr(void *pvParameters);
     static void _task(void *pvParameters);
 
+    /* Edge events ring buffer: written by the interrupt, read by readEvents() */
+    typedef struct {
+        DigitalInputEvent_t events[DIN_EVENT_BUFFER_SIZE];
+        std::atomic<uint32_t> head;
+        std::atomic<uint32_t> tail;
+        std::atomic<uint32_t> overflows;
+        std::atomic<uint32_t> pending; // Edges not yet passed to the user callback
+        uint8_t captureMode;    // Edges recorded, NONE_MODE when not capturing
+        uint8_t callbackMode;   // Edges passed to the user callback
+        uint8_t intrMode;       // Programmed: both of them
+        bool isrAdded;
+    } EventBuffer_t;
+
+    static EventBuffer_t *_eventBuffers;
+    static SemaphoreHandle_t _eventMutex;
+    static void IRAM_ATTR _recordEvent(uint32_t din, int level);
+    static void _updateInterrupt(DIn_Num_t num);
+    static void _enableInterrupt(DIn_Num_t num, InterruptMode_t mode);
+    static void _disableInterrupt(DIn_Num_t num);
+#if defined(CONFIG_OI_CORE)
+    static void _ioexIsr(void *pvParameters);
+#else
+    /* Pulse counter: the PCNT unit counts up to a limit, the overflows are accumulated on 64 bits */
+    typedef struct {
+        pcnt_unit_handle_t unit;
+        pcnt_channel_handle_t channel;
+        CounterMode_t mode;
+        int64_t overflow;   // Pulses counted by the previous PCNT cycles
+        int64_t lastPulse;  // Period mode: time of the last pulse (us)
+        int64_t period;     // Period mode: time between the last two pulses (us)
+        uint32_t gateTime;  // Frequency mode: gate time (ms)
+        int64_t gateStart;  // Frequency mode: start of the current gate (us)
+        int64_t gateCount;  // Frequency mode: count at the start of the current gate
+        float frequency;    // Frequency mode: frequency measured during the last gate (Hz)
+    } Counter_t;
+
+    static Counter_t *_counters;
+    static SemaphoreHandle_t _counterMutex;
+    static portMUX_TYPE _counterLock;
+    static TaskHandle_t _counterTaskHandle;
+    static int64_t _readCount(Counter_t *counter);
+    static void _counterTask(void *pvParameters);
+    static bool IRAM_ATTR _counterIsr(pcnt_unit_handle_t unit, const pcnt_watch_event_data_t *edata, void *userCtx);
+#endif
+
 #if defined(CONFIG_OI_CORE)
     static ioex_device_t** _device; // Pointer to IOEX device
     static ioex_num_t *_ioex_nums; // IOEX numbers for digital inputs
@@ -15,6 +15,12 @@ static const char* TAG = "DigitalInputsCLI";
 decltype(DigitalInputsCLI::digitalReadArgs) DigitalInputsCLI::digitalReadArgs;
 decltype(DigitalInputsCLI::attachInterruptArgs) DigitalInputsCLI::attachInterruptArgs;
 decltype(DigitalInputsCLI::detachInterruptArgs) DigitalInputsCLI::detachInterruptArgs;
+decltype(DigitalInputsCLI::captureEventsArgs) DigitalInputsCLI::captureEventsArgs;
+decltype(DigitalInputsCLI::readEventsArgs) DigitalInputsCLI::readEventsArgs;
+decltype(DigitalInputsCLI::attachCounterArgs) DigitalInputsCLI::attachCounterArgs;
+decltype(DigitalInputsCLI::detachCounterArgs) DigitalInputsCLI::detachCounterArgs;
+decltype(DigitalInputsCLI::readCounterArgs) DigitalInputsCLI::readCounterArgs;
+decltype(DigitalInputsCLI::resetCounterArgs) DigitalInputsCLI::resetCounterArgs;
 
 DigitalInputsInterface* DigitalInputsCLI::_digitalInputsInstance = nullptr;
 
@@ -163,6 +169,252 @@ int DigitalInputsCLI::detachInterruptFunc(int argc, char **argv)
     return 0;
 }
 
+int DigitalInputsCLI::captureEventsFunc(int argc, char **argv)
+{
+    PARSE_ARGS_OR_RETURN(argc, argv, captureEventsArgs);
+
+    // Parse the digital input number
+    DIn_Num_t din = (DIn_Num_t)(captureEventsArgs.din->ival[0] - 1);
+    if (din >= DIN_MAX) {
+        ESP_LOGE(TAG, "Invalid DIN number: %d. Must be between 1 and %d", captureEventsArgs.din->ival[0], DIN_MAX);
+        return -1;
+    }
+
+    // Parse the capture mode
+    InterruptMode_t mode = CHANGE_MODE; // Default mode
+    if (captureEventsArgs.mode->count > 0) {
+        const char *mode_str = captureEventsArgs.mode->sval[0];
+        if (strcmp(mode_str, "rising") == 0) {
+            mode = RISING_MODE;
+        } else if (strcmp(mode_str, "falling") == 0) {
+            mode = FALLING_MODE;
+        } else if (strcmp(mode_str, "change") == 0) {
+            mode = CHANGE_MODE;
+        } else if (strcmp(mode_str, "none") == 0) {
+            mode = NONE_MODE;
+        } else {
+            ESP_LOGE(TAG, "Invalid capture mode: %s. Must be 'rising', 'falling', 'change' or 'none'", mode_str);
+            return -1;
+        }
+    }
+
+#if defined(CONFIG_MODULE_MASTER)
+    CREATE_DIGITAL_INPUTS_INSTANCE(captureEventsArgs.id);
+#else
+    CREATE_DIGITAL_INPUTS_INSTANCE(NULL);
+#endif
+
+    if (_digitalInputsInstance != nullptr) {
+        _digitalInputsInstance->captureEvents(din, mode);
+        printf("Event capture %s on DIN_%d\n", (mode == NONE_MODE) ? "stopped" : "started", captureEventsArgs.din->ival[0]);
+    } else {
+        ESP_LOGE(TAG, "Failed to create instance");
+        return -1;
+    }
+
+    return 0;
+}
+
+int DigitalInputsCLI::readEventsFunc(int argc, char **argv)
+{
+    static DigitalInputEvent_t events[DIN_EVENT_BUFFER_SIZE];
+
+    PARSE_ARGS_OR_RETURN(argc, argv, readEventsArgs);
+
+    // Parse the digital input number
+    DIn_Num_t din = (DIn_Num_t)(readEventsArgs.din->ival[0] - 1);
+    if (din >= DIN_MAX) {
+        ESP_LOGE(TAG, "Invalid DIN number: %d. Must be between 1 and %d", readEventsArgs.din->ival[0], DIN_MAX);
+        return -1;
+    }
+
+    int max = DIN_EVENT_BUFFER_SIZE;
+    if ((readEventsArgs.max->count > 0) && (readEventsArgs.max->ival[0] < DIN_EVENT_BUFFER_SIZE)) {
+        max = readEventsArgs.max->ival[0];
+    }
+
+#if defined(CONFIG_MODULE_MASTER)
+    CREATE_DIGITAL_INPUTS_INSTANCE(readEventsArgs.id);
+#else
+    CREATE_DIGITAL_INPUTS_INSTANCE(NULL);
+#endif
+
+    if (_digitalInputsInstance == nullptr) {
+        ESP_LOGE(TAG, "Failed to create instance");
+        return -1;
+    }
+
+    uint32_t overflows = _digitalInputsInstance->getEventOverflows(din);
+    int count = _digitalInputsInstance->readEvents(din, events, max);
+    if (count < 0) {
+        return -1;
+    }
+
+    // Print events as json: {"overflows":0,"events":[{"t":123456,"l":1},...]}
+    printf("{\"overflows\":%lu,\"events\":[", overflows);
+    for (int i = 0; i < count; i++) {
+        printf("{\"t\":%llu,\"l\":%u}%s", events[i].timestamp, events[i].level, (i < count - 1) ? "," : "");
+    }
+    printf("]}\n");
+
+    return 0;
+}
+
+int DigitalInputsCLI::attachCounterFunc(int argc, char **argv)
+{
+    PARSE_ARGS_OR_RETURN(argc, argv, attachCounterArgs);
+
+    // Parse the digital input number
+    DIn_Num_t din = (DIn_Num_t)(attachCounterArgs.din->ival[0] - 1);
+    if (din >= DIN_MAX) {
+        ESP_LOGE(TAG, "Invalid DIN number: %d. Must be between 1 and %d", attachCounterArgs.din->ival[0], DIN_MAX);
+        return -1;
+    }
+
+    // Parse the counted edges
+    InterruptMode_t edge = RISING_MODE; // Default edge
+    if (attachCounterArgs.edge->count > 0) {
+        const char *edge_str = attachCounterArgs.edge->sval[0];
+        if (strcmp(edge_str, "rising") == 0) {
+            edge = RISING_MODE;
+        } else if (strcmp(edge_str, "falling") == 0) {
+            edge = FALLING_MODE;
+        } else if (strcmp(edge_str, "change") == 0) {
+            edge = CHANGE_MODE;
+        } else {
+            ESP_LOGE(TAG, "Invalid edge: %s. Must be 'rising', 'falling', or 'change'", edge_str);
+            return -1;
+        }
+    }
+
+    // Parse the measurement mode
+    CounterMode_t mode = COUNTER_MODE_FREQUENCY; // Default mode
+    if (attachCounterArgs.mode->count > 0) {
+        const char *mode_str = attachCounterArgs.mode->sval[0];
+        if (strcmp(mode_str, "frequency") == 0) {
+            mode = COUNTER_MODE_FREQUENCY;
+        } else if (strcmp(mode_str, "period") == 0) {
+            mode = COUNTER_MODE_PERIOD;
+        } else {
+            ESP_LOGE(TAG, "Invalid counter mode: %s. Must be 'frequency' or 'period'", mode_str);
+            return -1;
+        }
+    }
+
+    uint32_t gateTime = 1000; // Default gate time
+    if (attachCounterArgs.gate->count > 0) {
+        gateTime = (uint32_t)attachCounterArgs.gate->ival[0];
+    }
+
+#if defined(CONFIG_MODULE_MASTER)
+    CREATE_DIGITAL_INPUTS_INSTANCE(attachCounterArgs.id);
+#else
+    CREATE_DIGITAL_INPUTS_INSTANCE(NULL);
+#endif
+
+    if (_digitalInputsInstance == nullptr) {
+        ESP_LOGE(TAG, "Failed to create instance");
+        return -1;
+    }
+
+    if (_digitalInputsInstance->attachCounter(din, edge, mode, gateTime) < 0) {
+        ESP_LOGE(TAG, "Failed to attach counter to DIN_%d", attachCounterArgs.din->ival[0]);
+        return -1;
+    }
+    printf("Counter attached to DIN_%d in %s mode\n", attachCounterArgs.din->ival[0],
+        (mode == COUNTER_MODE_PERIOD) ? "PERIOD" : "FREQUENCY");
+
+    return 0;
+}
+
+int DigitalInputsCLI::detachCounterFunc(int argc, char **argv)
+{
+    PARSE_ARGS_OR_RETURN(argc, argv, detachCounterArgs);
+
+    // Parse the digital input number
+    DIn_Num_t din = (DIn_Num_t)(detachCounterArgs.din->ival[0] - 1);
+    if (din >= DIN_MAX) {
+        ESP_LOGE(TAG, "Invalid DIN number: %d. Must be between 1 and %d", detachCounterArgs.din->ival[0], DIN_MAX);
+        return -1;
+    }
+
+#if defined(CONFIG_MODULE_MASTER)
+    CREATE_DIGITAL_INPUTS_INSTANCE(detachCounterArgs.id);
+#else
+    CREATE_DIGITAL_INPUTS_INSTANCE(NULL);
+#endif
+
+    if (_digitalInputsInstance != nullptr) {
+        _digitalInputsInstance->detachCounter(din);
+        printf("Counter detached from DIN_%d\n", detachCounterArgs.din->ival[0]);
+    } else {
+        ESP_LOGE(TAG, "Failed to create instance");
+        return -1;
+    }
+
+    return 0;
+}
+
+int DigitalInputsCLI::readCounterFunc(int argc, char **argv)
+{
+    PARSE_ARGS_OR_RETURN(argc, argv, readCounterArgs);
+
+    // Parse the digital input number
+    DIn_Num_t din = (DIn_Num_t)(readCounterArgs.din->ival[0] - 1);
+    if (din >= DIN_MAX) {
+        ESP_LOGE(TAG, "Invalid DIN number: %d. Must be between 1 and %d", readCounterArgs.din->ival[0], DIN_MAX);
+        return -1;
+    }
+
+#if defined(CONFIG_MODULE_MASTER)
+    CREATE_DIGITAL_INPUTS_INSTANCE(readCounterArgs.id);
+#else
+    CREATE_DIGITAL_INPUTS_INSTANCE(NULL);
+#endif
+
+    if (_digitalInputsInstance == nullptr) {
+        ESP_LOGE(TAG, "Failed to create instance");
+        return -1;
+    }
+
+    int64_t count = _digitalInputsInstance->getCount(din);
+    float frequency = _digitalInputsInstance->getFrequency(din);
+    float period = _digitalInputsInstance->getPeriod(din);
+
+    // Print counter as json: {"count":1000,"frequency":100.000,"period":10000.000}
+    printf("{\"count\":%lld,\"frequency\":%.3f,\"period\":%.3f}\n", count, frequency, period);
+
+    return 0;
+}
+
+int DigitalInputsCLI::resetCounterFunc(int argc, char **argv)
+{
+    PARSE_ARGS_OR_RETURN(argc, argv, resetCounterArgs);
+
+    // Parse the digital input number
+    DIn_Num_t din = (DIn_Num_t)(resetCounterArgs.din->ival[0] - 1);
+    if (din >= DIN_MAX) {
+        ESP_LOGE(TAG, "Invalid DIN number: %d. Must be between 1 and %d", resetCounterArgs.din->ival[0], DIN_MAX);
+        return -1;
+    }
+
+#if defined(CONFIG_MODULE_MASTER)
+    CREATE_DIGITAL_INPUTS_INSTANCE(resetCounterArgs.id);
+#else
+    CREATE_DIGITAL_INPUTS_INSTANCE(NULL);
+#endif
+
+    if (_digitalInputsInstance != nullptr) {
+        _digitalInputsInstance->resetCount(din);
+        printf("Counter reset on DIN_%d\n", resetCounterArgs.din->ival[0]);
+    } else {
+        ESP_LOGE(TAG, "Failed to create instance");
+        return -1;
+    }
+
+    return 0;
+}
+
 int DigitalInputsCLI::init(void)
 {
     int err = 0;
@@ -229,5 +481,130 @@ int DigitalInputsCLI::init(void)
     };
     err |= esp_console_cmd_register(&detachInterruptCmd);
 
+    // Register capture events command
+    captureEventsArgs.din = arg_int1("d", "din", "<din>", "Digital input number (1-10)");
+    captureEventsArgs.mode = arg_str0("m", "mode", "<mode>", "Edges to record: rising, falling, change, none to stop (default: change)");
+#if defined(CONFIG_MODULE_MASTER)
+    captureEventsArgs.id = arg_int0("i", "id", "<id>", "Module ID for remote operation");
+    captureEventsArgs.end = arg_end(4);
+#else
+    captureEventsArgs.end = arg_end(3);
+#endif
+
+    const esp_console_cmd_t captureEventsCmd = {
+        .command = "capture-events",
+        .help = "Record timestamped edges of a digital input",
+        .hint = NULL,
+        .func = &DigitalInputsCLI::captureEventsFunc,
+        .argtable = &captureEventsArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    err |= esp_console_cmd_register(&captureEventsCmd);
+
+    // Register read events command
+    readEventsArgs.din = arg_int1("d", "din", "<din>", "Digital input number (1-10)");
+    readEventsArgs.max = arg_int0("n", "max", "<max>", "Maximum number of events to read (default: 64)");
+#if defined(CONFIG_MODULE_MASTER)
+    readEventsArgs.id = arg_int0("i", "id", "<id>", "Module ID for remote operation");
+    readEventsArgs.end = arg_end(4);
+#else
+    readEventsArgs.end = arg_end(3);
+#endif
+
+    const esp_console_cmd_t readEventsCmd = {
+        .command = "read-events",
+        .help = "Read recorded edges of a digital input as json",
+        .hint = NULL,
+        .func = &DigitalInputsCLI::readEventsFunc,
+        .argtable = &readEventsArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    err |= esp_console_cmd_register(&readEventsCmd);
+
+    // Register attach counter command
+    attachCounterArgs.din = arg_int1("d", "din", "<din>", "Digital input number (1-10)");
+    attachCounterArgs.edge = arg_str0("e", "edge", "<edge>", "Edges to count: rising, falling, change (default: rising)");
+    attachCounterArgs.mode = arg_str0("m", "mode", "<mode>", "Measurement mode: frequency, period (default: frequency)");
+    attachCounterArgs.gate = arg_int0("g", "gate", "<ms>", "Gate time in frequency mode (default: 1000)");
+#if defined(CONFIG_MODULE_MASTER)
+    attachCounterArgs.id = arg_int0("i", "id", "<id>", "Module ID for remote operation");
+    attachCounterArgs.end = arg_end(6);
+#else
+    attachCounterArgs.end = arg_end(5);
+#endif
+
+    const esp_console_cmd_t attachCounterCmd = {
+        .command = "attach-counter",
+        .help = "Count pulses and measure frequency on a digital input",
+        .hint = NULL,
+        .func = &DigitalInputsCLI::attachCounterFunc,
+        .argtable = &attachCounterArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    err |= esp_console_cmd_register(&attachCounterCmd);
+
+    // Register detach counter command
+    detachCounterArgs.din = arg_int1("d", "din", "<din>", "Digital input number (1-10)");
+#if defined(CONFIG_MODULE_MASTER)
+    detachCounterArgs.id = arg_int0("i", "id", "<id>", "Module ID for remote operation");
+    detachCounterArgs.end = arg_end(3);
+#else
+    detachCounterArgs.end = arg_end(2);
+#endif
+
+    const esp_console_cmd_t detachCounterCmd = {
+        .command = "detach-counter",
+        .help = "Stop counting pulses on a digital input",
+        .hint = NULL,
+        .func = &DigitalInputsCLI::detachCounterFunc,
+        .argtable = &detachCounterArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    err |= esp_console_cmd_register(&detachCounterCmd);
+
+    // Register read counter command
+    readCounterArgs.din = arg_int1("d", "din", "<din>", "Digital input number (1-10)");
+#if defined(CONFIG_MODULE_MASTER)
+    readCounterArgs.id = arg_int0("i", "id", "<id>", "Module ID for remote operation");
+    readCounterArgs.end = arg_end(3);
+#else
+    readCounterArgs.end = arg_end(2);
+#endif
+
+    const esp_console_cmd_t readCounterCmd = {
+        .command = "read-counter",
+        .help = "Read pulse count, frequency (Hz) and period (us) of a digital input as json",
+        .hint = NULL,
+        .func = &DigitalInputsCLI::readCounterFunc,
+        .argtable = &readCounterArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    err |= esp_console_cmd_register(&readCounterCmd);
+
+    // Register reset counter command
+    resetCounterArgs.din = arg_int1("d", "din", "<din>", "Digital input number (1-10)");
+#if defined(CONFIG_MODULE_MASTER)
+    resetCounterArgs.id = arg_int0("i", "id", "<id>", "Module ID for remote operation");
+    resetCounterArgs.end = arg_end(3);
+#else
+    resetCounterArgs.end = arg_end(2);
+#endif
+
+    const esp_console_cmd_t resetCounterCmd = {
+        .command = "reset-counter",
+        .help = "Reset the pulse count of a digital input",
+        .hint = NULL,
+        .func = &DigitalInputsCLI::resetCounterFunc,
+        .argtable = &resetCounterArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    err |= esp_console_cmd_register(&resetCounterCmd);
+
     return err;
 }
@@ -57,10 +57,69 @@ protected:
         struct arg_end *end;
     } detachInterruptArgs;
 
+    static struct {
+        struct arg_int *din;
+        struct arg_str *mode;
+#if defined(CONFIG_MODULE_MASTER)
+        struct arg_int *id;
+#endif
+        struct arg_end *end;
+    } captureEventsArgs;
+
+    static struct {
+        struct arg_int *din;
+        struct arg_int *max;
+#if defined(CONFIG_MODULE_MASTER)
+        struct arg_int *id;
+#endif
+        struct arg_end *end;
+    } readEventsArgs;
+
+    static struct {
+        struct arg_int *din;
+        struct arg_str *edge;
+        struct arg_str *mode;
+        struct arg_int *gate;
+#if defined(CONFIG_MODULE_MASTER)
+        struct arg_int *id;
+#endif
+        struct arg_end *end;
+    } attachCounterArgs;
+
+    static struct {
+        struct arg_int *din;
+#if defined(CONFIG_MODULE_MASTER)
+        struct arg_int *id;
+#endif
+        struct arg_end *end;
+    } detachCounterArgs;
+
+    static struct {
+        struct arg_int *din;
+#if defined(CONFIG_MODULE_MASTER)
+        struct arg_int *id;
+#endif
+        struct arg_end *end;
+    } readCounterArgs;
+
+    static struct {
+        struct arg_int *din;
+#if defined(CONFIG_MODULE_MASTER)
+        struct arg_int *id;
+#endif
+        struct arg_end *end;
+    } resetCounterArgs;
+
     // Command functions
     static int digitalReadFunc(int argc, char **argv);
     static int attachInterruptFunc(int argc, char **argv);
     static int detachInterruptFunc(int argc, char **argv);
+    static int captureEventsFunc(int argc, char **argv);
+    static int readEventsFunc(int argc, char **argv);
+    static int attachCounterFunc(int argc, char **argv);
+    static int detachCounterFunc(int argc, char **argv);
+    static int readCounterFunc(int argc, char **argv);
+    static int resetCounterFunc(int argc, char **argv);
 
 private:
     static DigitalInputsInterface* _digitalInputsInstance;
@@ -15,6 +15,11 @@ DIn_Num_t dinNumTable[DIN_MAX] = {DIN_1, DIN_2, DIN_3, DIN_4, DIN_5,
 
 int DigitalInputsCmd::digitalRead(DIn_Num_t num)
 {
+    uint16_t levels;
+    if (_module->readInputImage(IMAGE_DIGITAL_INPUTS, &levels, sizeof(uint16_t)) == 0) {
+        return (levels >> num) & 0x01;
+    }
+
     std::vector<uint8_t> msgBytes = {CALLBACK_DIGITAL_READ, (uint8_t)num};
     _module->runCallback(msgBytes);
     return static_cast<int>(msgBytes[2]);
@@ -36,4 +41,97 @@ void DigitalInputsCmd::detachInterrupt(DIn_Num_t num)
     _module->runCallback(msgBytes);
 }
 
+void DigitalInputsCmd::captureEvents(DIn_Num_t num, InterruptMode_t mode)
+{
+    std::vector<uint8_t> msgBytes = {CALLBACK_DIGITAL_CAPTURE_EVENTS, (uint8_t)num, (uint8_t)mode};
+    _module->runCallback(msgBytes);
+}
+
+int DigitalInputsCmd::readEvents(DIn_Num_t num, DigitalInputEvent_t* events, int max)
+{
+    int count = 0;
+    while (count < max) {
+        uint8_t request = (uint8_t)std::min(max - count, DIN_EVENT_BUFFER_SIZE);
+        std::vector<uint8_t> msgBytes = {CALLBACK_DIGITAL_READ_EVENTS, (uint8_t)num, request};
+        if ((_module->runCallback(msgBytes) < 0) || (msgBytes.size() < 8)) {
+            return (count > 0) ? count : -1;
+        }
+        uint8_t received = std::min(msgBytes[7], request);
+        if (msgBytes.size() < 8 + (size_t)received * 9) {
+            return (count > 0) ? count : -1;
+        }
+        for (int i = 0; i < received; i++) {
+            memcpy(&events[count].timestamp, &msgBytes[8 + i * 9], sizeof(uint64_t));
+            events[count].level = msgBytes[8 + i * 9 + 8];
+            count++;
+        }
+        if (received < request) { // No more events
+            break;
+        }
+    }
+    return count;
+}
+
+uint32_t DigitalInputsCmd::getEventOverflows(DIn_Num_t num)
+{
+    uint32_t overflows = 0;
+    std::vector<uint8_t> msgBytes = {CALLBACK_DIGITAL_READ_EVENTS, (uint8_t)num, 0};
+    if ((_module->runCallback(msgBytes) == 0) && (msgBytes.size() >= 8)) {
+        memcpy(&overflows, &msgBytes[3], sizeof(uint32_t));
+    }
+    return overflows;
+}
+
+int DigitalInputsCmd::attachCounter(DIn_Num_t num, InterruptMode_t edge, CounterMode_t mode, uint32_t gateTime)
+{
+    std::vector<uint8_t> msgBytes = {CALLBACK_DIGITAL_ATTACH_COUNTER, (uint8_t)num, (uint8_t)edge, (uint8_t)mode};
+    msgBytes.insert(msgBytes.end(), (uint8_t*)&gateTime, (uint8_t*)&gateTime + sizeof(uint32_t));
+    if ((_module->runCallback(msgBytes) < 0) || (msgBytes.size() < 5)) {
+        return -1;
+    }
+    return static_cast<int8_t>(msgBytes[4]);
+}
+
+void DigitalInputsCmd::detachCounter(DIn_Num_t num)
+{
+    std::vector<uint8_t> msgBytes = {CALLBACK_DIGITAL_DETACH_COUNTER, (uint8_t)num};
+    _module->runCallback(msgBytes);
+}
+
+int64_t DigitalInputsCmd::getCount(DIn_Num_t num)
+{
+    int64_t count = 0;
+    std::vector<uint8_t> msgBytes = {CALLBACK_DIGITAL_GET_COUNT, (uint8_t)num};
+    if ((_module->runCallback(msgBytes) == 0) && (msgBytes.size() >= 2 + sizeof(int64_t))) {
+        memcpy(&count, &msgBytes[2], sizeof(int64_t));
+    }
+    return count;
+}
+
+void DigitalInputsCmd::resetCount(DIn_Num_t num)
+{
+    std::vector<uint8_t> msgBytes = {CALLBACK_DIGITAL_RESET_COUNT, (uint8_t)num};
+    _module->runCallback(msgBytes);
+}
+
+float DigitalInputsCmd::getFrequency(DIn_Num_t num)
+{
+    float frequency = 0;
+    std::vector<uint8_t> msgBytes = {CALLBACK_DIGITAL_GET_FREQUENCY, (uint8_t)num};
+    if ((_module->runCallback(msgBytes) == 0) && (msgBytes.size() >= 2 + sizeof(float))) {
+        memcpy(&frequency, &msgBytes[2], sizeof(float));
+    }
+    return frequency;
+}
+
+float DigitalInputsCmd::getPeriod(DIn_Num_t num)
+{
+    float period = 0;
+    std::vector<uint8_t> msgBytes = {CALLBACK_DIGITAL_GET_PERIOD, (uint8_t)num};
+    if ((_module->runCallback(msgBytes) == 0) && (msgBytes.size() >= 2 + sizeof(float))) {
+        memcpy(&period, &msgBytes[2], sizeof(float));
+    }
+    return period;
+}
+
 #endif
\ No newline at end of file
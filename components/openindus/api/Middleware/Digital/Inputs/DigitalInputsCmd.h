@@ -27,6 +27,16 @@ public:
     int digitalRead(DIn_Num_t num) override;
     void attachInterrupt(DIn_Num_t num, IsrCallback_t callback, InterruptMode_t mode, void *arg = NULL) override;
     void detachInterrupt(DIn_Num_t num) override;
+    void captureEvents(DIn_Num_t num, InterruptMode_t mode) override;
+    int readEvents(DIn_Num_t num, DigitalInputEvent_t* events, int max) override;
+    uint32_t getEventOverflows(DIn_Num_t num) override;
+    int attachCounter(DIn_Num_t num, InterruptMode_t edge = RISING_MODE, 
+        CounterMode_t mode = COUNTER_MODE_FREQUENCY, uint32_t gateTime = 1000) override;
+    void detachCounter(DIn_Num_t num) override;
+    int64_t getCount(DIn_Num_t num) override;
+    void resetCount(DIn_Num_t num) override;
+    float getFrequency(DIn_Num_t num) override;
+    float getPeriod(DIn_Num_t num) override;
 
 private:
     ModuleControl *_module;
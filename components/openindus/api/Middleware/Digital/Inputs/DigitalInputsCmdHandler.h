@@ -37,10 +37,89 @@ public:
             data.clear();
         });
 
+        Slave::addCallback(CALLBACK_DIGITAL_CAPTURE_EVENTS, [](std::vector<uint8_t> &data) {
+            DigitalInputs digitalInputs;
+            digitalInputs.captureEvents((DIn_Num_t)data[1], (InterruptMode_t)data[2]);
+            data.clear();
+        });
+
+        /* Answer: [callback, num, max, overflows (4 bytes), count, count x (timestamp (8 bytes), level)] */
+        Slave::addCallback(CALLBACK_DIGITAL_READ_EVENTS, [](std::vector<uint8_t> &data) {
+            static DigitalInputEvent_t events[DIN_EVENT_BUFFER_SIZE];
+            DigitalInputs digitalInputs;
+            DIn_Num_t num = (DIn_Num_t)data[1];
+            int max = std::min((int)data[2], DIN_EVENT_BUFFER_SIZE);
+            uint32_t overflows = digitalInputs.getEventOverflows(num);
+            int count = digitalInputs.readEvents(num, events, max);
+            if (count < 0) {
+                count = 0;
+            }
+            data.insert(data.end(), (uint8_t*)&overflows, (uint8_t*)&overflows + sizeof(uint32_t));
+            data.push_back(static_cast<uint8_t>(count));
+            for (int i = 0; i < count; i++) {
+                data.insert(data.end(), (uint8_t*)&events[i].timestamp, (uint8_t*)&events[i].timestamp + sizeof(uint64_t));
+                data.push_back(events[i].level);
+            }
+        });
+
+        /* Request: [callback, num, edge, mode, gate time (4 bytes)], answer: [..., result] */
+        Slave::addCallback(CALLBACK_DIGITAL_ATTACH_COUNTER, [](std::vector<uint8_t> &data) {
+            DigitalInputs digitalInputs;
+            uint32_t gateTime;
+            memcpy(&gateTime, &data[4], sizeof(uint32_t));
+            int ret = digitalInputs.attachCounter((DIn_Num_t)data[1], (InterruptMode_t)data[2],
+                                                  (CounterMode_t)data[3], gateTime);
+            data.resize(4);
+            data.push_back(static_cast<uint8_t>(ret));
+        });
+
+        Slave::addCallback(CALLBACK_DIGITAL_DETACH_COUNTER, [](std::vector<uint8_t> &data) {
+            DigitalInputs digitalInputs;
+            digitalInputs.detachCounter((DIn_Num_t)data[1]);
+            data.clear();
+        });
+
+        Slave::addCallback(CALLBACK_DIGITAL_GET_COUNT, [](std::vector<uint8_t> &data) {
+            DigitalInputs digitalInputs;
+            int64_t count = digitalInputs.getCount((DIn_Num_t)data[1]);
+            data.insert(data.end(), (uint8_t*)&count, (uint8_t*)&count + sizeof(int64_t));
+        });
+
+        Slave::addCallback(CALLBACK_DIGITAL_RESET_COUNT, [](std::vector<uint8_t> &data) {
+            DigitalInputs digitalInputs;
+            digitalInputs.resetCount((DIn_Num_t)data[1]);
+            data.clear();
+        });
+
+        Slave::addCallback(CALLBACK_DIGITAL_GET_FREQUENCY, [](std::vector<uint8_t> &data) {
+            DigitalInputs digitalInputs;
+            float frequency = digitalInputs.getFrequency((DIn_Num_t)data[1]);
+            data.insert(data.end(), (uint8_t*)&frequency, (uint8_t*)&frequency + sizeof(float));
+        });
+
+        Slave::addCallback(CALLBACK_DIGITAL_GET_PERIOD, [](std::vector<uint8_t> &data) {
+            DigitalInputs digitalInputs;
+            float period = digitalInputs.getPeriod((DIn_Num_t)data[1]);
+            data.insert(data.end(), (uint8_t*)&period, (uint8_t*)&period + sizeof(float));
+        });
+
+        Slave::addProcessImage(IMAGE_DIGITAL_INPUTS, [](std::vector<uint8_t> &data) {
+            DigitalInputs digitalInputs;
+            uint16_t levels = 0;
+            for (int i = 0; i < DIN_MAX; ++i) {
+                if (digitalInputs.digitalRead((DIn_Num_t)i) == 1) {
+                    levels |= (1 << i);
+                }
+            }
+            data.insert(data.end(), (uint8_t*)&levels, (uint8_t*)&levels + sizeof(uint16_t));
+        });
+
         Slave::addResetCallback([]() {
             DigitalInputs digitalInputs;
             for (int i = 0; i < DIN_MAX; ++i) {
                 digitalInputs.detachInterrupt((DIn_Num_t)i);
+                digitalInputs.captureEvents((DIn_Num_t)i, NONE_MODE);
+                digitalInputs.detachCounter((DIn_Num_t)i);
             }
         });
 
@@ -52,12 +52,38 @@ typedef enum {
     CHANGE_MODE 
 } InterruptMode_t;
 
+/**
+ * @brief Digital Inputs Counter Modes
+ *
+ */
+typedef enum {
+    COUNTER_MODE_FREQUENCY = 0, // Frequency computed from the pulses counted during a gate time
+    COUNTER_MODE_PERIOD = 1     // Period measured between two pulses, for low frequencies
+} CounterMode_t;
+
 /**
  * @brief Function prototype for attachInterrupt callbacks
  *
  */
 typedef void (*IsrCallback_t)(void *);
 
+/**
+ * @brief Number of edge events buffered for each input.
+ * No event is lost as long as the input is read with readEvents() before
+ * DIN_EVENT_BUFFER_SIZE edges occurred, e.g. up to 6.4 kHz when read every 10 ms.
+ *
+ */
+#define DIN_EVENT_BUFFER_SIZE 64
+
+/**
+ * @brief Digital input edge event
+ *
+ */
+typedef struct {
+    uint64_t timestamp; // Time of the edge in microseconds since the boot of the module
+    uint8_t level;      // Level of the input after the edge
+} DigitalInputEvent_t;
+
 /**
  * @brief Digital Inputs class
  *
@@ -92,4 +118,81 @@ public:
      * @param num DIN to detach interrupt.
      */
     virtual void detachInterrupt(DIn_Num_t num) = 0;
+
+    /**
+     * @brief Record the edges of a DIN with their timestamp.
+     * The interrupt mode is shared with attachInterrupt().
+     *
+     * @param num DIN to monitor.
+     * @param mode Edges to record (RISING, FALLING or CHANGE), NONE_MODE stops the recording.
+     */
+    virtual void captureEvents(DIn_Num_t num, InterruptMode_t mode) = 0;
+
+    /**
+     * @brief Read the recorded edges of a DIN, oldest first.
+     *
+     * @param num DIN to read.
+     * @param events Destination buffer.
+     * @param max Maximum number of events to read.
+     * @return Number of events read, -1 on error.
+     */
+    virtual int readEvents(DIn_Num_t num, DigitalInputEvent_t* events, int max) = 0;
+
+    /**
+     * @brief Get the number of edges lost because the buffer was full.
+     *
+     * @param num DIN to monitor.
+     * @return Number of lost events since the recording started.
+     */
+    virtual uint32_t getEventOverflows(DIn_Num_t num) = 0;
+
+    /**
+     * @brief Count the pulses of a DIN with a hardware counter.
+     *
+     * @param num DIN to monitor.
+     * @param edge Edges to count (RISING, FALLING or CHANGE).
+     * @param mode Frequency measurement mode.
+     * @param gateTime Gate time in milliseconds, used in frequency mode.
+     * @return 0 on success, -1 on error (no counter unit available).
+     */
+    virtual int attachCounter(DIn_Num_t num, InterruptMode_t edge = RISING_MODE, 
+        CounterMode_t mode = COUNTER_MODE_FREQUENCY, uint32_t gateTime = 1000) = 0;
+
+    /**
+     * @brief Stop counting the pulses of a DIN and release its counter unit.
+     *
+     * @param num DIN to monitor.
+     */
+    virtual void detachCounter(DIn_Num_t num) = 0;
+
+    /**
+     * @brief Get the number of pulses counted since the counter was attached or reset.
+     *
+     * @param num DIN to monitor.
+     * @return Number of pulses.
+     */
+    virtual int64_t getCount(DIn_Num_t num) = 0;
+
+    /**
+     * @brief Reset the pulse count.
+     *
+     * @param num DIN to monitor.
+     */
+    virtual void resetCount(DIn_Num_t num) = 0;
+
+    /**
+     * @brief Get the frequency of the pulses.
+     *
+     * @param num DIN to monitor.
+     * @return Frequency in Hz.
+     */
+    virtual float getFrequency(DIn_Num_t num) = 0;
+
+    /**
+     * @brief Get the period of the pulses.
+     *
+     * @param num DIN to monitor.
+     * @return Period in microseconds, 0 if no pulse was measured.
+     */
+    virtual float getPeriod(DIn_Num_t num) = 0;
 };
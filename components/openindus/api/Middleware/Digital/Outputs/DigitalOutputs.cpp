@@ -7,6 +7,11 @@
  */
 
 #include "DigitalOutputs.h"
+#include "esp_timer.h"
+
+#define DOUT_CONTROL_TASK_PERIOD_MS 500
+#define DOUT_OVERCURRENT_RETRY_DELAY_MS 5000
+#define DOUT_OVERCURRENT_SIMULATION_TIMEOUT_MS 50
 
 #if !defined(CONFIG_OI_CORE)
 #define DOUT_SENSOR_ADC_NO_OF_SAMPLES 64U
@@ -24,6 +29,8 @@
 
 static const char TAG[] = "DigitalOutputs";
 
+static DOut_Num_t _doutNum[DOUT_MAX] = {DOUT_1, DOUT_2, DOUT_3, DOUT_4, DOUT_5, DOUT_6, DOUT_7, DOUT_8};
+
 uint8_t DigitalOutputs::_nb;
 DOut_Mode_t *DigitalOutputs::_mode;
 bool *DigitalOutputs::_level;
@@ -35,20 +42,23 @@ ioex_device_t **DigitalOutputs::_ioex;
 gpio_num_t *DigitalOutputs::_gpios;
 adc_unit_t *DigitalOutputs::_adcUnits;
 adc_channel_t *DigitalOutputs::_adcChannels;
-adc_oneshot_unit_handle_t DigitalOutputs::_adc1Handle;
-adc_oneshot_unit_handle_t DigitalOutputs::_adc2Handle;
-adc_cali_handle_t *DigitalOutputs::_adcCaliHandles;
+int *DigitalOutputs::_adcIndexes;
 #endif
 float DigitalOutputs::_overcurrentThreshold = 4.0f;
 float DigitalOutputs::_overcurrentThresholdSum = 8.0f;
 void (*DigitalOutputs::_overcurrentCallback)(void*) = NULL;
+DigitalOutputs::Protection_t *DigitalOutputs::_protection;
+uint32_t DigitalOutputs::_retryDelay = DOUT_OVERCURRENT_RETRY_DELAY_MS;
+uint8_t DigitalOutputs::_maxRetries = 0;
+float DigitalOutputs::_retryBackoff = 1.0f;
+portMUX_TYPE DigitalOutputs::_lock = portMUX_INITIALIZER_UNLOCKED;
 SemaphoreHandle_t DigitalOutputs::_mutex;
+TaskHandle_t DigitalOutputs::_controlTaskHandle = NULL;
 
 #if defined(CONFIG_OI_CORE)
 int DigitalOutputs::init(ioex_device_t **ioex, const ioex_num_t *ioex_num, const ioex_num_t *ioex_current, int nb)
 #else
-int DigitalOutputs::init(const gpio_num_t *gpio, const adc_unit_t *adc_units, const adc_channel_t *adc_channels, int nb,
-                        adc_oneshot_unit_handle_t adc1Handle, adc_oneshot_unit_handle_t adc2Handle)
+int DigitalOutputs::init(const gpio_num_t *gpio, const adc_unit_t *adc_units, const adc_channel_t *adc_channels, int nb)
 #endif
 {
     int err = 0;
@@ -59,6 +69,7 @@ int DigitalOutputs::init(const gpio_num_t *gpio, const adc_unit_t *adc_units, co
     _mode = (DOut_Mode_t *)calloc(nb, sizeof(DOut_Mode_t)); // Initialize all outputs to digital mode
     memset(_mode, DOUT_MODE_DIGITAL, nb * sizeof(DOut_Mode_t));
     _level = (bool*)calloc(nb, sizeof(bool)); // Initialize output levels to LOW   
+    _protection = (Protection_t *)calloc(nb, sizeof(Protection_t));
 
 #if defined(CONFIG_OI_CORE)
     _ioex = ioex;
@@ -122,55 +133,13 @@ int DigitalOutputs::init(const gpio_num_t *gpio, const adc_unit_t *adc_units, co
     err |= gpio_config(&doutConf);
 
     /* ADC */
-    // Set ADC handles
-    _adc1Handle = adc1Handle;
-    _adc2Handle = adc2Handle;
-    
-    // Configure ADC channels
-    adc_oneshot_chan_cfg_t adcConfig = {
-        .atten = ADC_ATTEN_DB_12,
-        .bitwidth = ADC_BITWIDTH_12,
-    };
-    for (uint8_t i = 0; i < _nb; i++) {
-        if (_adcUnits[i] == ADC_UNIT_1) {
-            if (_adc1Handle != NULL) {
-                err |= adc_oneshot_config_channel(_adc1Handle, _adcChannels[i], &adcConfig);
-            } else {
-                ESP_LOGE(TAG, "ADC1 handle is NULL");
-                err |= -1;
-            }
-        } else if (_adcUnits[i] == ADC_UNIT_2) {
-            if (_adc2Handle != NULL) {
-                err |= adc_oneshot_config_channel(_adc2Handle, _adcChannels[i], &adcConfig);
-            } else {
-                ESP_LOGE(TAG, "ADC2 handle is NULL");
-                err |= -1;
-            }
-        } else {
-            ESP_LOGE(TAG, "Invalid ADC unit for DOUT_%d", i + 1);
-        }
-    }
-
-    // Allocate memory for individual calibration handles
-    _adcCaliHandles = (adc_cali_handle_t *)calloc(nb, sizeof(adc_cali_handle_t));
-    if (_adcCaliHandles == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate memory for calibration handles");
-        return -1;
-    }
-    
-    // ADC Calibration
+    // Add current measurement channels to the background sampling
+    _adcIndexes = (int *)calloc(nb, sizeof(int));
     for (uint8_t i = 0; i < _nb; i++) {
-        adc_cali_curve_fitting_config_t adcCaliConfig = {
-            .unit_id = _adcUnits[i],
-            .chan = _adcChannels[i],
-            .atten = ADC_ATTEN_DB_12,
-            .bitwidth = ADC_BITWIDTH_12,
-        };
-        
-        esp_err_t ret = adc_cali_create_scheme_curve_fitting(&adcCaliConfig, &_adcCaliHandles[i]);
-        if (ret != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to create calibration scheme for channel %d: %s", i, esp_err_to_name(ret));
-            _adcCaliHandles[i] = NULL;
+        _adcIndexes[i] = AdcSampler::addChannel(_adcUnits[i], _adcChannels[i], DOUT_SENSOR_ADC_NO_OF_SAMPLES);
+        if (_adcIndexes[i] < 0) {
+            ESP_LOGE(TAG, "Failed to configure ADC channel for DOUT_%d", i + 1);
+            err |= -1;
         }
     }
 #endif
@@ -180,7 +149,18 @@ int DigitalOutputs::init(const gpio_num_t *gpio, const adc_unit_t *adc_units, co
 
     /* Create control task for overcurrent */
     ESP_LOGI(TAG, "Create control task");
-    xTaskCreate(_controlTask, "Control task", 4096, NULL, 1, NULL);
+    xTaskCreate(_controlTask, "Control task", 4096, NULL, 5, &_controlTaskHandle);
+
+    /* Overcurrent detection: the output is cut as soon as it is detected, the control task handles the retries */
+#if defined(CONFIG_OI_CORE)
+    for (uint8_t i = 0; i < _nb; i++) {
+        err |= ioex_isr_handler_add(*_ioex, _ioex_current[i], _ioexOvercurrentIsr, (void *)(uintptr_t)i, 1);
+        err |= ioex_set_interrupt_type(*_ioex, _ioex_current[i], IOEX_INTERRUPT_POSEDGE);
+        err |= ioex_interrupt_enable(*_ioex, _ioex_current[i]);
+    }
+#else
+    _updateThresholds();
+#endif
 
     return err;
 }
@@ -191,12 +171,15 @@ void DigitalOutputs::digitalWrite(DOut_Num_t num, bool level)
         if (_mode[num] == DOUT_MODE_DIGITAL) {
             xSemaphoreTake(_mutex, portMAX_DELAY);
             _level[num] = level;
-            xSemaphoreGive(_mutex);
+            _unlatch(num);
+            if (!_isCut(num)) { // Otherwise the level is applied when the retry delay expires
 #if defined(CONFIG_OI_CORE)
-            ioex_set_level(*_ioex, _ioex_num[num], (ioex_level_t)level);
+                ioex_set_level(*_ioex, _ioex_num[num], (ioex_level_t)level);
 #else
-            gpio_set_level(_gpios[num], level);
+                gpio_set_level(_gpios[num], level);
 #endif
+            }
+            xSemaphoreGive(_mutex);
         } else {
             ESP_LOGE(TAG, "Invalid output mode");
         }
@@ -211,12 +194,15 @@ void DigitalOutputs::toggleOutput(DOut_Num_t num)
         if (_mode[num] == DOUT_MODE_DIGITAL) {
             xSemaphoreTake(_mutex, portMAX_DELAY);
             _level[num] = !_level[num];
-            xSemaphoreGive(_mutex);
+            _unlatch(num);
+            if (!_isCut(num)) { // Otherwise the level is applied when the retry delay expires
 #if defined(CONFIG_OI_CORE)
-            ioex_set_level(*_ioex, _ioex_num[num], (ioex_level_t)_level[num]);
+                ioex_set_level(*_ioex, _ioex_num[num], (ioex_level_t)_level[num]);
 #else
-            gpio_set_level(_gpios[num], _level[num]);
+                gpio_set_level(_gpios[num], _level[num]);
 #endif
+            }
+            xSemaphoreGive(_mutex);
         } else {
             ESP_LOGE(TAG, "Invalid output mode");
         }
@@ -288,8 +274,12 @@ void DigitalOutputs::setPWMDutyCycle(DOut_Num_t num, float duty)
 #if !defined(CONFIG_OI_CORE)
     if (num < _nb) {
         if (_mode[num] == DOUT_MODE_PWM) {
+            xSemaphoreTake(_mutex, portMAX_DELAY);
             ledc_set_duty(LEDC_LOW_SPEED_MODE, (ledc_channel_t)(LEDC_CHANNEL_0 + (int)num), (uint32_t)(duty * 16383.0f / 100.0f));
-            ledc_update_duty(LEDC_LOW_SPEED_MODE, (ledc_channel_t)(LEDC_CHANNEL_0 + (int)num));
+            if (!_isCut(num)) { // Otherwise the duty cycle is applied when the retry delay expires
+                ledc_update_duty(LEDC_LOW_SPEED_MODE, (ledc_channel_t)(LEDC_CHANNEL_0 + (int)num));
+            }
+            xSemaphoreGive(_mutex);
         } else {
             ESP_LOGE(TAG, "Invalid output mode");
         }
@@ -314,6 +304,9 @@ float DigitalOutputs::getOutputCurrent(DOut_Num_t num)
 int DigitalOutputs::outputIsOvercurrent(DOut_Num_t num)
 {
     if (num < _nb) {
+        if (_protection[num].cut) {
+            return 1;
+        }
 #if defined(CONFIG_OI_CORE)
         return ioex_get_level(*_ioex, _ioex_current[num]);
 #else
@@ -330,165 +323,316 @@ int DigitalOutputs::outputIsOvercurrent(DOut_Num_t num)
 float DigitalOutputs::_adcReadCurrent(DOut_Num_t num)
 {
     if (num < _nb) {
-        int current_reading = 0;
-        int adc_reading     = 0;
-        float voltage       = 0.0f;
-
-        for (int i = 0; i < DOUT_SENSOR_ADC_NO_OF_SAMPLES; i++) {
-            if (_adcUnits[num] == ADC_UNIT_1) {
-                if (_adc1Handle != NULL) {
-                    adc_oneshot_read(_adc1Handle, _adcChannels[num], &current_reading);
-                } else {
-                    ESP_LOGE(TAG, "ADC1 handle is NULL");
-                    current_reading = 0;
-                }
-            } else if (_adcUnits[num] == ADC_UNIT_2) {
-                if (_adc2Handle != NULL) {
-                    adc_oneshot_read(_adc2Handle, _adcChannels[num], &current_reading);
-                } else {
-                    ESP_LOGE(TAG, "ADC2 handle is NULL");
-                    current_reading = 0;
-                }
-            } else {
-                current_reading = 0;
-                ESP_LOGE(TAG, "Invalid ADC channel");
-            }
-            adc_reading += current_reading;
-            vTaskDelay(pdMS_TO_TICKS(1));
-        }
-
-        adc_reading /= DOUT_SENSOR_ADC_NO_OF_SAMPLES;
+        float voltage = 0.0f;
 
-        // Convert adc_reading to voltage in mV
-        int voltage_mv = 0;
-        if (_adcCaliHandles[num] != NULL) {
-            adc_cali_raw_to_voltage(_adcCaliHandles[num], adc_reading, &voltage_mv);
-        } else {
-            ESP_LOGE(TAG, "ADC calibration handle for channel %d is NULL", num);
+        // Latest average of the last DOUT_SENSOR_ADC_NO_OF_SAMPLES samples, in mV
+        int voltage_mv = AdcSampler::readMilliVolt(_adcIndexes[num]);
+        if (voltage_mv < 0) {
             voltage_mv = 0;
         }
 
-        voltage = static_cast<float>(voltage_mv) / 1000.0f; // mV to V
-        float sense_current = voltage / DOUT_SENSOR_RESISTOR_SENSE_VALUE; // I = U/R
+        return _milliVoltToCurrent(voltage_mv);
+    } else {
+        ESP_LOGE(TAG, "Invalid DOUT_%d", num + 1);
+        return 0.0f;
+    }
+}
 
-        float current = 0.0f;
-        if (voltage < DOUT_SENSOR_VOLTAGE_BELOW_1A_mV) {
-            current = sense_current * DOUT_SENSOR_COEFF_BELOW_1A;
-        } else if (voltage < DOUT_SENSOR_VOLTAGE_BELOW_1_5A_mV) {
-            current = sense_current * DOUT_SENSOR_COEFF_BELOW_1_5A;
-        } else if (voltage < DOUT_SENSOR_VOLTAGE_BELOW_2A_mV) {
-            current = sense_current * DOUT_SENSOR_COEFF_BELOW_2A;
-        } else {
-            current = sense_current * DOUT_SENSOR_COEFF_ABOVE_2A;
-        }
+float DigitalOutputs::_milliVoltToCurrent(int milliVolt)
+{
+    float voltage = static_cast<float>(milliVolt) / 1000.0f; // mV to V
+    float sense_current = voltage / DOUT_SENSOR_RESISTOR_SENSE_VALUE; // I = U/R
+
+    float current = 0.0f;
+    if (voltage < DOUT_SENSOR_VOLTAGE_BELOW_1A_mV) {
+        current = sense_current * DOUT_SENSOR_COEFF_BELOW_1A;
+    } else if (voltage < DOUT_SENSOR_VOLTAGE_BELOW_1_5A_mV) {
+        current = sense_current * DOUT_SENSOR_COEFF_BELOW_1_5A;
+    } else if (voltage < DOUT_SENSOR_VOLTAGE_BELOW_2A_mV) {
+        current = sense_current * DOUT_SENSOR_COEFF_BELOW_2A;
+    } else {
+        current = sense_current * DOUT_SENSOR_COEFF_ABOVE_2A;
+    }
+
+    return current;
+}
+
+/* Inverse of _milliVoltToCurrent, to compare the raw samples without converting them */
+int DigitalOutputs::_currentToRaw(DOut_Num_t num, float current)
+{
+    float voltage = current * DOUT_SENSOR_RESISTOR_SENSE_VALUE / DOUT_SENSOR_COEFF_BELOW_1A;
+    if (voltage >= DOUT_SENSOR_VOLTAGE_BELOW_1A_mV) {
+        voltage = current * DOUT_SENSOR_RESISTOR_SENSE_VALUE / DOUT_SENSOR_COEFF_BELOW_1_5A;
+    }
+    if (voltage >= DOUT_SENSOR_VOLTAGE_BELOW_1_5A_mV) {
+        voltage = current * DOUT_SENSOR_RESISTOR_SENSE_VALUE / DOUT_SENSOR_COEFF_BELOW_2A;
+    }
+    if (voltage >= DOUT_SENSOR_VOLTAGE_BELOW_2A_mV) {
+        voltage = current * DOUT_SENSOR_RESISTOR_SENSE_VALUE / DOUT_SENSOR_COEFF_ABOVE_2A;
+    }
+    return AdcSampler::milliVoltToRaw(_adcUnits[num], (int)(voltage * 1000.0f));
+}
+
+void DigitalOutputs::_updateThresholds(void)
+{
+    for (uint8_t i = 0; i < _nb; i++) {
+        int raw = _currentToRaw((DOut_Num_t)i, _overcurrentThreshold);
+        AdcSampler::setThreshold(_adcIndexes[i], raw, _thresholdCallback, (void *)(uintptr_t)i);
+    }
+}
 
+/* Called from the ADC sampler task */
+void DigitalOutputs::_thresholdCallback(int index, int raw, void* arg)
+{
+    DOut_Num_t num = (DOut_Num_t)(uintptr_t)arg;
+    _trip(num, _milliVoltToCurrent(AdcSampler::rawToMilliVolt(_adcUnits[num], raw)));
+}
+#else
+/* Called from the IO expander interrupt task */
+void DigitalOutputs::_ioexOvercurrentIsr(void* arg)
+{
+    DOut_Num_t num = (DOut_Num_t)(uintptr_t)arg;
+    if (ioex_get_level(*_ioex, _ioex_current[num]) == 1) {
+        _trip(num, 0.0f); // Current is not measured, only the flag of the high side switch
+    }
+}
+#endif
+
+void DigitalOutputs::setOvercurrentThreshold(float threshold, float thresholdSum)
+{
+    _overcurrentThreshold = threshold;
+    _overcurrentThresholdSum = thresholdSum;
+#if !defined(CONFIG_OI_CORE)
+    _updateThresholds();
+#endif
+}
+
+void DigitalOutputs::setOvercurrentRetry(uint32_t retryDelay, uint8_t maxRetries, float backoff)
+{
+    if (backoff < 1.0f) {
+        ESP_LOGE(TAG, "Invalid backoff %.2f, must be greater or equal to 1", backoff);
+        return;
+    }
+    _retryDelay = retryDelay;
+    _maxRetries = maxRetries;
+    _retryBackoff = backoff;
+}
+
+float DigitalOutputs::getOvercurrentValue(DOut_Num_t num)
+{
+    if (num < _nb) {
+        portENTER_CRITICAL(&_lock);
+        float current = _protection[num].current;
+        portEXIT_CRITICAL(&_lock);
         return current;
     } else {
         ESP_LOGE(TAG, "Invalid DOUT_%d", num + 1);
         return 0.0f;
     }
 }
-#endif
 
-/**
- * @brief Every 500ms check if there is a power error on DOUT or
- * if output is in error: desactivate for 5 secondes then retry
- */
-#if defined(CONFIG_OI_CORE)
-void DigitalOutputs::_controlTask(void *pvParameters)
+int32_t DigitalOutputs::simulateOvercurrent(DOut_Num_t num, float current)
 {
-    uint8_t *state = (uint8_t *)calloc(_nb, sizeof(uint8_t));
+#if !defined(CONFIG_OI_CORE)
+    if (num >= _nb) {
+        ESP_LOGE(TAG, "Invalid DOUT_%d", num + 1);
+        return -1;
+    }
 
-    while (1) {
-        /* Checking if DOUT is in overcurrent */
-        for (int i = 0; i < _nb; i++) {
-            // If error happened
-            if (ioex_get_level(*_ioex, _ioex_current[i]) == 1) {
-                ESP_LOGE(TAG, "Current on DOUT_%u is too high", i + 1);
-                ioex_set_level(*_ioex, _ioex_num[i], IOEX_LOW);
-                state[i] = 1;
-            } else if (state[i] == 10) { // Retry after 10 loops
-                state[i] = 0;
-                // Set output at user choice (do not set HIGH if user setted this pin LOW during error)
-                xSemaphoreTake(_mutex, portMAX_DELAY);
-                ioex_set_level(*_ioex, _ioex_num[i], (ioex_level_t)_level[i]);
-                xSemaphoreGive(_mutex);
-            } else if (state[i] != 0) { // increase error counter to reach 10
-                state[i]++;
-            }
+    int raw = _currentToRaw(num, current);
+    if (raw < 0) {
+        return -1;
+    }
+
+    /* Replace the samples of the channel, they go through the same comparator as real ones */
+    int64_t start = esp_timer_get_time();
+    int64_t tripTime = 0;
+    AdcSampler::setOverride(_adcIndexes[num], raw);
+    while (esp_timer_get_time() - start < DOUT_OVERCURRENT_SIMULATION_TIMEOUT_MS * 1000) {
+        portENTER_CRITICAL(&_lock);
+        tripTime = _protection[num].tripTime;
+        portEXIT_CRITICAL(&_lock);
+        if (tripTime >= start) {
+            break;
         }
-        vTaskDelay(pdMS_TO_TICKS(500));
+        vTaskDelay(1);
     }
-    free(state);
+    AdcSampler::setOverride(_adcIndexes[num], -1);
+
+    return (tripTime >= start) ? (int32_t)(tripTime - start) : -1;
+#else
+    ESP_LOGW(TAG, "simulateOvercurrent is not supported in CONFIG_OI_CORE");
+    return -1;
+#endif
 }
+
+void DigitalOutputs::_trip(DOut_Num_t num, float current)
+{
+    _cutOutput(num);
+
+    portENTER_CRITICAL(&_lock);
+    _protection[num].cut = true;
+    _protection[num].current = current;
+    _protection[num].tripTime = esp_timer_get_time();
+    portEXIT_CRITICAL(&_lock);
+
+    xTaskNotify(_controlTaskHandle, (1UL << num), eSetBits);
+}
+
+void DigitalOutputs::_cutOutput(DOut_Num_t num)
+{
+#if defined(CONFIG_OI_CORE)
+    ioex_set_level(*_ioex, _ioex_num[num], IOEX_LOW);
 #else
+    if (_mode[num] == DOUT_MODE_PWM) {
+        ledc_stop(LEDC_LOW_SPEED_MODE, (ledc_channel_t)(LEDC_CHANNEL_0 + (int)num), 0);
+    } else {
+        gpio_set_level(_gpios[num], 0);
+    }
+#endif
+}
+
+void DigitalOutputs::_restoreOutput(DOut_Num_t num)
+{
+    // Set output at user choice (do not set HIGH if user setted this pin LOW during error)
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+#if defined(CONFIG_OI_CORE)
+    ioex_set_level(*_ioex, _ioex_num[num], (ioex_level_t)_level[num]);
+#else
+    if (_mode[num] == DOUT_MODE_PWM) {
+        ledc_update_duty(LEDC_LOW_SPEED_MODE, (ledc_channel_t)(LEDC_CHANNEL_0 + (int)num)); // Restart with the last duty cycle
+    } else {
+        gpio_set_level(_gpios[num], _level[num]);
+    }
+#endif
+    xSemaphoreGive(_mutex);
+}
+
+bool DigitalOutputs::_isCut(DOut_Num_t num)
+{
+    portENTER_CRITICAL(&_lock);
+    bool cut = _protection[num].cut;
+    portEXIT_CRITICAL(&_lock);
+    return cut;
+}
+
+/* A write from the user re-enables an output which reached the maximum number of retries */
+void DigitalOutputs::_unlatch(DOut_Num_t num)
+{
+    portENTER_CRITICAL(&_lock);
+    if (_protection[num].latched) {
+        _protection[num].latched = false;
+        _protection[num].cut = false;
+        _protection[num].retries = 0;
+    }
+    portEXIT_CRITICAL(&_lock);
+}
+
+/**
+ * @brief Handle the outputs cut by an overcurrent: notify the user and retry after the configured delay.
+ * Every 500ms, also check the total current of the outputs.
+ */
 void DigitalOutputs::_controlTask(void *pvParameters)
 {
-    uint8_t *state           = (uint8_t *)calloc(_nb, sizeof(uint8_t));
+    uint32_t tripped = 0;
+#if !defined(CONFIG_OI_CORE)
+    int64_t lastCheck        = 0;
     float currentSum         = 0.0f;
-    float current            = 0.0f;
     int currentSumState      = 0;
-    bool overcurrentDetected = false;
+#endif
 
     while (1) {
-        /* Reset currentSum */
-        currentSum = 0;
-        /* Checking if individual DOUT is in overcurrent (> 4A) */
+        tripped = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &tripped, pdMS_TO_TICKS(DOUT_CONTROL_TASK_PERIOD_MS));
+        int64_t now = esp_timer_get_time();
+
         for (uint8_t i = 0; i < _nb; i++) {
-            // Read current
-            current = _adcReadCurrent((DOut_Num_t)i);
-            currentSum += current;
-            // If error happened
-            if (current > _overcurrentThreshold) {
+            Protection_t *p = &_protection[i];
+
+#if defined(CONFIG_OI_CORE)
+            // The flag does not raise a new interrupt if it did not go low after a retry
+            if (!p->cut && !(tripped & (1UL << i)) && (ioex_get_level(*_ioex, _ioex_current[i]) == 1)) {
+                _trip((DOut_Num_t)i, 0.0f);
+                continue;
+            }
+#endif
+            if (tripped & (1UL << i)) {
+                portENTER_CRITICAL(&_lock);
+                float current = p->current;
+                int64_t tripTime = p->tripTime;
+                portEXIT_CRITICAL(&_lock);
                 ESP_LOGE(TAG, "Current on DOUT_%u is too high: %.2fA", i + 1, current);
-                gpio_set_level(_gpios[i], 0);
-                state[i] = 1;
-                overcurrentDetected = true;
-            } else if (state[i] == 10) { // Retry after 10 loops
-                state[i] = 0;
-                // Set output at user choice (do not set HIGH if user setted this pin LOW duringverror)
-                xSemaphoreTake(_mutex, portMAX_DELAY);
-                gpio_set_level(_gpios[i], _level[i]);
-                xSemaphoreGive(_mutex);
-            } else if (state[i] != 0) { // increase error counter to reach 10
-                state[i]++;
+
+                // Trips separated by a healthy period longer than the next retry delay are not successive
+                float delay = (float)_retryDelay * powf(_retryBackoff, (float)p->retries);
+                if ((p->restoreTime != 0) && (tripTime - p->restoreTime > (int64_t)(delay * 1000.0f))) {
+                    p->retries = 0;
+                    delay = (float)_retryDelay;
+                }
+                if (p->retries < UINT8_MAX) {
+                    p->retries++;
+                }
+
+                if ((_maxRetries != 0) && (p->retries > _maxRetries)) {
+                    ESP_LOGE(TAG, "DOUT_%u stays off after %u retries", i + 1, _maxRetries);
+                    portENTER_CRITICAL(&_lock);
+                    p->latched = true;
+                    portEXIT_CRITICAL(&_lock);
+                    p->retryTime = 0;
+                } else {
+                    p->retryTime = now + (int64_t)(delay * 1000.0f);
+                }
+
+                /* Call user callback if set */
+                if (_overcurrentCallback != NULL) {
+                    _overcurrentCallback(&_doutNum[i]);
+                }
+            } else if ((p->retryTime != 0) && (now >= p->retryTime)) {
+                p->retryTime = 0;
+                p->restoreTime = now;
+                portENTER_CRITICAL(&_lock);
+                p->cut = false;
+                portEXIT_CRITICAL(&_lock);
+                _restoreOutput((DOut_Num_t)i);
             }
         }
 
-        if (currentSum > _overcurrentThresholdSum) {
-            currentSumState = (currentSumState + 1) % 1000;
-            overcurrentDetected = true;
-        } else {
-            currentSumState--;
+#if !defined(CONFIG_OI_CORE)
+        if (now - lastCheck < DOUT_CONTROL_TASK_PERIOD_MS * 1000) {
+            continue;
         }
+        lastCheck = now;
 
-        /* If overcurrent detected */
-        if (overcurrentDetected) {
-            /* Call user callback if set */
+        currentSum = 0.0f;
+        for (uint8_t i = 0; i < _nb; i++) {
+            currentSum += _adcReadCurrent((DOut_Num_t)i);
+        }
+
+        if (currentSum > _overcurrentThresholdSum) {
+            currentSumState = (currentSumState + 1) % 1000;
+            /* Call user callback if set, no output in argument */
             if (_overcurrentCallback != NULL) {
                 _overcurrentCallback(NULL);
             }
-            overcurrentDetected = false;
+        } else {
+            currentSumState--;
         }
 
         // Total current is above 8A for more than a minute
         if (currentSumState == 120) {
             ESP_LOGE(TAG, "Total current is too high: %.2fA", currentSum);
             // Set all DOUT to 0;
-            for (uint8_t i = 0; i < DigitalOutputs::_nb; i++) {
-                gpio_set_level(DigitalOutputs::_gpios[i], 0);
+            for (uint8_t i = 0; i < _nb; i++) {
+                _cutOutput((DOut_Num_t)i);
             }
         } else if (currentSumState == -1) { // When off for two minute, reactivate outputs
-            // Set all DOUT to wanted value;
-            for (uint8_t i = 0; i < DigitalOutputs::_nb; i++) {
-                xSemaphoreTake(_mutex, portMAX_DELAY);
-                gpio_set_level(DigitalOutputs::_gpios[i], DigitalOutputs::_level[i]);
-                xSemaphoreGive(_mutex);
+            // Set all DOUT to wanted value, except the ones still cut by an overcurrent
+            for (uint8_t i = 0; i < _nb; i++) {
+                if (!_protection[i].cut) {
+                    _restoreOutput((DOut_Num_t)i);
+                }
             }
         }
-        vTaskDelay(pdMS_TO_TICKS(500));
+#endif
     }
-
-    free(state);
 }
-#endif
\ No newline at end of file
@@ -15,9 +15,7 @@
 #if defined(CONFIG_OI_CORE)
 #include "pcal6524.h"
 #else
-#include "esp_adc/adc_oneshot.h"
-#include "esp_adc/adc_cali.h"
-#include "esp_adc/adc_cali_scheme.h"
+#include "AdcSampler.h"
 #include "driver/gpio.h"
 #include "driver/ledc.h"
 #endif
@@ -33,10 +31,10 @@ public:
     float getOutputCurrent(DOut_Num_t num) override;
     int outputIsOvercurrent(DOut_Num_t num) override;
 
-    void setOvercurrentThreshold(float threshold, float thresholdSum = 8.0f) override {
-        _overcurrentThreshold = threshold;
-        _overcurrentThresholdSum = thresholdSum;
-    }
+    void setOvercurrentThreshold(float threshold, float thresholdSum = 8.0f) override;
+    void setOvercurrentRetry(uint32_t retryDelay, uint8_t maxRetries = 0, float backoff = 1.0f) override;
+    float getOvercurrentValue(DOut_Num_t num) override;
+    int32_t simulateOvercurrent(DOut_Num_t num, float current) override;
 
     void attachOvercurrentCallback(void (*callback)(void*), void *arg = NULL) override {
         _overcurrentCallback = callback;
@@ -50,8 +48,7 @@ protected:
 #if defined(CONFIG_OI_CORE)
     static int init(ioex_device_t **ioex, const ioex_num_t *ioex_num, const ioex_num_t *ioex_current, int num);
 #else
-    static int init(const gpio_num_t *gpio, const adc_unit_t *adc_units, const adc_channel_t *adc_channels, int num,
-                   adc_oneshot_unit_handle_t adc1Handle, adc_oneshot_unit_handle_t adc2Handle);
+    static int init(const gpio_num_t *gpio, const adc_unit_t *adc_units, const adc_channel_t *adc_channels, int num);
 #endif
 
 private:
@@ -67,10 +64,12 @@ private:
     static gpio_num_t *_gpios; // GPIO number for each DOUT
     static adc_unit_t *_adcUnits; // ADC unit for each DOUT current measurement
     static adc_channel_t *_adcChannels; // ADC channel for each DOUT current measurement
-    static adc_oneshot_unit_handle_t _adc1Handle;
-    static adc_oneshot_unit_handle_t _adc2Handle;
-    static adc_cali_handle_t *_adcCaliHandles; // Individual calibration handle for each channel
+    static int *_adcIndexes; // Index of each current measurement in AdcSampler
     static float _adcReadCurrent(DOut_Num_t num);
+    static float _milliVoltToCurrent(int milliVolt);
+    static int _currentToRaw(DOut_Num_t num, float current);
+    static void _updateThresholds(void);
+    static void _thresholdCallback(int index, int raw, void* arg);
 #endif
 
     /* Overcurrent threshold */
@@ -78,6 +77,33 @@ private:
     static float _overcurrentThresholdSum;
     static void (*_overcurrentCallback)(void*);
 
+    /* Overcurrent protection */
+    typedef struct {
+        uint8_t retries;        // Successive trips
+        bool cut;               // Output cut by the protection
+        bool latched;           // No more retry until the next write
+        int64_t retryTime;      // Time of the next retry in us, 0 if none
+        int64_t restoreTime;    // Time of the last retry in us
+        int64_t tripTime;       // Time of the last trip in us
+        float current;          // Current measured at the last trip
+    } Protection_t;
+
+    static Protection_t *_protection;
+    static uint32_t _retryDelay;
+    static uint8_t _maxRetries;
+    static float _retryBackoff;
+    static portMUX_TYPE _lock;
+
+    static void _trip(DOut_Num_t num, float current);
+    static void _cutOutput(DOut_Num_t num);
+    static void _restoreOutput(DOut_Num_t num);
+    static void _unlatch(DOut_Num_t num);
+    static bool _isCut(DOut_Num_t num);
+#if defined(CONFIG_OI_CORE)
+    static void _ioexOvercurrentIsr(void* arg);
+#endif
+
     static SemaphoreHandle_t _mutex;
+    static TaskHandle_t _controlTaskHandle;
     static void _controlTask(void *pvParameters);
 };
\ No newline at end of file
@@ -19,6 +19,8 @@ decltype(DigitalOutputsCLI::setPWMFrequencyArgs) DigitalOutputsCLI::setPWMFreque
 decltype(DigitalOutputsCLI::setPWMDutyCycleArgs) DigitalOutputsCLI::setPWMDutyCycleArgs;
 decltype(DigitalOutputsCLI::getOutputCurrentArgs) DigitalOutputsCLI::getOutputCurrentArgs;
 decltype(DigitalOutputsCLI::outputIsOvercurrentArgs) DigitalOutputsCLI::outputIsOvercurrentArgs;
+decltype(DigitalOutputsCLI::setOvercurrentRetryArgs) DigitalOutputsCLI::setOvercurrentRetryArgs;
+decltype(DigitalOutputsCLI::simulateOvercurrentArgs) DigitalOutputsCLI::simulateOvercurrentArgs;
 
 DigitalOutputsInterface* DigitalOutputsCLI::_digitalOutputsInstance = nullptr;
 
@@ -52,7 +54,7 @@ DigitalOutputsInterface* DigitalOutputsCLI::_digitalOutputsInstance = nullptr;
 // Callback function for overcurrent testing
 static void __attribute__((unused)) overcurrentCallback(void *arg)
 {
-    DOut_Num_t dout = (DOut_Num_t)(uintptr_t)arg;
+    DOut_Num_t dout = *(DOut_Num_t *)arg;
     printf("Overcurrent detected on DOUT_%d\n", dout + 1);
 }
 
@@ -287,6 +289,67 @@ int DigitalOutputsCLI::outputIsOvercurrentFunc(int argc, char **argv)
     return 0;
 }
 
+int DigitalOutputsCLI::setOvercurrentRetryFunc(int argc, char **argv)
+{
+    PARSE_ARGS_OR_RETURN(argc, argv, setOvercurrentRetryArgs);
+
+    uint32_t delay = (uint32_t)setOvercurrentRetryArgs.delay->ival[0];
+    uint8_t retries = (setOvercurrentRetryArgs.retries->count > 0) ? (uint8_t)setOvercurrentRetryArgs.retries->ival[0] : 0;
+    float backoff = (setOvercurrentRetryArgs.backoff->count > 0) ? (float)setOvercurrentRetryArgs.backoff->dval[0] : 1.0f;
+
+    if (backoff < 1.0f) {
+        ESP_LOGE(TAG, "Invalid backoff: %.2f. Must be greater or equal to 1.0", backoff);
+        return -1;
+    }
+
+#if defined(CONFIG_MODULE_MASTER)
+    CREATE_DIGITAL_OUTPUTS_INSTANCE(setOvercurrentRetryArgs.id);
+#else
+    CREATE_DIGITAL_OUTPUTS_INSTANCE(NULL);
+#endif
+
+    if (_digitalOutputsInstance != nullptr) {
+        _digitalOutputsInstance->setOvercurrentRetry(delay, retries, backoff);
+        printf("Overcurrent retry set to %lums, %u retries, backoff %.2f\n", delay, retries, backoff);
+    } else {
+        ESP_LOGE(TAG, "Failed to create instance");
+        return -1;
+    }
+
+    return 0;
+}
+
+int DigitalOutputsCLI::simulateOvercurrentFunc(int argc, char **argv)
+{
+    PARSE_ARGS_OR_RETURN(argc, argv, simulateOvercurrentArgs);
+
+    DOut_Num_t dout = (DOut_Num_t)(simulateOvercurrentArgs.dout->ival[0] - 1);
+    float current = (float)simulateOvercurrentArgs.current->dval[0];
+    
+    if (dout >= DOUT_MAX) {
+        ESP_LOGE(TAG, "Invalid DOUT number: %d. Must be between 1 and %d", 
+                 simulateOvercurrentArgs.dout->ival[0], DOUT_MAX);
+        return -1;
+    }
+
+#if defined(CONFIG_MODULE_MASTER)
+    CREATE_DIGITAL_OUTPUTS_INSTANCE(simulateOvercurrentArgs.id);
+#else
+    CREATE_DIGITAL_OUTPUTS_INSTANCE(NULL);
+#endif
+
+    if (_digitalOutputsInstance != nullptr) {
+        int32_t latency = _digitalOutputsInstance->simulateOvercurrent(dout, current);
+        float measured = _digitalOutputsInstance->getOvercurrentValue(dout);
+        printf("{\"latency_us\":%ld,\"current\":%.3f}\n", latency, measured);
+    } else {
+        ESP_LOGE(TAG, "Failed to create instance");
+        return -1;
+    }
+
+    return 0;
+}
+
 int DigitalOutputsCLI::init(void)
 {
     int err = 0;
@@ -437,5 +500,48 @@ int DigitalOutputsCLI::init(void)
     };
     err |= esp_console_cmd_register(&outputIsOvercurrentCmd);
 
+    // Register set overcurrent retry command
+    setOvercurrentRetryArgs.delay = arg_int1("t", "delay", "<ms>", "Delay before the first retry in ms");
+    setOvercurrentRetryArgs.retries = arg_int0("r", "retries", "<retries>", "Retries before the output stays off, 0 for no limit");
+    setOvercurrentRetryArgs.backoff = arg_dbl0("b", "backoff", "<backoff>", "Multiplier of the delay between two retries (>= 1.0)");
+#if defined(CONFIG_MODULE_MASTER)
+    setOvercurrentRetryArgs.id = arg_int0("i", "id", "<id>", "Module ID for remote operation");
+    setOvercurrentRetryArgs.end = arg_end(5);
+#else
+    setOvercurrentRetryArgs.end = arg_end(4);
+#endif
+
+    const esp_console_cmd_t setOvercurrentRetryCmd = {
+        .command = "set-overcurrent-retry",
+        .help = "Set the retry policy of outputs cut by an overcurrent",
+        .hint = NULL,
+        .func = &DigitalOutputsCLI::setOvercurrentRetryFunc,
+        .argtable = &setOvercurrentRetryArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    err |= esp_console_cmd_register(&setOvercurrentRetryCmd);
+
+    // Register simulate overcurrent command
+    simulateOvercurrentArgs.dout = arg_int1("d", "dout", "<dout>", "Digital output number (1-8)");
+    simulateOvercurrentArgs.current = arg_dbl1("c", "current", "<current>", "Simulated current in Amperes");
+#if defined(CONFIG_MODULE_MASTER)
+    simulateOvercurrentArgs.id = arg_int0("i", "id", "<id>", "Module ID for remote operation");
+    simulateOvercurrentArgs.end = arg_end(4);
+#else
+    simulateOvercurrentArgs.end = arg_end(3);
+#endif
+
+    const esp_console_cmd_t simulateOvercurrentCmd = {
+        .command = "simulate-overcurrent",
+        .help = "Inject a simulated current and print the time needed to cut the output",
+        .hint = NULL,
+        .func = &DigitalOutputsCLI::simulateOvercurrentFunc,
+        .argtable = &simulateOvercurrentArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    err |= esp_console_cmd_register(&simulateOvercurrentCmd);
+
     return err;
 }
@@ -93,6 +93,25 @@ protected:
         struct arg_end *end;
     } outputIsOvercurrentArgs;
 
+    static struct {
+        struct arg_int *delay;
+        struct arg_int *retries;
+        struct arg_dbl *backoff;
+#if defined(CONFIG_MODULE_MASTER)
+        struct arg_int *id;
+#endif
+        struct arg_end *end;
+    } setOvercurrentRetryArgs;
+
+    static struct {
+        struct arg_int *dout;
+        struct arg_dbl *current;
+#if defined(CONFIG_MODULE_MASTER)
+        struct arg_int *id;
+#endif
+        struct arg_end *end;
+    } simulateOvercurrentArgs;
+
     // Command functions
     static int digitalWriteFunc(int argc, char **argv);
     static int toggleOutputFunc(int argc, char **argv);
@@ -101,6 +120,8 @@ protected:
     static int setPWMDutyCycleFunc(int argc, char **argv);
     static int getOutputCurrentFunc(int argc, char **argv);
     static int outputIsOvercurrentFunc(int argc, char **argv);
+    static int setOvercurrentRetryFunc(int argc, char **argv);
+    static int simulateOvercurrentFunc(int argc, char **argv);
 
     // Static instance
     static DigitalOutputsInterface* _digitalOutputsInstance;
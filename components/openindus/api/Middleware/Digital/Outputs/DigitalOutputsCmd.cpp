@@ -18,6 +18,11 @@ DOut_Num_t doutNumTable[DOUT_MAX] = {DOUT_1, DOUT_2, DOUT_3, DOUT_4,
 
 void DigitalOutputsCmd::digitalWrite(DOut_Num_t num, bool level)
 {
+    uint8_t value = 0x80 | (uint8_t)level; // Bit 7: output driven by the process image
+    if (_module->writeOutputImage(IMAGE_DIGITAL_OUTPUTS, &value, sizeof(uint8_t), num) == 0) {
+        return;
+    }
+
     std::vector<uint8_t> msgBytes = {CALLBACK_DIGITAL_WRITE, (uint8_t)num, (uint8_t)level};
     _module->runCallback(msgBytes);
 }
@@ -75,14 +80,52 @@ void DigitalOutputsCmd::setOvercurrentThreshold(float threshold, float threshold
     _module->runCallback(msgBytes);
 }
 
+void DigitalOutputsCmd::setOvercurrentRetry(uint32_t retryDelay, uint8_t maxRetries, float backoff)
+{
+    std::vector<uint8_t> msgBytes = {CALLBACK_SET_OVERCURRENT_RETRY};
+    uint8_t *ptr                  = reinterpret_cast<uint8_t *>(&retryDelay);
+    msgBytes.insert(msgBytes.end(), ptr, ptr + sizeof(uint32_t));
+    msgBytes.push_back(maxRetries);
+    ptr = reinterpret_cast<uint8_t *>(&backoff);
+    msgBytes.insert(msgBytes.end(), ptr, ptr + sizeof(float));
+    _module->runCallback(msgBytes);
+}
+
+float DigitalOutputsCmd::getOvercurrentValue(DOut_Num_t num)
+{
+    /* The events carry the current, no request on the bus (the user callback runs in the bus task) */
+    if ((num < DOUT_MAX) && !isnan(_overcurrentValues[num])) {
+        return _overcurrentValues[num];
+    }
+    std::vector<uint8_t> msgBytes = {CALLBACK_GET_OVERCURRENT_VALUE, (uint8_t)num};
+    _module->runCallback(msgBytes);
+    float *current = reinterpret_cast<float *>(&msgBytes[2]);
+    return *current;
+}
+
+int32_t DigitalOutputsCmd::simulateOvercurrent(DOut_Num_t num, float current)
+{
+    std::vector<uint8_t> msgBytes = {CALLBACK_SIMULATE_OVERCURRENT, (uint8_t)num};
+    uint8_t *ptr                  = reinterpret_cast<uint8_t *>(&current);
+    msgBytes.insert(msgBytes.end(), ptr, ptr + sizeof(float));
+    _module->runCallback(msgBytes);
+    int32_t *latency = reinterpret_cast<int32_t *>(&msgBytes[2]);
+    return *latency;
+}
+
 void DigitalOutputsCmd::attachOvercurrentCallback(void (*callback)(void*), void *arg)
 {
     std::vector<uint8_t> msgBytes = {CALLBACK_ATTACH_OVERCURRENT_CALLBACK};
     _overcurrentCallback          = callback;
     Master::addEventCallback(EVENT_OVERCURRENT, _module->getId(),
                              [this](uint8_t *data) { 
+                                // data[1]: DOUT, DOUT_MAX if the total current is too high, data[2..5]: current
+                                DOut_Num_t num = (DOut_Num_t)data[1];
+                                if (num < DOUT_MAX) {
+                                    memcpy(&_overcurrentValues[num], &data[2], sizeof(float));
+                                }
                                 if (_overcurrentCallback != NULL) 
-                                    _overcurrentCallback(&doutNumTable[data[1]]); 
+                                    _overcurrentCallback((num < DOUT_MAX) ? &doutNumTable[num] : NULL); 
                              });
     _module->runCallback(msgBytes);
 }
@@ -90,6 +133,7 @@ void DigitalOutputsCmd::attachOvercurrentCallback(void (*callback)(void*), void
 void DigitalOutputsCmd::detachOvercurrentCallback()
 {
     std::vector<uint8_t> msgBytes = {CALLBACK_DETACH_OVERCURRENT_CALLBACK};
+    _resetOvercurrentValues();
     _module->runCallback(msgBytes);
 }
 
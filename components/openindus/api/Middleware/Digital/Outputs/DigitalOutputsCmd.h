@@ -20,8 +20,8 @@
 class DigitalOutputsCmd : public DigitalOutputsInterface
 {
 public:
-    DigitalOutputsCmd(ModuleControl *module) : _module(module), _overcurrentCallback(NULL) {}
-    DigitalOutputsCmd(uint16_t id) : _module(new ModuleControl(id)), _overcurrentCallback(NULL) {}
+    DigitalOutputsCmd(ModuleControl *module) : _module(module), _overcurrentCallback(NULL) { _resetOvercurrentValues(); }
+    DigitalOutputsCmd(uint16_t id) : _module(new ModuleControl(id)), _overcurrentCallback(NULL) { _resetOvercurrentValues(); }
     ~DigitalOutputsCmd() { delete _module; }
 
     void digitalWrite(DOut_Num_t num, bool level) override;
@@ -32,12 +32,22 @@ public:
     float getOutputCurrent(DOut_Num_t num) override;
     int outputIsOvercurrent(DOut_Num_t num) override;
     void setOvercurrentThreshold(float threshold, float thresholdSum = 8.0f);
+    void setOvercurrentRetry(uint32_t retryDelay, uint8_t maxRetries = 0, float backoff = 1.0f) override;
+    float getOvercurrentValue(DOut_Num_t num) override;
+    int32_t simulateOvercurrent(DOut_Num_t num, float current) override;
     void attachOvercurrentCallback(void (*callback)(void*), void *arg = NULL) override;
     void detachOvercurrentCallback(void) override;
 
 private:
     ModuleControl *_module;
     void (*_overcurrentCallback)(void*);
+    float _overcurrentValues[DOUT_MAX]; // Currents received with the events, NAN if none
+
+    void _resetOvercurrentValues(void) {
+        for (int i = 0; i < DOUT_MAX; i++) {
+            _overcurrentValues[i] = NAN;
+        }
+    }
 
 protected:
     friend class Core;
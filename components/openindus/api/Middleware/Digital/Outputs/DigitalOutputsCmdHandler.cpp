@@ -10,8 +10,18 @@
 
 #if defined(CONFIG_MODULE_SLAVE)
 
-void (*DigitalOutputsCmdHandler::_overcurrentCallback)(void*) = [](void*) {
-    Slave::sendEvent({EVENT_OVERCURRENT});
+void (*DigitalOutputsCmdHandler::_overcurrentCallback)(void*) = [](void* arg) {
+    // DOUT_MAX when the total current is too high
+    DOut_Num_t num = (arg != NULL) ? *(DOut_Num_t *)arg : DOUT_MAX;
+    float current = 0.0f;
+    if (num < DOUT_MAX) {
+        DigitalOutputs digitalOutputs;
+        current = digitalOutputs.getOvercurrentValue(num);
+    }
+    std::vector<uint8_t> event = {EVENT_OVERCURRENT, (uint8_t)num};
+    uint8_t *ptr = reinterpret_cast<uint8_t *>(&current);
+    event.insert(event.end(), ptr, ptr + sizeof(float));
+    Slave::sendEvent(event);
 };
 
 #endif
\ No newline at end of file
@@ -65,6 +65,31 @@ public:
             data.clear();
         });
 
+        Slave::addCallback(CALLBACK_SET_OVERCURRENT_RETRY, [](std::vector<uint8_t> &data) {
+            uint32_t *retryDelay = reinterpret_cast<uint32_t *>(&data[1]);
+            uint8_t maxRetries = data[5];
+            float *backoff = reinterpret_cast<float *>(&data[6]);
+            DigitalOutputs digitalOutputs;
+            digitalOutputs.setOvercurrentRetry(*retryDelay, maxRetries, *backoff);
+            data.clear();
+        });
+
+        Slave::addCallback(CALLBACK_GET_OVERCURRENT_VALUE, [](std::vector<uint8_t> &data) {
+            DigitalOutputs digitalOutputs;
+            float current = digitalOutputs.getOvercurrentValue((DOut_Num_t)data[1]);
+            uint8_t *ptr  = reinterpret_cast<uint8_t *>(&current);
+            data.insert(data.end(), ptr, ptr + sizeof(float));
+        });
+
+        Slave::addCallback(CALLBACK_SIMULATE_OVERCURRENT, [](std::vector<uint8_t> &data) {
+            float *current = reinterpret_cast<float *>(&data[2]);
+            DigitalOutputs digitalOutputs;
+            int32_t latency = digitalOutputs.simulateOvercurrent((DOut_Num_t)data[1], *current);
+            data.resize(2);
+            uint8_t *ptr = reinterpret_cast<uint8_t *>(&latency);
+            data.insert(data.end(), ptr, ptr + sizeof(int32_t));
+        });
+
         Slave::addCallback(CALLBACK_ATTACH_OVERCURRENT_CALLBACK, [](std::vector<uint8_t> &data) {
             DigitalOutputs digitalOutputs;
             digitalOutputs.attachOvercurrentCallback(_overcurrentCallback);
@@ -90,6 +115,16 @@ public:
             digitalOutputs.toggleOutput(num);
         });
 
+        /* One byte per output, bit 7 is set when the output is driven by the master */
+        Slave::addProcessImage(IMAGE_DIGITAL_OUTPUTS, NULL, [](std::vector<uint8_t> &data) {
+            DigitalOutputs digitalOutputs;
+            for (size_t i = 0; i < data.size(); ++i) {
+                if (data[i] & 0x80) {
+                    digitalOutputs.digitalWrite((DOut_Num_t)i, (bool)(data[i] & 0x01));
+                }
+            }
+        });
+
         return 0;
     }
 private:
@@ -107,10 +107,39 @@ public:
      */
     virtual void setOvercurrentThreshold(float threshold, float thresholdSum = 8.0f) = 0;
 
+    /**
+     * @brief Set the retry policy after an overcurrent.
+     * The output is restored after retryDelay, each new trip multiplies the delay by backoff.
+     * The count of trips is reset when the output stays healthy longer than the next delay.
+     *
+     * @param retryDelay Delay before the first retry in ms
+     * @param maxRetries Number of retries before the output stays off until the next write, 0 for no limit
+     * @param backoff Multiplier of the delay between two successive retries
+     */
+    virtual void setOvercurrentRetry(uint32_t retryDelay, uint8_t maxRetries = 0, float backoff = 1.0f) = 0;
+
+    /**
+     * @brief Get the current measured at the last overcurrent of a digital output
+     *
+     * @param num DOUT to get
+     * @return current in Ampere, 0 if no overcurrent happened or the current is not measured
+     */
+    virtual float getOvercurrentValue(DOut_Num_t num) = 0;
+
+    /**
+     * @brief Inject a simulated current on a digital output and measure the time needed to cut it.
+     * The output goes through the same protection path as a real overcurrent.
+     *
+     * @param num DOUT to test
+     * @param current Simulated current in Ampere
+     * @return Detection latency in us, -1 if the output was not cut
+     */
+    virtual int32_t simulateOvercurrent(DOut_Num_t num, float current) = 0;
+
     /**
      * @brief Attach a callback function to be called when an overcurrent is detected
      * 
-     * @param callback Function pointer to the callback function
+     * @param callback Function pointer to the callback function, its argument points to the DOut_Num_t
      * @param arg argument for the handler
      */
     virtual void attachOvercurrentCallback(void (*callback)(void*), void *arg = NULL) = 0;
@@ -42,6 +42,11 @@ int EncoderCmd::getRevolutions(void)
 
 int EncoderCmd::getPulses(void)
 {
+    int32_t value;
+    if (_module->readInputImage(IMAGE_ENCODER_PULSES, &value, sizeof(int32_t), _instance * sizeof(int32_t)) == 0) {
+        return value;
+    }
+
     std::vector<uint8_t> msgBytes = {CALLBACK_ENCODER_GET_PULSES, (uint8_t)_instance};
     _module->runCallback(msgBytes);
     int *pulses = reinterpret_cast<int *>(&msgBytes[2]);
@@ -64,4 +69,4 @@ float EncoderCmd::getSpeed(void)
     return *speed;
 }
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -13,10 +13,12 @@
 static const char TAG[] = "EncoderCmdHandler";
 
 Encoder **EncoderCmdHandler::_encoder = {nullptr};
+int EncoderCmdHandler::_num = 0;
 
-int EncoderCmdHandler::init(Encoder** encoder)
+int EncoderCmdHandler::init(Encoder** encoder, int num)
 {
     _encoder = encoder;
+    _num = num;
 
     Slave::addCallback(CALLBACK_ENCODER_BEGIN, [](std::vector<uint8_t> &msgBytes) {
         int instance  = msgBytes[1];
@@ -78,6 +80,14 @@ int EncoderCmdHandler::init(Encoder** encoder)
         }
     });
 
+    Slave::addProcessImage(IMAGE_ENCODER_PULSES, [](std::vector<uint8_t> &msgBytes) {
+        for (int i = 0; i < _num; i++) {
+            int32_t pulses = (_encoder[i] != nullptr) ? _encoder[i]->getPulses() : 0;
+            uint8_t *ptr   = reinterpret_cast<uint8_t *>(&pulses);
+            msgBytes.insert(msgBytes.end(), ptr, ptr + sizeof(int32_t));
+        }
+    });
+
     return 0;
 }
 
@@ -16,10 +16,11 @@
 class EncoderCmdHandler
 {
 public:
-    static int init(Encoder **encoder);
+    static int init(Encoder **encoder, int num);
 
 private:
     static Encoder **_encoder;
+    static int _num;
 };
 
 #endif
\ No newline at end of file
@@ -8,21 +8,280 @@
 
 #include "FlashLoader.h"
 
+#include <string.h>
+#include <algorithm>
+
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_ota_ops.h"
 #include "esp_flash_partitions.h"
 #include "esp_partition.h"
+#include "esp_image_format.h"
+#include "esp_flash_encrypt.h"
 #include "esp_system.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "rom/md5_hash.h"
+#include "rom/miniz.h"
+#if defined(CONFIG_FLASH_LOADER_SHA256)
+#include "mbedtls/sha256.h"
+#endif
 
 static const char FLASH_LOADER_TAG[] = "FlashLoader";
 
 static esp_ota_handle_t update_handle = 0;
 const esp_partition_t *update_partition = NULL;
 
+/* Compressed image, inflated as it is written */
+static FlashInflater* inflater = NULL;
+
+/* Chunks of a windowed transfer are staged in a double buffer, committed to flash by the flash task. 
+   They can arrive in any order in the buffer being filled and in the next one. */
+#define STAGE_CHUNKS (FLASH_LOADER_STAGE_SIZE / FLASH_LOADER_CHUNK_SIZE)
+
+typedef struct {
+    int index;
+    size_t length;
+} Stage_t;
+
+static uint8_t* stage_buffers[2] = {NULL, NULL};
+static volatile bool stage_busy[2] = {false, false}; // Given to the flash task
+static int stage_current = 0; // Buffer being filled, it waits for the flash task if it is busy
+static size_t stage_length = 0;
+static uint32_t stage_base = 0; // Offset of the first byte of the buffer being filled
+static uint32_t stage_offset = 0; // All the bytes before have been received
+static uint16_t stage_chunks[2 * STAGE_CHUNKS]; // Length of the chunks received after stage_base, 0 if missing
+static volatile bool flash_error = false;
+static QueueHandle_t stage_queue = NULL;
+
+/* Digests of the image, updated as it is written. The trailing 0xFF bytes may be padding 
+   after the end of the image, they are only hashed once they are followed by data. */
+static MD5Context md5_context;
+static size_t written_size = 0;
+static size_t pending_ff = 0; // Trailing 0xFF bytes, not hashed yet
+
+#if defined(CONFIG_FLASH_LOADER_SHA256)
+/* The last 32 bytes hashed are kept out of the SHA-256, they may be the hash appended to the image */
+static mbedtls_sha256_context sha_context;
+static uint8_t sha_tail[32];
+static size_t sha_tail_length = 0;
+
+static void _shaUpdate(const uint8_t* data, size_t length)
+{
+    size_t total = sha_tail_length + length;
+    if (total <= sizeof(sha_tail)) {
+        memcpy(&sha_tail[sha_tail_length], data, length);
+        sha_tail_length = total;
+        return;
+    }
+    size_t out = total - sizeof(sha_tail);
+    size_t fromTail = std::min(out, sha_tail_length);
+    mbedtls_sha256_update(&sha_context, sha_tail, fromTail);
+    mbedtls_sha256_update(&sha_context, data, out - fromTail);
+    memmove(sha_tail, &sha_tail[fromTail], sha_tail_length - fromTail);
+    memcpy(&sha_tail[sha_tail_length - fromTail], &data[out - fromTail], length - (out - fromTail));
+    sha_tail_length = sizeof(sha_tail);
+}
+#endif
+
+static void _hashUpdate(const uint8_t* data, size_t length)
+{
+    MD5Update(&md5_context, data, length);
+#if defined(CONFIG_FLASH_LOADER_SHA256)
+    _shaUpdate(data, length);
+#endif
+}
+
+static void _hashPending(void)
+{
+    uint8_t ff[64];
+    memset(ff, 0xFF, sizeof(ff));
+    while (pending_ff > 0) {
+        size_t n = std::min(pending_ff, sizeof(ff));
+        _hashUpdate(ff, n);
+        pending_ff -= n;
+    }
+}
+
+static void _hashReset(void)
+{
+    MD5Init(&md5_context);
+    written_size = 0;
+    pending_ff = 0;
+#if defined(CONFIG_FLASH_LOADER_SHA256)
+    mbedtls_sha256_free(&sha_context);
+    mbedtls_sha256_init(&sha_context);
+    mbedtls_sha256_starts(&sha_context, 0);
+    sha_tail_length = 0;
+#endif
+}
+
+#if defined(CONFIG_FLASH_LOADER_VERIFY)
+/* Read back the data which has just been written, while it is still in the flash cache */
+static int _verify(size_t address, const uint8_t* data, size_t length)
+{
+    uint8_t buffer[128];
+    if (esp_flash_encryption_enabled()) {
+        return 0; // The last bytes can be buffered by esp_ota_write until a full block is written
+    }
+    while (length > 0) {
+        size_t n = std::min(length, sizeof(buffer));
+        if ((esp_partition_read(update_partition, address, buffer, n) != ESP_OK) || (memcmp(buffer, data, n) != 0)) {
+            ESP_LOGE(FLASH_LOADER_TAG, "Verify failed at offset 0x%08x", address);
+            return -1;
+        }
+        address += n;
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+#endif
+
+static int _otaWrite(const uint8_t* data, size_t length, void* arg)
+{
+    esp_err_t err = esp_ota_write(update_handle, (const void *)data, length);
+    if (err != ESP_OK) {
+        ESP_LOGE(FLASH_LOADER_TAG, "esp_ota_write failed (%s)", esp_err_to_name(err));
+        return -1;
+    }
+#if defined(CONFIG_FLASH_LOADER_VERIFY)
+    if (_verify(written_size, data, length) < 0) {
+        return -1;
+    }
+#endif
+
+    size_t last = length; // Data before the trailing 0xFF bytes
+    while ((last > 0) && (data[last - 1] == 0xFF)) {
+        last--;
+    }
+    if (last > 0) {
+        _hashPending();
+        _hashUpdate(data, last);
+    }
+    pending_ff += length - last;
+    written_size += length;
+    return 0;
+}
+
+static void _flashTask(void* pvParameters)
+{
+    Stage_t stage;
+    while (1) {
+        if (xQueueReceive(stage_queue, &stage, portMAX_DELAY) == pdTRUE) {
+            int err;
+            if (inflater != NULL) {
+                err = inflater->write(stage_buffers[stage.index], stage.length, _otaWrite, NULL);
+            } else {
+                err = _otaWrite(stage_buffers[stage.index], stage.length, NULL);
+            }
+            if (err < 0) {
+                flash_error = true;
+            }
+            stage_busy[stage.index] = false;
+        }
+    }
+}
+
+/* Give the current stage buffer to the flash task */
+static void _stageCommit(void)
+{
+    if (stage_length > 0) {
+        Stage_t stage = {stage_current, stage_length};
+        stage_busy[stage_current] = true;
+        xQueueSend(stage_queue, &stage, portMAX_DELAY);
+        stage_current ^= 1;
+        stage_length = 0;
+    }
+}
+
+/* Commit the staged chunks and wait for the flash task */
+static void _stageFlush(void)
+{
+    if (stage_queue == NULL) {
+        return;
+    }
+    stage_length = stage_offset - stage_base; // The chunks after a missing one are never written
+    _stageCommit();
+    stage_base = stage_offset;
+    memset(stage_chunks, 0, sizeof(stage_chunks));
+    while (stage_busy[0] || stage_busy[1]) {
+        vTaskDelay(1);
+    }
+}
+
+static void _stageReset(void)
+{
+    _stageFlush();
+    stage_current = 0;
+    stage_length = 0;
+    stage_base = 0;
+    stage_offset = 0;
+    memset(stage_chunks, 0, sizeof(stage_chunks));
+    flash_error = false;
+}
+
+FlashInflater::FlashInflater(void) : 
+    _decompressor(NULL), _dict(NULL), _dictOffset(0), _outputSize(0), _done(false)
+{
+}
+
+FlashInflater::~FlashInflater(void)
+{
+    free(_decompressor);
+    free(_dict);
+}
+
+int FlashInflater::begin(void)
+{
+    if (_decompressor == NULL) {
+        _decompressor = (tinfl_decompressor*)malloc(sizeof(tinfl_decompressor));
+    }
+    if (_dict == NULL) {
+        _dict = (uint8_t*)malloc(TINFL_LZ_DICT_SIZE);
+    }
+    if ((_decompressor == NULL) || (_dict == NULL)) {
+        ESP_LOGE(FLASH_LOADER_TAG, "Cannot allocate the inflater");
+        return -1;
+    }
+    tinfl_init(_decompressor);
+    _dictOffset = 0;
+    _outputSize = 0;
+    _done = false;
+    return 0;
+}
+
+int FlashInflater::write(const uint8_t* data, size_t length, Output_t output, void* arg)
+{
+    if ((_decompressor == NULL) || (_dict == NULL)) {
+        return -1;
+    }
+    while (!_done) {
+        size_t inSize = length;
+        size_t outSize = TINFL_LZ_DICT_SIZE - _dictOffset;
+        tinfl_status status = tinfl_decompress(_decompressor, data, &inSize, _dict, &_dict[_dictOffset], &outSize,
+            TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+        data += inSize;
+        length -= inSize;
+        if (status < TINFL_STATUS_DONE) {
+            ESP_LOGE(FLASH_LOADER_TAG, "Inflate failed (%d)", status);
+            return -1;
+        }
+        if ((outSize > 0) && (output(&_dict[_dictOffset], outSize, arg) < 0)) {
+            return -1;
+        }
+        _dictOffset = (_dictOffset + outSize) & (TINFL_LZ_DICT_SIZE - 1);
+        _outputSize += outSize;
+        if (status == TINFL_STATUS_DONE) {
+            _done = true;
+        } else if (status == TINFL_STATUS_NEEDS_MORE_INPUT) {
+            break; // The whole block has been consumed
+        }
+    }
+    return 0;
+}
+
 void FlashLoader::begin(void)
 {
     esp_err_t err; 
@@ -49,50 +308,209 @@ void FlashLoader::begin(void)
     if (err != ESP_OK) {
         ESP_LOGE(FLASH_LOADER_TAG, "esp_ota_begin failed (%s)", esp_err_to_name(err));
         esp_ota_abort(update_handle);
+        update_handle = 0;
+        return;
     }
     ESP_LOGI(FLASH_LOADER_TAG, "esp_ota_begin succeeded");
+
+    if (stage_queue == NULL) {
+        stage_buffers[0] = (uint8_t*)malloc(FLASH_LOADER_STAGE_SIZE);
+        stage_buffers[1] = (uint8_t*)malloc(FLASH_LOADER_STAGE_SIZE);
+        stage_queue = xQueueCreate(2, sizeof(Stage_t));
+        xTaskCreate(_flashTask, "Flash loader task", 4096, NULL, 4, NULL);
+    }
+    _stageReset();
+    _hashReset();
+    delete inflater;
+    inflater = NULL;
 }
 
 void FlashLoader::write(uint8_t* data, size_t length) 
 {
-    esp_err_t err = esp_ota_write(update_handle, (const void *)data, length);
-    if (err != ESP_OK) {
-        ESP_LOGE(FLASH_LOADER_TAG, "esp_ota_write failed (%s)", esp_err_to_name(err));
+    _otaWrite(data, length, NULL);
+}
+
+void FlashLoader::write(uint32_t offset, uint8_t* data, size_t length)
+{
+    if ((stage_buffers[0] == NULL) || (stage_buffers[1] == NULL) || (length == 0) || 
+        (length > FLASH_LOADER_CHUNK_SIZE) || (offset < stage_offset) || 
+        ((offset - stage_base) % FLASH_LOADER_CHUNK_SIZE != 0)) {
+        return; // Already received
+    }
+
+    /* The chunk is dropped if its stage buffer is not free, it is sent again */
+    size_t chunk = (offset - stage_base) / FLASH_LOADER_CHUNK_SIZE;
+    if (chunk >= 2 * STAGE_CHUNKS) {
+        return;
+    }
+    int index = stage_current ^ (chunk / STAGE_CHUNKS);
+    if (stage_busy[index]) {
         return;
     }
+    memcpy(&stage_buffers[index][(chunk % STAGE_CHUNKS) * FLASH_LOADER_CHUNK_SIZE], data, length);
+    stage_chunks[chunk] = length;
+
+    /* Move over the chunks received in order, a full buffer is given to the flash task */
+    size_t next = (stage_offset - stage_base) / FLASH_LOADER_CHUNK_SIZE;
+    while ((next < 2 * STAGE_CHUNKS) && (stage_chunks[next] != 0) && 
+        ((stage_offset - stage_base) % FLASH_LOADER_CHUNK_SIZE == 0)) {
+        stage_offset += stage_chunks[next];
+        next++;
+        if (next == STAGE_CHUNKS) {
+            stage_length = FLASH_LOADER_STAGE_SIZE;
+            _stageCommit();
+            stage_base += FLASH_LOADER_STAGE_SIZE;
+            memmove(stage_chunks, &stage_chunks[STAGE_CHUNKS], STAGE_CHUNKS * sizeof(stage_chunks[0]));
+            memset(&stage_chunks[STAGE_CHUNKS], 0, STAGE_CHUNKS * sizeof(stage_chunks[0]));
+            next = 0;
+        }
+    }
 }
 
-void FlashLoader::check(uint8_t md5Sum[16], size_t progSize)
+int FlashLoader::getStatus(uint32_t end, uint32_t* offset, uint32_t* missing)
 {
-    esp_err_t err;
-    uint8_t* buffer = NULL;
-    uint32_t addr = 0;
-    MD5Context context;
+    *offset = stage_offset;
+    *missing = 0;
+    for (int n = 0; n < 32; n++) {
+        uint32_t chunkOffset = stage_offset + n * FLASH_LOADER_CHUNK_SIZE;
+        if (chunkOffset >= end) {
+            break;
+        }
+        size_t chunk = (chunkOffset - stage_base) / FLASH_LOADER_CHUNK_SIZE;
+        if ((chunk >= 2 * STAGE_CHUNKS) || (stage_chunks[chunk] == 0)) {
+            *missing |= (1UL << n);
+        }
+    }
+    return flash_error ? -1 : 0;
+}
 
-    ESP_LOGI(FLASH_LOADER_TAG, "FlashLoader check");
+bool FlashLoader::isActive(void)
+{
+    return (update_handle != 0);
+}
 
-    buffer = (uint8_t*)malloc(128);
-    assert(update_partition != NULL);
+int FlashLoader::beginDeflate(void)
+{
+    _stageReset();
+    if (inflater == NULL) {
+        inflater = new FlashInflater();
+    }
+    return inflater->begin();
+}
 
-    MD5Init(&context);
-    while (progSize > 0) {
-        uint32_t n = progSize;
-        if (n > 128) 
-            n = 128;
-        err = esp_partition_read(update_partition, addr, buffer, n);
+int FlashLoader::writeDeflate(uint8_t* data, size_t length)
+{
+    if (inflater == NULL) {
+        return -1;
+    }
+    return inflater->write(data, length, _otaWrite, NULL);
+}
+
+/* Hash a part of the partition, when the image has not been written as it is checked */
+static void _readBack(MD5Context* md5, void* sha, size_t from, size_t to)
+{
+    uint8_t buffer[128];
+    while (from < to) {
+        size_t n = std::min(to - from, sizeof(buffer));
+        esp_err_t err = esp_partition_read(update_partition, from, buffer, n);
         if (err != ESP_OK) {
             ESP_LOGE(FLASH_LOADER_TAG, "esp_partition_read failed (%s)", esp_err_to_name(err));
         }
-        MD5Update(&context, buffer, n);
-        addr += n;
-        progSize -= n;
+        if (md5 != NULL) {
+            MD5Update(md5, buffer, n);
+        }
+#if defined(CONFIG_FLASH_LOADER_SHA256)
+        if (sha != NULL) {
+            mbedtls_sha256_update((mbedtls_sha256_context*)sha, buffer, n);
+        }
+#endif
+        from += n;
+    }
+}
+
+#if defined(CONFIG_FLASH_LOADER_SHA256)
+/**
+ * @brief Check the SHA-256 appended to the image, from the incremental hash if the image 
+ * ends in the last bytes written
+ */
+static int _checkSha256(size_t progSize)
+{
+    esp_image_header_t header;
+    if ((esp_partition_read(update_partition, 0, &header, sizeof(header)) != ESP_OK) || 
+        (header.magic != ESP_IMAGE_HEADER_MAGIC) || !header.hash_appended || (progSize < 32 + sizeof(header))) {
+        return 0; // Nothing to check
+    }
+
+    size_t target = progSize - 32; // The hash covers the image before it
+    size_t base = written_size - pending_ff - sha_tail_length; // Bytes in sha_context
+    uint8_t expected[32];
+    uint8_t digest[32];
+    mbedtls_sha256_context context;
+    mbedtls_sha256_init(&context);
+
+    uint8_t bytes[sizeof(sha_tail) + 32];
+    if ((target >= base) && (progSize <= written_size) && (progSize - base <= sizeof(bytes))) {
+        /* Bytes after the hashed ones: the tail, then the pending 0xFF bytes */
+        for (size_t i = 0; i < progSize - base; i++) {
+            bytes[i] = (i < sha_tail_length) ? sha_tail[i] : 0xFF;
+        }
+        mbedtls_sha256_clone(&context, &sha_context);
+        mbedtls_sha256_update(&context, bytes, target - base);
+        memcpy(expected, &bytes[target - base], 32);
+    } else {
+        mbedtls_sha256_starts(&context, 0);
+        _readBack(NULL, &context, 0, target);
+        esp_partition_read(update_partition, target, expected, 32);
+    }
+    mbedtls_sha256_finish(&context, digest);
+    mbedtls_sha256_free(&context);
+
+    if (memcmp(digest, expected, 32) != 0) {
+        ESP_LOGE(FLASH_LOADER_TAG, "The SHA-256 of the image does not match its appended hash");
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+int FlashLoader::check(uint8_t md5Sum[16], size_t progSize)
+{
+    int ret = 0;
+    size_t hashedSize;
+    MD5Context context;
+
+    ESP_LOGI(FLASH_LOADER_TAG, "FlashLoader check");
+    _stageFlush();
+    assert(update_partition != NULL);
+
+    /* The image usually ends in the padding of the last block, after the hashed bytes */
+    hashedSize = written_size - pending_ff;
+    if ((progSize >= hashedSize) && (progSize <= written_size)) {
+        uint8_t ff[64];
+        size_t n = progSize - hashedSize;
+        memset(ff, 0xFF, sizeof(ff));
+        context = md5_context;
+        while (n > 0) {
+            size_t m = std::min(n, sizeof(ff));
+            MD5Update(&context, ff, m);
+            n -= m;
+        }
+    } else {
+        ESP_LOGW(FLASH_LOADER_TAG, "Image size does not match the written data, reading it back");
+        MD5Init(&context);
+        _readBack(&context, NULL, 0, progSize);
     }
     MD5Final(md5Sum, &context);
-    free(buffer);
+
+#if defined(CONFIG_FLASH_LOADER_SHA256)
+    ret = _checkSha256(progSize);
+#endif
+    return ret;
 }
 
 void FlashLoader::end(void)
 {
+    _stageFlush();
     esp_err_t err = esp_ota_end(update_handle);
     if (err != ESP_OK) {
         if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
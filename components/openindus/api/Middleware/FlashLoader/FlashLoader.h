@@ -11,12 +11,117 @@
 #include <cstdint>
 #include <cstddef>
 
+/* Largest chunk of a windowed transfer, sent with its offset in one frame */
+#define FLASH_LOADER_CHUNK_SIZE 512
+
+/* Size of each of the two stage buffers of the slaves, one flash sector */
+#define FLASH_LOADER_STAGE_SIZE 4096
+
+struct tinfl_decompressor_tag;
+
+/**
+ * @brief Inflater of a zlib stream received in blocks of any size, with the ROM miniz routines.
+ * The inflated data is given to the output function each time the 32KB dictionary is full
+ * or the input block has been consumed.
+ */
+class FlashInflater
+{
+public:
+
+    typedef int (*Output_t)(const uint8_t* data, size_t length, void* arg);
+
+    FlashInflater(void);
+    ~FlashInflater(void);
+
+    /**
+     * @brief Start a new stream
+     * 
+     * @return 0 on success, -1 if the buffers cannot be allocated
+     */
+    int begin(void);
+
+    /**
+     * @brief Inflate a block of the stream
+     * 
+     * @param data Compressed data
+     * @param length 
+     * @param output Called with the inflated data
+     * @param arg Argument of the output function
+     * @return 0 on success, -1 if the stream is corrupted or the output failed
+     */
+    int write(const uint8_t* data, size_t length, Output_t output, void* arg);
+
+    inline size_t getOutputSize(void) {
+        return _outputSize;
+    }
+
+private:
+
+    struct tinfl_decompressor_tag* _decompressor;
+    uint8_t* _dict;
+    size_t _dictOffset;
+    size_t _outputSize;
+    bool _done;
+};
+
 class FlashLoader
 {
 public:
 
     static void begin(void);
     static void write(uint8_t* data, size_t length);
-    static void check(uint8_t md5Sum[16], size_t progSize);
+
+    /**
+     * @brief Get the MD5 of the start of the image. The digest is computed as the image is written, 
+     * the flash is only read back if the size does not match the written data.
+     * With CONFIG_FLASH_LOADER_SHA256, the SHA-256 appended to the image is checked too.
+     * 
+     * @param md5Sum 
+     * @param progSize Size of the image
+     * @return 0 on success, -1 if the image does not match its SHA-256
+     */
+    static int check(uint8_t md5Sum[16], size_t progSize);
     static void end(void);
+
+    /**
+     * @brief Write a chunk of a windowed transfer at its offset.
+     * Chunks are staged in a double buffer and committed to flash by a separate task, so that 
+     * the bus task keeps receiving while the flash is erased. A chunk is accepted in any order 
+     * when it falls in a stage buffer which is not being written, otherwise it is dropped and 
+     * the master sends it again.
+     * 
+     * @param offset Offset in the image, compressed or not, a multiple of FLASH_LOADER_CHUNK_SIZE
+     * @param data 
+     * @param length FLASH_LOADER_CHUNK_SIZE, less for the last chunk
+     */
+    static void write(uint32_t offset, uint8_t* data, size_t length);
+
+    /**
+     * @brief Get the status of a windowed transfer
+     * 
+     * @param end Offset of the end of the data sent by the master
+     * @param offset All the bytes before this offset have been accepted
+     * @param missing Bit n: the chunk at offset + n * FLASH_LOADER_CHUNK_SIZE, before end, is missing
+     * @return 0 on success, -1 if the flash could not be written
+     */
+    static int getStatus(uint32_t end, uint32_t* offset, uint32_t* missing);
+
+    static bool isActive(void);
+
+    /**
+     * @brief Start a compressed image, written with writeDeflate() or by chunks.
+     * The staged chunks are inflated by the flash task.
+     * 
+     * @return 0 on success, -1 on error
+     */
+    static int beginDeflate(void);
+
+    /**
+     * @brief Inflate the next block of a compressed image into the flash
+     * 
+     * @param data 
+     * @param length 
+     * @return 0 on success, -1 on error
+     */
+    static int writeDeflate(uint8_t* data, size_t length);
 };
@@ -17,6 +17,8 @@
 #define MAX_DRV8873_FREQU       100000 // max driver is 100kHz
 // Frequency in Hertz over the audio range. can be up to 100kHz
 #define LEDC_FREQUENCY          39062 // Approx 39kHz is max at 11 bits resolution
+#define CURRENT_SAMPLES         1000
+#define CURRENT_SCAN_SIZE       100 // Samples read by each ADC scan
 
 #if (LEDC_FREQUENCY > MAX_DRV8873_FREQU)
     #error "LEDC_FREQUENCY exceeds maximum frequency supported by DRV8873"
@@ -24,6 +26,22 @@
 
 static const char* TAG = "MotorDc";
 
+/* Average voltage of an ADC channel over CURRENT_SAMPLES samples */
+static float _readAverageVoltage(uint8_t channel)
+{
+    uint16_t raws[CURRENT_SCAN_SIZE];
+    float sum = 0.0f;
+    for (int j = 0; j < CURRENT_SAMPLES; j += CURRENT_SCAN_SIZE) {
+        if (ads866x_scan((1 << channel), CURRENT_SCAN_SIZE, raws) != 0) {
+            return 0.0f;
+        }
+        for (int k = 0; k < CURRENT_SCAN_SIZE; k++) {
+            sum += ads866x_convert_raw_2_volt(raws[k], 6);
+        }
+    }
+    return sum / CURRENT_SAMPLES;
+}
+
 std::vector<MotorDC_PinConfig_t> MotorDc::_motorsConfig;
 gpio_num_t MotorDc::_faultPin;
 std::vector<MotorDirection_t> MotorDc::_directions;
@@ -181,25 +199,13 @@ float MotorDc::getCurrent(MotorNum_t motor)
         ESP_LOGW(TAG, "Motor %d direction not initialized, assuming FORWARD", motor);
         // Default to channel 0 (FORWARD)
         uint8_t channel = motorToChannel[motor][0];
-        float sum = 0.0f;
-        for (int j = 0; j < 1000; ++j) {
-            float raw = ads866x_analog_read(channel);
-            float voltage = ads866x_convert_raw_2_volt(raw, 6);
-            sum += voltage;
-        }
-        float avg = sum / 1000.0f;
+        float avg = _readAverageVoltage(channel);
         float current = avg * 1100.0f / 430.0f;
         return current;
     }
 
     uint8_t channel = motorToChannel[motor][(_directions.at(motor) == FORWARD) ? 0 : 1];
-    float sum = 0.0f;
-    for (int j = 0; j < 1000; ++j) {
-        float raw = ads866x_analog_read(channel);
-        float voltage = ads866x_convert_raw_2_volt(raw, 6);
-        sum += voltage;
-    }
-    float avg = sum / 1000.0f;
+    float avg = _readAverageVoltage(channel);
 
     // Convert voltage to current (I = U / R)
     float current = avg * 1100.0f / 430.0f; // k=1100, R=430Ohm
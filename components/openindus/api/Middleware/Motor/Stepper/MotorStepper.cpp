@@ -11,7 +11,6 @@
 #include <algorithm>
 #include "esp_log.h"
 #include "esp_err.h"
-#include "esp_adc/adc_oneshot.h"
 
 static const char TAG[] = "MotorStepper";
 
@@ -22,7 +21,7 @@ static QueueHandle_t _busyEvent[MOTOR_MAX];
 static SemaphoreHandle_t _homingSemaphore[MOTOR_MAX];
 static bool _taskHomingStopRequested[MOTOR_MAX] = {false, false};
 static SemaphoreHandle_t _taskHomingStopSemaphore[MOTOR_MAX];
-static adc_oneshot_unit_handle_t _adcHandle = nullptr;
+static int _adcIndex = -1;
 
 static void _triggerLimitSwitch(void* arg);
 static void _homingTask(void* arg);
@@ -57,28 +56,19 @@ int MotorStepper::init(PS01_Hal_Config_t* config, PS01_Param_t* param)
     return err;
 }
 
-int MotorStepper::configProtections(adc_oneshot_unit_handle_t adcHandle)
+int MotorStepper::configProtections(void)
 {
     esp_err_t err = ESP_OK;
 
-    _adcHandle = adcHandle;
-
-    /* Configure ADC to read power supply voltage */
-    if (_adcHandle == NULL) {
-        adc_oneshot_chan_cfg_t config = {
-            .atten = ADC_ATTEN_DB_12,
-            .bitwidth = ADC_BITWIDTH_12,
-        };
-        err |= adc_oneshot_config_channel(_adcHandle, ADC_CHANNEL_0, &config);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to configure ADC channel: %s", esp_err_to_name(err));
-        }
+    /* Sample the power supply voltage in background */
+    _adcIndex = AdcSampler::addChannel(ADC_UNIT_1, ADC_CHANNEL_0);
+    if (_adcIndex < 0) {
+        ESP_LOGE(TAG, "Failed to configure ADC channel");
     }
     
-    int adc_value = 0;
-    err |= adc_oneshot_read(_adcHandle, ADC_CHANNEL_0, &adc_value);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to read ADC: %s", esp_err_to_name(err));
+    int adc_value = AdcSampler::readRaw(_adcIndex);
+    if (adc_value < 0) {
+        ESP_LOGE(TAG, "Failed to read ADC");
         adc_value = 0; // Use default value
     }
     ESP_LOGD(TAG, "ADC Value on GPIO1: %d", adc_value);
@@ -306,9 +296,9 @@ float MotorStepper::getSupplyVoltage(void)
     float voltage = 0.0f;
     int adc_raw = 0;
     
-    if (_adcHandle != NULL) {
-        esp_err_t err = adc_oneshot_read(_adcHandle, ADC_CHANNEL_0, &adc_raw);
-        if (err == ESP_OK && adc_raw > 0) {
+    if (_adcIndex >= 0) {
+        adc_raw = AdcSampler::readRaw(_adcIndex);
+        if (adc_raw > 0) {
             voltage = (float)adc_raw * 3.3f / 4095.0f;
         }
     }
@@ -11,7 +11,7 @@
 #include "DigitalInputs.h"
 #include "Motor.h"
 #include "powerSTEP01/PS01.h"
-#include "esp_adc/adc_oneshot.h"
+#include "AdcSampler.h"
 
 /**
  * @brief Stepper motors step modes
@@ -266,7 +266,7 @@ public:
 
 protected:
     static int init(PS01_Hal_Config_t *config, PS01_Param_t *param);
-    static int configProtections(adc_oneshot_unit_handle_t adc1_handle);
+    static int configProtections(void);
 
 private:
     static int _registerCLI(void);
@@ -80,6 +80,11 @@ void MotorStepperCmd::setFullStepSpeed(MotorNum_t motor, float speed)
 
 int32_t MotorStepperCmd::getPosition(MotorNum_t motor)
 {
+    int32_t value;
+    if (_module->readInputImage(IMAGE_MOTOR_POSITION, &value, sizeof(int32_t), motor * sizeof(int32_t)) == 0) {
+        return value;
+    }
+
     std::vector<uint8_t> msgBytes = {CALLBACK_MOTOR_GET_POSITION, (uint8_t)motor};
     _module->runCallback(msgBytes);
     int32_t *position = reinterpret_cast<int32_t *>(&msgBytes[2]);
@@ -96,6 +101,12 @@ float MotorStepperCmd::getSpeed(MotorNum_t motor)
 
 MotorStepperStatus_t MotorStepperCmd::getStatus(MotorNum_t motor)
 {
+    MotorStepperStatus_t value;
+    if (_module->readInputImage(IMAGE_MOTOR_STATUS, &value, sizeof(MotorStepperStatus_t),
+        motor * sizeof(MotorStepperStatus_t)) == 0) {
+        return value;
+    }
+
     std::vector<uint8_t> msgBytes = {CALLBACK_MOTOR_GET_STATUS, (uint8_t)motor};
     _module->runCallback(msgBytes);
     MotorStepperStatus_t *status = reinterpret_cast<MotorStepperStatus_t *>(&msgBytes[2]);
@@ -226,4 +237,4 @@ void MotorStepperCmd::detachFlagInterrupt(void)
     _module->runCallback(msgBytes);
 }
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
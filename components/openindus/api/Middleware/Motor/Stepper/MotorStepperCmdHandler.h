@@ -227,6 +227,22 @@ public:
             MotorStepper::triggerLimitSwitch(num);
         });
 
+        Slave::addProcessImage(IMAGE_MOTOR_POSITION, [](std::vector<uint8_t> &data) {
+            for (int i = 0; i < MOTOR_MAX; i++) {
+                int32_t position = MotorStepper::getPosition(static_cast<MotorNum_t>(i));
+                uint8_t *ptr     = reinterpret_cast<uint8_t *>(&position);
+                data.insert(data.end(), ptr, ptr + sizeof(int32_t));
+            }
+        });
+
+        Slave::addProcessImage(IMAGE_MOTOR_STATUS, [](std::vector<uint8_t> &data) {
+            for (int i = 0; i < MOTOR_MAX; i++) {
+                MotorStepperStatus_t status = MotorStepper::getStatus(static_cast<MotorNum_t>(i));
+                uint8_t *ptr                = reinterpret_cast<uint8_t *>(&status);
+                data.insert(data.end(), ptr, ptr + sizeof(MotorStepperStatus_t));
+            }
+        });
+
         return 0;
     }
 
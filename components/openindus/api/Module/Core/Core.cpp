@@ -190,7 +190,7 @@ int Core::init(void)
      */
     err |= DigitalInputs::init(&_ioex, _dinGpio, 4);
     err |= DigitalOutputs::init(&_ioex, _doutGpio, _doutCurrentGpio, 4);
-    err |= AnalogInputsHV::init(ADC_UNIT_1, _ainChannel, 2, adcHandles[0]);
+    err |= AnalogInputsHV::init(ADC_UNIT_1, _ainChannel, 2);
 
     ESP_LOGI(TAG, "Create a power monitoring task");
     xTaskCreate(_powerMonitoringTask, "Power monitoring task", 4096, NULL, 1, NULL);
@@ -8,14 +8,10 @@
 
 #include "Module.h"
 #include "ModulePinout.h"
-#include "esp_adc/adc_oneshot.h"
-#include "esp_adc/adc_cali.h"
-#include "esp_adc/adc_cali_scheme.h"
 
 static const char TAG[] = "Module";
 
 uint16_t Module::_type = 0;
-adc_oneshot_unit_handle_t Module::adcHandles[2] = {NULL, NULL};
 
 int Module::init(uint16_t type)
 {
@@ -36,7 +32,7 @@ int Module::init(uint16_t type)
     Led::on(LED_BLUE);
 
     /* ADC */
-    Module::_initADC();
+    err |= AdcSampler::init();
 
     /* Bus */
 #if defined(CONFIG_MODULE_MASTER) || defined(CONFIG_MODULE_SLAVE) 
@@ -48,8 +44,6 @@ int Module::init(uint16_t type)
         .gpioNumSync = MODULE_GPIO_BUS_GPIO,
         .gpioModeSync = GPIO_MODE_INPUT_OUTPUT,
         .gpioNumPower = MODULE_GPIO_CMD_MOSFET_ALIM,
-        .adcHandle = Module::adcHandles[0],
-        .adcCaliHandle = NULL,
     };
 #if defined(CONFIG_MODULE_MASTER)
     config.gpioModeSync = GPIO_MODE_INPUT_OUTPUT;
@@ -105,16 +99,3 @@ int Module::_initBoardInfos(void)
 
     return err;
 }
-
-void Module::_initADC(void)
-{
-    adc_oneshot_unit_init_cfg_t adcConfig = {};
-    adcConfig.unit_id = ADC_UNIT_1;
-    if (adc_oneshot_new_unit(&adcConfig, &Module::adcHandles[0]) != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to initialize ADC unit 1");
-    }
-    adcConfig.unit_id = ADC_UNIT_2;
-    if (adc_oneshot_new_unit(&adcConfig, &Module::adcHandles[1]) != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to initialize ADC unit 2");
-    }
-}
\ No newline at end of file
@@ -12,8 +12,7 @@
 #include "Board.h"
 #include "Bus.h"
 #include "Led.h"
-#include "esp_adc/adc_oneshot.h"
-#include "esp_adc/adc_cali.h"
+#include "AdcSampler.h"
 
 class Module : private Board, private Led, private Bus
 {
@@ -33,13 +32,9 @@ public:
 
 protected:
     static int init(uint16_t type);
-    
-    /* ADC handles */
-    static adc_oneshot_unit_handle_t adcHandles[2];
 
 private:
     static uint16_t _type;
 
     static int _initBoardInfos(void);
-    static void _initADC(void);
 };
\ No newline at end of file
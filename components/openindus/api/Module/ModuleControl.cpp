@@ -13,23 +13,105 @@
 
 static const char TAG[] = "ModuleControl";
 
-ModuleControl::ModuleControl(uint16_t id) : _id(id), _type(0), _sn(0) {}
+ModuleControl::ModuleControl(uint16_t id) : _id(id), _type(0), _sn(0),
+    _inputFront(0), _inputValid(false), _outputDirty(false), _batchTask(NULL), _batchError(0)
+{
+    _imageMutex = xSemaphoreCreateMutex();
+    _configMutex = xSemaphoreCreateMutex();
+}
 
-ModuleControl::ModuleControl(uint16_t type, uint32_t sn) : _id(0xFFFF), _type(type), _sn(sn)
+ModuleControl::ModuleControl(uint16_t type, uint32_t sn) : _id(0xFFFF), _type(type), _sn(sn),
+    _inputFront(0), _inputValid(false), _outputDirty(false), _batchTask(NULL), _batchError(0)
 {
+    _imageMutex = xSemaphoreCreateMutex();
+    _configMutex = xSemaphoreCreateMutex();
     Master::addModuleControlInstance(this);
 }
 
+static bool _callbackAnswered(uint8_t callbackId);
+
 int ModuleControl::runCallback(const uint8_t callbackId, std::vector<uint8_t> &args, bool ackNeeded)
 {
+    if (_batchTask == xTaskGetCurrentTaskHandle()) {
+        if (!_callbackAnswered(callbackId)) {
+            return addBatch(callbackId, args);
+        }
+        _sendBatch(); // The caller needs the answer now, the queued callbacks run first
+    }
+    _storeConfig(callbackId, args.data(), args.size());
     return Master::runCallback(_id, callbackId, args, ackNeeded);
 }
 
 int ModuleControl::runCallback(std::vector<uint8_t> &msgBytes, bool ackNeeded)
 {
+    if ((_batchTask == xTaskGetCurrentTaskHandle()) && !msgBytes.empty()) {
+        if (!_callbackAnswered(msgBytes[0])) {
+            return addBatch(msgBytes);
+        }
+        _sendBatch(); // The caller needs the answer now, the queued callbacks run first
+    }
+    _storeConfig(msgBytes);
     return Master::runCallback(_id, msgBytes, ackNeeded);
 }
 
+int ModuleControl::runCallbackAsync(const std::vector<uint8_t> &msgBytes, 
+    std::function<void(int, std::vector<uint8_t> &)> done, uint32_t timeoutMs)
+{
+    _storeConfig(msgBytes);
+    return Master::runCallbackAsync(_id, msgBytes, done, timeoutMs);
+}
+
+void ModuleControl::beginBatch(void)
+{
+    if (_batchTask != NULL) {
+        ESP_LOGW(TAG, "Batch already started, previous callbacks are discarded");
+    }
+    _batch.clear();
+    _batchError = 0;
+    _batchTask = xTaskGetCurrentTaskHandle();
+}
+
+int ModuleControl::addBatch(std::vector<uint8_t> &msgBytes)
+{
+    if (_batchTask != xTaskGetCurrentTaskHandle()) {
+        ESP_LOGE(TAG, "No batch started");
+        return -1;
+    }
+    if (msgBytes.empty() || _callbackAnswered(msgBytes[0])) {
+        ESP_LOGE(TAG, "Callback 0x%02X returns a value, it cannot be batched", msgBytes.empty() ? 0 : msgBytes[0]);
+        return -1;
+    }
+    _storeConfig(msgBytes);
+    _batch.push_back(msgBytes);
+    return 0;
+}
+
+int ModuleControl::addBatch(const uint8_t callbackId, std::vector<uint8_t> &args)
+{
+    std::vector<uint8_t> msgBytes = args;
+    msgBytes.insert(msgBytes.begin(), callbackId);
+    return addBatch(msgBytes);
+}
+
+int ModuleControl::commitBatch(void)
+{
+    if (_batchTask != xTaskGetCurrentTaskHandle()) {
+        ESP_LOGE(TAG, "No batch started");
+        return -1;
+    }
+    _batchTask = NULL;
+    _sendBatch();
+    return _batchError;
+}
+
+void ModuleControl::_sendBatch(void)
+{
+    if (!_batch.empty()) {
+        _batchError |= Master::runCallbackBatch(_id, _batch);
+        _batch.clear();
+    }
+}
+
 void ModuleControl::restart(void)
 { 
     Master::moduleRestart(_id);
@@ -59,7 +141,310 @@ void ModuleControl::registerModuleEventCallback(ModuleControl* module,
     uint8_t eventId, uint8_t eventArg, 
     uint8_t callbackId, std::vector<uint8_t> callbackArgs)
 {
+    /* Registering the same callback again for an event only changes its arguments */
+    xSemaphoreTake(_configMutex, portMAX_DELAY);
+    auto it = std::find_if(_eventConfig.begin(), _eventConfig.end(), [&](const EventConfig_s &event) {
+        return (event.module == module) && (event.eventId == eventId) && 
+            (event.eventArg == eventArg) && (event.callbackId == callbackId);
+    });
+    if (it != _eventConfig.end()) {
+        it->callbackArgs = callbackArgs;
+    } else {
+        _eventConfig.push_back({module, eventId, eventArg, callbackId, callbackArgs});
+    }
+    xSemaphoreGive(_configMutex);
     Master::registerEventCallback(_id, module, eventId, eventArg, callbackId, callbackArgs);
 }
 
+int ModuleControl::readInputImage(uint8_t imageId, void* data, size_t size, size_t offset)
+{
+    int err = -1;
+
+    if (!Master::isCyclicRunning()) {
+        return -1;
+    }
+
+    xSemaphoreTake(_imageMutex, portMAX_DELAY);
+    if (_inputValid) {
+        auto it = _inputImage[_inputFront].find(imageId);
+        if ((it != _inputImage[_inputFront].end()) && (offset + size <= it->second.size())) {
+            memcpy(data, &it->second[offset], size);
+            err = 0;
+        }
+    }
+    xSemaphoreGive(_imageMutex);
+
+    return err;
+}
+
+int ModuleControl::writeOutputImage(uint8_t imageId, const void* data, size_t size, size_t offset)
+{
+    if (!Master::isCyclicRunning()) {
+        return -1;
+    }
+
+    xSemaphoreTake(_imageMutex, portMAX_DELAY);
+    std::vector<uint8_t> &entry = _outputImage[imageId];
+    if (entry.size() < offset + size) {
+        entry.resize(offset + size, 0);
+    }
+    memcpy(&entry[offset], data, size);
+    _outputDirty = true;
+    xSemaphoreGive(_imageMutex);
+
+    return 0;
+}
+
+/**
+ * @brief Serialize the output image as [id, length, data...] records
+ * 
+ * @param buffer Destination buffer
+ * @param size Buffer size
+ * @return Number of bytes written, 0 if the outputs did not change since the last cycle
+ */
+int ModuleControl::_buildOutputImage(uint8_t* buffer, size_t size)
+{
+    size_t length = 0;
+
+    xSemaphoreTake(_imageMutex, portMAX_DELAY);
+    if (_outputDirty) {
+        for (auto &it : _outputImage) {
+            if ((it.second.size() > 0xFF) || (length + 2 + it.second.size() > size)) {
+                ESP_LOGW(TAG, "Output image entry 0x%02X does not fit in the frame", it.first);
+                continue;
+            }
+            buffer[length++] = it.first;
+            buffer[length++] = (uint8_t)it.second.size();
+            memcpy(&buffer[length], it.second.data(), it.second.size());
+            length += it.second.size();
+        }
+        _outputDirty = false;
+    }
+    xSemaphoreGive(_imageMutex);
+
+    return length;
+}
+
+/**
+ * @brief Parse the [id, length, data...] records sent by the slave into the
+ * back buffer, then make it the front buffer
+ * 
+ * @param buffer Received records
+ * @param length Number of bytes received
+ */
+void ModuleControl::_parseInputImage(const uint8_t* buffer, size_t length)
+{
+    /* Only the cyclic task writes the back buffer, no need to lock while parsing */
+    ProcessImage &image = _inputImage[_inputFront ^ 1];
+    size_t index = 0;
+    while (index + 2 <= length) {
+        uint8_t imageId = buffer[index];
+        uint8_t entryLength = buffer[index + 1];
+        if (index + 2 + entryLength > length) {
+            ESP_LOGW(TAG, "Truncated input image entry 0x%02X", imageId);
+            break;
+        }
+        image[imageId].assign(&buffer[index + 2], &buffer[index + 2 + entryLength]);
+        index += 2 + entryLength;
+    }
+
+    xSemaphoreTake(_imageMutex, portMAX_DELAY);
+    _inputFront ^= 1;
+    _inputValid = true;
+    xSemaphoreGive(_imageMutex);
+}
+
+void ModuleControl::_invalidateInputImage(void)
+{
+    xSemaphoreTake(_imageMutex, portMAX_DELAY);
+    _inputValid = false;
+    _outputDirty = true; // Send the full output image again when the exchange resumes
+    xSemaphoreGive(_imageMutex);
+}
+
+/**
+ * @brief Number of leading bytes of a configuration callback (callback id included) which identify 
+ * the setting: a new call replaces the previous one with the same key. 0 if the whole message is the 
+ * key, -1 if the callback does not configure the module.
+ */
+static int _configKeyLength(uint8_t callbackId)
+{
+    switch (callbackId) {
+    case CALLBACK_SET_OVERCURRENT_THRESHOLD:
+    case CALLBACK_SET_OVERCURRENT_RETRY:
+    case CALLBACK_ATTACH_OVERCURRENT_CALLBACK:
+    case CALLBACK_MOTOR_ATTACH_FLAG_INTERRUPT:
+        return 1;
+    case CALLBACK_OUTPUT_MODE:
+    case CALLBACK_SET_PWM_FREQUENCY:
+    case CALLBACK_ATTACH_INTERRUPT:
+    case CALLBACK_DIGITAL_ATTACH_COUNTER:
+    case CALLBACK_ANALOG_INPUT_MODE:
+    case CALLBACK_ANALOG_INPUT_VOLTAGE_RANGE:
+    case CALLBACK_ANALOG_OUTPUT_MODE:
+    case CALLBACK_MOTOR_SET_STEP_RESOLUTION:
+    case CALLBACK_MOTOR_SET_MAX_SPEED:
+    case CALLBACK_MOTOR_SET_MIN_SPEED:
+    case CALLBACK_MOTOR_SET_FULL_STEP_SPEED:
+    case CALLBACK_MOTOR_SET_ACCELERATION:
+    case CALLBACK_MOTOR_SET_DECELERATION:
+    case CALLBACK_MOTOR_RESET_ALL_ADVANCED_PARAM:
+    case CALLBACK_ENCODER_BEGIN:
+        return 2;
+    case CALLBACK_MOTOR_ATTACH_LIMIT_SWITCH:
+    case CALLBACK_MOTOR_SET_ADVANCED_PARAM:
+    case CALLBACK_SENSOR_SET_PARAMETER:
+        return 3;
+    case CALLBACK_ADD_SENSOR:
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+/**
+ * @brief Configuration callback cancelled by a callback, with the length of its key
+ */
+static int _configCancelled(uint8_t callbackId, uint8_t* configId)
+{
+    switch (callbackId) {
+    case CALLBACK_DETACH_INTERRUPT:             *configId = CALLBACK_ATTACH_INTERRUPT; return 2;
+    case CALLBACK_DIGITAL_DETACH_COUNTER:       *configId = CALLBACK_DIGITAL_ATTACH_COUNTER; return 2;
+    case CALLBACK_DETACH_OVERCURRENT_CALLBACK:  *configId = CALLBACK_ATTACH_OVERCURRENT_CALLBACK; return 1;
+    case CALLBACK_MOTOR_DETACH_LIMIT_SWITCH:    *configId = CALLBACK_MOTOR_ATTACH_LIMIT_SWITCH; return 3;
+    case CALLBACK_MOTOR_DETACH_FLAG_INTERRUPT:  *configId = CALLBACK_MOTOR_ATTACH_FLAG_INTERRUPT; return 1;
+    case CALLBACK_ENCODER_END:                  *configId = CALLBACK_ENCODER_BEGIN; return 2;
+    default: return -1;
+    }
+}
+
+/**
+ * @brief Callbacks whose caller reads the answer, or waits for the event they trigger: 
+ * they are never queued in a batch
+ */
+static bool _callbackAnswered(uint8_t callbackId)
+{
+    switch (callbackId) {
+    case CALLBACK_GET_OUTPUT_CURRENT:
+    case CALLBACK_OUTPUT_IS_OVERCURRENT:
+    case CALLBACK_GET_OVERCURRENT_VALUE:
+    case CALLBACK_SIMULATE_OVERCURRENT:
+    case CALLBACK_DIGITAL_READ:
+    case CALLBACK_DIGITAL_READ_EVENTS:
+    case CALLBACK_DIGITAL_ATTACH_COUNTER:
+    case CALLBACK_DIGITAL_GET_COUNT:
+    case CALLBACK_DIGITAL_GET_FREQUENCY:
+    case CALLBACK_DIGITAL_GET_PERIOD:
+    case CALLBACK_ANALOG_INPUT_GET_MODE:
+    case CALLBACK_ANALOG_INPUT_GET_VOLTAGE_RANGE:
+    case CALLBACK_ANALOG_READ:
+    case CALLBACK_ANALOG_READ_VOLT:
+    case CALLBACK_ANALOG_READ_MILLIVOLT:
+    case CALLBACK_ANALOG_READ_AMP:
+    case CALLBACK_ANALOG_READ_MILLIAMP:
+    case CALLBACK_ANALOG_CAPTURE_START:
+    case CALLBACK_ANALOG_CAPTURE_STATUS:
+    case CALLBACK_ANALOG_CAPTURE_READ:
+    case CALLBACK_MOTOR_WAIT:
+    case CALLBACK_MOTOR_GET_POSITION:
+    case CALLBACK_MOTOR_GET_SPEED:
+    case CALLBACK_MOTOR_GET_ADVANCED_PARAM:
+    case CALLBACK_MOTOR_GET_SUPPLY_VOLTAGE:
+    case CALLBACK_MOTOR_GET_STATUS:
+    case CALLBACK_ENCODER_GET_REVOLUTIONS:
+    case CALLBACK_ENCODER_GET_PULSES:
+    case CALLBACK_ENCODER_GET_ANGLE:
+    case CALLBACK_ENCODER_GET_SPEED:
+    case CALLBACK_MOTOR_DC_GET_CURRENT:
+    case CALLBACK_MOTOR_DC_GET_FAULT:
+    case CALLBACK_ADD_SENSOR:
+    case CALLBACK_SENSOR_READ:
+    case CALLBACK_SENSOR_READ_MILLIVOLT:
+    case CALLBACK_SENSOR_READ_RESISTANCE:
+    case CALLBACK_SENSOR_READ_TEMPERATURE:
+    case CALLBACK_SENSOR_READ_RAW:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Compare a stored configuration message with the key of a callback
+ * 
+ * @param config Callback id followed by its arguments
+ * @param configId Callback id of the key
+ * @param args Arguments of the key
+ * @param size Number of arguments
+ * @param length Key length, callback id included, see _configKeyLength
+ */
+static bool _sameKey(const std::vector<uint8_t> &config, uint8_t configId, const uint8_t* args, size_t size, int length)
+{
+    if (config.empty() || (config[0] != configId)) {
+        return false;
+    }
+    if (length == 0) {
+        return (config.size() == size + 1) && std::equal(args, args + size, config.begin() + 1);
+    }
+    return (config.size() >= (size_t)length) && (size + 1 >= (size_t)length) && 
+        std::equal(config.begin() + 1, config.begin() + length, args);
+}
+
+void ModuleControl::_storeConfig(const std::vector<uint8_t> &msgBytes)
+{
+    if (!msgBytes.empty()) {
+        _storeConfig(msgBytes[0], msgBytes.data() + 1, msgBytes.size() - 1);
+    }
+}
+
+/**
+ * @brief Keep the last call of a configuration callback, nothing is copied for the other callbacks
+ */
+void ModuleControl::_storeConfig(uint8_t callbackId, const uint8_t* args, size_t size)
+{
+    uint8_t configId = callbackId;
+    int length = _configKeyLength(callbackId);
+    if (length < 0) {
+        length = _configCancelled(callbackId, &configId);
+        if (length < 0) {
+            return;
+        }
+    }
+
+    xSemaphoreTake(_configMutex, portMAX_DELAY);
+    _config.erase(std::remove_if(_config.begin(), _config.end(), 
+        [&](const std::vector<uint8_t> &config) { return _sameKey(config, configId, args, size, length); }), _config.end());
+    if (configId == callbackId) {
+        std::vector<uint8_t> msgBytes;
+        msgBytes.reserve(size + 1);
+        msgBytes.push_back(callbackId);
+        msgBytes.insert(msgBytes.end(), args, args + size);
+        _config.push_back(std::move(msgBytes));
+    }
+    xSemaphoreGive(_configMutex);
+}
+
+/**
+ * @brief Send the stored configuration again, after the module restarted
+ * 
+ * @return 0 on success, -1 if a callback failed
+ */
+int ModuleControl::_replayConfig(void)
+{
+    xSemaphoreTake(_configMutex, portMAX_DELAY);
+    std::vector<std::vector<uint8_t>> config = _config;
+    std::vector<EventConfig_s> eventConfig = _eventConfig;
+    xSemaphoreGive(_configMutex);
+
+    int err = 0;
+    for (auto &msgBytes : config) {
+        err |= Master::runCallback(_id, msgBytes);
+    }
+    for (auto &event : eventConfig) {
+        Master::registerEventCallback(_id, event.module, event.eventId, event.eventArg, event.callbackId, event.callbackArgs);
+    }
+    ESP_LOGI(TAG, "Module %u: %u settings restored", _id, config.size() + eventConfig.size());
+    return err;
+}
+
 #endif
\ No newline at end of file
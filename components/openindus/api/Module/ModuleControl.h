@@ -32,6 +32,40 @@ public:
     int runCallback(const uint8_t callbackId, std::vector<uint8_t> &args, bool ackNeeded = true);
     int runCallback(std::vector<uint8_t> &msgBytes, bool ackNeeded = true);
 
+    /**
+     * @brief Run a callback without waiting for the answer, see Master::runCallbackAsync
+     * 
+     * @param msgBytes Callback id followed by its arguments
+     * @param done Called by a dispatcher task with 0 and the answer, or -1 on error
+     * @param timeoutMs Deadline of the request
+     * @return 0 if the request is queued, -1 otherwise
+     */
+    int runCallbackAsync(const std::vector<uint8_t> &msgBytes, 
+        std::function<void(int, std::vector<uint8_t> &)> done = NULL, uint32_t timeoutMs = 100);
+
+    /**
+     * @brief Start a batch: until commitBatch() is called, the callbacks run
+     * by the calling task are queued and sent together in as few frames as possible.
+     * A callback which returns a value sends the queued ones first, then runs at once.
+     */
+    void beginBatch(void);
+
+    /**
+     * @brief Queue a callback in the current batch
+     * 
+     * @param msgBytes Callback id followed by its arguments
+     * @return 0 on success, -1 if no batch was started by the calling task or if the callback returns a value
+     */
+    int addBatch(std::vector<uint8_t> &msgBytes);
+    int addBatch(const uint8_t callbackId, std::vector<uint8_t> &args);
+
+    /**
+     * @brief Send the queued callbacks and end the batch
+     * 
+     * @return 0 on success, -1 if one of the callbacks sent since beginBatch() failed
+     */
+    int commitBatch(void);
+
     void restart(void);
 
     void ledOn(LedColor_t color);
@@ -43,10 +77,68 @@ public:
         uint8_t eventId, uint8_t eventArg, 
         uint8_t callbackId, std::vector<uint8_t> callbackArgs);
 
+    /**
+     * @brief Read an entry of the input process image received during the last cycle
+     * 
+     * @param imageId Process image entry (see ProcessImage_e)
+     * @param data Destination buffer
+     * @param size Number of bytes to read
+     * @param offset Offset of the first byte in the entry
+     * @return 0 on success, -1 if cyclic exchange is not running or the entry is not available
+     */
+    int readInputImage(uint8_t imageId, void* data, size_t size, size_t offset = 0);
+
+    /**
+     * @brief Write an entry of the output process image sent during the next cycle
+     * 
+     * @param imageId Process image entry (see ProcessImage_e)
+     * @param data Source buffer
+     * @param size Number of bytes to write
+     * @param offset Offset of the first byte in the entry
+     * @return 0 on success, -1 if cyclic exchange is not running
+     */
+    int writeOutputImage(uint8_t imageId, const void* data, size_t size, size_t offset = 0);
+
 private:
     uint16_t _id;   // Slave id
     uint16_t _type; // Board type
     uint32_t _sn;   // Board serial number
+
+    /* Process image, input entries are double buffered: the cyclic task fills
+    the back buffer and swaps it with the one read by the user */
+    using ProcessImage = std::map<uint8_t, std::vector<uint8_t>>;
+    ProcessImage _inputImage[2];
+    uint8_t _inputFront;
+    bool _inputValid;
+    ProcessImage _outputImage;
+    bool _outputDirty;
+    SemaphoreHandle_t _imageMutex;
+
+    std::vector<std::vector<uint8_t>> _batch;
+    TaskHandle_t _batchTask; // Task which started the batch
+    int _batchError;
+
+    /* Configuration sent to the slave, replayed when the module restarts */
+    struct EventConfig_s {
+        ModuleControl* module;
+        uint8_t eventId;
+        uint8_t eventArg;
+        uint8_t callbackId;
+        std::vector<uint8_t> callbackArgs;
+    };
+    std::vector<std::vector<uint8_t>> _config; // Configuration callbacks, in the order of their last call
+    std::vector<EventConfig_s> _eventConfig;
+    SemaphoreHandle_t _configMutex;
+
+    int _buildOutputImage(uint8_t* buffer, size_t size);
+    void _parseInputImage(const uint8_t* buffer, size_t length);
+    void _invalidateInputImage(void);
+    void _sendBatch(void);
+    void _storeConfig(const std::vector<uint8_t> &msgBytes);
+    void _storeConfig(uint8_t callbackId, const uint8_t* args, size_t size);
+    int _replayConfig(void);
+
+    friend class Master;
 };
 
 #endif
\ No newline at end of file
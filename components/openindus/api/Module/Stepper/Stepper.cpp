@@ -51,7 +51,7 @@ int Stepper::init(void)
     PS01_Hal_Config_t ps01Conf = STEPPER_CONFIG_MOTOR_DEFAULT();
     PS01_Param_t ps01Param     = STEPPER_PARAM_MOTOR_DEFAULT();
     err |= MotorStepper::init(&ps01Conf, &ps01Param);
-    err |= MotorStepper::configProtections(adcHandles[0]);
+    err |= MotorStepper::configProtections();
     err |= MotorStepperParam::initNVSParam();
 
     /* Encoder */
@@ -62,7 +62,7 @@ int Stepper::init(void)
 #if defined(CONFIG_MODULE_SLAVE)
     err |= DigitalInputsCmdHandler::init();
     err |= MotorStepperCmdHandler::init();
-    err |= EncoderCmdHandler::init(encoder);
+    err |= EncoderCmdHandler::init(encoder, STEPPER_ENCODER_MAX);
 #endif
 
     err |= DigitalInputsCLI::init();
@@ -13,18 +13,44 @@
 #include "UsbConsole.h"
 #include "UsbSerial.h"
 #include "OSAL.h"
+#include "esp_timer.h"
 
 static const char TAG[] = "Master";
 
 State_e Master::_state = STATE_IDLE;
 TaskHandle_t Master::_busTaskHandle = NULL;
 TaskHandle_t Master::_ledSyncTaskHandle = NULL;
-SemaphoreHandle_t Master::_callbackMutex = NULL;
+TaskHandle_t Master::_cyclicTaskHandle = NULL;
+TaskHandle_t Master::_baudRateTaskHandle = NULL;
+TaskHandle_t Master::_discoverTaskHandle = NULL;
+SemaphoreHandle_t Master::_discoverMutex = NULL;
+TaskHandle_t Master::_supervisionTaskHandle = NULL;
+QueueHandle_t Master::_dispatchQueue = NULL;
+QueueHandle_t Master::_requestsFree = NULL;
+Master::CallbackRequest_s Master::_requests[MASTER_DISPATCH_QUEUE_SIZE];
+uint8_t Master::_dispatchBuffers[MASTER_DISPATCH_TASKS][BUS_RS_DATA_LENGTH_MAX];
+uint8_t Master::_cyclicBuffers[BUS_RS_WINDOW_SIZE + 1][BUS_RS_DATA_LENGTH_MAX];
 
 std::vector<ModuleControl*> Master::_modules;
+SemaphoreHandle_t Master::_modulesMutex = NULL;
 std::map<uint16_t, Master::SlaveInfo, std::greater<uint16_t>> Master::_slaveInfos;
+std::map<uint16_t, uint8_t> Master::_slaveCapabilities;
 std::map<Master::EventKey, Master::EventCallback> Master::_eventCallbacks;
 std::function<void(int)> Master::_errorCallback = NULL;
+std::map<uint16_t, Master::Heartbeat_s> Master::_heartbeats;
+SemaphoreHandle_t Master::_heartbeatMutex = NULL;
+uint32_t Master::_heartbeatTimeout = BUS_HEARTBEAT_TIMEOUT;
+std::function<void(uint16_t)> Master::_moduleLostCallback = NULL;
+std::function<void(uint16_t)> Master::_moduleReturnedCallback = NULL;
+
+volatile bool Master::_cyclicRunning = false;
+uint32_t Master::_cyclicPeriod = 0;
+CyclicStats_s Master::_cyclicStats = {};
+uint64_t Master::_cyclicTimeSum = 0;
+uint64_t Master::_cyclicJitterSum = 0;
+SemaphoreHandle_t Master::_cyclicStatsMutex = NULL;
+uint8_t Master::_baudRates = 1;
+SemaphoreHandle_t Master::_baudRateMutex = NULL;
 
 int Master::init(void)
 {
@@ -32,9 +58,19 @@ int Master::init(void)
 
     BusIO::writeSync(0);
 
-    /* Initialize mutex to call function */
-    _callbackMutex = xSemaphoreCreateMutex();
-    xSemaphoreGive(_callbackMutex);
+    _baudRateMutex = xSemaphoreCreateMutex();
+    _heartbeatMutex = xSemaphoreCreateMutex();
+    _discoverMutex = xSemaphoreCreateMutex();
+    if (_modulesMutex == NULL) {
+        _modulesMutex = xSemaphoreCreateMutex();
+    }
+
+    /* Long events of the slaves, reassembled from the CAN segments */
+    BusCAN::setMessageCallback([](uint16_t id, uint8_t* data, uint16_t size) {
+        if ((data[0] == CMD_SEND_EVENT) && (size >= 2)) {
+            _handleEvent(id, &data[1]);
+        }
+    }, 0);
 
     ESP_LOGI(TAG, "Create BusCAN task");
     xTaskCreate(_busCanTask, "BusCAN task", 4096, NULL, 1, &_busTaskHandle);
@@ -42,6 +78,20 @@ int Master::init(void)
     ESP_LOGI(TAG, "Create LED synchronization task");
     xTaskCreate(_ledSyncTask, "LED Sync task", 2048, NULL, 1, &_ledSyncTaskHandle);
 
+    ESP_LOGI(TAG, "Create dispatcher tasks");
+    _requestsFree = xQueueCreate(MASTER_DISPATCH_QUEUE_SIZE, sizeof(CallbackRequest_s*));
+    for (int i=0; i<MASTER_DISPATCH_QUEUE_SIZE; i++) {
+        CallbackRequest_s* request = &_requests[i];
+        xQueueSend(_requestsFree, &request, 0);
+    }
+    _dispatchQueue = xQueueCreate(MASTER_DISPATCH_QUEUE_SIZE, sizeof(CallbackRequest_s*));
+    for (int i=0; i<MASTER_DISPATCH_TASKS; i++) {
+        xTaskCreate(_dispatchTask, "Dispatch task", 4096, (void*)(intptr_t)i, 2, NULL);
+    }
+
+    ESP_LOGI(TAG, "Create supervision task");
+    xTaskCreate(_supervisionTask, "Supervision task", 4096, NULL, 1, &_supervisionTaskHandle);
+
     _state = STATE_RUNNING;
 
     /* CLI */
@@ -71,7 +121,27 @@ int Master::getStatus(void)
     return (int)_state;
 }
 
+void Master::addModuleControlInstance(ModuleControl* module)
+{
+    /* The modules are usually instantiated before init */
+    if (_modulesMutex == NULL) {
+        _modulesMutex = xSemaphoreCreateMutex();
+    }
+    xSemaphoreTake(_modulesMutex, portMAX_DELAY);
+    _modules.push_back(module);
+    xSemaphoreGive(_modulesMutex);
+}
+
 bool Master::autoId(void)
+{
+    /* The ids of the modules change, the cyclic exchange waits */
+    xSemaphoreTake(_modulesMutex, portMAX_DELAY);
+    bool success = _autoId();
+    xSemaphoreGive(_modulesMutex);
+    return success;
+}
+
+bool Master::_autoId(void)
 {
     /* Check if IDs are in bus order or by Serial Number */
     int numIdAuto = 0;
@@ -93,23 +163,13 @@ bool Master::autoId(void)
         return false;
     }
 
-    /* Initialize module with auto id (bus order) */
-    if (numIdAuto) {
-        _slaveInfos.clear();
-
-        BusRS::Frame_t frame;
-        frame.cmd = CMD_DISCOVER_SLAVES;
-        frame.id = 0;
-        frame.dir = 1;
-        frame.ack = false;
-        frame.length = 0;
-        BusRS::write(&frame);
+    Led::on(LED_YELLOW);
 
-        Led::on(LED_YELLOW);
+    /* All the slaves answer at once, the CAN arbitration orders the answers */
+    discoverSlaves(_modules.size());
 
-        /* Wait */
-        delay(200);
-    
+    /* Initialize module with auto id (bus order) */
+    if (numIdAuto) {
         if (_modules.size() == _slaveInfos.size()) {
             std::map<uint16_t, SlaveInfo>::iterator it = _slaveInfos.begin();
             for (int i=0; i<_modules.size(); i++) {
@@ -120,7 +180,6 @@ bool Master::autoId(void)
                     _modules[i]->setSN(it->second.second);
                     ++it;
                     _modules[i]->ledOn(LED_YELLOW);
-                    delay(50);
                 } else {
                     char name1[16];
                     char name2[16];
@@ -142,11 +201,19 @@ bool Master::autoId(void)
     /* Initialize module with SN */
     else {
         for (int i=0; i<_modules.size(); i++) {
-            uint16_t id = Master::getSlaveId(_modules[i]->getType(), _modules[i]->getSN());
+            uint16_t id = 0;
+            for (auto &it : _slaveInfos) {
+                if ((it.second.first == _modules[i]->getType()) && (it.second.second == _modules[i]->getSN())) {
+                    id = it.first;
+                    break;
+                }
+            }
+            if (id == 0) { // Missed by the discovery
+                id = Master::getSlaveId(_modules[i]->getType(), _modules[i]->getSN());
+            }
             if (id != 0) {
                 _modules[i]->setId(id);
                 _modules[i]->ledOn(LED_YELLOW);
-                delay(50);
             } else {
                 ESP_LOGE(TAG, "Cannot instantiate module with SN:%i",  _modules[i]->getSN());
                 return false;
@@ -156,6 +223,16 @@ bool Master::autoId(void)
 
     delay(50);
 
+    /* Negotiate protocol features with each slave */
+    _slaveCapabilities.clear();
+    for (int i=0; i<_modules.size(); i++) {
+        _negotiateCapabilities(_modules[i]->getId());
+    }
+
+    /* Use the fastest baud rate supported by all the slaves */
+    negotiateBaudRate();
+    _updateCanPriority();
+
     /* Success, broadcast message to set all led green */
     for (int i=0; i<_modules.size(); i++) {
         _modules[i]->ledBlink(LED_GREEN, 1000);
@@ -169,26 +246,46 @@ void autoTest(void)
 }
 
 void Master::program(uint16_t boardType, uint32_t boardSN)
+{
+    program(boardType, std::vector<uint32_t>{boardSN});
+}
+
+/**
+ * @brief Program identical modules with the image received from the USB serial port.
+ * The image is sent once to all the modules if they support multicast.
+ * 
+ * @param boardType 
+ * @param boardSNs Serial numbers of the modules
+ */
+void Master::program(uint16_t boardType, std::vector<uint32_t> boardSNs)
 {
     UsbConsole::end(); // Do not perform in the task
-    uint16_t id = getSlaveId(boardType, boardSN);
-    xTaskCreate(_programmingTask, "Module programming task", 4096, (void*)&id, 1, NULL);
+    std::vector<uint16_t>* ids = new std::vector<uint16_t>();
+    for (auto sn : boardSNs) {
+        uint16_t id = getSlaveId(boardType, sn);
+        if (id != 0) {
+            ids->push_back(id);
+        } else {
+            ESP_LOGE(TAG, "Cannot find module with SN:%lu", sn);
+        }
+    }
+    xTaskCreate(_programmingTask, "Module programming task", 4096, (void*)ids, 1, NULL);
     Led::blink(LED_WHITE, 1000); // Programming mode
 }
 
 bool Master::ping(uint16_t boardType, uint32_t boardSN) 
 {
-    BusRS::Frame_t frame;
+    uint8_t data[sizeof(boardType)+sizeof(boardSN)];
+    BusRS::Frame_t frame = {};
     frame.cmd = CMD_PING;
     frame.id = 0;
     frame.dir = 1;
     frame.ack = true;
-    frame.length = sizeof(boardType)+sizeof(boardSN);
-    frame.data = (uint8_t*)malloc(sizeof(boardType)+sizeof(boardSN));
+    frame.length = sizeof(data);
+    frame.data = data;
     memcpy(frame.data, &boardType, sizeof(boardType)); // Type 
     memcpy(&frame.data[2], &boardSN, sizeof(boardSN)); // Serial number
-    BusRS::write(&frame, 10);
-    return (BusRS::read(&frame, 10) == 0);
+    return (BusRS::transfer(&frame, 10, sizeof(data)) == 0);
 }
 
 void Master::getBoardInfo(uint16_t boardType, uint32_t boardSN, Board_Info_t* info)
@@ -200,26 +297,39 @@ void Master::getBoardInfo(uint16_t boardType, uint32_t boardSN, Board_Info_t* in
         return;
     }
 
-    BusRS::Frame_t frame;
+    BusRS::Frame_t frame = {};
     frame.cmd = CMD_GET_BOARD_INFO;
     frame.id = id;
     frame.dir = 1;
     frame.ack = true;
     frame.length = 0;
-    frame.data = (uint8_t*)malloc(sizeof(Board_Info_t));
-    BusRS::write(&frame, 100);
-    BusRS::read(&frame, 100);
-    memcpy(info, frame.data, sizeof(Board_Info_t));
-    free(frame.data);
+    frame.data = (uint8_t*)info; // Answer is decoded directly in info
+    if (BusRS::transfer(&frame, 100, sizeof(Board_Info_t)) < 0) {
+        Led::blink(LED_RED, 1000); // Error
+    }
     return;
 }
 
-std::map<uint16_t, Master::SlaveInfo, std::greater<uint16_t>> Master::discoverSlaves(void)
+/**
+ * @brief Broadcast a discovery request, the slaves answer with their id on the CAN bus.
+ * 
+ * @param expected Number of slaves on the rail, 0 if unknown: until they have all answered, the 
+ * discovery waits BUS_DISCOVER_TIMEOUT ms for the next answer, then only BUS_DISCOVER_QUIET ms
+ * @return std::map<uint16_t, SlaveInfo, std::greater<uint16_t>> Type and serial number of each slave id
+ */
+std::map<uint16_t, Master::SlaveInfo, std::greater<uint16_t>> Master::discoverSlaves(size_t expected)
 {
+    std::map<uint16_t, SlaveInfo, std::greater<uint16_t>> slaveInfos;
+
     // Delete previous id list
+    xSemaphoreTake(_discoverMutex, portMAX_DELAY);
     _slaveInfos.clear();
+    int64_t start = esp_timer_get_time();
+    ulTaskNotifyTake(pdTRUE, 0);
+    _discoverTaskHandle = xTaskGetCurrentTaskHandle();
+    xSemaphoreGive(_discoverMutex);
 
-    BusRS::Frame_t frame;
+    BusRS::Frame_t frame = {};
     frame.cmd = CMD_DISCOVER_SLAVES;
     frame.id = 0;
     frame.dir = 1;
@@ -227,10 +337,29 @@ std::map<uint16_t, Master::SlaveInfo, std::greater<uint16_t>> Master::discoverSl
     frame.length = 0;
     BusRS::write(&frame);
 
-    // Wait for slaves to answer
-    delay(200);
+    // Wait for slaves to answer, more modules than expected may be on the rail
+    size_t answers = 0;
+    TickType_t timeout = pdMS_TO_TICKS(BUS_DISCOVER_TIMEOUT);
+    while (1) {
+        uint32_t count = ulTaskNotifyTake(pdTRUE, timeout);
+        if (count == 0) {
+            break;
+        }
+        answers += count;
+        timeout = pdMS_TO_TICKS((answers < expected) ? BUS_DISCOVER_TIMEOUT : BUS_DISCOVER_QUIET);
+    }
+
+    // Later answers are ignored by the CAN task
+    xSemaphoreTake(_discoverMutex, portMAX_DELAY);
+    _discoverTaskHandle = NULL;
+    slaveInfos = _slaveInfos;
+    xSemaphoreGive(_discoverMutex);
 
-    return _slaveInfos;
+    ESP_LOGI(TAG, "Discovered %u slaves in %lld us", slaveInfos.size(), esp_timer_get_time() - start);
+    if ((expected != 0) && (slaveInfos.size() != expected)) {
+        ESP_LOGW(TAG, "%u slaves expected", expected);
+    }
+    return slaveInfos;
 }
 
 int Master::runCallback(const uint16_t slaveId, const uint8_t callbackId, std::vector<uint8_t> &args, bool ackNeeded)
@@ -245,41 +374,218 @@ int Master::runCallback(const uint16_t slaveId, const uint8_t callbackId, std::v
 
 int Master::runCallback(const uint16_t slaveId, std::vector<uint8_t> &msgBytes, bool ackNeeded)
 {
-    BusRS::Frame_t frame;
+    if (!ackNeeded) {
+        BusRS::Frame_t frame = {};
+        frame.cmd = CMD_RUN_CALLBACK;
+        frame.id = slaveId;
+        frame.dir = 1;
+        frame.ack = false;
+        frame.length = msgBytes.size();
+        frame.data = msgBytes.data();
+        BusRS::write(&frame, pdMS_TO_TICKS(100));
+        return 0;
+    }
+
+    /* Dispatcher tasks not started yet */
+    if (_dispatchQueue == NULL) {
+        uint8_t* buffer = BusRS::allocBuffer(100);
+        if (buffer == NULL) {
+            return -1;
+        }
+        int err = _transferCallback(slaveId, msgBytes, buffer, MASTER_CALLBACK_TIMEOUT);
+        BusRS::freeBuffer(buffer);
+        return err;
+    }
+
+    if (msgBytes.size() > BUS_RS_DATA_LENGTH_MAX) {
+        return -1;
+    }
+
+    /* The dispatcher works on the message of the caller, which sleeps until it is notified */
+    CallbackRequest_s* request;
+    if (xQueueReceive(_requestsFree, &request, pdMS_TO_TICKS(MASTER_CALLBACK_TIMEOUT)) != pdTRUE) {
+        ESP_LOGE(TAG, "Too many pending callbacks");
+        return -1;
+    }
+    request->slaveId = slaveId;
+    request->msgBytes = &msgBytes;
+    request->done = NULL;
+    request->task = xTaskGetCurrentTaskHandle();
+    request->finished = false;
+    request->timeoutMs = MASTER_CALLBACK_TIMEOUT;
+    xQueueSend(_dispatchQueue, &request, portMAX_DELAY); // Never full, there are as many requests as entries
+    do {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY); // The dispatcher always completes the request
+    } while (!request->finished);
+    int err = request->result;
+    xQueueSend(_requestsFree, &request, 0);
+    return err;
+}
+
+int Master::runCallbackAsync(const uint16_t slaveId, const std::vector<uint8_t> &msgBytes, 
+    CallbackDone done, uint32_t timeoutMs)
+{
+    if ((_dispatchQueue == NULL) || (msgBytes.size() > BUS_RS_DATA_LENGTH_MAX)) {
+        return -1;
+    }
+    CallbackRequest_s* request;
+    if (xQueueReceive(_requestsFree, &request, pdMS_TO_TICKS(timeoutMs)) != pdTRUE) {
+        ESP_LOGE(TAG, "Too many pending callbacks");
+        return -1;
+    }
+    request->slaveId = slaveId;
+    request->message.assign(msgBytes.begin(), msgBytes.end()); // The request keeps its capacity
+    request->msgBytes = &request->message;
+    request->done = std::move(done);
+    request->task = NULL;
+    request->timeoutMs = timeoutMs;
+    xQueueSend(_dispatchQueue, &request, portMAX_DELAY);
+    return 0;
+}
+
+/**
+ * @brief Send the queued callbacks. Each task has one request in flight, 
+ * the bus answers them in any order.
+ */
+void Master::_dispatchTask(void *pvParameters)
+{
+    uint8_t* buffer = _dispatchBuffers[(intptr_t)pvParameters];
+    CallbackRequest_s* request;
+
+    while (1) {
+        if (xQueueReceive(_dispatchQueue, &request, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        int err = _transferCallback(request->slaveId, *request->msgBytes, buffer, request->timeoutMs);
+        if (request->task != NULL) {
+            /* The caller releases the request once it has read the result */
+            request->result = err;
+            request->finished = true;
+            xTaskNotifyGive(request->task);
+            continue;
+        }
+        if (request->done != NULL) {
+            request->done(err, *request->msgBytes);
+        }
+        request->done = NULL;
+        xQueueSend(_requestsFree, &request, 0);
+    }
+}
+
+int Master::_transferCallback(const uint16_t slaveId, std::vector<uint8_t> &msgBytes, uint8_t* buffer, uint32_t timeoutMs)
+{
+    BusRS::Frame_t frame = {};
     frame.cmd = CMD_RUN_CALLBACK;
     frame.id = slaveId;
     frame.dir = 1;
-    frame.ack = ackNeeded;
+    frame.ack = true;
     frame.length = msgBytes.size();
-    frame.data = msgBytes.data();
 
+    /* Requests to slaves which support it are tagged, so that they do not wait for each other */
+    frame.ext = ((getSlaveCapabilities(slaveId) & BUS_RS_CAPABILITY_TAG) != 0);
+
+    memcpy(buffer, msgBytes.data(), msgBytes.size());
+    frame.data = buffer;
+
+    int err = BusRS::transfer(&frame, timeoutMs);
+    if (err == 0) {
+        msgBytes.assign(frame.data, frame.data + frame.length);
+    }
+    return (err < 0) ? -1 : 0;
+}
+
+/**
+ * @brief Run several callbacks on a slave with as few frames as possible.
+ * Each request is sent as a [length (2 bytes), msgBytes...] record and the slave
+ * answers with one record per request, in the same order.
+ * 
+ * @param slaveId Slave id
+ * @param msgs Callback messages, replaced by the answers of the slave
+ * @param ackNeeded Wait for the answer of the slave
+ * @return 0 on success, -1 on error
+ */
+int Master::runCallbackBatch(const uint16_t slaveId, std::vector<std::vector<uint8_t>> &msgs, bool ackNeeded)
+{
     int err = 0;
-    xSemaphoreTake(_callbackMutex, portMAX_DELAY);
-    BusRS::write(&frame, pdMS_TO_TICKS(100));
-    if (ackNeeded) {
-        err = BusRS::read(&frame, pdMS_TO_TICKS(100));
-        if (err < 0) {
-            goto error;
-        } else {
-            msgBytes.assign(frame.data, frame.data + frame.length);
-            goto success;
+    
+    /* Slaves with an older firmware only know CMD_RUN_CALLBACK */
+    if ((getSlaveCapabilities(slaveId) & BUS_RS_CAPABILITY_BATCH) == 0) {
+        for (auto &msg : msgs) {
+            err |= runCallback(slaveId, msg, ackNeeded);
         }
+        return err;
     }
 
-success:
-    xSemaphoreGive(_callbackMutex);
-    return 0;
+    uint8_t* buffer = BusRS::allocBuffer(100);
+    if (buffer == NULL) {
+        return -1;
+    }
+
+    size_t first = 0;
+    while (first < msgs.size()) {
+        /* Pack as many records as the frame can hold */
+        size_t last = first;
+        size_t length = 0;
+        while ((last < msgs.size()) && (length + 2 + msgs[last].size() <= BUS_RS_DATA_LENGTH_MAX)) {
+            uint16_t size = msgs[last].size();
+            memcpy(&buffer[length], &size, sizeof(uint16_t));
+            memcpy(&buffer[length + 2], msgs[last].data(), size);
+            length += 2 + size;
+            last++;
+        }
+        if (last == first) { // Too large for a batch record
+            err |= runCallback(slaveId, msgs[first], ackNeeded);
+            first++;
+            continue;
+        }
+
+        BusRS::Frame_t frame = {};
+        frame.cmd = CMD_RUN_CALLBACK_BATCH;
+        frame.id = slaveId;
+        frame.dir = 1;
+        frame.ack = ackNeeded;
+        frame.ext = ((getSlaveCapabilities(slaveId) & BUS_RS_CAPABILITY_TAG) != 0);
+        frame.length = length;
+        frame.data = buffer;
+
+        if (!ackNeeded) {
+            BusRS::write(&frame, pdMS_TO_TICKS(100));
+        } else if (BusRS::transfer(&frame, pdMS_TO_TICKS(100) * (last - first)) < 0) {
+            err = -1;
+        } else {
+            /* Split the answer records */
+            size_t index = 0;
+            for (size_t i = first; i < last; i++) {
+                uint16_t size;
+                if (index + 2 > frame.length) {
+                    err = -1;
+                    break;
+                }
+                memcpy(&size, &frame.data[index], sizeof(uint16_t));
+                if (index + 2 + size > frame.length) {
+                    err = -1;
+                    break;
+                }
+                msgs[i].assign(&frame.data[index + 2], &frame.data[index + 2 + size]);
+                index += 2 + size;
+            }
+            if (frame.error == 1) {
+                ESP_LOGW(TAG, "Batch error on slave %u", slaveId);
+                err = -1;
+            }
+        }
+        first = last;
+    }
 
-error:
-    xSemaphoreGive(_callbackMutex);
-    return -1;
+    BusRS::freeBuffer(buffer);
+    return err;
 }
 
 void Master::ledCtrl(const uint16_t slaveId, const uint8_t state, const uint8_t color, const uint32_t period)
 {
     std::vector<uint8_t> args = {state, color};
     args.insert(args.end(), (uint8_t *)&period, (uint8_t *)&period + sizeof(uint32_t));
-    BusRS::Frame_t frame;
+    BusRS::Frame_t frame = {};
     frame.cmd = CMD_LED_CTRL;
     frame.id = slaveId;
     frame.dir = 1;
@@ -292,7 +598,7 @@ void Master::ledCtrl(const uint16_t slaveId, const uint8_t state, const uint8_t
 void Master::moduleRestart(const uint16_t slaveId)
 {
     std::vector<uint8_t> args;
-    BusRS::Frame_t frame;
+    BusRS::Frame_t frame = {};
     frame.cmd = CMD_RESTART;
     frame.id = slaveId;
     frame.dir = 1;
@@ -304,7 +610,14 @@ void Master::moduleRestart(const uint16_t slaveId)
 
 void Master::resetModules(void)
 {
-    BusRS::Frame_t frame;
+    /* Slaves left at a higher baud rate by a previous session go back to the default one */
+    BusRS::pause(BUS_RS_BAUD_DRAIN_TIMEOUT);
+    _sendBaudRate(0, false);
+    BusRS::setBaudRate(0);
+    BusRS::resume();
+    delay(5);
+
+    BusRS::Frame_t frame = {};
     frame.cmd = CMD_RESET;
     frame.id = 0;
     frame.dir = 1;
@@ -318,181 +631,937 @@ void Master::registerEventCallback(uint16_t slaveId, ModuleControl* module,
     uint8_t eventId, uint8_t eventArg, 
     uint8_t callbackId, std::vector<uint8_t> callbackArgs)
 {
-    BusRS::Frame_t frame;
+    registerEventCallback(slaveId, module->getId(), eventId, eventArg, callbackId, callbackArgs);
+}
+
+/**
+ * @brief Run a callback of a slave when another module sends an event, the slave receives 
+ * the CAN frames of this module from now on
+ */
+void Master::registerEventCallback(uint16_t slaveId, uint16_t moduleId, 
+    uint8_t eventId, uint8_t eventArg, 
+    uint8_t callbackId, std::vector<uint8_t> callbackArgs)
+{
+    uint8_t data[5 + MASTER_EVENT_ARGS_MAX];
+    if (callbackArgs.size() > MASTER_EVENT_ARGS_MAX) {
+        ESP_LOGE(TAG, "Too many callback arguments: %u", callbackArgs.size());
+        return;
+    }
+
+    BusRS::Frame_t frame = {};
     frame.cmd = CMD_REGISTER_EVENT_CALLBACK;
     frame.id = slaveId;
     frame.dir = 1;
     frame.ack = false;
     frame.length = 5 + callbackArgs.size();
-    frame.data = (uint8_t*)malloc(frame.length);
-    frame.data[0] = module->getId() & 0xFF;
-    frame.data[1] = (module->getId() >> 8) & 0xFF;
+    frame.data = data;
+    frame.data[0] = moduleId & 0xFF;
+    frame.data[1] = (moduleId >> 8) & 0xFF;
     frame.data[2] = eventId;
     frame.data[3] = eventArg;
     frame.data[4] = callbackId;
     memcpy(&frame.data[5], callbackArgs.data(), callbackArgs.size());
     BusRS::write(&frame, 100);
-    free(frame.data);
 }
 
 uint16_t Master::getSlaveId(uint16_t boardType, uint32_t boardSN)
 {
     uint16_t id = 0;
 
-    BusRS::Frame_t frame;
+    uint8_t data[sizeof(boardType)+sizeof(boardSN)];
+    BusRS::Frame_t frame = {};
     frame.cmd = CMD_PING; // CMD_GET_SLAVE_ID
     frame.id = 0;
     frame.dir = 1;
     frame.ack = true;
-    frame.length = sizeof(boardType)+sizeof(boardSN);
-    frame.data = (uint8_t*)malloc(sizeof(boardType)+sizeof(boardSN));
+    frame.length = sizeof(data);
+    frame.data = data;
     memcpy(frame.data, &boardType, sizeof(boardType)); // Type 
     memcpy(&frame.data[2], &boardSN, sizeof(boardSN)); // Serial number
-    BusRS::write(&frame, 100);
-    BusRS::read(&frame, 100);
-    id = frame.id;
-    free(frame.data);
+    if (BusRS::transfer(&frame, 100, sizeof(data)) == 0) {
+        id = frame.id;
+    }
     return id;
 }
 
-void Master::_busCanTask(void *pvParameters) 
+uint8_t Master::getSlaveCapabilities(uint16_t slaveId)
 {
-    BusCAN::Frame_t frame;
-    uint16_t id;
-    uint8_t size;
+    auto it = _slaveCapabilities.find(slaveId);
+    if (it != _slaveCapabilities.end()) {
+        return it->second;
+    }
+    return 0;
+}
 
-    while (1) {
-        if (BusCAN::read(&frame, &id, &size) != -1) { 
-            switch (frame.cmd)
-            {
-                case CMD_SEND_EVENT:
-                {
-                    auto it = _eventCallbacks.find(std::make_pair(frame.args[0], id));
-                    if (it != _eventCallbacks.end()) {
-                        if (it->second != NULL) {
-                            it->second(frame.args);
-                        }
-                    } else {
-                        ESP_LOGW(TAG, "Command does not exist: command: 0x%02x, id: %d", frame.args[0], id);
-                    }
-                    break;
-                }
-                case CMD_DISCOVER_SLAVES:
-                {
-                    uint16_t* type = reinterpret_cast<uint16_t*>(&frame.args[0]);
-                    uint32_t* sn = reinterpret_cast<uint32_t*>(&frame.args[2]);
-                    _slaveInfos.insert(std::pair<uint16_t, std::pair<uint16_t, uint32_t>>(id, std::pair<uint16_t, uint32_t>(*type, *sn)));
-                    char name[16];
-                    ESP_LOGI(TAG, "Received id from %s\t SN:%i | ID:%i", BoardUtils::typeToName(*type, name), *sn, id);
-                    break;
-                }
-                case CMD_SEND_ERROR:
-                {
-                    uint8_t errorCode = frame.args[0];
-                    if (_errorCallback) {
-                        _errorCallback(errorCode);
-                    }
-                    break;
-                }
-                default:
-                {
-                    ESP_LOGW(TAG, "Receive undefined command");
-                    break;
-                }
-            }
-        } else {
-            Led::blink(LED_RED, 1000); // Error
+int Master::getBusStats(uint16_t slaveId, Bus::BusStats_t* stats)
+{
+    uint8_t* buffer = BusRS::allocBuffer(100);
+    if (buffer == NULL) {
+        return -1;
+    }
+    BusRS::Frame_t frame = {};
+    frame.cmd = CMD_GET_BUS_STATS;
+    frame.id = slaveId;
+    frame.dir = 1;
+    frame.ack = true;
+    frame.length = 0;
+    frame.data = buffer;
+    int err = BusRS::transfer(&frame, 100);
+    if ((err == 0) && (frame.length == 1 + sizeof(Bus::BusStats_t)) && (buffer[0] == BUS_STATS_VERSION)) {
+        memcpy(stats, &buffer[1], sizeof(Bus::BusStats_t));
+    } else {
+        err = -1;
+    }
+    BusRS::freeBuffer(buffer);
+    return err;
+}
+
+/**
+ * @brief Ask a slave which protocol features it supports.
+ * Slaves with an older firmware ignore the request, they keep the legacy protocol.
+ */
+void Master::_negotiateCapabilities(uint16_t slaveId)
+{
+    uint8_t data[2] = {BUS_RS_PROTOCOL_VERSION, BusRS::getCapabilities()};
+    BusRS::Frame_t frame = {};
+    frame.cmd = CMD_GET_CAPABILITIES;
+    frame.id = slaveId;
+    frame.dir = 1;
+    frame.ack = true;
+    frame.length = sizeof(data);
+    frame.data = data;
+    BusRS::setCrc(slaveId, false); // The request itself uses the legacy checksum
+    if ((BusRS::transfer(&frame, 20, sizeof(data)) == 0) && (frame.length == sizeof(data))) {
+        _slaveCapabilities[slaveId] = data[1] & BusRS::getCapabilities();
+        ESP_LOGI(TAG, "Slave %u: protocol v%u, capabilities: 0x%02X", slaveId, data[0], _slaveCapabilities[slaveId]);
+    } else {
+        _slaveCapabilities[slaveId] = 0;
+        ESP_LOGI(TAG, "Slave %u: legacy protocol", slaveId);
+    }
+    BusRS::setCrc(slaveId, (_slaveCapabilities[slaveId] & BUS_RS_CAPABILITY_CRC) != 0);
+}
+
+/**
+ * @brief Switch the rail to the fastest baud rate supported by all the slaves which passes an echo test.
+ * The rate is changed with CMD_SET_BAUD_RATE on the CAN bus, which keeps working whatever the rate of 
+ * the RS bus. The slaves switch on probation, the master sends echo frames to each slave and confirms 
+ * the new rate, or all the modules go back to the previous rate. Once a faster rate is in use, a task 
+ * falls back to the next lower rate when errors persist.
+ * 
+ * @param maxBaudRate Fastest rate to try, 0 for no limit
+ * @return uint32_t Baud rate in use
+ */
+uint32_t Master::negotiateBaudRate(uint32_t maxBaudRate)
+{
+    uint8_t rates = BusRS::getBaudRates();
+
+    /* The rates supported by all the slaves, the default one only if a slave cannot switch */
+    for (int i=0; i<_modules.size(); i++) {
+        uint16_t id = _modules[i]->getId();
+        uint8_t data[2] = {};
+        BusRS::Frame_t frame = {};
+        frame.cmd = CMD_GET_BAUD_RATES;
+        frame.id = id;
+        frame.dir = 1;
+        frame.ack = true;
+        frame.ext = ((getSlaveCapabilities(id) & BUS_RS_CAPABILITY_TAG) != 0);
+        frame.length = 0;
+        frame.data = data;
+        if (((getSlaveCapabilities(id) & BUS_RS_CAPABILITY_BAUD) == 0) ||
+            (BusRS::transfer(&frame, 20, sizeof(data)) < 0) || (frame.length < 1)) {
+            ESP_LOGI(TAG, "Slave %u cannot change the baud rate", id);
+            rates = 0;
+            break;
+        }
+        rates &= data[0];
+    }
+    if (_modules.empty()) {
+        rates = 0;
+    }
+    for (int i=0; i<BUS_RS_BAUD_RATES_NB; i++) {
+        if ((maxBaudRate != 0) && (BusRS::getBaudRate(i) > maxBaudRate)) {
+            rates &= ~(1 << i);
         }
     }
+    rates |= 1; // The default rate is always available
+
+    xSemaphoreTake(_baudRateMutex, portMAX_DELAY);
+    _baudRates = rates;
+    for (int i=BUS_RS_BAUD_RATES_NB-1; i>=0; i--) {
+        if ((rates & (1 << i)) && (_switchBaudRate(i) == 0)) {
+            break;
+        }
+    }
+    xSemaphoreGive(_baudRateMutex);
+
+    if ((BusRS::getBaudRateIndex() > 0) && (_baudRateTaskHandle == NULL)) {
+        xTaskCreate(_baudRateTask, "Baud rate task", 3072, NULL, 1, &_baudRateTaskHandle);
+    }
+
+    uint32_t baudRate = BusRS::getBaudRate(BusRS::getBaudRateIndex());
+    ESP_LOGI(TAG, "RS bus baud rate: %lu", baudRate);
+    return baudRate;
 }
 
-void Master::_ledSyncTask(void *pvParameters)
+/**
+ * @brief Move all the modules to a baud rate, the default rate is never tested.
+ * The transfers of the other tasks are held and the ones in flight drained first, 
+ * no frame crosses the switch. The fallback to the default rate happens even if 
+ * the bus could not be drained, a higher rate is not tried.
+ * 
+ * @param index Index in BUS_RS_BAUD_RATES
+ * @return int 0 if the rate is in use, -1 if the previous rate has been kept or restored
+ */
+int Master::_switchBaudRate(uint8_t index)
 {
-    const TickType_t xDelay = pdMS_TO_TICKS(60 * 60 * 1000); // 1 hour in milliseconds
-    
-    ESP_LOGI(TAG, "LED sync task started");
-    
-    while (1) {
-        // Wait for one hour
-        vTaskDelay(xDelay);
-        
-        ESP_LOGI(TAG, "Resynchronizing LEDs");
+    uint8_t previous = BusRS::getBaudRateIndex();
+    if (index == previous) {
+        return 0;
+    }
 
-        Led::sync(); // Resynchronize the LED state
-        
-        // Iterate through all modules and resynchronize their LEDs
-        for (int i = 0; i < _modules.size(); i++) {
-            _modules[i]->ledSync();
+    int err = 0;
+    if ((BusRS::pause(BUS_RS_BAUD_DRAIN_TIMEOUT) < 0) && (index != 0)) {
+        ESP_LOGW(TAG, "Bus busy, baud rate not changed");
+        err = -1;
+        goto end;
+    }
+
+    _sendBaudRate(index, (index != 0));
+    delay(5); // Let the slaves switch
+    BusRS::setBaudRate(index);
+    if ((index == 0) || _testBaudRate()) {
+        if (index != 0) {
+            _sendBaudRate(index, false); // Confirm
         }
+        goto end;
     }
+
+    ESP_LOGW(TAG, "Echo test failed at %lu bauds", BusRS::getBaudRate(index));
+    _sendBaudRate(previous, false);
+    delay(5);
+    BusRS::setBaudRate(previous);
+    err = -1;
+
+end:
+    BusRS::resume();
+    return err;
 }
 
-void Master::_programmingTask(void *pvParameters)
+void Master::_sendBaudRate(uint8_t index, bool probation)
 {
-    uint16_t id = *(uint16_t*)pvParameters;
-    int sequence = 0;
-    UsbSerialProtocol::Packet_t packet;
-    packet.data = (uint8_t*)malloc(16400);
-    BusRS::Frame_t frame;
-    frame.data = (uint8_t*)malloc(1024);
+    BusCAN::Frame_t frame;
+    frame.cmd = CMD_SET_BAUD_RATE;
+    frame.args[0] = index;
+    frame.args[1] = probation;
+    BusCAN::write(&frame, 0, 3);
+}
 
-    /* FlashLoader begin */
-    frame.cmd = CMD_FLASH_LOADER_BEGIN;
-    frame.id = id;
-    frame.dir = 1;
-    frame.ack = true;
-    frame.length = 0;
-    BusRS::write(&frame, pdMS_TO_TICKS(5000));
-    if (BusRS::read(&frame, pdMS_TO_TICKS(5000)) < 0) {
-        Led::blink(LED_RED, 1000); // Error
+/**
+ * @brief Let the slaves send their CAN frames with priority identifiers when all of them support it.
+ * The master keeps sending standard frames: identifier 0 wins the arbitration against both layouts, 
+ * and with the priority identifiers the slaves keep one of their two acceptance filters for it.
+ */
+void Master::_updateCanPriority(void)
+{
+    bool enable = !_modules.empty();
+    for (int i=0; i<_modules.size(); i++) {
+        enable &= ((getSlaveCapabilities(_modules[i]->getId()) & BUS_RS_CAPABILITY_CAN_PRIORITY) != 0);
+    }
+    ESP_LOGI(TAG, "CAN priority identifiers %s", enable ? "enabled" : "disabled");
+
+    BusCAN::Frame_t frame;
+    frame.cmd = CMD_SET_CAN_PRIORITY;
+    frame.args[0] = enable;
+    BusCAN::write(&frame, 0, 2);
+}
+
+/**
+ * @brief Send full size echo frames to each slave and compare the answers
+ */
+bool Master::_testBaudRate(void)
+{
+    bool success = true;
+    uint8_t* pattern = BusRS::allocBuffer(100);
+    uint8_t* buffer = BusRS::allocBuffer(100);
+    if ((pattern == NULL) || (buffer == NULL)) {
+        success = false;
         goto end;
     }
 
-    UsbSerialProtocol::begin(115200);
+    /* Sync bytes between varying bytes, the parser must not lose the frame */
+    for (int i=0; i<BUS_RS_DATA_LENGTH_MAX; i++) {
+        pattern[i] = (i % 4 == 0) ? BUS_RS_SYNC_BYTE : (uint8_t)(i * 37);
+    }
 
-    while (1) {
-        if (UsbSerialProtocol::read(&packet) < 0) {
+    for (int i=0; (i<_modules.size()) && success; i++) {
+        uint16_t id = _modules[i]->getId();
+        for (int n=0; n<BUS_RS_BAUD_TEST_FRAMES; n++) {
+            pattern[1] = n;
+            memcpy(buffer, pattern, BUS_RS_DATA_LENGTH_MAX);
+            BusRS::Frame_t frame = {};
+            frame.cmd = CMD_ECHO;
+            frame.id = id;
+            frame.dir = 1;
+            frame.ack = true;
+            frame.ext = ((getSlaveCapabilities(id) & BUS_RS_CAPABILITY_TAG) != 0);
+            frame.length = BUS_RS_DATA_LENGTH_MAX;
+            frame.data = buffer;
+            if ((BusRS::transfer(&frame, 50) < 0) || (frame.length != BUS_RS_DATA_LENGTH_MAX) ||
+                (memcmp(buffer, pattern, BUS_RS_DATA_LENGTH_MAX) != 0)) {
+                ESP_LOGW(TAG, "Slave %u: echo error", id);
+                success = false;
+                break;
+            }
+        }
+    }
+
+end:
+    if (pattern != NULL) {
+        BusRS::freeBuffer(pattern);
+    }
+    if (buffer != NULL) {
+        BusRS::freeBuffer(buffer);
+    }
+    return success;
+}
+
+/**
+ * @brief Fall back to the next lower baud rate when the bus errors persist
+ */
+void Master::_baudRateTask(void *pvParameters)
+{
+    BusRS::Stats_t stats;
+    BusRS::getStats(&stats);
+    uint32_t lastErrors = stats.framingErrors + stats.checksumErrors + stats.timeoutErrors;
+    int periods = 0;
+
+    while (1) {
+        delay(BUS_RS_BAUD_CHECK_PERIOD);
+        BusRS::getStats(&stats);
+        uint32_t errors = stats.framingErrors + stats.checksumErrors + stats.timeoutErrors;
+        uint32_t newErrors = (errors >= lastErrors) ? (errors - lastErrors) : errors; // Counters may have been reset
+        lastErrors = errors;
+
+        if ((BusRS::getBaudRateIndex() == 0) || (newErrors < BUS_RS_BAUD_ERRORS_MAX)) {
+            periods = 0;
+            continue;
+        }
+        if (++periods < BUS_RS_BAUD_ERRORS_PERIODS) {
+            continue;
+        }
+        periods = 0;
+
+        xSemaphoreTake(_baudRateMutex, portMAX_DELAY);
+        uint8_t current = BusRS::getBaudRateIndex();
+        ESP_LOGW(TAG, "Too many errors at %lu bauds", BusRS::getBaudRate(current));
+        for (int i=current-1; i>=0; i--) {
+            if ((_baudRates & (1 << i)) && (_switchBaudRate(i) == 0)) {
+                break;
+            }
+        }
+        xSemaphoreGive(_baudRateMutex);
+
+        /* The errors of the switch itself are not counted */
+        BusRS::getStats(&stats);
+        lastErrors = stats.framingErrors + stats.checksumErrors + stats.timeoutErrors;
+    }
+}
+
+void Master::setHeartbeatTimeout(uint32_t timeoutMs)
+{
+    _heartbeatTimeout = timeoutMs;
+}
+
+bool Master::isModuleAlive(uint16_t slaveId)
+{
+    bool alive = true; // A module without heartbeat is not supervised
+    xSemaphoreTake(_heartbeatMutex, portMAX_DELAY);
+    auto it = _heartbeats.find(slaveId);
+    if (it != _heartbeats.end()) {
+        alive = it->second.alive && !it->second.restarted;
+    }
+    xSemaphoreGive(_heartbeatMutex);
+    return alive;
+}
+
+/**
+ * @brief Check the heartbeats of the declared modules. A module which stopped sending them is lost, 
+ * a module which comes back or restarted is enumerated again and its configuration is sent again.
+ */
+void Master::_supervisionTask(void *pvParameters)
+{
+    while (1) {
+        delay(BUS_CAN_HEARTBEAT_PERIOD / 2);
+
+        for (auto module : _modules) {
+            uint16_t id = module->getId();
+            bool lost = false;
+            bool restarted = false;
+
+            xSemaphoreTake(_heartbeatMutex, portMAX_DELAY);
+            auto it = _heartbeats.find(id);
+            if (it != _heartbeats.end()) {
+                if (it->second.restarted) {
+                    lost = it->second.alive; // Restarted before its heartbeat timed out
+                    restarted = true;
+                    it->second.restarted = false;
+                    it->second.alive = false;
+                } else if (it->second.alive && 
+                    ((xTaskGetTickCount() - it->second.lastTick) > pdMS_TO_TICKS(_heartbeatTimeout))) {
+                    lost = true;
+                    it->second.alive = false;
+                }
+            }
+            xSemaphoreGive(_heartbeatMutex);
+
+            if (lost) {
+                ESP_LOGW(TAG, "Module %u lost", id);
+                if (_moduleLostCallback) {
+                    _moduleLostCallback(id);
+                }
+            }
+            if (restarted) {
+                if (_restoreModule(module) < 0) {
+                    ESP_LOGE(TAG, "Module %u is back but cannot be restored", id);
+                    continue;
+                }
+                xSemaphoreTake(_heartbeatMutex, portMAX_DELAY);
+                _heartbeats[id].alive = true;
+                xSemaphoreGive(_heartbeatMutex);
+                ESP_LOGI(TAG, "Module %u is back", id);
+                if (_moduleReturnedCallback) {
+                    _moduleReturnedCallback(id);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Enumerate a restarted module again: it starts at the default baud rate, 
+ * without the negotiated capabilities and without the configuration sent by the user
+ */
+int Master::_restoreModule(ModuleControl* module)
+{
+    uint16_t id = module->getId();
+
+    /* Bring the whole rail back to the default baud rate to reach the module */
+    bool renegotiate = (BusRS::getBaudRateIndex() != 0);
+    if (renegotiate) {
+        xSemaphoreTake(_baudRateMutex, portMAX_DELAY);
+        _switchBaudRate(0);
+        xSemaphoreGive(_baudRateMutex);
+    }
+
+    /* The module at this position of the rail must be of the same type */
+    Board_Info_t info;
+    BusRS::Frame_t frame = {};
+    frame.cmd = CMD_GET_BOARD_INFO;
+    frame.id = id;
+    frame.dir = 1;
+    frame.ack = true;
+    frame.length = 0;
+    frame.data = (uint8_t*)&info;
+    BusRS::setCrc(id, false);
+    if (BusRS::transfer(&frame, 100, sizeof(Board_Info_t)) < 0) {
+        return -1;
+    }
+    if ((module->getType() != 0) && !BoardUtils::areTypeCompatible(info.efuse.board_type, module->getType())) {
+        char name[16];
+        ESP_LOGE(TAG, "Module %u has been replaced by a %s", id, BoardUtils::typeToName(info.efuse.board_type, name));
+        return -1;
+    }
+    xSemaphoreTake(_modulesMutex, portMAX_DELAY);
+    if (module->getSN() != info.efuse.serial_number) {
+        ESP_LOGW(TAG, "Module %u has been replaced, SN: %lu", id, info.efuse.serial_number);
+        module->setSN(info.efuse.serial_number);
+    }
+    _negotiateCapabilities(id);
+    xSemaphoreGive(_modulesMutex);
+
+    _updateCanPriority(); // A restarted module is back to the standard identifiers
+    int err = module->_replayConfig();
+    if (renegotiate) {
+        negotiateBaudRate();
+    }
+    module->ledBlink(LED_GREEN, 1000);
+    return err;
+}
+
+/**
+ * @brief Start the cyclic exchange of the process images of all modules.
+ * Once started, the Cmd classes read and write the local copy of the images
+ * instead of running a callback on the slave.
+ * The exchanges of a cycle are in flight at the same time, a module which does not answer
+ * only loses its own image at the end of the period.
+ * 
+ * @param periodMs Cycle period in milliseconds
+ * @return 0 on success, -1 on error
+ */
+int Master::startCyclic(uint32_t periodMs)
+{
+    if (periodMs == 0) {
+        ESP_LOGE(TAG, "Invalid cycle period");
+        return -1;
+    }
+    if (_cyclicTaskHandle != NULL) {
+        ESP_LOGE(TAG, "Cyclic exchange already running");
+        return -1;
+    }
+    if (_cyclicStatsMutex == NULL) {
+        _cyclicStatsMutex = xSemaphoreCreateMutex();
+    }
+
+    _cyclicPeriod = periodMs;
+    resetCyclicStats();
+
+    ESP_LOGI(TAG, "Start cyclic exchange, period: %lums", periodMs);
+    _cyclicRunning = true;
+    if (xTaskCreate(_cyclicTask, "Cyclic task", 4096, NULL, 5, &_cyclicTaskHandle) != pdPASS) {
+        _cyclicRunning = false;
+        ESP_LOGE(TAG, "Failed to create cyclic task");
+        return -1;
+    }
+    return 0;
+}
+
+void Master::stopCyclic(void)
+{
+    if (_cyclicTaskHandle == NULL) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "Stop cyclic exchange");
+    _cyclicRunning = false;
+    while (_cyclicTaskHandle != NULL) { // Wait for the current cycle to finish
+        delay(1);
+    }
+    for (auto module : _modules) {
+        module->_invalidateInputImage();
+    }
+}
+
+void Master::getCyclicStats(CyclicStats_s* stats)
+{
+    if (_cyclicStatsMutex == NULL) {
+        memset(stats, 0, sizeof(CyclicStats_s));
+        return;
+    }
+    xSemaphoreTake(_cyclicStatsMutex, portMAX_DELAY);
+    memcpy(stats, &_cyclicStats, sizeof(CyclicStats_s));
+    if (_cyclicStats.cycles > 0) {
+        stats->cycleTimeAvg = _cyclicTimeSum / _cyclicStats.cycles;
+        stats->jitterAvg = _cyclicJitterSum / _cyclicStats.cycles;
+    }
+    xSemaphoreGive(_cyclicStatsMutex);
+}
+
+void Master::resetCyclicStats(void)
+{
+    if (_cyclicStatsMutex == NULL) {
+        return;
+    }
+    xSemaphoreTake(_cyclicStatsMutex, portMAX_DELAY);
+    memset(&_cyclicStats, 0, sizeof(CyclicStats_s));
+    _cyclicStats.period = _cyclicPeriod * 1000;
+    _cyclicStats.cycleTimeMin = UINT32_MAX;
+    _cyclicTimeSum = 0;
+    _cyclicJitterSum = 0;
+    xSemaphoreGive(_cyclicStatsMutex);
+}
+
+/* Time left until a deadline of esp_timer_get_time(), in ms rounded up */
+static uint32_t _remainingMs(int64_t deadline)
+{
+    int64_t left = deadline - esp_timer_get_time();
+    return (left > 0) ? (uint32_t)((left + 999) / 1000) : 0;
+}
+
+/**
+ * @brief Send the output image of a module and receive its input image in a single transaction
+ * 
+ * @param module Module, without tagged frames
+ * @param buffer Frame buffer (BUS_RS_DATA_LENGTH_MAX bytes)
+ * @param deadline End of the cycle (us)
+ * @return 0 on success, -1 on error
+ */
+int Master::_exchangeImage(ModuleControl* module, uint8_t* buffer, int64_t deadline)
+{
+    BusRS::Frame_t frame = {};
+    frame.cmd = CMD_PROCESS_IMAGE;
+    frame.id = module->getId();
+    frame.dir = 1;
+    frame.length = module->_buildOutputImage(buffer, BUS_RS_DATA_LENGTH_MAX);
+    frame.data = buffer;
+
+    if ((BusRS::transfer(&frame, _remainingMs(deadline)) < 0) || (frame.error == 1)) {
+        module->_invalidateInputImage();
+        return -1;
+    }
+    module->_parseInputImage(frame.data, frame.length);
+    return 0;
+}
+
+/**
+ * @brief Send the output image of a module in a tagged frame, the answer is collected by _receiveImage
+ * 
+ * @param module Module
+ * @param frame Frame of the transaction, it receives the input image
+ * @param buffer Frame buffer (BUS_RS_DATA_LENGTH_MAX bytes)
+ * @param deadline End of the cycle (us)
+ * @return int Transaction handle, -1 on error
+ */
+int Master::_sendImage(ModuleControl* module, BusRS::Frame_t* frame, uint8_t* buffer, int64_t deadline)
+{
+    *frame = {};
+    frame->cmd = CMD_PROCESS_IMAGE;
+    frame->id = module->getId();
+    frame->dir = 1;
+    frame->ext = 1;
+    frame->length = module->_buildOutputImage(buffer, BUS_RS_DATA_LENGTH_MAX);
+    frame->data = buffer;
+
+    int transaction = BusRS::transferStart(frame, _remainingMs(deadline));
+    if (transaction < 0) {
+        module->_invalidateInputImage();
+    }
+    return transaction;
+}
+
+int Master::_receiveImage(ModuleControl* module, BusRS::Frame_t* frame, int transaction, int64_t deadline)
+{
+    if ((BusRS::transferWait(transaction, _remainingMs(deadline)) < 0) || (frame->error == 1)) {
+        module->_invalidateInputImage();
+        return -1;
+    }
+    module->_parseInputImage(frame->data, frame->length);
+    return 0;
+}
+
+/**
+ * @brief Each cycle, the images are sent to all the modules without waiting, as many at a time as 
+ * the window allows, then the answers are collected: all of them must come before the end of the cycle.
+ */
+void Master::_cyclicTask(void *pvParameters)
+{
+    TickType_t lastWakeTime = xTaskGetTickCount();
+    int64_t schedule = esp_timer_get_time();
+    int64_t start, end, deadline;
+    uint32_t cycleTime, jitter;
+    int errors;
+
+    /* Exchanges in flight, collected in the order they were sent */
+    BusRS::Frame_t frames[BUS_RS_WINDOW_SIZE];
+    ModuleControl* modules[BUS_RS_WINDOW_SIZE];
+    int transactions[BUS_RS_WINDOW_SIZE];
+    int first, pending;
+
+    while (_cyclicRunning) {
+        start = esp_timer_get_time();
+        deadline = start + _cyclicPeriod * 1000;
+        errors = 0;
+        first = 0;
+        pending = 0;
+
+        /* Discovery and module restoration wait for the end of the cycle */
+        xSemaphoreTake(_modulesMutex, portMAX_DELAY);
+        for (auto module : _modules) {
+            if (module->getId() == 0xFFFF) { // Not discovered by autoId
+                continue;
+            }
+            if ((getSlaveCapabilities(module->getId()) & BUS_RS_CAPABILITY_TAG) == 0) {
+                /* The answers of the tagged exchanges in flight are collected meanwhile */
+                if (_exchangeImage(module, _cyclicBuffers[BUS_RS_WINDOW_SIZE], deadline) < 0) {
+                    errors++;
+                }
+                continue;
+            }
+            if (pending == BUS_RS_WINDOW_SIZE) {
+                if (_receiveImage(modules[first], &frames[first], transactions[first], deadline) < 0) {
+                    errors++;
+                }
+                first = (first + 1) % BUS_RS_WINDOW_SIZE;
+                pending--;
+            }
+            int index = (first + pending) % BUS_RS_WINDOW_SIZE;
+            transactions[index] = _sendImage(module, &frames[index], _cyclicBuffers[index], deadline);
+            if (transactions[index] < 0) {
+                errors++;
+                continue;
+            }
+            modules[index] = module;
+            pending++;
+        }
+        for (; pending > 0; pending--) {
+            if (_receiveImage(modules[first], &frames[first], transactions[first], deadline) < 0) {
+                errors++;
+            }
+            first = (first + 1) % BUS_RS_WINDOW_SIZE;
+        }
+        xSemaphoreGive(_modulesMutex);
+        end = esp_timer_get_time();
+
+        cycleTime = (uint32_t)(end - start);
+        jitter = (uint32_t)((start > schedule) ? (start - schedule) : (schedule - start));
+        xSemaphoreTake(_cyclicStatsMutex, portMAX_DELAY);
+        _cyclicStats.cycles++;
+        _cyclicStats.errors += errors;
+        if (cycleTime > _cyclicStats.period) {
+            _cyclicStats.overruns++;
+        }
+        _cyclicStats.cycleTimeMin = std::min(_cyclicStats.cycleTimeMin, cycleTime);
+        _cyclicStats.cycleTimeMax = std::max(_cyclicStats.cycleTimeMax, cycleTime);
+        _cyclicStats.jitterMax = std::max(_cyclicStats.jitterMax, jitter);
+        _cyclicTimeSum += cycleTime;
+        _cyclicJitterSum += jitter;
+        xSemaphoreGive(_cyclicStatsMutex);
+
+        if (xTaskDelayUntil(&lastWakeTime, pdMS_TO_TICKS(_cyclicPeriod)) == pdFALSE) {
+            /* Overrun, restart the schedule from now instead of running late cycles back to back */
+            lastWakeTime = xTaskGetTickCount();
+            schedule = esp_timer_get_time();
+        } else {
+            schedule += _cyclicPeriod * 1000;
+        }
+    }
+
+    _cyclicTaskHandle = NULL;
+    vTaskDelete(NULL);
+}
+
+void Master::_busCanTask(void *pvParameters) 
+{
+    BusCAN::Frame_t frame;
+    uint16_t id;
+    uint8_t size;
+
+    while (1) {
+        if (BusCAN::read(&frame, &id, &size) != -1) { 
+            switch (frame.cmd)
+            {
+                case CMD_SEND_EVENT:
+                {
+                    _handleEvent(id, frame.args);
+                    break;
+                }
+                case CMD_DISCOVER_SLAVES:
+                {
+                    uint16_t* type = reinterpret_cast<uint16_t*>(&frame.args[0]);
+                    uint32_t* sn = reinterpret_cast<uint32_t*>(&frame.args[2]);
+                    xSemaphoreTake(_discoverMutex, portMAX_DELAY);
+                    if (_discoverTaskHandle != NULL) {
+                        _slaveInfos.insert(std::pair<uint16_t, std::pair<uint16_t, uint32_t>>(id, std::pair<uint16_t, uint32_t>(*type, *sn)));
+                        xTaskNotifyGive(_discoverTaskHandle);
+                    }
+                    xSemaphoreGive(_discoverMutex);
+                    char name[16];
+                    ESP_LOGD(TAG, "Received id from %s\t SN:%i | ID:%i", BoardUtils::typeToName(*type, name), *sn, id); // The console would delay the next answers
+                    break;
+                }
+                case CMD_HEARTBEAT:
+                {
+                    uint32_t uptime;
+                    memcpy(&uptime, &frame.args[1], sizeof(uint32_t));
+                    xSemaphoreTake(_heartbeatMutex, portMAX_DELAY);
+                    auto it = _heartbeats.find(id);
+                    if (it == _heartbeats.end()) {
+                        _heartbeats[id] = {xTaskGetTickCount(), uptime, frame.args[0], true, false};
+                    } else {
+                        /* Back after a timeout, or restarted in between two heartbeats */
+                        if (!it->second.alive || (uptime < it->second.uptime)) {
+                            it->second.restarted = true;
+                        }
+                        it->second.lastTick = xTaskGetTickCount();
+                        it->second.uptime = uptime;
+                        it->second.state = frame.args[0];
+                    }
+                    xSemaphoreGive(_heartbeatMutex);
+                    break;
+                }
+                case CMD_SEND_ERROR:
+                {
+                    uint8_t errorCode = frame.args[0];
+                    if (_errorCallback) {
+                        _errorCallback(errorCode);
+                    }
+                    break;
+                }
+                default:
+                {
+                    ESP_LOGW(TAG, "Receive undefined command");
+                    break;
+                }
+            }
+        } else {
+            Led::blink(LED_RED, 1000); // Error
+        }
+    }
+}
+
+/**
+ * @brief Run the callback registered for an event of a slave
+ * 
+ * @param id Slave which sent the event
+ * @param args Event ID, then the event data
+ */
+void Master::_handleEvent(uint16_t id, uint8_t* args)
+{
+    auto it = _eventCallbacks.find(std::make_pair(args[0], id));
+    if (it != _eventCallbacks.end()) {
+        if (it->second != NULL) {
+            it->second(args);
+        }
+    } else {
+        ESP_LOGW(TAG, "Command does not exist: command: 0x%02x, id: %d", args[0], id);
+    }
+}
+
+void Master::_ledSyncTask(void *pvParameters)
+{
+    const TickType_t xDelay = pdMS_TO_TICKS(60 * 60 * 1000); // 1 hour in milliseconds
+    
+    ESP_LOGI(TAG, "LED sync task started");
+    
+    while (1) {
+        // Wait for one hour
+        vTaskDelay(xDelay);
+        
+        ESP_LOGI(TAG, "Resynchronizing LEDs");
+
+        Led::sync(); // Resynchronize the LED state
+        
+        // Iterate through all modules and resynchronize their LEDs
+        for (int i = 0; i < _modules.size(); i++) {
+            _modules[i]->ledSync();
+        }
+    }
+}
+
+void Master::_programmingTask(void *pvParameters)
+{
+    Programming_t prog = {};
+    prog.ids = *(std::vector<uint16_t>*)pvParameters;
+    delete (std::vector<uint16_t>*)pvParameters;
+    std::vector<uint16_t> &ids = prog.ids;
+    bool crc = true;
+    bool deflate = true; // The modules inflate the compressed images
+    FlashInflater* inflater = NULL; // Or the master does
+    UsbSerialProtocol::Packet_t packet;
+    packet.data = (uint8_t*)malloc(16400);
+    BusRS::Frame_t frame = {};
+    frame.data = BusRS::allocBuffer(100);
+    prog.windowed = true;
+    prog.window = (uint8_t*)malloc(FLASH_LOADER_WINDOW_SIZE);
+    prog.buffer = BusRS::allocBuffer(100);
+
+    if (ids.empty() || (prog.window == NULL) || (packet.data == NULL) || (frame.data == NULL) || (prog.buffer == NULL)) {
+        Led::blink(LED_RED, 1000); // Error
+        goto end;
+    }
+
+    /* FlashLoader begin */
+    for (auto id : ids) {
+        _negotiateCapabilities(id);
+        prog.windowed &= ((getSlaveCapabilities(id) & BUS_RS_CAPABILITY_WINDOW) != 0);
+        crc &= ((getSlaveCapabilities(id) & BUS_RS_CAPABILITY_CRC) != 0);
+        deflate &= ((getSlaveCapabilities(id) & BUS_RS_CAPABILITY_DEFLATE) != 0);
+        frame.cmd = CMD_FLASH_LOADER_BEGIN;
+        frame.id = id;
+        frame.dir = 1;
+        frame.ack = true;
+        frame.length = 0;
+        if (BusRS::transfer(&frame, pdMS_TO_TICKS(5000)) < 0) {
+            Led::blink(LED_RED, 1000); // Error
+            goto end;
+        }
+    }
+    if (prog.windowed && (ids.size() > 1)) {
+        ESP_LOGI(TAG, "Multicast programming of %u modules", ids.size());
+        BusRS::setCrc(0, crc); // Broadcast chunks
+    }
+
+    UsbSerialProtocol::begin(115200);
+
+    while (1) {
+        if (UsbSerialProtocol::read(&packet) < 0) {
             Led::blink(LED_RED, 1000); // Error
         } else {
             switch (packet.command)
             {
             case UsbSerialProtocol::FLASH_LOADER_DATA:
-                sequence = 0;
                 memcpy(&packet.size, &packet.data[0], 4); // data size
-                for (int i=0; i<(packet.size/1024); i++) {
-                    frame.cmd = CMD_FLASH_LOADER_WRITE;
-                    frame.id = id;
-                    frame.dir = 1;
-                    frame.ack = true;
-                    frame.length = 1024;
-                    memcpy(frame.data, &packet.data[sequence*1024+16], 1024); // data
-                    BusRS::write(&frame, pdMS_TO_TICKS(100));
-                    if (BusRS::read(&frame, pdMS_TO_TICKS(100)) < 0) {
+                if (_programWrite(&prog, CMD_FLASH_LOADER_WRITE, &packet.data[16], packet.size) < 0) {
+                    Led::blink(LED_RED, 1000); // Error
+                    goto end;
+                }
+                packet.direction = 1;
+                packet.command = 0x03;
+                packet.size = 4;
+                packet.value = 0;
+                memset(packet.data, 0x00, 4);
+                UsbSerialProtocol::write(&packet);
+                break;
+
+            case UsbSerialProtocol::FLASH_LOADER_DEFL_BEGIN:
+                if (deflate) {
+                    if (_programFlush(&prog) < 0) {
                         Led::blink(LED_RED, 1000); // Error
                         goto end;
                     }
-                    sequence++;
-                }
-                if ((packet.size%1024) > 0) {
-                    frame.cmd = CMD_FLASH_LOADER_WRITE;
-                    frame.id = id;
-                    frame.dir = 1;
-                    frame.ack = true;
-                    frame.length = packet.size%1024;
-                    memcpy(frame.data, &packet.data[sequence*1024+16], packet.size%1024); // data
-                    BusRS::write(&frame, pdMS_TO_TICKS(100));
-                    if (BusRS::read(&frame, pdMS_TO_TICKS(100)) < 0) {
+                    for (auto id : ids) {
+                        frame.cmd = CMD_FLASH_LOADER_DEFL_BEGIN;
+                        frame.id = id;
+                        frame.dir = 1;
+                        frame.ack = true;
+                        frame.length = 0;
+                        if ((BusRS::transfer(&frame, pdMS_TO_TICKS(500)) < 0) || (frame.error == 1)) {
+                            Led::blink(LED_RED, 1000); // Error
+                            goto end;
+                        }
+                    }
+                    prog.offset = 0; // New stream
+                    prog.sent = 0;
+                    prog.acked = 0;
+                    prog.missing = 0;
+                } else {
+                    if (inflater == NULL) {
+                        inflater = new FlashInflater();
+                    }
+                    if (inflater->begin() < 0) {
                         Led::blink(LED_RED, 1000); // Error
                         goto end;
                     }
-                }                
+                }
+                packet.direction = 1;
+                packet.size = 4;
+                packet.value = 0;
+                memset(packet.data, 0x00, 4);
+                UsbSerialProtocol::write(&packet);
+                break;
+
+            case UsbSerialProtocol::FLASH_LOADER_DEFL_DATA:
+            {
+                int err;
+                memcpy(&packet.size, &packet.data[0], 4); // compressed data size
+                if (deflate) {
+                    err = _programWrite(&prog, CMD_FLASH_LOADER_DEFL_WRITE, &packet.data[16], packet.size);
+                } else if (inflater != NULL) {
+                    /* Some modules cannot inflate, the image is forwarded as it is inflated */
+                    err = inflater->write(&packet.data[16], packet.size, _programInflated, &prog);
+                } else {
+                    err = -1;
+                }
+                if (err < 0) {
+                    Led::blink(LED_RED, 1000); // Error
+                    goto end;
+                }
                 packet.direction = 1;
-                packet.command = 0x03;
                 packet.size = 4;
                 packet.value = 0;
                 memset(packet.data, 0x00, 4);
                 UsbSerialProtocol::write(&packet);
                 break;
+            }
 
             case UsbSerialProtocol::SYNC:
                 packet.direction = 1;
@@ -504,13 +1573,12 @@ void Master::_programmingTask(void *pvParameters)
 
             case UsbSerialProtocol::READ_REG:
                 frame.cmd = CMD_READ_REGISTER;
-                frame.id = id;
+                frame.id = ids[0];
                 frame.dir = 1;
                 frame.ack = true;
                 frame.length = 4;
                 memcpy(frame.data, packet.data, 4); // addr
-                BusRS::write(&frame, pdMS_TO_TICKS(200));
-                if (BusRS::read(&frame, pdMS_TO_TICKS(200)) < 0) {
+                if (BusRS::transfer(&frame, pdMS_TO_TICKS(200)) < 0) {
                     Led::blink(LED_RED, 1000); // Error
                     goto end;
                 } else {
@@ -523,24 +1591,44 @@ void Master::_programmingTask(void *pvParameters)
                 break;
 
             case UsbSerialProtocol::SPI_FLASH_LOADER_MD5:
-                frame.cmd = CMD_FLASH_LOADER_CHECK;
-                frame.id = id;
-                frame.dir = 1;
-                frame.ack = true;
-                frame.length = 4;
-                memcpy(frame.data, &packet.data[4], 4); // flash size
-                BusRS::write(&frame, pdMS_TO_TICKS(500));
-                if (BusRS::read(&frame, pdMS_TO_TICKS(3000)) < 0) {
+            {
+                /* Each module checks its own copy, a module which differs fails the whole update */
+                uint8_t md5Sum[16];
+                if (_programFlush(&prog) < 0) {
                     Led::blink(LED_RED, 1000); // Error
                     goto end;
-                } else {
-                    packet.direction = 1;
-                    packet.size = 18;
-                    memcpy(packet.data, frame.data, 16); // md5 sum
-                    memset(&packet.data[16], 0x00, 2);
-                    UsbSerialProtocol::write(&packet);
                 }
+                for (size_t i=0; i<ids.size(); i++) {
+                    frame.cmd = CMD_FLASH_LOADER_CHECK;
+                    frame.id = ids[i];
+                    frame.dir = 1;
+                    frame.ack = true;
+                    frame.length = 4;
+                    memcpy(frame.data, &packet.data[4], 4); // flash size
+                    if (BusRS::transfer(&frame, pdMS_TO_TICKS(3000)) < 0) {
+                        Led::blink(LED_RED, 1000); // Error
+                        goto end;
+                    }
+                    if (frame.error == 1) {
+                        ESP_LOGE(TAG, "Module %u: the image does not match its SHA-256", ids[i]);
+                        memset(md5Sum, 0x00, 16);
+                        break;
+                    }
+                    if (i == 0) {
+                        memcpy(md5Sum, frame.data, 16);
+                    } else if (memcmp(md5Sum, frame.data, 16) != 0) {
+                        ESP_LOGE(TAG, "Module %u: the image differs from module %u", ids[i], ids[0]);
+                        memset(md5Sum, 0x00, 16);
+                        break;
+                    }
+                }
+                packet.direction = 1;
+                packet.size = 18;
+                memcpy(packet.data, md5Sum, 16); // md5 sum
+                memset(&packet.data[16], 0x00, 2);
+                UsbSerialProtocol::write(&packet);
                 break;
+            }
             
             case UsbSerialProtocol::CHANGE_BAUDRATE:
                 packet.direction = 1;
@@ -551,12 +1639,16 @@ void Master::_programmingTask(void *pvParameters)
                 break;
 
             case UsbSerialProtocol::FLASH_LOADER_END:
-                frame.cmd = CMD_FLASH_LOADER_END;
-                frame.id = id;
-                frame.dir = 1;
-                frame.ack = 0;
-                frame.length = 0;
-                BusRS::write(&frame);
+            case UsbSerialProtocol::FLASH_LOADER_DEFL_END:
+                _programFlush(&prog);
+                for (auto id : ids) {
+                    frame.cmd = CMD_FLASH_LOADER_END;
+                    frame.id = id;
+                    frame.dir = 1;
+                    frame.ack = 0;
+                    frame.length = 0;
+                    BusRS::write(&frame);
+                }
                 packet.direction = 1;
                 packet.size = 4;
                 memset(packet.data, 0x00, 4);
@@ -576,11 +1668,200 @@ void Master::_programmingTask(void *pvParameters)
     }
 
 end:
+    BusRS::setCrc(0, false);
+    delete inflater;
+    free(prog.window);
+    BusRS::freeBuffer(prog.buffer);
     free(packet.data);
     packet.data = NULL;
-    free(frame.data);
+    BusRS::freeBuffer(frame.data);
     frame.data = NULL;
     vTaskDelete(NULL);
 }
 
+/**
+ * @brief Write a block of the image to the modules being programmed.
+ * Without the sliding window, each frame is acknowledged by each module in turn. Otherwise the 
+ * block is copied into the window and sent in chunks without waiting for the modules, which are 
+ * only polled for the chunks they miss when the window is full. The chunks are broadcast if 
+ * several modules are programmed.
+ * 
+ * @param prog Programming session
+ * @param cmd CMD_FLASH_LOADER_WRITE, or CMD_FLASH_LOADER_DEFL_WRITE for a compressed image 
+ * (only used without the window)
+ * @param data 
+ * @param size 
+ * @return 0 on success, -1 on error
+ */
+int Master::_programWrite(Programming_t* prog, uint8_t cmd, const uint8_t* data, size_t size)
+{
+    if (!prog->windowed) {
+        BusRS::Frame_t frame = {};
+        frame.dir = 1;
+        frame.data = prog->buffer;
+        for (size_t pos = 0; pos < size; pos += BUS_RS_DATA_LENGTH_MAX) {
+            for (auto id : prog->ids) {
+                frame.cmd = cmd;
+                frame.id = id;
+                frame.ack = true;
+                frame.length = std::min((size_t)BUS_RS_DATA_LENGTH_MAX, size - pos);
+                memcpy(frame.data, &data[pos], frame.length);
+                if ((BusRS::transfer(&frame, pdMS_TO_TICKS(100)) < 0) || (frame.error == 1)) {
+                    return -1;
+                }
+            }
+        }
+        prog->offset += size;
+        return 0;
+    }
+
+    while (size > 0) {
+        size_t space = FLASH_LOADER_WINDOW_SIZE - (prog->offset - prog->acked);
+        if (space == 0) {
+            _programSend(prog, false);
+            if (_programAck(prog) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        size_t index = prog->offset % FLASH_LOADER_WINDOW_SIZE;
+        size_t n = std::min({size, space, (size_t)FLASH_LOADER_WINDOW_SIZE - index});
+        memcpy(&prog->window[index], data, n);
+        prog->offset += n;
+        data += n;
+        size -= n;
+    }
+    _programSend(prog, false);
+    return 0;
+}
+
+/**
+ * @brief Send the chunks reported missing by the modules, then the chunks of the window 
+ * which have not been sent yet
+ * 
+ * @param prog Programming session
+ * @param flush Also send the last chunk if it is not full
+ */
+void Master::_programSend(Programming_t* prog, bool flush)
+{
+    for (int n = 0; prog->missing != 0; n++) {
+        if (prog->missing & (1UL << n)) {
+            uint32_t offset = prog->acked + n * FLASH_LOADER_CHUNK_SIZE;
+            _programChunk(prog, offset, std::min((size_t)FLASH_LOADER_CHUNK_SIZE, (size_t)(prog->sent - offset)));
+            prog->missing &= ~(1UL << n);
+        }
+    }
+
+    while (prog->sent < prog->offset) {
+        size_t length = std::min((size_t)FLASH_LOADER_CHUNK_SIZE, (size_t)(prog->offset - prog->sent));
+        if (!flush && (length < FLASH_LOADER_CHUNK_SIZE)) {
+            break;
+        }
+        _programChunk(prog, prog->sent, length);
+        prog->sent += length;
+    }
+}
+
+/**
+ * @brief Send a chunk of the window, with its offset
+ */
+void Master::_programChunk(Programming_t* prog, uint32_t offset, size_t length)
+{
+    BusRS::Frame_t frame = {};
+    frame.cmd = CMD_FLASH_LOADER_CHUNK;
+    frame.id = (prog->ids.size() == 1) ? prog->ids[0] : 0;
+    frame.dir = 1;
+    frame.ack = false;
+    frame.data = prog->buffer;
+
+    size_t index = offset % FLASH_LOADER_WINDOW_SIZE;
+    size_t first = std::min(length, (size_t)FLASH_LOADER_WINDOW_SIZE - index);
+    memcpy(frame.data, &offset, sizeof(uint32_t));
+    memcpy(&frame.data[sizeof(uint32_t)], &prog->window[index], first);
+    memcpy(&frame.data[sizeof(uint32_t) + first], prog->window, length - first);
+    frame.length = sizeof(uint32_t) + length;
+    BusRS::write(&frame, pdMS_TO_TICKS(100));
+}
+
+/**
+ * @brief Poll each module for the chunks it misses and slide the window to the lowest 
+ * cumulative acknowledgment. A module answers once it has handled the chunks sent before, 
+ * only the chunks missed by at least one module are sent again.
+ * 
+ * @param prog Programming session
+ * @return 0 on success, -1 on error or if the modules do not progress anymore
+ */
+int Master::_programAck(Programming_t* prog)
+{
+    BusRS::Frame_t frame = {};
+    frame.dir = 1;
+    frame.data = prog->buffer;
+    uint32_t acked = prog->sent;
+    uint32_t missing = 0; // Bit n: chunk at prog->acked + n * FLASH_LOADER_CHUNK_SIZE
+
+    for (auto id : prog->ids) {
+        uint32_t status[2] = {0, 0}; // Cumulative offset, chunks missing after it
+        frame.cmd = CMD_FLASH_LOADER_STATUS;
+        frame.id = id;
+        frame.ack = true;
+        frame.ext = ((getSlaveCapabilities(id) & BUS_RS_CAPABILITY_TAG) != 0);
+        frame.length = sizeof(uint32_t);
+        memcpy(frame.data, &prog->sent, sizeof(uint32_t));
+        if ((BusRS::transfer(&frame, pdMS_TO_TICKS(500)) < 0) || (frame.error == 1) || 
+            (frame.length < sizeof(status))) {
+            ESP_LOGE(TAG, "Module %u: cannot write the image", id);
+            return -1;
+        }
+        memcpy(status, frame.data, sizeof(status));
+        if ((status[0] < prog->acked) || (status[0] > prog->sent)) {
+            ESP_LOGE(TAG, "Module %u: unexpected offset %lu", id, status[0]);
+            return -1;
+        }
+        missing |= status[1] << ((status[0] - prog->acked) / FLASH_LOADER_CHUNK_SIZE);
+        acked = std::min(acked, status[0]);
+    }
+
+    if (acked > prog->acked) {
+        missing >>= (acked - prog->acked) / FLASH_LOADER_CHUNK_SIZE;
+        prog->acked = acked;
+        prog->stalled = false;
+    } else if (!prog->stalled) {
+        prog->stalled = true;
+        prog->stallTime = xTaskGetTickCount();
+    } else if ((xTaskGetTickCount() - prog->stallTime) > pdMS_TO_TICKS(FLASH_LOADER_ACK_TIMEOUT)) {
+        ESP_LOGE(TAG, "Programming stalled at offset %lu", prog->acked);
+        return -1;
+    }
+    if (prog->stalled) {
+        vTaskDelay(pdMS_TO_TICKS(5)); // The modules are busy writing the flash
+    }
+    prog->missing = missing;
+    return 0;
+}
+
+/**
+ * @brief Wait until all the data written has been acknowledged
+ * 
+ * @param prog Programming session
+ * @return 0 on success, -1 on error
+ */
+int Master::_programFlush(Programming_t* prog)
+{
+    while (prog->windowed && (prog->acked < prog->offset)) {
+        _programSend(prog, true);
+        if (_programAck(prog) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Output of the inflater of the master, when the modules cannot inflate the image themselves
+ */
+int Master::_programInflated(const uint8_t* data, size_t length, void* arg)
+{
+    return _programWrite((Programming_t*)arg, CMD_FLASH_LOADER_WRITE, data, length);
+}
+
 #endif
\ No newline at end of file
@@ -18,6 +18,50 @@
 #include "Types.h"
 #include "ModuleControl.h"
 
+/**
+ * @brief Cyclic process image exchange statistics, times are in microseconds
+ * 
+ */
+struct CyclicStats_s {
+    uint32_t period;        // Configured cycle period
+    uint32_t cycles;        // Number of cycles
+    uint32_t errors;        // Number of failed slave exchanges
+    uint32_t overruns;      // Number of cycles which lasted longer than the period
+    uint32_t cycleTimeMin;  // Time spent exchanging the images of all slaves
+    uint32_t cycleTimeMax;
+    uint32_t cycleTimeAvg;
+    uint32_t jitterMax;     // Deviation of the cycle start from its schedule
+    uint32_t jitterAvg;
+};
+
+/* Discovery ends when no answer came for the quiet period, once the expected slaves have answered */
+#define BUS_DISCOVER_TIMEOUT 200    // ms, without any answer, or while answers are missing
+#define BUS_DISCOVER_QUIET 10       // ms, after the last answer
+
+/* Remote callbacks are sent by dispatcher tasks, each one has a request in flight */
+#define MASTER_DISPATCH_TASKS BUS_RS_WINDOW_SIZE
+#define MASTER_DISPATCH_QUEUE_SIZE 16 // Requests of the blocking and asynchronous callbacks
+#define MASTER_CALLBACK_TIMEOUT 100 // ms
+
+/* Arguments of the callback run by a slave on an event of another module (registerEventCallback) */
+#define MASTER_EVENT_ARGS_MAX 32
+
+/* Programming: data sent before the modules are polled for their status. It covers both stage 
+   buffers of the slaves, and the chunks still in their uart buffer while one is written to flash. 
+   The missing chunks are reported in a 32-bit bitmap, the window must not exceed 32 chunks. */
+#define FLASH_LOADER_WINDOW_SIZE (2 * FLASH_LOADER_STAGE_SIZE + 2 * FLASH_LOADER_CHUNK_SIZE)
+#define FLASH_LOADER_ACK_TIMEOUT 2000 // ms without progress
+
+/* A module is lost when no heartbeat came for this time, by default */
+#define BUS_HEARTBEAT_TIMEOUT (3 * BUS_CAN_HEARTBEAT_PERIOD) // ms
+
+/* Baud rate supervision: the rail falls back to a lower rate on sustained errors */
+#define BUS_RS_BAUD_TEST_FRAMES 4       // Echo frames sent to each slave before a new rate is confirmed
+#define BUS_RS_BAUD_CHECK_PERIOD 1000   // ms
+#define BUS_RS_BAUD_ERRORS_MAX 5        // Errors per period
+#define BUS_RS_BAUD_ERRORS_PERIODS 3    // Consecutive periods over the limit before falling back
+#define BUS_RS_BAUD_DRAIN_TIMEOUT 500   // ms, for the transactions in flight to end before a switch
+
 class Master
 {
 public:
@@ -29,29 +73,69 @@ public:
 
     static bool autoId(void);
     static void program(uint16_t boardType, uint32_t boardSN);
+    static void program(uint16_t boardType, std::vector<uint32_t> boardSNs);
 
     static void moduleRestart(const uint16_t slaveId);
     static bool ping(uint16_t boardType, uint32_t boardSN);
     static void ledCtrl(const uint16_t slaveId, const uint8_t state, const uint8_t color = LED_NONE, const uint32_t period = 0);
 
     using SlaveInfo = std::pair<uint16_t, uint32_t>; // Slave ID and serial number
-    static std::map<uint16_t, SlaveInfo, std::greater<uint16_t>> discoverSlaves(void);
+    static std::map<uint16_t, SlaveInfo, std::greater<uint16_t>> discoverSlaves(size_t expected = 0);
     static void getBoardInfo(uint16_t boardType, uint32_t boardSN, Board_Info_t* info);
 
     static int runCallback(const uint16_t slaveId, const uint8_t callbackId, std::vector<uint8_t> &args, bool ackNeeded = true);
     static int runCallback(const uint16_t slaveId, std::vector<uint8_t> &msgBytes, bool ackNeeded = true);
 
+    /**
+     * @brief Completion of an asynchronous callback: 0 and the answer of the slave, or -1 on error
+     * It runs in a dispatcher task and must not wait for another remote callback.
+     */
+    using CallbackDone = std::function<void(int, std::vector<uint8_t> &)>;
+
+    /**
+     * @brief Queue a callback for the dispatcher tasks and return without waiting for the answer.
+     * Requests to different slaves are in flight at the same time.
+     * 
+     * @param slaveId Slave id
+     * @param msgBytes Callback id followed by its arguments
+     * @param done Called with the answer, can be NULL
+     * @param timeoutMs Time to get a free request, then timeout of the answer once the request is sent
+     * @return 0 if the request is queued, -1 otherwise
+     */
+    static int runCallbackAsync(const uint16_t slaveId, const std::vector<uint8_t> &msgBytes, 
+        CallbackDone done = NULL, uint32_t timeoutMs = MASTER_CALLBACK_TIMEOUT);
+    static int runCallbackBatch(const uint16_t slaveId, std::vector<std::vector<uint8_t>> &msgs, bool ackNeeded = true);
+
     static void resetModules(void);
 
     static void registerEventCallback(uint16_t slaveId, ModuleControl* module, 
         uint8_t eventId, uint8_t eventArg, 
         uint8_t callbackId, std::vector<uint8_t> callbackArgs);
+    static void registerEventCallback(uint16_t slaveId, uint16_t moduleId, 
+        uint8_t eventId, uint8_t eventArg, 
+        uint8_t callbackId, std::vector<uint8_t> callbackArgs);
 
     static uint16_t getSlaveId(uint16_t boardType, uint32_t boardSN);
+    static uint8_t getSlaveCapabilities(uint16_t slaveId);
 
-    static inline void addModuleControlInstance(ModuleControl* module) {
-        _modules.push_back(module);
-    }
+    /**
+     * @brief Get the bus statistics seen by a slave
+     * 
+     * @param slaveId 
+     * @param stats 
+     * @return error: -1 (no answer or older firmware), succeed: 0
+     */
+    static int getBusStats(uint16_t slaveId, Bus::BusStats_t* stats);
+
+    static uint32_t negotiateBaudRate(uint32_t maxBaudRate = 0);
+
+    static int startCyclic(uint32_t periodMs);
+    static void stopCyclic(void);
+    static inline bool isCyclicRunning(void) { return _cyclicRunning; }
+    static void getCyclicStats(CyclicStats_s* stats);
+    static void resetCyclicStats(void);
+
+    static void addModuleControlInstance(ModuleControl* module);
 
     static inline void addEventCallback(uint8_t eventId, uint16_t slaveId, std::function<void(uint8_t*)>callback) {
         _eventCallbacks.insert({std::make_pair(eventId, slaveId), callback});
@@ -65,24 +149,130 @@ public:
         _errorCallback = callback;
     }
 
+    /**
+     * @brief Called with the slave id when a module stops sending its heartbeat
+     */
+    static inline void onModuleLost(std::function<void(uint16_t)> callback) {
+        _moduleLostCallback = callback;
+    }
+
+    /**
+     * @brief Called with the slave id when a lost or restarted module is back, 
+     * once its configuration has been sent again
+     */
+    static inline void onModuleReturned(std::function<void(uint16_t)> callback) {
+        _moduleReturnedCallback = callback;
+    }
+
+    static void setHeartbeatTimeout(uint32_t timeoutMs);
+    static bool isModuleAlive(uint16_t slaveId);
+
 private:
     static State_e _state;
     static TaskHandle_t _busTaskHandle;
     static TaskHandle_t _ledSyncTaskHandle;
-    static SemaphoreHandle_t _callbackMutex;
+    static TaskHandle_t _cyclicTaskHandle;
+    static TaskHandle_t _baudRateTaskHandle;
+    static TaskHandle_t _discoverTaskHandle; // Notified by the CAN task for each discovery answer
+    static SemaphoreHandle_t _discoverMutex; // Protects the slave infos filled by the CAN task
+    static TaskHandle_t _supervisionTaskHandle;
+
+    struct CallbackRequest_s {
+        uint16_t slaveId;
+        std::vector<uint8_t>* msgBytes; // Message of a blocking caller, or the copy below
+        std::vector<uint8_t> message;   // Copy of an asynchronous message
+        CallbackDone done;
+        TaskHandle_t task;              // Blocking caller, notified when the request is finished
+        volatile bool finished;
+        int result;
+        uint32_t timeoutMs;             // From the moment the request is sent
+    };
+    static CallbackRequest_s _requests[MASTER_DISPATCH_QUEUE_SIZE];
+    static QueueHandle_t _requestsFree;
+    static QueueHandle_t _dispatchQueue;
+    static uint8_t _dispatchBuffers[MASTER_DISPATCH_TASKS][BUS_RS_DATA_LENGTH_MAX]; // Answer buffer of each task
+
+    static void _dispatchTask(void *pvParameters);
+    static int _transferCallback(const uint16_t slaveId, std::vector<uint8_t> &msgBytes, uint8_t* buffer, uint32_t timeoutMs);
 
     static void _busCanTask(void *pvParameters);
     static void _programmingTask(void *pvParameters);
+
+    typedef struct {
+        std::vector<uint16_t> ids;
+        bool windowed;          // The modules receive the chunks in a sliding window
+        uint32_t offset;        // Bytes of the image given to _programWrite, compressed or not
+        uint32_t sent;          // Bytes sent
+        uint32_t acked;         // Bytes acknowledged by all the modules
+        uint32_t missing;       // Chunks to send again, bit n: chunk at acked + n * FLASH_LOADER_CHUNK_SIZE
+        bool stalled;           // The last acknowledgment did not progress
+        TickType_t stallTime;   // Since this time
+        uint8_t* window;        // Bytes not acknowledged yet, FLASH_LOADER_WINDOW_SIZE
+        uint8_t* buffer;        // Frame buffer
+    } Programming_t;
+
+    static int _programWrite(Programming_t* prog, uint8_t cmd, const uint8_t* data, size_t size);
+    static void _programSend(Programming_t* prog, bool flush);
+    static void _programChunk(Programming_t* prog, uint32_t offset, size_t length);
+    static int _programAck(Programming_t* prog);
+    static int _programFlush(Programming_t* prog);
+    static int _programInflated(const uint8_t* data, size_t length, void* arg);
     static void _ledSyncTask(void *pvParameters);
+    static void _cyclicTask(void *pvParameters);
+    static void _baudRateTask(void *pvParameters);
+    static void _supervisionTask(void *pvParameters);
+
+    static bool _autoId(void);
+    static void _negotiateCapabilities(uint16_t slaveId);
+    static void _updateCanPriority(void);
+    static void _handleEvent(uint16_t id, uint8_t* args);
+
+    static uint8_t _baudRates; // Baud rates supported by all the slaves (bit n: BUS_RS_BAUD_RATES[n])
+    static SemaphoreHandle_t _baudRateMutex;
+
+    static int _switchBaudRate(uint8_t index);
+    static void _sendBaudRate(uint8_t index, bool probation);
+    static bool _testBaudRate(void);
 
     using EventKey = std::pair<uint8_t, uint16_t>; // Event ID and Module ID
     using EventCallback = std::function<void(uint8_t*)>;
 
     static std::vector<ModuleControl*> _modules;
+    static SemaphoreHandle_t _modulesMutex; // Held while the ids change and during each cycle of the exchange
     static std::map<uint16_t, SlaveInfo, std::greater<uint16_t>> _slaveInfos;
+    static std::map<uint16_t, uint8_t> _slaveCapabilities; // Protocol features supported by each slave
     static std::map<EventKey, EventCallback> _eventCallbacks;
     static std::function<void(int)> _errorCallback;
 
+    /* Module supervision, only the slaves which sent a heartbeat are supervised */
+    struct Heartbeat_s {
+        TickType_t lastTick;
+        uint32_t uptime;    // ms
+        uint8_t state;
+        bool alive;
+        bool restarted;     // Handled by the supervision task
+    };
+    static std::map<uint16_t, Heartbeat_s> _heartbeats;
+    static SemaphoreHandle_t _heartbeatMutex;
+    static uint32_t _heartbeatTimeout; // ms
+    static std::function<void(uint16_t)> _moduleLostCallback;
+    static std::function<void(uint16_t)> _moduleReturnedCallback;
+
+    static int _restoreModule(ModuleControl* module);
+
+    static volatile bool _cyclicRunning;
+    static uint32_t _cyclicPeriod; // ms
+    static CyclicStats_s _cyclicStats;
+    static uint64_t _cyclicTimeSum;
+    static uint64_t _cyclicJitterSum;
+    static SemaphoreHandle_t _cyclicStatsMutex;
+
+    static uint8_t _cyclicBuffers[BUS_RS_WINDOW_SIZE + 1][BUS_RS_DATA_LENGTH_MAX]; // One per exchange in flight, the last one for the untagged exchanges
+
+    static int _exchangeImage(ModuleControl* module, uint8_t* buffer, int64_t deadline);
+    static int _sendImage(ModuleControl* module, BusRS::Frame_t* frame, uint8_t* buffer, int64_t deadline);
+    static int _receiveImage(ModuleControl* module, BusRS::Frame_t* frame, int transaction, int64_t deadline);
+
     static int _registerCLI(void);
 };
 
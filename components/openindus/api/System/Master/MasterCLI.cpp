@@ -8,6 +8,7 @@
 
 #include "Master.h"
 #include "esp_timer.h"
+#include <atomic>
 
 #if defined(CONFIG_MODULE_MASTER)
 
@@ -22,7 +23,7 @@ static struct {
 static int programCmd(int argc, char **argv)
 {
     uint16_t type;
-    uint32_t sn;
+    std::vector<uint32_t> sns;
 
     int nerrors = arg_parse(argc, argv, (void **) &programArgs);
     if (nerrors != 0) {
@@ -31,9 +32,11 @@ static int programCmd(int argc, char **argv)
     }
 
     type = programArgs.type->ival[0];
-    sn = programArgs.sn->ival[0];
+    for (int i = 0; i < programArgs.sn->count; i++) {
+        sns.push_back(programArgs.sn->ival[i]);
+    }
 
-    Master::program(type, sn);
+    Master::program(type, sns);
 
     return 0;
 }
@@ -41,7 +44,7 @@ static int programCmd(int argc, char **argv)
 static int _registerProgramCmd(void)
 {
     programArgs.type = arg_int1(NULL, NULL, "<TYPE>", "Board type");
-    programArgs.sn = arg_int1(NULL, NULL, "<SN>", "Board serial number");
+    programArgs.sn = arg_intn(NULL, NULL, "<SN>", 1, 16, "Serial numbers of the boards, identical modules are programmed together");
     programArgs.end = arg_end(1);
     const esp_console_cmd_t cmd = {
         .command = "program",
@@ -473,6 +476,82 @@ static int _registerRunCallback(void)
     }
 }
 
+/* --- callback-bench --- */
+
+static struct {
+    struct arg_int *count;
+    struct arg_int *callback;
+    struct arg_int *ids;
+    struct arg_end *end;
+} callbackBenchArgs;
+
+static int callbackBenchCmd(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &callbackBenchArgs);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, callbackBenchArgs.end, argv[0]);
+        return 1;
+    }
+
+    int count = (callbackBenchArgs.count->count > 0) ? callbackBenchArgs.count->ival[0] : 100;
+    if (count <= 0) {
+        return 1;
+    }
+    uint8_t callback = (callbackBenchArgs.callback->count > 0) ? callbackBenchArgs.callback->ival[0] : CALLBACK_DIGITAL_READ;
+    int nb = callbackBenchArgs.ids->count;
+
+    /* One request at a time */
+    int errors = 0;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < count; i++) {
+        std::vector<uint8_t> msgBytes = {callback, 0};
+        errors += (Master::runCallback(callbackBenchArgs.ids->ival[i % nb], msgBytes) < 0);
+    }
+    int64_t blockingTime = esp_timer_get_time() - start;
+
+    /* All the requests queued at once */
+    SemaphoreHandle_t done = xSemaphoreCreateCounting(count, 0);
+    std::atomic<int> asyncErrors(0);
+    int queued = 0;
+    start = esp_timer_get_time();
+    for (int i = 0; i < count; i++) {
+        std::vector<uint8_t> msgBytes = {callback, 0};
+        if (Master::runCallbackAsync(callbackBenchArgs.ids->ival[i % nb], msgBytes, [&](int err, std::vector<uint8_t> &answer) {
+            asyncErrors += (err < 0);
+            xSemaphoreGive(done);
+        }, 1000) == 0) {
+            queued++;
+        }
+    }
+    for (int i = 0; i < queued; i++) {
+        xSemaphoreTake(done, portMAX_DELAY);
+    }
+    int64_t asyncTime = esp_timer_get_time() - start;
+    vSemaphoreDelete(done);
+
+    printf("{\"requests\":%d,\"blocking_us\":%lld,\"blocking_errors\":%d,\"async_us\":%lld,\"async_errors\":%d}\n",
+        count, blockingTime, errors, asyncTime, asyncErrors.load() + (count - queued));
+    return 0;
+}
+
+static int _registerCallbackBenchCmd(void)
+{
+    callbackBenchArgs.count = arg_int0("n", "count", "<N>", "Number of requests (default: 100)");
+    callbackBenchArgs.callback = arg_int0("c", "callback", "<CB>", "Callback ID, called with the argument 0 (default: digital read)");
+    callbackBenchArgs.ids = arg_intn(NULL, NULL, "<ID>", 1, 16, "Slave IDs, used in turn");
+    callbackBenchArgs.end = arg_end(3);
+    const esp_console_cmd_t cmd = {
+        .command = "callback-bench",
+        .help = "Time remote callbacks run one at a time, then queued at once",
+        .hint = NULL,
+        .func = &callbackBenchCmd,
+        .argtable = &callbackBenchArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    return esp_console_cmd_register(&cmd);
+}
+
 /* --- module-restart --- */
 
 static struct {
@@ -509,6 +588,318 @@ static int _registerModuleRestartCmd(void)
     return esp_console_cmd_register(&cmd);
 }
 
+/* --- register-event --- */
+
+static struct {
+    struct arg_int *id;
+    struct arg_int *module;
+    struct arg_int *event;
+    struct arg_int *arg;
+    struct arg_int *callback;
+    struct arg_end *end;
+} registerEventArgs;
+
+static int registerEventCmd(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &registerEventArgs);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, registerEventArgs.end, argv[0]);
+        return 1;
+    }
+    uint16_t slaveId = registerEventArgs.id->ival[0];
+    uint16_t moduleId = registerEventArgs.module->ival[0];
+    uint8_t eventId = (registerEventArgs.event->count > 0) ? registerEventArgs.event->ival[0] : EVENT_DIGITAL_INTERRUPT;
+    uint8_t eventArg = (registerEventArgs.arg->count > 0) ? registerEventArgs.arg->ival[0] : 0;
+    uint8_t callbackId = (registerEventArgs.callback->count > 0) ? registerEventArgs.callback->ival[0] : 0xFF;
+    Master::registerEventCallback(slaveId, moduleId, eventId, eventArg, callbackId, {});
+    printf("Module ID: %u subscribed to the events of module ID: %u\n", slaveId, moduleId);
+    return 0;
+}
+
+static int _registerRegisterEventCmd(void)
+{
+    registerEventArgs.id = arg_int1("i", "id", "<ID>", "Slave ID");
+    registerEventArgs.module = arg_int1("m", "module", "<ID>", "ID of the module sending the event");
+    registerEventArgs.event = arg_int0("e", "event", "<EVENT>", "Event ID (default: digital interrupt)");
+    registerEventArgs.arg = arg_int0("a", "arg", "<ARG>", "Event argument (default: 0)");
+    registerEventArgs.callback = arg_int0("c", "callback", "<CB>", "Event callback ID of the slave (default: none)");
+    registerEventArgs.end = arg_end(5);
+    const esp_console_cmd_t cmd = {
+        .command = "register-event",
+        .help = "Run an event callback of a slave when another module sends an event",
+        .hint = NULL,
+        .func = &registerEventCmd,
+        .argtable = &registerEventArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    return esp_console_cmd_register(&cmd);
+}
+
+/* --- get-bus-stats --- */
+
+static struct {
+    struct arg_int *id;
+    struct arg_end *end;
+} getBusStatsArgs;
+
+static int getBusStatsCmd(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &getBusStatsArgs);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, getBusStatsArgs.end, argv[0]);
+        return 1;
+    }
+    Bus::BusStats_t stats;
+    if (Master::getBusStats(getBusStatsArgs.id->ival[0], &stats) < 0) {
+        fprintf(stderr, "No bus statistics from module ID: %d\n", getBusStatsArgs.id->ival[0]);
+        return 1;
+    }
+    Bus::printBusStats(&stats);
+    return 0;
+}
+
+static int _registerGetBusStatsCmd(void)
+{
+    getBusStatsArgs.id = arg_int1("i", "id", "<ID>", "Slave ID");
+    getBusStatsArgs.end = arg_end(1);
+    const esp_console_cmd_t cmd = {
+        .command = "get-bus-stats",
+        .help = "Print the bus statistics seen by a slave module",
+        .hint = NULL,
+        .func = &getBusStatsCmd,
+        .argtable = &getBusStatsArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    return esp_console_cmd_register(&cmd);
+}
+
+/* --- cyclic --- */
+
+static struct {
+    struct arg_str *action;
+    struct arg_int *period;
+    struct arg_end *end;
+} cyclicArgs;
+
+static int cyclicCmd(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &cyclicArgs);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, cyclicArgs.end, argv[0]);
+        return 1;
+    }
+
+    const char* action = cyclicArgs.action->sval[0];
+    if (strcmp(action, "start") == 0) {
+        uint32_t period = (cyclicArgs.period->count > 0) ? cyclicArgs.period->ival[0] : 10;
+        if (Master::startCyclic(period) < 0) {
+            return 2;
+        }
+    } else if (strcmp(action, "stop") == 0) {
+        Master::stopCyclic();
+    } else if (strcmp(action, "stats") == 0) {
+        CyclicStats_s stats;
+        Master::getCyclicStats(&stats);
+        printf("{\"running\":%s,\"period\":%lu,\"cycles\":%lu,\"errors\":%lu,\"overruns\":%lu,"
+            "\"cycle_min\":%lu,\"cycle_max\":%lu,\"cycle_avg\":%lu,\"jitter_max\":%lu,\"jitter_avg\":%lu}\n",
+            Master::isCyclicRunning() ? "true" : "false", stats.period, stats.cycles, stats.errors, stats.overruns,
+            (stats.cycles > 0) ? stats.cycleTimeMin : 0, stats.cycleTimeMax, stats.cycleTimeAvg,
+            stats.jitterMax, stats.jitterAvg);
+    } else if (strcmp(action, "reset") == 0) {
+        Master::resetCyclicStats();
+    } else {
+        printf("Unknown action: %s\n", action);
+        return 1;
+    }
+    return 0;
+}
+
+static int _registerCyclicCmd(void)
+{
+    cyclicArgs.action = arg_str1(NULL, NULL, "<start|stop|stats|reset>", "Action");
+    cyclicArgs.period = arg_int0("p", "period", "<MS>", "Cycle period in milliseconds (default: 10)");
+    cyclicArgs.end = arg_end(2);
+    const esp_console_cmd_t cmd = {
+        .command = "cyclic",
+        .help = "Control the cyclic process image exchange and print its statistics (times in us)",
+        .hint = NULL,
+        .func = &cyclicCmd,
+        .argtable = &cyclicArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    return esp_console_cmd_register(&cmd);
+}
+
+/* --- baud-rate --- */
+
+static struct {
+    struct arg_int *max;
+    struct arg_end *end;
+} baudRateArgs;
+
+static int baudRateCmd(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &baudRateArgs);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, baudRateArgs.end, argv[0]);
+        return 1;
+    }
+
+    uint32_t max = (baudRateArgs.max->count > 0) ? baudRateArgs.max->ival[0] : 0;
+    printf("%lu\n", Master::negotiateBaudRate(max));
+    return 0;
+}
+
+static int _registerBaudRateCmd(void)
+{
+    baudRateArgs.max = arg_int0("m", "max", "<BAUD>", "Fastest baud rate to try (default: no limit)");
+    baudRateArgs.end = arg_end(1);
+    const esp_console_cmd_t cmd = {
+        .command = "baud-rate",
+        .help = "Negotiate the RS bus baud rate with the slaves and print the rate in use",
+        .hint = NULL,
+        .func = &baudRateCmd,
+        .argtable = &baudRateArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    return esp_console_cmd_register(&cmd);
+}
+
+/* --- bus-rs-bench --- */
+
+/* Heap operations are counted by the allocator hooks, when they are enabled */
+static volatile bool RSBenchCounting = false;
+static volatile uint32_t RSBenchHeapOps = 0;
+
+#if defined(CONFIG_HEAP_USE_HOOKS)
+extern "C" void esp_heap_trace_alloc_hook(void* ptr, size_t size, uint32_t caps)
+{
+    if (RSBenchCounting) {
+        RSBenchHeapOps++;
+    }
+}
+
+extern "C" void esp_heap_trace_free_hook(void* ptr)
+{
+    if (RSBenchCounting) {
+        RSBenchHeapOps++;
+    }
+}
+#endif
+
+static struct {
+    struct arg_int *id;
+    struct arg_int *transactions;
+    struct arg_int *size;
+    struct arg_end *end;
+} RSBenchArgs;
+
+/* Echo transactions, with the frame path of the bus or copied through a heap buffer 
+   before the write and after the read, as the frames were before the buffer pool */
+static int RSBenchRun(uint16_t id, int transactions, size_t size, bool copy, uint8_t* buffer, float* tps, float* heapOps)
+{
+    int errors = 0;
+    RSBenchHeapOps = 0;
+    RSBenchCounting = true;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < transactions; i++) {
+        BusRS::Frame_t frame = {};
+        frame.cmd = CMD_ECHO;
+        frame.id = id;
+        frame.dir = 1;
+        frame.ack = true;
+        frame.length = size;
+        frame.data = buffer;
+        if (copy) {
+            uint8_t* tx = (uint8_t*)malloc(BUS_RS_FRAME_LENGTH_MAX);
+            memcpy(tx, &frame, BUS_RS_HEADER_LENGTH);
+            memcpy(&tx[BUS_RS_HEADER_LENGTH], buffer, size);
+            free(tx);
+        }
+        if (BusRS::transfer(&frame, 100) < 0) {
+            errors++;
+        }
+        if (copy) {
+            uint8_t* rx = (uint8_t*)malloc(BUS_RS_FRAME_LENGTH_MAX);
+            memcpy(rx, buffer, frame.length);
+            free(rx);
+        }
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    RSBenchCounting = false;
+
+    *tps = (float)transactions * 1000000 / (elapsed > 0 ? elapsed : 1);
+#if defined(CONFIG_HEAP_USE_HOOKS)
+    *heapOps = (float)RSBenchHeapOps / transactions;
+#else
+    *heapOps = -1;
+#endif
+    return errors;
+}
+
+static int RSBenchCmd(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &RSBenchArgs);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, RSBenchArgs.end, argv[0]);
+        return 1;
+    }
+
+    uint16_t id = RSBenchArgs.id->ival[0];
+    int transactions = (RSBenchArgs.transactions->count > 0) ? RSBenchArgs.transactions->ival[0] : 1000;
+    int size = (RSBenchArgs.size->count > 0) ? RSBenchArgs.size->ival[0] : 8;
+    if ((transactions < 1) || (size < 0) || (size > BUS_RS_DATA_LENGTH_MAX)) {
+        fprintf(stderr, "Invalid arguments\n");
+        return 1;
+    }
+
+    uint8_t* buffer = BusRS::allocBuffer(100);
+    if (buffer == NULL) {
+        return 1;
+    }
+    for (int i = 0; i < size; i++) {
+        buffer[i] = (uint8_t)i;
+    }
+
+    float tps, heapOps, copyTps, copyHeapOps;
+    int errors = RSBenchRun(id, transactions, size, false, buffer, &tps, &heapOps);
+    errors += RSBenchRun(id, transactions, size, true, buffer, &copyTps, &copyHeapOps);
+    BusRS::freeBuffer(buffer);
+
+    printf("{\"transactions\":%d,\"bytes\":%d,\"errors\":%d,\"tps\":%.0f,\"heap_ops\":%.2f,\"copy_tps\":%.0f,\"copy_heap_ops\":%.2f}\n",
+        transactions, size, errors, tps, heapOps, copyTps, copyHeapOps);
+    return 0;
+}
+
+static int _registerRSBenchCmd(void)
+{
+    RSBenchArgs.id = arg_int1("i", "id", "<ID>", "slave id");
+    RSBenchArgs.transactions = arg_int0("n", "transactions", "<N>", "echo transactions per run (default 1000)");
+    RSBenchArgs.size = arg_int0("s", "size", "<BYTES>", "payload of each frame (default 8)");
+    RSBenchArgs.end = arg_end(3);
+
+    const esp_console_cmd_t cmd = {
+        .command = "bus-rs-bench",
+        .help = "Measure the echo transactions per second and the heap operations per transaction, "
+            "then the same with the frames copied through the heap",
+        .hint = NULL,
+        .func = &RSBenchCmd,
+        .argtable = &RSBenchArgs,
+        .func_w_context = NULL,
+        .context = NULL
+    };
+    
+    if (esp_console_cmd_register(&cmd) == ESP_OK) {
+        return 0;
+    } else {
+        return -1;
+    }
+}
+
 int Master::_registerCLI(void)
 {
     int err = 0;
@@ -523,6 +914,12 @@ int Master::_registerCLI(void)
     err |= _registerGetStatusCmd();
     err |= _registerRunCallback();
     err |= _registerModuleRestartCmd();
+    err |= _registerRegisterEventCmd();
+    err |= _registerGetBusStatsCmd();
+    err |= _registerCyclicCmd();
+    err |= _registerBaudRateCmd();
+    err |= _registerCallbackBenchCmd();
+    err |= _registerRSBenchCmd();
     return err;
 }
 
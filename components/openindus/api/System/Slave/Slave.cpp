@@ -10,15 +10,20 @@
 
 #if defined(CONFIG_MODULE_SLAVE)
 
+#include "esp_timer.h"
+
 static const char TAG[] = "Slave";
 
 uint16_t Slave::_id;
+uint8_t Slave::_masterCapabilities = 0;
 State_e Slave::_state = STATE_IDLE;
 TaskHandle_t Slave::_busTaskHandle = NULL;
 std::map<uint8_t, std::function<void(std::vector<uint8_t>&)>> Slave::_callbacks;
 std::list<std::function<void(void)>> Slave::_resetCallbacks;
 std::map<uint8_t, std::function<void(std::vector<uint8_t> &)>> Slave::_eventCallbacks;
 std::vector<EventCallbackConfig_s> Slave::_eventCallbackConfigs;
+std::map<uint8_t, std::pair<std::function<void(std::vector<uint8_t> &)>, 
+    std::function<void(std::vector<uint8_t> &)>>> Slave::_processImages;
 
 int Slave::init(void)
 {
@@ -27,6 +32,14 @@ int Slave::init(void)
     /* Board ID is represented by the 10 most significants bits of the adc reading (12 bits) */
     _id = (uint16_t) (BusIO::readId()>>2);
     ESP_LOGI(TAG, "Bus Id: %d", _id);
+    _updateCanFilter();
+
+    /* Long events of the subscribed modules, the master controls the flow */
+    BusCAN::setMessageCallback([](uint16_t id, uint8_t* data, uint16_t size) {
+        if ((data[0] == CMD_SEND_EVENT) && (size >= 3)) {
+            _handleEvent(id, &data[1]);
+        }
+    });
 
     /* Bus task */
     ESP_LOGI(TAG, "Create BusRS task");
@@ -35,6 +48,9 @@ int Slave::init(void)
     ESP_LOGI(TAG, "Create BusCAN task");
     xTaskCreate(_busCanTask, "BusCAN task", 4096, NULL, 1, &_busTaskHandle);
 
+    ESP_LOGI(TAG, "Create heartbeat task");
+    xTaskCreate(_heartbeatTask, "Heartbeat task", 2048, NULL, 1, NULL);
+
     _state = STATE_RUNNING;
 
     _registerCLI();
@@ -70,11 +86,24 @@ int Slave::getStatus(void)
  */
 void Slave::sendEvent(std::vector<uint8_t> msgBytes)
 {
+    BusCAN::Priority_e priority = msgBytes.empty() ? BusCAN::PRIORITY_IO : _eventPriority(msgBytes[0]);
+
+    /* Longer than one frame: segmented when the master can reassemble it */
+    if (msgBytes.size() > (sizeof(BusCAN::Frame_t) - 1)) {
+        if (_masterCapabilities & BUS_RS_CAPABILITY_CAN_SEGMENT) {
+            msgBytes.insert(msgBytes.begin(), CMD_SEND_EVENT);
+            BusCAN::writeMessage(msgBytes.data(), msgBytes.size(), _id, priority);
+            return;
+        }
+        ESP_LOGW(TAG, "Event 0x%02X truncated to %u bytes", msgBytes[0], (sizeof(BusCAN::Frame_t) - 1));
+        msgBytes.resize((sizeof(BusCAN::Frame_t) - 1));
+    }
+
     BusCAN::Frame_t frame;
     frame.cmd = CMD_SEND_EVENT;
     std::copy(msgBytes.begin(), msgBytes.end(), frame.args);
     uint8_t size = msgBytes.size() + 1;
-    BusCAN::write(&frame, _id, size);
+    BusCAN::write(&frame, _id, size, priority);
 }
 
 /**
@@ -87,14 +116,14 @@ void Slave::sendError(uint8_t errorCode)
     BusCAN::Frame_t frame;
     frame.cmd = CMD_SEND_ERROR;
     frame.args[0] = errorCode;
-    BusCAN::write(&frame, _id, 1);
+    BusCAN::write(&frame, _id, 1, BusCAN::PRIORITY_EMERGENCY);
 }
 
 void Slave::_busRsTask(void *pvParameters) 
 {
-    BusRS::Frame_t frame;
-    frame.length = 1024;
-    frame.data = (uint8_t*)malloc(frame.length);
+    BusRS::Frame_t frame = {};
+    frame.length = BUS_RS_DATA_LENGTH_MAX;
+    frame.data = BusRS::allocBuffer();
     while (1) {
         if (BusRS::read(&frame, portMAX_DELAY) < 0) {
             Led::blink(LED_RED, 1000); // Error
@@ -180,13 +209,61 @@ void Slave::_busRsTask(void *pvParameters)
                 }
                 break;
             }
+            case CMD_FLASH_LOADER_DEFL_BEGIN:
+            {
+                if (frame.id == _id) {
+                    frame.error = (FlashLoader::beginDeflate() < 0);
+                    frame.dir = 0;
+                    frame.ack = false;
+                    frame.length = 0;
+                    BusRS::write(&frame);
+                }
+                break;
+            }
+            case CMD_FLASH_LOADER_DEFL_WRITE:
+            {
+                if (frame.id == _id) {
+                    frame.error = (FlashLoader::writeDeflate(frame.data, frame.length) < 0);
+                    frame.dir = 0;
+                    frame.ack = false;
+                    frame.length = 0;
+                    BusRS::write(&frame);
+                }
+                break;
+            }
+            case CMD_FLASH_LOADER_CHUNK:
+            {
+                /* Sent without answer, to this module or to all the modules being programmed */
+                if (((frame.id == _id) || (frame.id == 0)) && FlashLoader::isActive() && 
+                    (frame.length > sizeof(uint32_t))) {
+                    uint32_t offset;
+                    memcpy(&offset, frame.data, sizeof(uint32_t));
+                    FlashLoader::write(offset, &frame.data[sizeof(uint32_t)], frame.length - sizeof(uint32_t));
+                }
+                break;
+            }
+            case CMD_FLASH_LOADER_STATUS:
+            {
+                if ((frame.id == _id) && (frame.length >= sizeof(uint32_t))) {
+                    uint32_t end;
+                    uint32_t status[2]; // Cumulative offset, chunks missing after it
+                    memcpy(&end, frame.data, sizeof(uint32_t));
+                    frame.error = (FlashLoader::getStatus(end, &status[0], &status[1]) < 0);
+                    frame.dir = 0;
+                    frame.ack = false;
+                    frame.length = sizeof(status);
+                    memcpy(frame.data, status, sizeof(status));
+                    BusRS::write(&frame);
+                }
+                break;
+            }
             case CMD_FLASH_LOADER_CHECK:
             {
                 if (frame.id == _id) {
                     uint8_t md5Sum[16];
                     size_t progSize;
                     memcpy(&progSize, frame.data, sizeof(progSize));
-                    FlashLoader::check(md5Sum, progSize);
+                    frame.error = (FlashLoader::check(md5Sum, progSize) < 0);
                     frame.dir = 0;
                     frame.ack = false;
                     frame.length = 16;
@@ -241,6 +318,156 @@ void Slave::_busRsTask(void *pvParameters)
 
                 break;
             }
+            case CMD_RUN_CALLBACK_BATCH:
+            {
+                if (frame.id == _id) {
+                    /* Answers are written in the frame buffer, keep a copy of the requests */
+                    std::vector<uint8_t> requests(frame.data, frame.data + frame.length);
+                    std::vector<uint8_t> msg;
+                    size_t index = 0;
+                    size_t length = 0;
+                    uint16_t size;
+
+                    while (index + 2 <= requests.size()) {
+                        memcpy(&size, &requests[index], sizeof(uint16_t));
+                        if ((size == 0) || (index + 2 + size > requests.size())) {
+                            frame.error = 1;
+                            ESP_LOGW(TAG, "Invalid batch record");
+                            break;
+                        }
+                        msg.assign(&requests[index + 2], &requests[index + 2 + size]);
+                        index += 2 + size;
+
+                        auto it = _callbacks.find(msg[0]);
+                        if (it != _callbacks.end()) {
+                            (*it).second(msg);
+                        } else {
+                            frame.error = 1;
+                            ESP_LOGW(TAG, "Callback does not exist: %d", msg[0]);
+                            msg.clear();
+                        }
+
+                        if (length + 2 > BUS_RS_DATA_LENGTH_MAX) {
+                            frame.error = 1;
+                            continue;
+                        }
+                        if (length + 2 + msg.size() > BUS_RS_DATA_LENGTH_MAX) {
+                            frame.error = 1;
+                            ESP_LOGW(TAG, "Batch answer does not fit in the frame");
+                            msg.clear();
+                        }
+                        size = msg.size();
+                        memcpy(&frame.data[length], &size, sizeof(uint16_t));
+                        memcpy(&frame.data[length + 2], msg.data(), size);
+                        length += 2 + size;
+                    }
+
+                    if (frame.ack == true) {
+                        frame.dir = 0;
+                        frame.ack = false;
+                        frame.length = length;
+                        BusRS::write(&frame);
+                    }
+                }
+                break;
+            }
+            case CMD_GET_CAPABILITIES:
+            {
+                if (frame.id == _id) {
+                    ESP_LOGI(TAG, "Get capabilities, master protocol v%u", frame.data[0]);
+                    _masterCapabilities = (frame.length >= 2) ? frame.data[1] : 0;
+
+                    frame.dir = 0;
+                    frame.ack = false;
+                    frame.length = 2;
+                    frame.data[0] = BUS_RS_PROTOCOL_VERSION;
+                    frame.data[1] = BusRS::getCapabilities();
+                    BusRS::write(&frame);
+                }
+                break;
+            }
+            case CMD_GET_BAUD_RATES:
+            {
+                if (frame.id == _id) {
+                    frame.dir = 0;
+                    frame.ack = false;
+                    frame.length = 2;
+                    frame.data[0] = BusRS::getBaudRates();
+                    frame.data[1] = BusRS::getBaudRateIndex();
+                    BusRS::write(&frame);
+                }
+                break;
+            }
+            case CMD_GET_BUS_STATS:
+            {
+                if (frame.id == _id) {
+                    Bus::BusStats_t stats;
+                    Bus::getBusStats(&stats);
+                    frame.dir = 0;
+                    frame.ack = false;
+                    frame.length = 1 + sizeof(Bus::BusStats_t);
+                    frame.data[0] = BUS_STATS_VERSION;
+                    memcpy(&frame.data[1], &stats, sizeof(Bus::BusStats_t));
+                    BusRS::write(&frame);
+                }
+                break;
+            }
+            case CMD_ECHO:
+            {
+                if ((frame.id == _id) && (frame.ack == true)) {
+                    frame.dir = 0;
+                    frame.ack = false;
+                    BusRS::write(&frame);
+                }
+                break;
+            }
+            case CMD_PROCESS_IMAGE:
+            {
+                if (frame.id == _id) {
+                    std::vector<uint8_t> entry;
+                    
+                    /* Apply the output entries: [id, length, data...] */
+                    size_t index = 0;
+                    while (index + 2 <= frame.length) {
+                        uint8_t imageId = frame.data[index];
+                        uint8_t length = frame.data[index + 1];
+                        if (index + 2 + length > frame.length) {
+                            ESP_LOGW(TAG, "Truncated process image entry: 0x%02X", imageId);
+                            break;
+                        }
+                        auto it = _processImages.find(imageId);
+                        if ((it != _processImages.end()) && (it->second.second != NULL)) {
+                            entry.assign(&frame.data[index + 2], &frame.data[index + 2 + length]);
+                            it->second.second(entry);
+                        }
+                        index += 2 + length;
+                    }
+
+                    /* Answer with the input entries */
+                    if (frame.ack == true) {
+                        frame.dir = 0;
+                        frame.ack = false;
+                        frame.length = 0;
+                        for (auto &it : _processImages) {
+                            if (it.second.first == NULL) {
+                                continue;
+                            }
+                            entry.clear();
+                            it.second.first(entry);
+                            if ((entry.size() > 0xFF) || (frame.length + 2 + entry.size() > BUS_RS_DATA_LENGTH_MAX)) {
+                                ESP_LOGW(TAG, "Process image entry 0x%02X does not fit in the frame", it.first);
+                                continue;
+                            }
+                            frame.data[frame.length] = it.first;
+                            frame.data[frame.length + 1] = (uint8_t)entry.size();
+                            memcpy(&frame.data[frame.length + 2], entry.data(), entry.size());
+                            frame.length += 2 + entry.size();
+                        }
+                        BusRS::write(&frame);
+                    }
+                }
+                break;
+            }
             case CMD_LED_CTRL:
             {
                 LedState_t state;
@@ -285,7 +512,18 @@ void Slave::_busRsTask(void *pvParameters)
                     eventConfig.eventArg = frame.data[3];
                     eventConfig.callbackId = frame.data[4];
                     eventConfig.callbackArgs = std::vector<uint8_t>(frame.data + 5, frame.data + frame.length);
-                    _eventCallbackConfigs.push_back(eventConfig); // Store the event callback config
+                    /* Registered again by the master after a restart: the arguments are replaced */
+                    auto it = std::find_if(_eventCallbackConfigs.begin(), _eventCallbackConfigs.end(), 
+                        [&](const EventCallbackConfig_s &config) {
+                            return (config.moduleId == eventConfig.moduleId) && (config.eventId == eventConfig.eventId) && 
+                                (config.eventArg == eventConfig.eventArg) && (config.callbackId == eventConfig.callbackId);
+                        });
+                    if (it != _eventCallbackConfigs.end()) {
+                        it->callbackArgs = eventConfig.callbackArgs;
+                    } else {
+                        _eventCallbackConfigs.push_back(eventConfig); // Store the event callback config
+                    }
+                    _updateCanFilter();
                 }
                 break;
             }
@@ -294,7 +532,7 @@ void Slave::_busRsTask(void *pvParameters)
             }
         }
     }
-    free(frame.data);
+    BusRS::freeBuffer(frame.data);
     frame.data = NULL;
 }
 
@@ -303,24 +541,49 @@ void Slave::_busCanTask(void *pvParameters)
     BusCAN::Frame_t frame;
     uint16_t id;
     uint8_t size;
+    int fallbackIndex = -1; // Baud rate restored if the master does not confirm the new one
+    TickType_t fallbackTick = 0;
 
     while (1) {
-        if (BusCAN::read(&frame, &id, &size) != -1) { 
+        TickType_t timeout = portMAX_DELAY;
+        if (fallbackIndex >= 0) {
+            TickType_t elapsed = xTaskGetTickCount() - fallbackTick;
+            TickType_t probation = pdMS_TO_TICKS(BUS_RS_BAUD_PROBATION);
+            timeout = (elapsed < probation) ? (probation - elapsed) : 0;
+            if (timeout == 0) {
+                ESP_LOGW(TAG, "Baud rate not confirmed, back to %lu", BusRS::getBaudRate(fallbackIndex));
+                BusRS::setBaudRate(fallbackIndex);
+                fallbackIndex = -1;
+                continue;
+            }
+        }
+        if (BusCAN::read(&frame, &id, &size, timeout) != -1) { 
             switch (frame.cmd)
             {
-                case CMD_SEND_EVENT:
-                {                    
-                    for (auto it = _eventCallbackConfigs.begin(); it != _eventCallbackConfigs.end(); ++it) {
-                        if ((it->moduleId == id) && 
-                            (it->eventId == frame.args[0]) &&
-                            (it->eventArg == frame.args[1])) {
-                                auto callbackIt = _eventCallbacks.find(it->callbackId);
-                                if (callbackIt != _eventCallbacks.end()) {
-                                    callbackIt->second(it->callbackArgs);
-                                }
+                case CMD_SET_BAUD_RATE:
+                {
+                    /* args: rate index, probation (the rate is reverted unless it is sent again without it) */
+                    if ((id == 0) && (size >= 3) && (frame.args[0] < BUS_RS_BAUD_RATES_NB)) {
+                        if (frame.args[1] && (frame.args[0] != BusRS::getBaudRateIndex())) {
+                            fallbackIndex = BusRS::getBaudRateIndex();
+                            fallbackTick = xTaskGetTickCount();
+                        } else {
+                            fallbackIndex = -1;
                         }
+                        BusRS::setBaudRate(frame.args[0]);
                     }
-
+                    break;
+                }
+                case CMD_SET_CAN_PRIORITY:
+                {
+                    if ((id == 0) && (size >= 2)) {
+                        BusCAN::setPriorityIds(frame.args[0] != 0);
+                    }
+                    break;
+                }
+                case CMD_SEND_EVENT:
+                {                    
+                    _handleEvent(id, frame.args);
                     break;
                 }
                 default:
@@ -330,9 +593,89 @@ void Slave::_busCanTask(void *pvParameters)
     }
 }
 
+/**
+ * @brief Run the callbacks registered for an event of another module
+ * 
+ * @param id Module which sent the event
+ * @param args Event ID, event argument, ...
+ */
+void Slave::_handleEvent(uint16_t id, uint8_t* args)
+{
+    for (auto it = _eventCallbackConfigs.begin(); it != _eventCallbackConfigs.end(); ++it) {
+        if ((it->moduleId == id) && 
+            (it->eventId == args[0]) &&
+            (it->eventArg == args[1])) {
+                auto callbackIt = _eventCallbacks.find(it->callbackId);
+                if (callbackIt != _eventCallbacks.end()) {
+                    callbackIt->second(it->callbackArgs);
+                }
+        }
+    }
+}
+
+/**
+ * @brief Only receive the CAN frames of the master and of the modules whose events are subscribed
+ */
+void Slave::_updateCanFilter(void)
+{
+    std::vector<uint16_t> ids = {0};
+    for (auto &config : _eventCallbackConfigs) {
+        ids.push_back(config.moduleId);
+    }
+    BusCAN::setFilter(ids);
+}
+
+/**
+ * @brief Arbitration priority of the events, the safety related ones win the bus.
+ * The event ids are only unique for a type of module.
+ * 
+ * @param eventId 
+ * @return BusCAN::Priority_e 
+ */
+BusCAN::Priority_e Slave::_eventPriority(uint8_t eventId)
+{
+    switch (eventId)
+    {
+#if defined(CONFIG_OI_STEPPER) || defined(CONFIG_OI_STEPPER_VE)
+        case EVENT_MOTOR_READY: // Same value as EVENT_OVERCURRENT, the steppers have no protected outputs
+            return BusCAN::PRIORITY_MOTION;
+        case EVENT_MOTOR_FLAG_INTERRUPT:
+            return BusCAN::PRIORITY_EMERGENCY;
+#else
+        case EVENT_OVERCURRENT:
+            return BusCAN::PRIORITY_EMERGENCY;
+#endif
+        case EVENT_DIGITAL_INTERRUPT: // Limit switches, motor stops
+            return BusCAN::PRIORITY_MOTION;
+        case EVENT_MOTOR_DC_CURRENT:
+        case EVENT_SENSOR_VALUE:
+        case EVENT_SENSOR_VALUE_MILLIVOLT:
+        case EVENT_SENSOR_VALUE_RESISTANCE:
+        case EVENT_SENSOR_VALUE_TEMPERATURE:
+        case EVENT_SENSOR_VALUE_RAW:
+            return BusCAN::PRIORITY_TELEMETRY;
+        default:
+            return BusCAN::PRIORITY_IO;
+    }
+}
+
+/**
+ * @brief Send the state and the uptime of the module on the CAN bus, the master detects 
+ * a lost module when they stop and a restarted module when the uptime goes backwards
+ */
 void Slave::_heartbeatTask(void *pvParameters)
 {
-    /** @todo Send heartbeat periodically */
+    BusCAN::Frame_t frame;
+    TickType_t lastWakeTime = xTaskGetTickCount();
+
+    while (1) {
+        uint32_t uptime = (uint32_t)(esp_timer_get_time() / 1000);
+        frame.cmd = CMD_HEARTBEAT;
+        frame.args[0] = (uint8_t)_state;
+        memcpy(&frame.args[1], &uptime, sizeof(uint32_t));
+        BusCAN::write(&frame, _id, 1 + 1 + sizeof(uint32_t), BusCAN::PRIORITY_TELEMETRY);
+        vTaskDelayUntil(&lastWakeTime, pdMS_TO_TICKS(BUS_CAN_HEARTBEAT_PERIOD));
+    }
 }
 
 #endif
\ No newline at end of file
@@ -41,8 +41,22 @@ public:
         _eventCallbacks.insert({callbackId, callback});
     }
 
+    /**
+     * @brief Declare an entry of the process image exchanged cyclically with the master
+     * 
+     * @param imageId Process image entry (see ProcessImage_e)
+     * @param input Called at each cycle to append the entry bytes sent to the master, can be NULL
+     * @param output Called with the entry bytes received from the master, can be NULL
+     */
+    static inline void addProcessImage(uint8_t imageId, 
+        std::function<void(std::vector<uint8_t> &)> input, 
+        std::function<void(std::vector<uint8_t> &)> output = NULL) {
+        _processImages.insert({imageId, std::make_pair(input, output)});
+    }
+
 protected:
     static uint16_t _id;
+    static uint8_t _masterCapabilities; // Sent by the master with CMD_GET_CAPABILITIES
 
 private:
     static State_e _state;
@@ -52,11 +66,17 @@ private:
     static std::list<std::function<void(void)>> _resetCallbacks;
     static std::map<uint8_t, std::function<void(std::vector<uint8_t> &)>> _eventCallbacks;
     static std::vector<EventCallbackConfig_s> _eventCallbackConfigs;
+    static std::map<uint8_t, std::pair<std::function<void(std::vector<uint8_t> &)>, 
+        std::function<void(std::vector<uint8_t> &)>>> _processImages; // Input and output handlers
 
     static void _busRsTask(void *pvParameters);
     static void _busCanTask(void *pvParameters);
     static void _heartbeatTask(void *pvParameters);
 
+    static void _updateCanFilter(void);
+    static void _handleEvent(uint16_t id, uint8_t* args);
+    static BusCAN::Priority_e _eventPriority(uint8_t eventId);
+
     static int _registerCLI(void);
 };
 
@@ -36,6 +36,19 @@ enum BusCmd_e {
     CMD_SEND_ERROR              = (uint8_t) 0x12,
     CMD_REGISTER_EVENT_CALLBACK = (uint8_t) 0x13,
     CMD_GET_SLAVE_ID            = (uint8_t) 0x14,
+    CMD_GET_CAPABILITIES        = (uint8_t) 0x15,
+    CMD_PROCESS_IMAGE           = (uint8_t) 0x16,
+    CMD_RUN_CALLBACK_BATCH      = (uint8_t) 0x17,
+    CMD_SET_BAUD_RATE           = (uint8_t) 0x18, // Sent on the CAN bus, the RS bus can be out of sync
+    CMD_GET_BAUD_RATES          = (uint8_t) 0x19,
+    CMD_ECHO                    = (uint8_t) 0x1A,
+    CMD_FLASH_LOADER_CHUNK      = (uint8_t) 0x1B, // Chunk of a windowed transfer, may be broadcast: [offset (4 bytes), data]
+    CMD_FLASH_LOADER_STATUS     = (uint8_t) 0x1C, // [end (4 bytes)], answer: [cumulative offset (4 bytes), missing chunks (4 bytes)]
+    CMD_FLASH_LOADER_DEFL_BEGIN = (uint8_t) 0x1D, // Start of a zlib compressed image
+    CMD_FLASH_LOADER_DEFL_WRITE = (uint8_t) 0x1E, // Next block of the compressed image
+    CMD_SET_CAN_PRIORITY        = (uint8_t) 0x1F, // Sent on the CAN bus by the master: [enable]
+    CMD_CAN_SEGMENT             = (uint8_t) 0x20, // Segment of a CAN message longer than one frame (BUS_CAN_SEGMENT_CMD)
+    CMD_GET_BUS_STATS           = (uint8_t) 0x21, // Answer: [version, Bus::BusStats_t]
 };
 
 /**
@@ -57,6 +70,17 @@ enum Callback_e {
     CALLBACK_SET_OVERCURRENT_THRESHOLD      = 0x0A,
     CALLBACK_ATTACH_OVERCURRENT_CALLBACK    = 0x0B,
     CALLBACK_DETACH_OVERCURRENT_CALLBACK    = 0x0C,
+    CALLBACK_DIGITAL_CAPTURE_EVENTS         = 0x0D,
+    CALLBACK_DIGITAL_READ_EVENTS            = 0x0E,
+    CALLBACK_DIGITAL_ATTACH_COUNTER         = 0x0F,
+    CALLBACK_DIGITAL_DETACH_COUNTER         = 0x10,
+    CALLBACK_DIGITAL_GET_COUNT              = 0x11,
+    CALLBACK_DIGITAL_RESET_COUNT            = 0x12,
+    CALLBACK_DIGITAL_GET_FREQUENCY          = 0x13,
+    CALLBACK_DIGITAL_GET_PERIOD             = 0x14,
+    CALLBACK_SET_OVERCURRENT_RETRY          = 0x15,
+    CALLBACK_GET_OVERCURRENT_VALUE          = 0x16,
+    CALLBACK_SIMULATE_OVERCURRENT           = 0x17,
 
     /* ANALOG */
     CALLBACK_ANALOG_INPUT_MODE              = 0x20,
@@ -70,6 +94,10 @@ enum Callback_e {
     CALLBACK_ANALOG_READ_MILLIAMP           = 0x28,
     CALLBACK_ANALOG_OUTPUT_MODE             = 0x29,
     CALLBACK_ANALOG_WRITE                   = 0x2A,
+    CALLBACK_ANALOG_CAPTURE_START           = 0x2B,
+    CALLBACK_ANALOG_CAPTURE_STOP            = 0x2C,
+    CALLBACK_ANALOG_CAPTURE_STATUS          = 0x2D,
+    CALLBACK_ANALOG_CAPTURE_READ            = 0x2E,
 
     /* STEPPER MOTOR */
     CALLBACK_MOTOR_STOP                     = 0x40,
@@ -131,6 +159,26 @@ enum Callback_e {
     CALLBACK_SENSOR_READ_RAW                = 0xB6,
 };
 
+/**
+ * @brief Process image entry enumeration
+ * 
+ */
+enum ProcessImage_e {
+    /* DIGITAL */
+    IMAGE_DIGITAL_INPUTS                    = 0x00, // Input: uint16_t levels bitmask
+    IMAGE_DIGITAL_OUTPUTS                   = 0x01, // Output: uint8_t per output (bit 7: driven, bit 0: level)
+
+    /* ANALOG */
+    IMAGE_ANALOG_INPUTS_MILLIVOLT           = 0x20, // Input: float per channel
+
+    /* STEPPER MOTOR */
+    IMAGE_MOTOR_POSITION                    = 0x40, // Input: int32_t per motor
+    IMAGE_MOTOR_STATUS                      = 0x41, // Input: MotorStepperStatus_t per motor
+
+    /* ENCODER */
+    IMAGE_ENCODER_PULSES                    = 0x80, // Input: int32_t per encoder instance
+};
+
 /**
  * @brief Event enumeration
  * 
@@ -138,7 +186,7 @@ enum Callback_e {
 enum Event_e {
     /* DIGITAL */
     EVENT_DIGITAL_INTERRUPT                 = 0x00,
-    EVENT_OVERCURRENT                       = 0x01,
+    EVENT_OVERCURRENT                       = 0x01, // Args: DOut_Num_t, float current (A)
 
     /* MOTOR */
     EVENT_MOTOR_READY                       = 0x01,
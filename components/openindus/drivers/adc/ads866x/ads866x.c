@@ -1,3 +1,4 @@
+#include <string.h>
 #include "ads866x.h"
 
 static const char ADS866x_TAG[] = "Ads866x";
@@ -11,6 +12,27 @@ static bool s_spi_initialized = false;
 static bool s_gpio_initialized = false;
 static bool s_device_configured = false;
 static bool* adc_channels_PD = NULL;
+static SemaphoreHandle_t s_mutex = NULL; // Recursive, every register access and frame is sent with it
+static uint8_t s_scan_mask = 0; // Sequence programmed for the last scan, 0 if unknown
+static spi_transaction_t s_scan_trans[ADS866X_SCAN_QUEUE_SIZE];
+static bool s_stream_running = false;
+static int s_stream_pending = 0; // Frames queued to the SPI driver during a stream
+
+/* A running stream keeps the device: the other tasks are refused instead of waiting for its end */
+static bool ads866x_lock(void)
+{
+    if (s_stream_running && (xSemaphoreGetMutexHolder(s_mutex) != xTaskGetCurrentTaskHandle())) {
+        ESP_LOGE(ADS866x_TAG, "Device is busy with a stream");
+        return false;
+    }
+    xSemaphoreTakeRecursive(s_mutex, portMAX_DELAY);
+    return true;
+}
+
+static void ads866x_unlock(void)
+{
+    xSemaphoreGiveRecursive(s_mutex);
+}
 
 static int ads866x_gpio_init(void)
 {
@@ -75,7 +97,7 @@ static int ads866x_spi_init(void)
                 .input_delay_ns = 0,
                 .spics_io_num = s_config->spi_pin_cs,
                 .flags = 0,
-                .queue_size = 1,
+                .queue_size = ADS866X_SCAN_QUEUE_SIZE,
                 .pre_cb = NULL,
                 .post_cb = NULL
             };
@@ -102,6 +124,7 @@ int ads866x_init(ads866x_config_t *config)
     s_device_configured = true;
 
     adc_channels_PD = (bool*)calloc(s_config->adc_channel_nb, sizeof(bool));
+    s_mutex = xSemaphoreCreateRecursiveMutex();
 
     ads866x_gpio_init();
     ads866x_spi_init();
@@ -116,8 +139,12 @@ uint16_t ads866x_analog_read(uint8_t channel)
 
     if (s_device_configured) {
         if (channel < s_config->adc_channel_nb) {
+            if (!ads866x_lock()) {
+                return 0;
+            }
             ads866x_manual_channel_select(channel);
             res = ads866x_noOp();
+            ads866x_unlock();
 
             // Puts result in 12 bits format - Cf datasheet ADS8664 Block Table 4 - Page 56
             res = res >> 4;
@@ -130,6 +157,177 @@ uint16_t ads866x_analog_read(uint8_t channel)
     return res;
 }
 
+static int ads866x_sequence_start(uint8_t channels_mask)
+{
+    if (!s_device_configured || !s_spi_initialized) {
+        ESP_LOGE(ADS866x_TAG, "Device is not configured !!!");
+        return -1;
+    }
+
+    if ((channels_mask == 0) || (channels_mask >> s_config->adc_channel_nb) != 0) {
+        ESP_LOGE(ADS866x_TAG, "Invalid scan of channels 0x%02x", channels_mask);
+        return -1;
+    }
+
+    /* Power up the channels of the sequence which are powered down, the others are left to their owner */
+    uint8_t channels_PD = 0;
+    for (size_t i = 0; i < s_config->adc_channel_nb; i++) {
+        channels_PD |= (adc_channels_PD[i] ? (1 << i) : 0);
+    }
+    if ((channels_PD & channels_mask) != 0) {
+        ads866x_set_channels_power_down(channels_PD & ~channels_mask);
+        vTaskDelay(ADS866X_CHANNEL_POWER_UP_DELAY / portTICK_PERIOD_MS);
+    }
+
+    /* Program the sequence only when it changes */
+    if (channels_mask != s_scan_mask) {
+        ads866x_set_channels_sequence(channels_mask);
+        s_scan_mask = channels_mask;
+    }
+
+    /* The frame following AUTO_RST samples the first channel of the sequence */
+    ads866x_auto_reset();
+
+    return 0;
+}
+
+static int ads866x_queue_frame(spi_transaction_t *trans)
+{
+    /* NOP frame (zero tx data) moves to the next channel */
+    memset(trans, 0, sizeof(spi_transaction_t));
+    trans->flags = SPI_TRANS_USE_TXDATA | SPI_TRANS_USE_RXDATA;
+    trans->length = 32;
+    trans->rxlength = 32;
+    return (spi_device_queue_trans(s_spi_handler, trans, portMAX_DELAY) == ESP_OK) ? 0 : -1;
+}
+
+static uint16_t ads866x_get_frame(spi_transaction_t **trans)
+{
+    spi_transaction_t *result = NULL;
+    spi_device_get_trans_result(s_spi_handler, &result, portMAX_DELAY);
+    if (trans != NULL) {
+        *trans = result;
+    }
+    uint32_t res = result->rx_data[0] << 24 | result->rx_data[1] << 16 | result->rx_data[2] << 8 | result->rx_data[3];
+    // Same correction and 12 bits format as ads866x_analog_read
+    return ((uint16_t)(res >> 1)) >> 4;
+}
+
+int ads866x_scan(uint8_t channels_mask, uint16_t samples, uint16_t *buffer)
+{
+    if (buffer == NULL) {
+        return -1;
+    }
+
+    int err = 0;
+    size_t total = (size_t)samples * __builtin_popcount(channels_mask);
+    size_t queued = 0;
+    size_t done = 0;
+
+    if (!ads866x_lock()) {
+        return -1;
+    }
+
+    if (ads866x_sequence_start(channels_mask) != 0) {
+        ads866x_unlock();
+        return -1;
+    }
+
+    while (done < total) {
+        /* Keep the queue full */
+        while ((err == 0) && (queued < total) && (queued - done < ADS866X_SCAN_QUEUE_SIZE)) {
+            err = ads866x_queue_frame(&s_scan_trans[queued % ADS866X_SCAN_QUEUE_SIZE]);
+            if (err == 0) {
+                queued++;
+            }
+        }
+
+        if (done == queued) {
+            break; // Nothing left in the queue after an error
+        }
+
+        buffer[done++] = ads866x_get_frame(NULL);
+    }
+
+    s_ads866x_mode = ADS866X_MODE_AUTO;
+
+    ads866x_unlock();
+
+    if (err != 0) {
+        ESP_LOGE(ADS866x_TAG, "Failed to queue scan transactions");
+    }
+    return err;
+}
+
+int ads866x_stream_start(uint8_t channels_mask)
+{
+    if (!ads866x_lock()) {
+        return -1;
+    }
+
+    if (ads866x_sequence_start(channels_mask) != 0) {
+        ads866x_unlock();
+        return -1;
+    }
+
+    s_stream_pending = 0;
+    for (int i = 0; i < ADS866X_SCAN_QUEUE_SIZE; i++) {
+        if (ads866x_queue_frame(&s_scan_trans[i]) != 0) {
+            break;
+        }
+        s_stream_pending++;
+    }
+
+    if (s_stream_pending == 0) {
+        ESP_LOGE(ADS866x_TAG, "Failed to queue stream transactions");
+        ads866x_unlock();
+        return -1;
+    }
+
+    s_ads866x_mode = ADS866X_MODE_AUTO;
+    s_stream_running = true;
+
+    /* The mutex is kept until ads866x_stream_stop() */
+    return 0;
+}
+
+int ads866x_stream_read(uint16_t *buffer, size_t count)
+{
+    if (!s_stream_running || (buffer == NULL)) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        spi_transaction_t *result = NULL;
+        buffer[i] = ads866x_get_frame(&result);
+
+        /* Queue the frame again right away so that the bus never idles */
+        if (ads866x_queue_frame(result) != 0) {
+            s_stream_pending--;
+            ESP_LOGE(ADS866x_TAG, "Failed to queue stream transactions");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void ads866x_stream_stop(void)
+{
+    if (!s_stream_running) {
+        return;
+    }
+
+    /* Drain the frames still in flight */
+    while (s_stream_pending > 0) {
+        ads866x_get_frame(NULL);
+        s_stream_pending--;
+    }
+
+    s_stream_running = false;
+    ads866x_unlock();
+}
+
 float ads866x_get_voltage_reference(void)
 {
     return s_ads866x_voltage_reference;
@@ -148,6 +346,7 @@ uint16_t ads866x_noOp(void)
 uint16_t ads866x_reset(void)
 {
     ESP_LOGI(ADS866x_TAG, "Reset ads866x.");
+    s_scan_mask = 0;
     return ads866x_spi_write_command_register(ADS866X_CMD_RST);
 }
 
@@ -193,11 +392,13 @@ uint16_t ads866x_manual_channel_select(uint8_t channel)
 
 void ads866x_set_channels_sequence(uint8_t channels_on)
 {
+    s_scan_mask = 0;
     ads866x_spi_write_register(AUTO_SEQ_EN, channels_on);
 }
 
 void ads866x_set_channels_power_down(uint8_t channels_off)
 {
+    s_scan_mask = 0;
     for (size_t i = 0; i < s_config->adc_channel_nb; i++) {
         adc_channels_PD[i] = (bool)((channels_off >> i) & 1);
     }
@@ -232,9 +433,13 @@ uint8_t ads866x_get_device_id(void)
 void ads866x_set_device_id(uint8_t id)
 {
     uint8_t reg = 0;
+    if (!ads866x_lock()) {
+        return;
+    }
     reg = ads866x_get_feature_select();
     reg = (reg & 0b00010111) | ((id & 0b11) << 6);
     ads866x_spi_write_register(FT_SEL, reg);
+    ads866x_unlock();
 }
 
 bool ads866x_get_alarm(void)
@@ -245,9 +450,13 @@ bool ads866x_get_alarm(void)
 void ads866x_set_alarm(bool alarm)
 {
     uint8_t reg = 0;
+    if (!ads866x_lock()) {
+        return;
+    }
     reg = ads866x_get_feature_select();
     reg = (reg & 0b11000111) | ((alarm == true) << 4);
     ads866x_spi_write_register(FT_SEL, reg);
+    ads866x_unlock();
 }
 
 uint8_t ads866x_get_sdo(void)
@@ -258,9 +467,13 @@ uint8_t ads866x_get_sdo(void)
 void ads866x_set_sdo(uint8_t sdo)
 {
     uint8_t reg = 0;
+    if (!ads866x_lock()) {
+        return;
+    }
     reg = ads866x_get_feature_select();
     reg = (reg & 0b11010000) | (sdo & 0b111);
     ads866x_spi_write_register(FT_SEL, reg);
+    ads866x_unlock();
 }
 
 uint8_t ads866x_get_feature_select(void)
@@ -490,9 +703,13 @@ esp_err_t ads866x_spi_write_register(uint8_t reg, uint8_t value)
             .rx_buffer = NULL
         };
 
+        if (!ads866x_lock()) {
+            return ESP_ERR_INVALID_STATE;
+        }
         ESP_ERROR_CHECK(spi_device_polling_transmit(s_spi_handler, &trans));
 
         s_ads866x_mode = ADS866X_MODE_PROG;
+        ads866x_unlock();
     } else {
         ESP_LOGE(ADS866x_TAG, "SPI is not initialized !!!");
     }
@@ -502,7 +719,7 @@ esp_err_t ads866x_spi_write_register(uint8_t reg, uint8_t value)
 uint8_t ads866x_spi_read_program_register(uint8_t reg)
 {
     uint8_t txBuffer[3] = {((reg << 1) | 0x00), 0x00, 0x00};
-    uint8_t rxBuffer[3];
+    uint8_t rxBuffer[3] = {0x00, 0x00, 0x00};
 
     if (s_spi_initialized == true) {
         spi_transaction_t trans = {
@@ -516,9 +733,13 @@ uint8_t ads866x_spi_read_program_register(uint8_t reg)
             .rx_buffer = &rxBuffer
         };
 
+        if (!ads866x_lock()) {
+            return 0;
+        }
         ESP_ERROR_CHECK(spi_device_polling_transmit(s_spi_handler, &trans));
 
         s_ads866x_mode = ADS866X_MODE_PROG;
+        ads866x_unlock();
     } else {
         ESP_LOGE(ADS866x_TAG, "SPI is not initialized !!!");
     }
@@ -531,30 +752,35 @@ uint8_t ads866x_spi_read_program_register(uint8_t reg)
 uint16_t ads866x_spi_write_command_register(uint8_t reg)
 {
     uint8_t txBuffer[4] = {reg, 0x00, 0x00, 0x00};
-    uint8_t rxBuffer[4];
+    uint8_t rxBuffer[4] = {0x00, 0x00, 0x00, 0x00};
 
-    if (s_spi_initialized == true) {
-        spi_transaction_t trans = {
-            .flags = 0,
-            .cmd = 0,
-            .addr = 0,
-            .length = 16,
-            .rxlength = 16,
-            .user = NULL,
-            .tx_buffer = txBuffer,
-            .rx_buffer = rxBuffer
-        };
+    if (s_spi_initialized != true) {
+        ESP_LOGE(ADS866x_TAG, "SPI is not initialized !!!");
+        return 0;
+    }
 
-        if (s_ads866x_mode > ADS866X_MODE_PROG) {
-            // only 16 bit if POWERDOWN or STDBY or RST or IDLE
-            trans.length = 32;
-        }
+    if (!ads866x_lock()) {
+        return 0;
+    }
 
-        ESP_ERROR_CHECK(spi_device_polling_transmit(s_spi_handler, &trans));
-    } else {
-        ESP_LOGE(ADS866x_TAG, "SPI is not initialized !!!");
+    spi_transaction_t trans = {
+        .flags = 0,
+        .cmd = 0,
+        .addr = 0,
+        .length = 16,
+        .rxlength = 16,
+        .user = NULL,
+        .tx_buffer = txBuffer,
+        .rx_buffer = rxBuffer
+    };
+
+    if (s_ads866x_mode > ADS866X_MODE_PROG) {
+        // only 16 bit if POWERDOWN or STDBY or RST or IDLE
+        trans.length = 32;
     }
 
+    ESP_ERROR_CHECK(spi_device_polling_transmit(s_spi_handler, &trans));
+
     if (s_ads866x_mode == ADS866X_MODE_POWER_DN) {
         vTaskDelay(15 / portTICK_PERIOD_MS);
     }
@@ -587,6 +813,8 @@ uint16_t ads866x_spi_write_command_register(uint8_t reg)
             break;
     }
 
+    ads866x_unlock();
+
     uint32_t res = rxBuffer[0] << 24 | rxBuffer[1] << 16 | rxBuffer[2] << 8 | rxBuffer[3];
 
     return (uint16_t)(res >> 1);    //Correction of the ESP reading which is left shifted by 1 bit
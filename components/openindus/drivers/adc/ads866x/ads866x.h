@@ -19,6 +19,8 @@
 #include "esp_log.h"
 #include "driver/spi_master.h"
 #include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "math.h"
 
@@ -30,6 +32,8 @@ extern "C"
 #define ADS8664_VOLTAGE_REFERENCE (float)4.096
 #define ADS866x_RESOLUTION_BITS  (uint8_t)12
 #define ADS866X_MAX_CHANNELS_NB   (uint8_t)8
+#define ADS866X_SCAN_QUEUE_SIZE   32    // SPI transactions queued during a scan or a stream
+#define ADS866X_CHANNEL_POWER_UP_DELAY  15  // ms, settling of a channel powered up for a scan
 
 // COMMAND REGISTER MAP --------------------------------------------------------------------------------------------
 #define ADS866X_CMD_NO_OP     0x00  // Continue operation in previous mode
@@ -141,6 +145,40 @@ int ads866x_init(ads866x_config_t *config);
  */
 uint16_t ads866x_analog_read(uint8_t channel);
 
+/**
+ * @brief Read several channels with the auto-sequence mode: each frame returns the next enabled channel
+ * The frames are queued to the SPI driver, the calling task waits for them without using the CPU.
+ * Costs 1 + samples x channels transactions, instead of 2 per sample with ads866x_analog_read.
+ * Only the sequence register is programmed, a channel of the mask which is powered down is powered up first.
+ * @param[in] channels_mask : Bit n to read channel n
+ * @param[in] samples : Number of samples per channel
+ * @param[out] buffer : Raw values, samples x channels, channels in ascending order for each sample
+ * @retval 0 if success, -1 otherwise
+ */
+int ads866x_scan(uint8_t channels_mask, uint16_t samples, uint16_t *buffer);
+
+/**
+ * @brief Start a continuous auto-sequence acquisition: frames are re-queued as soon as they complete so the
+ * converter runs back to back at the SPI frame rate. The device is reserved until ads866x_stream_stop(),
+ * meanwhile the reads and register accesses of the other tasks fail.
+ * @param[in] channels_mask : Bit n to read channel n
+ * @retval 0 if success, -1 otherwise
+ */
+int ads866x_stream_start(uint8_t channels_mask);
+
+/**
+ * @brief Wait for the next values of a running stream
+ * @param[out] buffer : Raw values, channels in ascending order, the sequence continues from the previous call
+ * @param[in] count : Number of values to read
+ * @retval 0 if success, -1 otherwise
+ */
+int ads866x_stream_read(uint16_t *buffer, size_t count);
+
+/**
+ * @brief Stop the stream and release the device
+ */
+void ads866x_stream_stop(void);
+
 
 /**
  * @brief Retval analog voltage reference of ads866x
@@ -163,6 +163,192 @@ def test_digital_interrupt(dut, cli):
                 time.sleep(0.5) # Wait to ensure no interrupt is triggered
                 cli.send_command(dout_module_id, f"digital-write {dout_num} 0")
 
+def test_digital_events(dut, cli):
+    """Test timestamped edge capture on digital inputs"""
+
+    # Load wiring configuration
+    config = load_config()
+    digital_io_wiring = config["test_bench"]["wiring"]["digital_io"]
+
+    # Number of edges generated, must fit in the 64 events buffer of the input
+    edges = 20
+
+    # Wait for prompt before starting tests
+    dut.expect(cli.prompt, timeout=10)
+
+    for wiring in digital_io_wiring[:3]:
+        dout_module_id = cli.get_module_id(wiring["module_dout"])
+        dout_num = wiring["dout"]
+        din_module_id = cli.get_module_id(wiring["module_din"])
+        din_num = wiring["din"]
+
+        print(f"Testing events on {wiring['module_dout']}:{dout_num} -> {wiring['module_din']}:{din_num}")
+
+        # Set output mode to digital and start from LOW
+        cli.send_command(dout_module_id, f"output-mode -d {dout_num} -m digital")
+        cli.send_command(dout_module_id, f"digital-write {dout_num} 0")
+        time.sleep(0.1)
+
+        # Start recording all edges
+        cli.send_command(din_module_id, f"capture-events -d {din_num} -m change")
+
+        # Generate edges without waiting between them
+        for _ in range(edges):
+            cli.send_command(dout_module_id, f"toggle-output -d {dout_num}")
+        time.sleep(0.1)
+
+        # Read the recorded events
+        cli.send_command(din_module_id, f"read-events -d {din_num}", wait_for_prompt=False)
+        response = dut.expect(r'(\{"overflows":\d+,"events":\[[^\]]*\]\})', timeout=5)
+        dut.expect(cli.prompt, timeout=5)
+        result = json.loads(response.group(1))
+        events = result["events"]
+
+        assert result["overflows"] == 0, f"{result['overflows']} events lost on {wiring['module_din']}:{din_num}"
+        assert len(events) == edges, f"Expected {edges} events, got {len(events)} on {wiring['module_din']}:{din_num}"
+        for i in range(1, len(events)):
+            assert events[i]["t"] > events[i - 1]["t"], f"Event {i} timestamp is not increasing"
+            assert events[i]["l"] != events[i - 1]["l"], f"Event {i} level does not alternate"
+
+        # Stop recording, the buffer must be empty
+        cli.send_command(din_module_id, f"capture-events -d {din_num} -m none")
+        cli.send_command(din_module_id, f"read-events -d {din_num}", wait_for_prompt=False)
+        response = dut.expect(r'(\{"overflows":\d+,"events":\[[^\]]*\]\})', timeout=5)
+        dut.expect(cli.prompt, timeout=5)
+        assert len(json.loads(response.group(1))["events"]) == 0, "Events recorded after the capture was stopped"
+
+def read_counter(dut, cli, module_id, din_num):
+    """Read the counter of a digital input as a dict"""
+    cli.send_command(module_id, f"read-counter -d {din_num}", wait_for_prompt=False)
+    response = dut.expect(r'(\{"count":-?\d+,"frequency":[\d.]+,"period":[\d.]+\})', timeout=5)
+    dut.expect(cli.prompt, timeout=5)
+    return json.loads(response.group(1))
+
+def test_digital_counter(dut, cli):
+    """Test pulse counting and frequency measurement on digital inputs"""
+
+    # Load wiring configuration
+    config = load_config()
+    digital_io_wiring = config["test_bench"]["wiring"]["digital_io"]
+
+    pwm_freq = 1000
+
+    # Wait for prompt before starting tests
+    dut.expect(cli.prompt, timeout=10)
+
+    for wiring in digital_io_wiring[:3]:
+        # Inputs of the Core are on the IO expander, without hardware counter
+        if wiring["module_din"] == "core":
+            continue
+
+        dout_module_id = cli.get_module_id(wiring["module_dout"])
+        dout_num = wiring["dout"]
+        din_module_id = cli.get_module_id(wiring["module_din"])
+        din_num = wiring["din"]
+
+        print(f"Testing counter on {wiring['module_dout']}:{dout_num} -> {wiring['module_din']}:{din_num}")
+
+        # Count the edges generated by toggling the output
+        cli.send_command(dout_module_id, f"output-mode -d {dout_num} -m digital")
+        cli.send_command(dout_module_id, f"digital-write {dout_num} 0")
+        cli.send_command(din_module_id, f"attach-counter -d {din_num} -e change")
+        cli.send_command(din_module_id, f"reset-counter -d {din_num}")
+        for _ in range(10):
+            cli.send_command(dout_module_id, f"toggle-output -d {dout_num}")
+        time.sleep(0.1)
+        counter = read_counter(dut, cli, din_module_id, din_num)
+        assert counter["count"] == 10, f"Expected 10 pulses, got {counter['count']}"
+
+        # Frequency mode with a PWM signal
+        cli.send_command(dout_module_id, f"output-mode -d {dout_num} -m pwm")
+        cli.send_command(dout_module_id, f"set-pwm-frequency -d {dout_num} -f {pwm_freq}")
+        cli.send_command(dout_module_id, f"set-pwm-duty-cycle -d {dout_num} -c 50.0")
+        cli.send_command(din_module_id, f"attach-counter -d {din_num} -e rising -m frequency -g 500")
+        time.sleep(1.5)
+        counter = read_counter(dut, cli, din_module_id, din_num)
+        assert abs(counter["frequency"] - pwm_freq) <= pwm_freq * 0.02, f"Expected {pwm_freq}Hz, got {counter['frequency']}Hz"
+        assert counter["count"] >= pwm_freq, f"Expected at least {pwm_freq} pulses, got {counter['count']}"
+
+        # Period mode with the same signal
+        cli.send_command(din_module_id, f"attach-counter -d {din_num} -e rising -m period")
+        time.sleep(0.5)
+        counter = read_counter(dut, cli, din_module_id, din_num)
+        expected_period = 1000000.0 / pwm_freq
+        assert abs(counter["period"] - expected_period) <= expected_period * 0.05, f"Expected {expected_period}us, got {counter['period']}us"
+
+        # Restore the output and release the counter
+        cli.send_command(dout_module_id, f"set-pwm-duty-cycle -d {dout_num} -c 0.0")
+        cli.send_command(dout_module_id, f"output-mode -d {dout_num} -m digital")
+        cli.send_command(din_module_id, f"detach-counter -d {din_num}")
+
+def read_din(dut, cli, module_id, din_num):
+    """Read the level of a digital input"""
+    cli.send_command(module_id, f"digital-read {din_num}", wait_for_prompt=False)
+    response = dut.expect(r"(\d+)\s*\n" + cli.prompt, timeout=5)
+    return int(response.group(1))
+
+def test_overcurrent_protection(dut, cli):
+    """Test the detection latency and the retry of the overcurrent protection with a simulated current"""
+
+    # Load wiring configuration
+    config = load_config()
+    digital_io_wiring = config["test_bench"]["wiring"]["digital_io"]
+
+    max_latency_us = 10000
+    retry_delay_s = 1.0
+
+    # Wait for prompt before starting tests
+    dut.expect(cli.prompt, timeout=10)
+
+    for wiring in digital_io_wiring[:3]:
+        # Outputs of the Core only report a flag from the high side switch
+        if wiring["module_dout"] == "core":
+            continue
+
+        dout_module_id = cli.get_module_id(wiring["module_dout"])
+        dout_num = wiring["dout"]
+        din_module_id = cli.get_module_id(wiring["module_din"])
+        din_num = wiring["din"]
+
+        print(f"Testing overcurrent on {wiring['module_dout']}:{dout_num} -> {wiring['module_din']}:{din_num}")
+
+        cli.send_command(dout_module_id, f"output-mode -d {dout_num} -m digital")
+        cli.send_command(dout_module_id, f"set-overcurrent-retry -t {int(retry_delay_s * 1000)} -r 2 -b 2.0")
+        cli.send_command(dout_module_id, f"digital-write {dout_num} 1")
+        assert read_din(dut, cli, din_module_id, din_num) == 1
+
+        # The output is cut within a few milliseconds
+        cli.send_command(dout_module_id, f"simulate-overcurrent -d {dout_num} -c 6.0", wait_for_prompt=False)
+        response = dut.expect(r'(\{"latency_us":-?\d+,"current":[\d.]+\})', timeout=5)
+        dut.expect(cli.prompt, timeout=5)
+        result = json.loads(response.group(1))
+        print(f"Overcurrent detected in {result['latency_us']}us, {result['current']}A")
+        assert 0 <= result["latency_us"] <= max_latency_us, f"Overcurrent detected in {result['latency_us']}us"
+        assert result["current"] > 4.0, f"Expected a current above the threshold, got {result['current']}A"
+        assert read_din(dut, cli, din_module_id, din_num) == 0, "Output not cut"
+
+        # Restored after the retry delay
+        time.sleep(retry_delay_s + 0.2)
+        assert read_din(dut, cli, din_module_id, din_num) == 1, "Output not restored after the retry delay"
+
+        # The delay doubles, then the output stays off after the last retry
+        cli.send_command(dout_module_id, f"simulate-overcurrent -d {dout_num} -c 6.0")
+        time.sleep(retry_delay_s)
+        assert read_din(dut, cli, din_module_id, din_num) == 0, "Output restored before the backoff delay"
+        time.sleep(retry_delay_s + 0.3)
+        assert read_din(dut, cli, din_module_id, din_num) == 1, "Output not restored after the backoff delay"
+        cli.send_command(dout_module_id, f"simulate-overcurrent -d {dout_num} -c 6.0")
+        time.sleep(retry_delay_s * 4 + 0.5)
+        assert read_din(dut, cli, din_module_id, din_num) == 0, "Output restored after the last retry"
+
+        # A write re-enables the output
+        cli.send_command(dout_module_id, f"digital-write {dout_num} 1")
+        assert read_din(dut, cli, din_module_id, din_num) == 1, "Output not re-enabled by a write"
+
+        # Restore default policy
+        cli.send_command(dout_module_id, f"digital-write {dout_num} 0")
+        cli.send_command(dout_module_id, "set-overcurrent-retry -t 5000")
+
 def test_set_pwm_analog_read(dut, cli):
     """Test PWM functionality on digital outputs and analog reading"""
     
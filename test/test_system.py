@@ -9,6 +9,7 @@
 import pytest
 import json
 import os
+import time
 
 def test_init_and_start(dut):
     """Test the initialization and starting of the system"""
@@ -128,4 +129,372 @@ def test_get_slave_info(dut):
         
         # Test get-slave-info command with timestamp flag
         dut.write(f"get-slave-info {module_type} {module_sn} -d")
-        dut.expect(r"\d+", timeout=5)  # Unix timestamp as number
\ No newline at end of file
+        dut.expect(r"\d+", timeout=5)  # Unix timestamp as number
+
+def test_cyclic_exchange(dut):
+    """Test cyclic process image exchange"""
+
+    # Wait for prompt before sending commands
+    dut.expect("Core>", timeout=10)
+
+    # Start the exchange with a 5ms period
+    dut.write("cyclic start -p 5")
+    dut.expect("Core>", timeout=5)
+
+    # Let some cycles run
+    time.sleep(0.5)
+
+    dut.write("cyclic stats")
+    response = dut.expect(r'(\{"running":[^\}]+\})', timeout=5)
+    stats = json.loads(response.group(1))
+
+    assert stats["running"] is True, "Cyclic exchange should be running"
+    assert stats["period"] == 5000, f"Expected a 5000us period, got {stats['period']}"
+    assert stats["cycles"] > 0, "No cycle has been executed"
+    assert stats["errors"] == 0, f"{stats['errors']} slave exchanges failed"
+    assert stats["cycle_max"] >= stats["cycle_min"], "Invalid cycle time statistics"
+
+    # Stop the exchange
+    dut.write("cyclic stop")
+    dut.expect("Core>", timeout=5)
+
+    dut.write("cyclic stats")
+    response = dut.expect(r'(\{"running":[^\}]+\})', timeout=5)
+    stats = json.loads(response.group(1))
+    assert stats["running"] is False, "Cyclic exchange should be stopped"
+
+def test_bus_rs_bench(dut):
+    """Test the transactions per second and the heap operations of the RS bus frame path"""
+
+    # Load the mixed module from config.json
+    config_path = os.path.join(os.path.dirname(__file__), "config.json")
+    with open(config_path, 'r') as f:
+        config = json.load(f)
+    module = next((m for m in config["test_bench"]["modules"] if m["name"] == "mixed"), None)
+    if module is None:
+        pytest.skip("Module 'mixed' not found in configuration")
+
+    # Wait for prompt before sending commands
+    dut.expect("Core>", timeout=10)
+
+    dut.write(f"get-slave-id {module['type']} {module['serial_number']}")
+    response = dut.expect(r"Slave ID: (\d+)", timeout=5)
+    slave_id = int(response.group(1))
+    dut.expect("Core>", timeout=5)
+
+    dut.write(f"bus-rs-bench -i {slave_id} -n 500 -s 64")
+    response = dut.expect(r'(\{"transactions":[^\}]+\})', timeout=30)
+    bench = json.loads(response.group(1))
+    assert bench["errors"] == 0, f"{bench['errors']} echo transactions failed"
+    # Counted only when the heap hooks are enabled
+    if bench["heap_ops"] >= 0:
+        assert bench["heap_ops"] == 0, f"{bench['heap_ops']} heap operations per transaction"
+    # The copies through the heap cannot be faster
+    assert bench["tps"] >= bench["copy_tps"] * 0.95
+
+def test_bus_rs_crc(dut):
+    """Test the CRC protection of the RS bus frames"""
+
+    # Load the mixed module from config.json
+    config_path = os.path.join(os.path.dirname(__file__), "config.json")
+    with open(config_path, 'r') as f:
+        config = json.load(f)
+    module = next((m for m in config["test_bench"]["modules"] if m["name"] == "mixed"), None)
+    if module is None:
+        pytest.skip("Module 'mixed' not found in configuration")
+
+    # Wait for prompt before sending commands
+    dut.expect("Core>", timeout=10)
+
+    # The CRC of the largest frame must be negligible against its transmission time
+    dut.write("bus-rs-crc-bench")
+    response = dut.expect(r'(\{"bytes":[^\}]+\})', timeout=5)
+    bench = json.loads(response.group(1))
+    assert bench["crc_us"] < bench["wire_us"] / 100, f"CRC takes {bench['crc_us']}us for {bench['wire_us']}us on the wire"
+
+    dut.write(f"get-slave-id {module['type']} {module['serial_number']}")
+    response = dut.expect(r"Slave ID: (\d+)", timeout=5)
+    slave_id = int(response.group(1))
+    dut.expect("Core>", timeout=5)
+
+    dut.write("bus-rs-stats --reset")
+    dut.expect("Core>", timeout=5)
+
+    # Two flips in the same bit column of the answer payload cancel out in the XOR checksum
+    dut.write(f"bus-rs-fault -i {slave_id} 64 72")
+    dut.expect("Core>", timeout=5)
+    dut.write(f"run-callback {slave_id} 7 0")  # CALLBACK_DIGITAL_READ
+    dut.expect("Core>", timeout=5)
+
+    dut.write("bus-rs-stats")
+    response = dut.expect(r'(\{"tx_frames":[^\}]+\})', timeout=5)
+    stats = json.loads(response.group(1))
+    assert stats["checksum_errors"] == 1, f"Expected the corrupted frame to be detected, got {stats['checksum_errors']} errors"
+
+    # The bus keeps working after the dropped frame
+    dut.write(f"ping {module['type']} {module['serial_number']}")
+    dut.expect(rf"Ping module: {module['serial_number']} time: \d+ us", timeout=5)
+
+
+def test_bus_rs_baud_rate(dut):
+    """Test the negotiation of the RS bus baud rate"""
+
+    # Load the mixed module from config.json
+    config_path = os.path.join(os.path.dirname(__file__), "config.json")
+    with open(config_path, 'r') as f:
+        config = json.load(f)
+    module = next((m for m in config["test_bench"]["modules"] if m["name"] == "mixed"), None)
+    if module is None:
+        pytest.skip("Module 'mixed' not found in configuration")
+
+    # Wait for prompt before sending commands
+    dut.expect("Core>", timeout=10)
+
+    dut.write("baud-rate")
+    response = dut.expect(r"(\d{6,})\r?\n", timeout=10)
+    baud_rate = int(response.group(1))
+    assert baud_rate >= 921600, f"Unexpected baud rate: {baud_rate}"
+    dut.expect("Core>", timeout=5)
+
+    # The bus works at the negotiated rate
+    dut.write(f"ping {module['type']} {module['serial_number']}")
+    dut.expect(rf"Ping module: {module['serial_number']} time: \d+ us", timeout=5)
+
+    dut.write("bus-rs-rates")
+    response = dut.expect(r'(\{"baud_rate":\d+,"rates":\[.*\]\})', timeout=5)
+    rates = json.loads(response.group(1))
+    assert rates["baud_rate"] == baud_rate
+    assert any(r["baud_rate"] == baud_rate and r["rx_frames"] > 0 for r in rates["rates"])
+
+    # Back to the default rate
+    dut.write("baud-rate --max 921600")
+    response = dut.expect(r"(\d{6,})\r?\n", timeout=10)
+    assert int(response.group(1)) == 921600
+    dut.write(f"ping {module['type']} {module['serial_number']}")
+    dut.expect(rf"Ping module: {module['serial_number']} time: \d+ us", timeout=5)
+
+
+def test_module_supervision(dut):
+    """Test that a restarted module is detected and restored"""
+
+    # Load the mixed module from config.json
+    config_path = os.path.join(os.path.dirname(__file__), "config.json")
+    with open(config_path, 'r') as f:
+        config = json.load(f)
+    module = next((m for m in config["test_bench"]["modules"] if m["name"] == "mixed"), None)
+    if module is None:
+        pytest.skip("Module 'mixed' not found in configuration")
+
+    # Wait for prompt before sending commands
+    dut.expect("Core>", timeout=10)
+
+    dut.write(f"get-slave-id {module['type']} {module['serial_number']}")
+    response = dut.expect(r"Slave ID: (\d+)", timeout=5)
+    slave_id = int(response.group(1))
+    dut.expect("Core>", timeout=5)
+
+    # The restart is seen from the uptime of the heartbeats, the module is enumerated again
+    dut.write(f"module-restart --id {slave_id}")
+    dut.expect(rf"Module {slave_id} is back", timeout=15)
+
+    dut.write(f"ping {module['type']} {module['serial_number']}")
+    dut.expect(rf"Ping module: {module['serial_number']} time: \d+ us", timeout=5)
+
+
+def test_callback_async(dut):
+    """Test the remote callbacks queued to the dispatcher tasks"""
+
+    # Load the mixed module from config.json
+    config_path = os.path.join(os.path.dirname(__file__), "config.json")
+    with open(config_path, 'r') as f:
+        config = json.load(f)
+    module = next((m for m in config["test_bench"]["modules"] if m["name"] == "mixed"), None)
+    if module is None:
+        pytest.skip("Module 'mixed' not found in configuration")
+
+    # Wait for prompt before sending commands
+    dut.expect("Core>", timeout=10)
+
+    dut.write(f"get-slave-id {module['type']} {module['serial_number']}")
+    response = dut.expect(r"Slave ID: (\d+)", timeout=5)
+    slave_id = int(response.group(1))
+    dut.expect("Core>", timeout=5)
+
+    dut.write(f"callback-bench -n 50 {slave_id}")
+    response = dut.expect(r'(\{"requests":[^\}]+\})', timeout=30)
+    bench = json.loads(response.group(1))
+    assert bench["blocking_errors"] == 0, f"{bench['blocking_errors']} blocking callbacks failed"
+    assert bench["async_errors"] == 0, f"{bench['async_errors']} asynchronous callbacks failed"
+    # Requests to a single slave wait for each other, they must not be slower than blocking calls
+    assert bench["async_us"] <= bench["blocking_us"] * 1.2
+
+
+def test_bus_can_filter(dut):
+    """Test the counters of the CAN acceptance filter"""
+
+    # Wait for prompt before sending commands
+    dut.expect("Core>", timeout=10)
+
+    dut.write("bus-can-filter --reset")
+    dut.expect("Core>", timeout=5)
+
+    # The master receives the heartbeats of all the slaves
+    time.sleep(3)
+    dut.write("bus-can-filter")
+    response = dut.expect(r'(\{"accept_all":[^\}]+\})', timeout=5)
+    stats = json.loads(response.group(1))
+    assert stats["accept_all"] is True, "The master must receive the frames of all the modules"
+    assert stats["received"] > 0, "No heartbeat received"
+    assert stats["rejected"] == 0
+    # The master always sends standard frames, the slaves switch to the priority identifiers
+    assert stats["priority_ids"] is False
+
+
+def test_bus_can_filter_subscribed(dut):
+    """Test that a slave subscribed to other modules still receives all the commands of the master"""
+
+    # Load the mixed module from config.json
+    config_path = os.path.join(os.path.dirname(__file__), "config.json")
+    with open(config_path, 'r') as f:
+        config = json.load(f)
+    module = next((m for m in config["test_bench"]["modules"] if m["name"] == "mixed"), None)
+    if module is None:
+        pytest.skip("Module 'mixed' not found in configuration")
+
+    # Wait for prompt before sending commands
+    dut.expect("Core>", timeout=10)
+
+    dut.write(f"get-slave-id {module['type']} {module['serial_number']}")
+    response = dut.expect(r"Slave ID: (\d+)", timeout=5)
+    slave_id = int(response.group(1))
+    dut.expect("Core>", timeout=5)
+
+    # Rate reached while the slave only receives the frames of the master
+    dut.write("baud-rate --max 2000000")
+    response = dut.expect(r"(\d{6,})\r?\n", timeout=10)
+    baud_rate = int(response.group(1))
+    dut.write("baud-rate --max 921600")
+    dut.expect(r"(\d{6,})\r?\n", timeout=10)
+    if baud_rate == 921600:
+        pytest.skip("The rail does not run faster than the default baud rate")
+
+    # Non-zero identifiers in the acceptance filter of the slave, with the priority identifiers in use
+    for module_id in (5, 6):
+        dut.write(f"register-event -i {slave_id} -m {module_id}")
+        dut.expect(rf"Module ID: {slave_id} subscribed", timeout=5)
+        dut.expect("Core>", timeout=5)
+
+    # CMD_SET_BAUD_RATE is a CAN frame of the master, the echo test fails if the slave missed it
+    dut.write("baud-rate --max 2000000")
+    response = dut.expect(r"(\d{6,})\r?\n", timeout=10)
+    assert int(response.group(1)) == baud_rate, "The slave did not apply the baud rate"
+    dut.write(f"ping {module['type']} {module['serial_number']}")
+    dut.expect(rf"Ping module: {module['serial_number']} time: \d+ us", timeout=5)
+
+    # Back to the default rate
+    dut.write("baud-rate --max 921600")
+    response = dut.expect(r"(\d{6,})\r?\n", timeout=10)
+    assert int(response.group(1)) == 921600
+
+
+def test_bus_can_bench(dut):
+    """Test that concurrent producers queue CAN events without waiting for the bus"""
+
+    # Wait for prompt before sending commands
+    dut.expect("Core>", timeout=10)
+
+    dut.write("bus-can-bench -p 4 -n 250")
+    response = dut.expect(r'(\{"producers":[^\}]+\})', timeout=10)
+    bench = json.loads(response.group(1))
+    # Telemetry frames replace the oldest ones when the ring is full, they are never dropped
+    assert bench["dropped"] == 0
+    assert bench["failed"] == 0
+    assert bench["sent"] + bench["overwritten"] >= bench["events"]
+    # 1 Mbit/s carries about 10000 frames per second, queueing must be much faster
+    assert bench["events_per_s"] > 50000, f"{bench['events_per_s']} events/s"
+
+
+def test_bus_can_segments(dut):
+    """Test the reassembly of segmented CAN messages"""
+
+    # Wait for prompt before sending commands
+    dut.expect("Core>", timeout=10)
+
+    # Interleaved streams of several sources, missing frame, timeout and oversized message
+    dut.write("bus-can-segment-test")
+    response = dut.expect(r'(\{"interleaved":[^\}]+\})', timeout=5)
+    result = json.loads(response.group(1))
+    assert all(result.values()), result
+    dut.expect("Core>", timeout=5)
+
+    dut.write("bus-can-segments")
+    response = dut.expect(r'(\{"sent":[^\}]+\})', timeout=5)
+    stats = json.loads(response.group(1))
+    assert stats["lost"] == 0
+    assert stats["timeouts"] == 0
+
+
+def test_bus_can_arbitration(dut):
+    """Test the latency of the priority classes on a saturated CAN bus, simulated on the target"""
+
+    # Wait for prompt before sending commands
+    dut.expect("Core>", timeout=10)
+
+    dut.write("bus-can-arbitration-sim -m 8 -n 10000")
+    response = dut.expect(r'(\{"modules":[^\}]+\})', timeout=10)
+    sim = json.loads(response.group(1))
+    # An emergency frame waits at most for the frame in progress and the emergencies of the other modules
+    assert sim["emergency_us"] <= (sim["modules"] + 1) * 160, sim
+    assert sim["emergency_us"] <= sim["motion_us"] <= sim["io_us"], sim
+    # With the standard identifiers the module with the highest id waits behind the telemetry of the others
+    assert sim["standard_emergency_us"] > 10 * sim["emergency_us"], sim
+
+
+def test_bus_stats(dut):
+    """Test the bus statistics of the master, of each slave and remotely read from a slave"""
+
+    config_path = os.path.join(os.path.dirname(__file__), "config.json")
+    with open(config_path, 'r') as f:
+        config = json.load(f)
+    module = next((m for m in config["test_bench"]["modules"] if m["name"] == "mixed"), None)
+    if module is None:
+        pytest.skip("Module 'mixed' not found in configuration")
+
+    # Wait for prompt before sending commands
+    dut.expect("Core>", timeout=10)
+
+    dut.write(f"get-slave-id {module['type']} {module['serial_number']}")
+    response = dut.expect(r"Slave ID: (\d+)", timeout=5)
+    slave_id = int(response.group(1))
+    dut.expect("Core>", timeout=5)
+
+    dut.write("bus-rs-slaves --reset")
+    dut.expect("Core>", timeout=5)
+    for _ in range(10):
+        dut.write(f"run-callback {slave_id} 7 0")  # CALLBACK_DIGITAL_READ
+        dut.expect("Core>", timeout=5)
+
+    dut.write("bus-rs-slaves")
+    response = dut.expect(r'(\[.*\])', timeout=5)
+    slaves = {s["id"]: s for s in json.loads(response.group(1))}
+    assert slave_id in slaves
+    stats = slaves[slave_id]
+    assert stats["transactions"] >= 10
+    assert stats["timeouts"] == 0
+    assert 0 < stats["p50_us"] <= stats["p99_us"] <= stats["max_us"]
+    dut.expect("Core>", timeout=5)
+
+    dut.write("bus-stats")
+    response = dut.expect(r'(\{"rs":.*\}\})', timeout=5)
+    stats = json.loads(response.group(1))
+    assert stats["rs"]["tx_frames"] > 0
+    assert stats["can"]["rx_frames"] > 0, "No heartbeat received"
+    assert stats["can"]["bus_off"] == 0
+    dut.expect("Core>", timeout=5)
+
+    # The slave answers with its own view of both buses
+    dut.write(f"get-bus-stats -i {slave_id}")
+    response = dut.expect(r'(\{"rs":.*\}\})', timeout=5)
+    stats = json.loads(response.group(1))
+    assert stats["rs"]["rx_frames"] > 0
+    assert stats["can"]["tx_frames"] > 0, "No heartbeat sent"